@@ -17,16 +17,44 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
-#include "../helpers.h"
-#include "../types.h"
-
+/* Feature macros must come before the first system header */
 #define _GNU_SOURCE
 #define __STDC_WANT_LIB_EXT1__
 
+#include "../helpers.h"
+#include "../types.h"
+
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <malloc.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <linux/falloc.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+/* Largest zero write issued when holes can not be punched */
+#define XPUNCH_ZERO_CHUNK	0x10000
+
+
+/*
+ * Internal structures
+ */
+
+/* Thread started by xthread_create */
+typedef struct tag_xthread {
+    pthread_t thread;
+    xthread_proc proc;
+    void *arg;
+} xthread;
 
 
 /*
@@ -112,3 +140,297 @@ errno_t xmemcpy(void *dest, size_t dest_size, const void *src, size_t count)
 
     return(errno);
 }
+
+/*
+ * Time routines
+ */
+
+uint64_t xtime_usec(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return((uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000);
+}
+
+void xsleep_usec(uint32_t usec)
+{
+    struct timespec delay;
+
+    delay.tv_sec = usec / 1000000;
+    delay.tv_nsec = (long)(usec % 1000000) * 1000;
+
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+        continue;
+    }
+}
+
+
+errno_t xmap_file(const char *filename, bool_t writable, xfile_map *map)
+{
+    int fd;
+    int err;
+    void *view;
+    struct stat st;
+
+    assert(filename != 0);
+    assert(map != 0);
+
+    if (filename == 0 || map == 0) {
+        return(EINVAL);
+    }
+
+    memset(map, 0, sizeof(xfile_map));
+
+    fd = open(filename, (writable == True) ? O_RDWR : O_RDONLY);
+
+    if (fd < 0) {
+        return(errno);
+    }
+
+    if (fstat(fd, &st) != 0) {
+        err = errno;
+        close(fd);
+        return(err);
+    }
+
+    if (st.st_size > 0) {
+        view = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+        if (view == MAP_FAILED) {
+            err = errno;
+            close(fd);
+            return(err);
+        }
+
+        /* Image reads are mostly sequential */
+        madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+        map->view = (ptr_t)view;
+    }
+
+    map->size = (uint64_t)st.st_size;
+    map->handle = (ptr_t)(intptr_t)fd;
+
+    return(0);
+}
+
+void xunmap_file(xfile_map *map)
+{
+    assert(map != 0);
+
+    if (map == 0) {
+        return;
+    }
+
+    if (map->view != 0) {
+        munmap(map->view, (size_t)map->size);
+    }
+
+    if (map->handle != 0) {
+        close((int)(intptr_t)map->handle);
+    }
+
+    memset(map, 0, sizeof(xfile_map));
+}
+
+errno_t xpwrite_file(const xfile_map *map, 
+                     const void *data, 
+                     size_t size, 
+                     uint64_t offset)
+{
+    ssize_t written;
+
+    assert(map != 0);
+    assert(data != 0 || size == 0);
+
+    if (map == 0 || (data == 0 && size > 0)) {
+        return(EINVAL);
+    }
+
+    while (size > 0) {
+        written = pwrite((int)(intptr_t)map->handle, data, size, (off_t)offset);
+
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (written <= 0) {
+            return((written < 0) ? errno : EIO);
+        }
+
+        data = (const uint8_t*)data + written;
+        size -= (size_t)written;
+        offset += (uint64_t)written;
+    }
+
+    return(0);
+}
+
+errno_t xpunch_file(const xfile_map *map, uint64_t offset, uint64_t size)
+{
+    int fd;
+    errno_t err;
+    size_t chunk;
+    static const uint8_t zeros[XPUNCH_ZERO_CHUNK];
+
+    assert(map != 0);
+
+    if (map == 0) {
+        return(EINVAL);
+    }
+
+    if (size == 0) {
+        return(0);
+    }
+
+    fd = (int)(intptr_t)map->handle;
+
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 
+        (off_t)offset, (off_t)size) == 0) {
+        return(0);
+    }
+
+    if (errno != EOPNOTSUPP && errno != ENOSYS) {
+        return(errno);
+    }
+
+    /* File systems without holes store the zeros */
+    while (size > 0) {
+        chunk = (size < sizeof(zeros)) ? (size_t)size : sizeof(zeros);
+        err = xpwrite_file(map, zeros, chunk, offset);
+
+        if (err != 0) {
+            return(err);
+        }
+
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return(0);
+}
+
+errno_t xfind_data(const xfile_map *map, 
+                   uint64_t offset, 
+                   uint64_t *data_start, 
+                   uint64_t *data_end)
+{
+    int fd;
+    off_t start;
+    off_t end;
+
+    assert(map != 0);
+    assert(data_start != 0);
+    assert(data_end != 0);
+
+    if (map == 0 || data_start == 0 || data_end == 0) {
+        return(EINVAL);
+    }
+
+    if (offset >= map->size) {
+        *data_start = map->size;
+        *data_end = map->size;
+        return(0);
+    }
+
+    fd = (int)(intptr_t)map->handle;
+    start = lseek(fd, (off_t)offset, SEEK_DATA);
+
+    if (start < 0) {
+        if (errno == ENXIO) {
+            *data_start = map->size;
+            *data_end = map->size;
+            return(0);
+        }
+
+        /* Without hole reporting the whole file is data */
+        if (errno == EINVAL || errno == EOPNOTSUPP) {
+            *data_start = offset;
+            *data_end = map->size;
+            return(0);
+        }
+
+        return(errno);
+    }
+
+    end = lseek(fd, start, SEEK_HOLE);
+
+    if (end < 0) {
+        return(errno);
+    }
+
+    *data_start = ((uint64_t)start < map->size) ? (uint64_t)start : map->size;
+    *data_end = ((uint64_t)end < map->size) ? (uint64_t)end : map->size;
+
+    return(0);
+}
+
+static void*
+thread_start(void *arg)
+{
+    xthread *thread = (xthread*)arg;
+
+    thread->proc(thread->arg);
+
+    return(0);
+}
+
+errno_t xthread_create(xthread_proc proc, void *arg, ptr_t *thread)
+{
+    int err;
+    xthread *nthread;
+
+    assert(proc != 0);
+    assert(thread != 0);
+
+    if (proc == 0 || thread == 0) {
+        return(EINVAL);
+    }
+
+    nthread = (xthread*)malloc(sizeof(xthread));
+
+    if (nthread == 0) {
+        return(ENOMEM);
+    }
+
+    nthread->proc = proc;
+    nthread->arg = arg;
+
+    err = pthread_create(&nthread->thread, 0, thread_start, nthread);
+
+    if (err != 0) {
+        free(nthread);
+        return(err);
+    }
+
+    *thread = (ptr_t)nthread;
+
+    return(0);
+}
+
+errno_t xthread_join(ptr_t thread)
+{
+    int err;
+    xthread *nthread = (xthread*)thread;
+
+    assert(nthread != 0);
+
+    if (nthread == 0) {
+        return(EINVAL);
+    }
+
+    err = pthread_join(nthread->thread, 0);
+
+    free(nthread);
+
+    return(err);
+}
+
+uint32_t xcpu_count(void)
+{
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return((count > 0) ? (uint32_t)count : 1);
+}
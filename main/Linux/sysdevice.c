@@ -17,8 +17,12 @@
     Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
+/* Needed for O_DIRECT */
+#define _GNU_SOURCE
+
 #include "command.h"
 #include "debug.h"
+#include "devcache.h"
 #include "device.h"
 #include "errors.h"
 #include "helpers.h"
@@ -27,26 +31,118 @@
 #include "sysdevice.h"
 
 #include <assert.h>
+#include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <hal/libhal.h>
+#include <linux/bsg.h>
+#include <linux/fs.h>
 #include <scsi/sg.h>
+#include <poll.h>
+#include <stdlib.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <linux/netlink.h>
 
 
 #define CDB_MAX_LENGTH		16U
 #define SPT_SENSE_LENGTH	32U
 #define SCSI_COMMAND_TIMEOUT	30000U
-#define SCSI_GENERIC_POSTFIX 	"_scsi_generic"
 
+/* Host status of commands that timed out, DID_TIME_OUT */
+#define SG_HOST_TIME_OUT	0x03
+
+/* Driver status of commands that failed or timed out, DRIVER_* */
+#define SG_DRIVER_MASK		0x0F
+#define SG_DRIVER_ERROR		0x04
+#define SG_DRIVER_TIME_OUT	0x06
+
+#define BSG_DEVICE_PREFIX	"/dev/bsg/"
+#define DEFAULT_MAX_PHYSICAL_PAGES	32U
+#define ASYNC_QUEUE_DEPTH	16U
+#define MAX_IOVEC_COUNT		64U
+#define BLOCK_DEVICE_PREFIX	"/dev/"
+#define BLOCK_SECTOR_SIZE	2048U
+#define BLOCK_PROBE_CHUNKS	8U
+#define SYSFS_SCSI_GENERIC_DIR	"/sys/class/scsi_generic"
+#define SYSFS_BLOCK_DIR		"/sys/block"
+#define CDROM_BLOCK_PREFIX	"sr"
+#define SCSI_TYPE_ROM		0x05
+#define ENUMERATE_MAX_THREADS	8U
+#define ENUMERATE_INITIAL_DRIVES	4U
+#define CONFIGURATION_HEADER_LENGTH	8U
+#define MAX_CONFIGURATION_LENGTH	0xFFFCU
+#define MMC_OPCODE_GET_CONFIG	0x46
+#define DEVCACHE_DIR		"liboptical"
+#define DEVCACHE_FILE		"devices.cache"
+#define UEVENT_BUFFER_SIZE	8192U
+#define UEVENT_SOCKET_BUFFER	(256U * 1024U)
+#define UEVENT_KERNEL_GROUP	1U
+#define MONITOR_RETRY_MSEC	100U
+#define MONITOR_PROBE_TIMEOUT	5000000U
+
+/* Not exported by older glibc copies of scsi/sg.h */
+#ifndef SG_FLAG_MMAP_IO
+#define SG_FLAG_MMAP_IO		4
+#endif
+
+
+/*
+ * Asynchronous command queue
+ *
+ * The sg driver writes sense data into the buffer given at submit
+ * time, so every command in flight keeps its own slot until it is
+ * read back. The slot index is used as the sg pack_id.
+ */
+
+struct async_slot {
+    bool_t busy;
+    uint32_t tag;
+    int direction;
+    uint8_t sense_buffer[SPT_SENSE_LENGTH];
+};
 
-static const char* __storage_types[] = {
-    "storage.cdrom"
+struct async_queue {
+    struct async_slot slots[ASYNC_QUEUE_DEPTH];
 };
 
 
+static const optcl_transport __system_transport;
+
+
+static RESULT check_system_transport(const optcl_device *device)
+{
+    RESULT error;
+    const optcl_transport *transport = 0;
+
+    assert(device != 0);
+
+    if (device == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_transport(device, &transport, 0);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    /* Platform extensions work on sg sessions only */
+    if (transport != 0 && transport != &__system_transport) {
+        return(E_NOTIMPL);
+    }
+
+    return(SUCCESS);
+}
+
+
 static RESULT destroy_devices_list(optcl_list *devices)
 {
     RESULT error;
@@ -92,483 +188,3394 @@ static RESULT destroy_devices_list(optcl_list *devices)
 }
 
 static RESULT
-enumerate_device_adapter(optcl_device *device, optcl_adapter **adapter)
+read_sysfs_value(const char *sysfs_dir, const char *attribute, uint32_t *value)
+{
+    int count;
+    FILE *file;
+    unsigned int nvalue;
+    char filename[PATH_MAX];
+
+    assert(sysfs_dir != 0);
+    assert(attribute != 0);
+    assert(value != 0);
+
+    if (sysfs_dir == 0 || attribute == 0 || value == 0) {
+        return(E_INVALIDARG);
+    }
+
+    count = snprintf(filename, sizeof(filename), "%s/%s", sysfs_dir, attribute);
+
+    if (count < 0 || count >= (int)sizeof(filename)) {
+        return(E_OUTOFRANGE);
+    }
+
+    file = fopen(filename, "r");
+
+    if (file == 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    count = fscanf(file, "%u", &nvalue);
+
+    fclose(file);
+
+    if (count != 1) {
+        return(E_UNEXPECTED);
+    }
+
+    *value = (uint32_t)nvalue;
+
+    return(SUCCESS);
+}
+
+static RESULT
+get_block_name(const char *path, char *name, size_t name_size)
+{
+    int count;
+    DIR *dir;
+    struct dirent *entry;
+    const char *sg_name;
+    char block_dir[PATH_MAX];
+
+    assert(path != 0);
+    assert(name != 0);
+    assert(name_size > 0);
+
+    if (path == 0 || name == 0 || name_size == 0) {
+        return(E_INVALIDARG);
+    }
+
+    sg_name = strrchr(path, '/');
+    sg_name = (sg_name != 0) ? sg_name + 1 : path;
+
+    /* Drives enumerated through their block device */
+    if (strncmp(sg_name, CDROM_BLOCK_PREFIX, strlen(CDROM_BLOCK_PREFIX)) == 0) {
+        count = snprintf(name, name_size, "%s", sg_name);
+
+        return((count < 0 || count >= (int)name_size) ? E_OUTOFRANGE : SUCCESS);
+    }
+
+    count = snprintf(block_dir, sizeof(block_dir), 
+        "/sys/class/scsi_generic/%s/device/block", sg_name);
+
+    if (count < 0 || count >= (int)sizeof(block_dir)) {
+        return(E_OUTOFRANGE);
+    }
+
+    dir = opendir(block_dir);
+
+    if (dir == 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    count = -1;
+
+    while ((entry = readdir(dir)) != 0) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        count = snprintf(name, name_size, "%s", entry->d_name);
+
+        break;
+    }
+
+    closedir(dir);
+
+    if (count < 0) {
+        return(E_DEVINVALIDPATH);
+    }
+
+    if (count >= (int)name_size) {
+        return(E_OUTOFRANGE);
+    }
+
+    return(SUCCESS);
+}
+
+static RESULT
+get_sysfs_queue_dir(const char *path, char *queue_dir, size_t queue_dir_size)
 {
+    int count;
     RESULT error;
-    RESULT destroy_error;
-    optcl_adapter *nadapter = 0;
+    char block_name[NAME_MAX + 1];
 
-    assert(device != 0);
-    assert(adapter != 0);
+    assert(path != 0);
+    assert(queue_dir != 0);
+    assert(queue_dir_size > 0);
 
-    if (device == 0 || adapter == 0) {
+    if (path == 0 || queue_dir == 0 || queue_dir_size == 0) {
         return(E_INVALIDARG);
     }
 
-    error = optcl_adapter_create(&nadapter);
+    error = get_block_name(path, block_name, sizeof(block_name));
 
     if (FAILED(error)) {
         return(error);
     }
 
-    assert(nadapter != 0);
+    count = snprintf(queue_dir, queue_dir_size, "/sys/block/%s/queue", block_name);
 
-    if (nadapter == 0) {
-        return(E_POINTER);
+    if (count < 0 || count >= (int)queue_dir_size) {
+        return(E_OUTOFRANGE);
     }
 
-    error = optcl_adapter_set_bus_type(nadapter, ADAPTER_BUSTYPE_SCSI);
+    return(SUCCESS);
+}
 
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(nadapter);
-        return(SUCCEEDED(destroy_error) ? error : destroy_error);
-    }
+/*
+ * The sysfs device path runs through the host controller, which
+ * tells USB bridges apart from ATA and SCSI hosts.
+ */
+static uint32_t
+query_bus_type(const optcl_device *device)
+{
+    int count;
+    const char *path = 0;
+    char link[PATH_MAX];
+    char target[PATH_MAX];
+    char block_name[NAME_MAX + 1];
 
-    error = optcl_adapter_set_max_alignment_mask(nadapter, sizeof(void*));
+    assert(device != 0);
 
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(nadapter);
-        return(SUCCEEDED(destroy_error) ? error : destroy_error);
+    if (FAILED(optcl_device_get_path_ref(device, &path)) || path == 0) {
+        return(ADAPTER_BUSTYPE_SCSI);
     }
 
-    error = optcl_adapter_set_max_physical_pages(nadapter, 32);
+    if (FAILED(get_block_name(path, block_name, sizeof(block_name)))) {
+        return(ADAPTER_BUSTYPE_SCSI);
+    }
 
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(nadapter);
-        return(SUCCEEDED(destroy_error) ? error : destroy_error);
+    count = snprintf(link, sizeof(link), "/sys/block/%s/device", block_name);
+
+    if (count < 0 || count >= (int)sizeof(link) || realpath(link, target) == 0) {
+        return(ADAPTER_BUSTYPE_SCSI);
     }
 
-    error = optcl_adapter_set_max_transfer_length(nadapter, 32 * getpagesize());
+    if (strstr(target, "/usb") != 0) {
+        return(ADAPTER_BUSTYPE_USB);
+    }
 
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(nadapter);
-        return(SUCCEEDED(destroy_error) ? error : destroy_error);
+    if (strstr(target, "/ata") != 0) {
+        return(ADAPTER_BUSTYPE_ATAPI);
     }
 
-    *adapter = nadapter;
+    if (strstr(target, "/fw") != 0 || strstr(target, "/firewire") != 0) {
+        return(ADAPTER_BUSTYPE_IEEE1394);
+    }
 
-    return(error);
+    return(ADAPTER_BUSTYPE_SCSI);
 }
 
 static RESULT
-enumerate_device_features(optcl_device *device)
+query_transfer_limits(const optcl_device *device,
+                      uint32_t *alignment,
+                      uint32_t *max_pages,
+                      uint32_t *max_transfer_len)
 {
+    int fd;
+    int value;
     RESULT error;
-    RESULT destroy_error;
-    optcl_list_iterator it = 0;
-    optcl_feature *feature = 0;
-    optcl_mmc_get_configuration command;
-    optcl_mmc_response_get_configuration *response = 0;
+    uint32_t limit;
+    uint32_t dma_mask;
+    uint32_t segments;
+    uint32_t page_size;
+    struct stat st;
+    unsigned short sectors;
+    const char *path = 0;
+    char queue_dir[PATH_MAX];
 
     assert(device != 0);
+    assert(alignment != 0);
+    assert(max_pages != 0);
+    assert(max_transfer_len != 0);
 
-    if (device == 0) {
+    if (device == 0 || alignment == 0 || max_pages == 0 || max_transfer_len == 0) {
         return(E_INVALIDARG);
     }
 
-    command.rt = MMC_GET_CONFIG_RT_ALL;
-    command.start_feature = 0;
+    page_size = (uint32_t)getpagesize();
 
-    error = optcl_command_get_configuration(device, &command, &response);
+    *alignment = page_size;
+    *max_pages = DEFAULT_MAX_PHYSICAL_PAGES;
+    *max_transfer_len = DEFAULT_MAX_PHYSICAL_PAGES * page_size;
+
+    error = optcl_device_get_path_ref(device, &path);
 
     if (FAILED(error)) {
         return(error);
     }
 
-    if (response == 0) {
-        return(E_POINTER);
+    if (path == 0) {
+        return(E_DEVINVALIDPATH);
     }
 
-    error = optcl_list_get_head_pos(response->descriptors, &it);
-
-    if (FAILED(error)) {
-        destroy_error = optcl_list_destroy(response->descriptors, 1);
-        free(response);
-        return(SUCCEEDED(destroy_error) ? error : destroy_error);
-    }
+    limit = 0;
 
-    while (it != 0) {
-        error = optcl_list_get_at_pos(response->descriptors, it, (const pptr_t)&feature);
+    /*
+     * The block queue of the drive knows the real limits, the
+     * sg ioctls are used only when sysfs is not available.
+     */
+    error = get_sysfs_queue_dir(path, queue_dir, sizeof(queue_dir));
 
-        if (FAILED(error)) {
-            break;
+    if (SUCCEEDED(error)) {
+        if (SUCCEEDED(read_sysfs_value(queue_dir, "max_sectors_kb", &limit))) {
+            limit = (limit > UINT32_MAX / 1024) ? UINT32_MAX : limit * 1024;
+        } else {
+            limit = 0;
         }
 
-        if (feature == 0) {
-            error = E_POINTER;
-            break;
+        if (SUCCEEDED(read_sysfs_value(queue_dir, "max_segments", &segments)) && segments > 0) {
+            *max_pages = segments;
         }
 
-        error = optcl_device_set_feature(device, feature->feature_code, feature);
-
-        if (FAILED(error)) {
-            break;
+        if (SUCCEEDED(read_sysfs_value(queue_dir, "dma_alignment", &dma_mask)) && dma_mask >= *alignment) {
+            *alignment = dma_mask + 1;
         }
+    }
 
-        error = optcl_list_get_next(response->descriptors, it, &it);
-
-        if (FAILED(error)) {
-            break;
+    if (limit == 0) {
+        fd = open(path, O_RDONLY | O_NONBLOCK);
+
+        if (fd >= 0) {
+            value = 0;
+            sectors = 0;
+
+            /*
+             * The block layer reports BLKSECTGET as an unsigned short
+             * count of 512 byte sectors, the sg driver as an int count
+             * of bytes.
+             */
+            if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+                if (ioctl(fd, BLKSECTGET, &sectors) == 0 && sectors > 0) {
+                    limit = (uint32_t)sectors * 512;
+                }
+            } else if (ioctl(fd, BLKSECTGET, &value) == 0 && value > 0) {
+                limit = (uint32_t)value;
+            } else if (ioctl(fd, SG_GET_RESERVED_SIZE, &value) == 0 && value > 0) {
+                limit = (uint32_t)value;
+            }
+
+            close(fd);
         }
     }
 
-    destroy_error = optcl_list_destroy(response->descriptors, False);
+    /*
+     * Every segment maps at least one page, and transfers are
+     * kept to whole pages.
+     */
+    if (limit > 0) {
+        if (*max_pages > 0 && limit / page_size > *max_pages) {
+            limit = *max_pages * page_size;
+        }
 
-    free(response);
+        limit -= limit % page_size;
 
-    if (FAILED(destroy_error)) {
-        return(destroy_error);
+        if (limit > 0) {
+            *max_transfer_len = limit;
+        }
     }
 
-    return(SUCCEEDED(destroy_error) ? error : destroy_error);
+    return(SUCCESS);
 }
 
 static RESULT
-get_device_attributes(LibHalContext *hal_ctx, const char *udi, optcl_device *device)
+enumerate_device_adapter(optcl_device *device, optcl_adapter **adapter)
 {
     RESULT error;
     RESULT destroy_error;
-    size_t nudi_len;
-    char *tmp = 0;
-    char *nudi = 0;
-    char *udi_parent = 0;
-    DBusError dbus_error;
-    char *ndevice_path = 0;
-    optcl_adapter *adapter = 0;
-    optcl_mmc_inquiry command;
-    optcl_mmc_response_inquiry *response;
+    uint32_t alignment;
+    uint32_t max_pages;
+    uint32_t max_transfer_len;
+    optcl_adapter *nadapter = 0;
 
-    assert(hal_ctx != 0);
-    assert(udi != 0);
     assert(device != 0);
+    assert(adapter != 0);
 
-    if (hal_ctx == 0 || udi == 0 || device == 0) {
+    if (device == 0 || adapter == 0) {
         return(E_INVALIDARG);
     }
 
-    dbus_error_init(&dbus_error);
-
-    udi_parent = libhal_device_get_property_string(hal_ctx, udi,
-                 "info.parent", &dbus_error);
+    error = query_transfer_limits(device, &alignment, &max_pages, &max_transfer_len);
 
-    if (udi_parent == 0 || dbus_error_is_set(&dbus_error)) {
-        error = E_DEVINVALIDPATH;
-        goto error_exit;
+    if (FAILED(error)) {
+        return(error);
     }
 
-    nudi_len = strlen(udi_parent) + strlen(SCSI_GENERIC_POSTFIX) + 1;
-    nudi = malloc(nudi_len);
+    error = optcl_adapter_create(&nadapter);
 
-    if (nudi == 0) {
-        error = E_OUTOFMEMORY;
-        goto error_exit;
+    if (FAILED(error)) {
+        return(error);
     }
 
-    memset(nudi, 0, nudi_len);
-    xstrcat(nudi, nudi_len, udi_parent);
-    xstrcat(nudi, nudi_len, SCSI_GENERIC_POSTFIX);
-
-    ndevice_path = libhal_device_get_property_string(hal_ctx, nudi,
-                   "linux.device_file", &dbus_error);
+    assert(nadapter != 0);
 
-    if (ndevice_path == 0 || dbus_error_is_set(&dbus_error)) {
-        free(ndevice_path);
-        error = E_DEVINVALIDPATH;
-        goto error_exit;
+    if (nadapter == 0) {
+        return(E_POINTER);
     }
 
-    error = optcl_device_set_path(device, ndevice_path);
+    error = optcl_adapter_set_bus_type(nadapter, query_bus_type(device));
 
     if (FAILED(error)) {
-        free(ndevice_path);
-        goto error_exit;
+        destroy_error = optcl_adapter_destroy(nadapter);
+        return(SUCCEEDED(destroy_error) ? error : destroy_error);
     }
 
-    error = optcl_device_set_type(device, DEVICE_TYPE_CD_DVD);
+    /*
+     * Page aligned buffers let the sg driver map user memory
+     * for direct I/O instead of copying through its own buffers.
+     */
+    error = optcl_adapter_set_max_alignment_mask(nadapter, alignment);
 
     if (FAILED(error)) {
-        goto error_exit;
+        destroy_error = optcl_adapter_destroy(nadapter);
+        return(SUCCEEDED(destroy_error) ? error : destroy_error);
     }
 
-    error = enumerate_device_adapter(device, &adapter);
+    error = optcl_adapter_set_max_physical_pages(nadapter, max_pages);
 
     if (FAILED(error)) {
-        goto error_exit;
+        destroy_error = optcl_adapter_destroy(nadapter);
+        return(SUCCEEDED(destroy_error) ? error : destroy_error);
     }
 
-    error = optcl_device_set_adapter(device, adapter);
+    error = optcl_adapter_set_max_transfer_length(nadapter, max_transfer_len);
 
     if (FAILED(error)) {
-        goto error_exit;
+        destroy_error = optcl_adapter_destroy(nadapter);
+        return(SUCCEEDED(destroy_error) ? error : destroy_error);
     }
 
-    memset(&command, 0, sizeof(command));
+    *adapter = nadapter;
 
-    error = optcl_command_inquiry(device, &command, &response);
+    return(error);
+}
 
-    if (FAILED(error)) {
-        goto error_exit;
+/*
+ * The whole feature list is read in one transfer, MMC devices report
+ * well under a kilobyte of feature descriptors. The raw data is kept
+ * for the enumeration cache.
+ */
+static RESULT
+read_configuration(optcl_device *device, uint8_t **data, uint32_t *size)
+{
+    RESULT error;
+    uint32_t length;
+    uint8_t cdb[10];
+    uint8_t *buffer = 0;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(data != 0);
+    assert(size != 0);
+
+    if (device == 0 || data == 0 || size == 0) {
+        return(E_INVALIDARG);
     }
 
-    error = optcl_device_set_type(device, response->device_type);
+    error = optcl_device_get_transfer_limits(device, &limits);
 
     if (FAILED(error)) {
-        goto error_exit;
+        return(error);
     }
 
-    tmp = xstrdup((char*)response->product);
+    /* The feature header tells the data length */
+    buffer = xmalloc_aligned(CONFIGURATION_HEADER_LENGTH, limits.alignment_mask);
 
-    if (tmp == 0) {
-        error = E_OUTOFMEMORY;
-        goto error_exit;
+    if (buffer == 0) {
+        return(E_OUTOFMEMORY);
     }
 
-    error = optcl_device_set_product(device, tmp);
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = MMC_OPCODE_GET_CONFIG;
+    cdb[1] = MMC_GET_CONFIG_RT_ALL;
+    cdb[8] = CONFIGURATION_HEADER_LENGTH;
+
+    error = optcl_device_command_execute(device, cdb, sizeof(cdb), buffer, CONFIGURATION_HEADER_LENGTH);
 
     if (FAILED(error)) {
-        free(tmp);
-        goto error_exit;
+        xfree_aligned(buffer);
+        return(error);
     }
 
-    tmp = xstrdup((char*)response->vendor);
+    length = uint32_from_be(*(uint32_t*)&buffer[0]) + 4;
 
-    error = optcl_device_set_vendor(device, tmp);
+    xfree_aligned(buffer);
 
-    if (FAILED(error)) {
-        free(tmp);
-        goto error_exit;
+    if (length > MAX_CONFIGURATION_LENGTH) {
+        length = MAX_CONFIGURATION_LENGTH;
+    }
+
+    if (limits.max_transfer_len > 0 && length > limits.max_transfer_len) {
+        length = limits.max_transfer_len;
     }
 
-    tmp = xstrdup((char*)response->vendor_string);
+    /* Only whole descriptors are parsed */
+    length -= length % 4;
 
-    error = optcl_device_set_vendor_string(device, tmp);
+    if (length < CONFIGURATION_HEADER_LENGTH) {
+        return(E_FEATINVHEADER);
+    }
 
-    if (FAILED(error)) {
-        free(tmp);
-        goto error_exit;
+    buffer = xmalloc_aligned(length, limits.alignment_mask);
+
+    if (buffer == 0) {
+        return(E_OUTOFMEMORY);
     }
 
-    error = enumerate_device_features(device);
+    memset(buffer, 0, length);
 
-error_exit:
+    cdb[7] = (uint8_t)(length >> 8);
+    cdb[8] = (uint8_t)length;
 
-    if (nudi != 0) {
-        free(nudi);
-    }
+    error = optcl_device_command_execute(device, cdb, sizeof(cdb), buffer, length);
 
-    if (udi_parent != 0) {
-        free(udi_parent);
+    if (FAILED(error)) {
+        xfree_aligned(buffer);
+        return(error);
     }
 
-    if (response != 0) {
-        destroy_error = optcl_command_destroy_response((optcl_mmc_response*)response);
-        error = SUCCEEDED(destroy_error) ? error : destroy_error;
+    *data = malloc(length);
+
+    if (*data == 0) {
+        xfree_aligned(buffer);
+        return(E_OUTOFMEMORY);
     }
 
-    LIBHAL_FREE_DBUS_ERROR(&dbus_error);
+    memcpy(*data, buffer, length);
+    *size = length;
 
-    return(error);
+    xfree_aligned(buffer);
+
+    return(SUCCESS);
 }
 
 static RESULT
-append_enumerated_drive(LibHalContext *hal_ctx,
-                        const char *type, optcl_list *devices)
+set_device_features(optcl_device *device, const uint8_t data[], uint32_t size)
 {
-    int i;
     RESULT error;
-    int device_num;
-    DBusError dbus_error;
-    char **all_cdroms = 0;
-    optcl_device *device = 0;
+    RESULT destroy_error;
+    optcl_list_iterator it = 0;
+    optcl_feature *feature = 0;
+    optcl_mmc_response_get_configuration *response = 0;
 
-    assert(hal_ctx != 0);
-    assert(type != 0);
-    assert(devices != 0);
+    assert(device != 0);
+    assert(data != 0);
 
-    if (hal_ctx == 0 || type == 0 || devices == 0) {
+    if (device == 0 || data == 0) {
         return(E_INVALIDARG);
     }
 
-    dbus_error_init(&dbus_error);
+    error = optcl_command_parse_configuration(data, size, &response);
 
-    all_cdroms = libhal_find_device_by_capability(hal_ctx,
-                 type, &device_num, &dbus_error);
+    if (FAILED(error)) {
+        return(error);
+    }
 
-    if (all_cdroms == 0 || dbus_error_is_set(&dbus_error)) {
-        LIBHAL_FREE_DBUS_ERROR(&dbus_error);
-        return(E_DEVINVALIDPATH);
+    if (response == 0) {
+        return(E_POINTER);
     }
 
-    LIBHAL_FREE_DBUS_ERROR(&dbus_error);
+    error = optcl_list_get_head_pos(response->descriptors, &it);
+
+    if (FAILED(error)) {
+        destroy_error = optcl_list_destroy(response->descriptors, 1);
+        free(response);
+        return(SUCCEEDED(destroy_error) ? error : destroy_error);
+    }
 
-    for (i = 0; i < device_num; ++i) {
-        error = optcl_device_create(&device);
+    while (it != 0) {
+        error = optcl_list_get_at_pos(response->descriptors, it, (const pptr_t)&feature);
 
         if (FAILED(error)) {
             break;
         }
 
-        error = get_device_attributes(hal_ctx, all_cdroms[i], device);
+        if (feature == 0) {
+            error = E_POINTER;
+            break;
+        }
+
+        error = optcl_device_set_feature(device, feature->feature_code, feature);
 
         if (FAILED(error)) {
             break;
         }
 
-        error = optcl_list_add_tail(devices, (const ptr_t)device);
+        error = optcl_list_get_next(response->descriptors, it, &it);
 
         if (FAILED(error)) {
             break;
         }
     }
 
-    libhal_free_string_array(all_cdroms);
+    destroy_error = optcl_list_destroy(response->descriptors, False);
 
-    return(error);
-}
+    free(response);
+
+    return(SUCCEEDED(destroy_error) ? error : destroy_error);
+}
+
+/*
+ * Drives are found in sysfs and then probed concurrently, every probe
+ * waits on its drive for INQUIRY and the GET CONFIGURATION walk.
+ */
+
+struct enumerated_drive {
+    char path[PATH_MAX];
+    char sysfs_path[PATH_MAX];
+    optcl_device *device;
+    RESULT error;
+    optcl_devcache_identity identity;
+    bool_t cached;              /* Capabilities came from the cache */
+    bool_t stale;               /* The cache entry no longer matches */
+    uint8_t *features;          /* Raw GET CONFIGURATION data to cache */
+    uint32_t features_size;
+    uint64_t attach_time;       /* When the monitor saw the drive, in microseconds */
+};
+
+struct enumeration {
+    struct enumerated_drive *drives;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t next;
+    const optcl_devcache *cache;
+};
+
+static RESULT
+add_enumerated_drive(struct enumeration *enumeration,
+                     const char *path,
+                     const char *sysfs_path)
+{
+    uint32_t capacity;
+    struct enumerated_drive *drive;
+    struct enumerated_drive *ndrives;
+
+    assert(enumeration != 0);
+    assert(path != 0);
+    assert(sysfs_path != 0);
+
+    if (enumeration == 0 || path == 0 || sysfs_path == 0) {
+        return(E_INVALIDARG);
+    }
+
+    if (enumeration->count == enumeration->capacity) {
+        capacity = (enumeration->capacity == 0) 
+            ? ENUMERATE_INITIAL_DRIVES : enumeration->capacity * 2;
+
+        ndrives = realloc(enumeration->drives, capacity * sizeof(struct enumerated_drive));
+
+        if (ndrives == 0) {
+            return(E_OUTOFMEMORY);
+        }
+
+        enumeration->drives = ndrives;
+        enumeration->capacity = capacity;
+    }
+
+    drive = &enumeration->drives[enumeration->count];
+
+    memset(drive, 0, sizeof(struct enumerated_drive));
+
+    if (snprintf(drive->path, sizeof(drive->path), "%s", path) >= (int)sizeof(drive->path)) {
+        return(E_OUTOFRANGE);
+    }
+
+    if (snprintf(drive->sysfs_path, sizeof(drive->sysfs_path), "%s", sysfs_path) >= (int)sizeof(drive->sysfs_path)) {
+        return(E_OUTOFRANGE);
+    }
+
+    drive->error = SUCCESS;
+
+    ++enumeration->count;
+
+    return(SUCCESS);
+}
+
+static struct enumerated_drive*
+find_enumerated_drive(const struct enumeration *enumeration, const char *sysfs_path)
+{
+    uint32_t i;
+
+    assert(enumeration != 0);
+    assert(sysfs_path != 0);
+
+    for (i = 0; i < enumeration->count; ++i) {
+        if (strcmp(enumeration->drives[i].sysfs_path, sysfs_path) == 0) {
+            return(&enumeration->drives[i]);
+        }
+    }
+
+    return(0);
+}
+
+/*
+ * SCSI generic nodes of multimedia devices are preferred, they take
+ * every command and report the real transfer limits of the drive.
+ */
+static RESULT
+scan_scsi_generic(struct enumeration *enumeration)
+{
+    int count;
+    DIR *dir;
+    RESULT error;
+    uint32_t type;
+    struct dirent *entry;
+    char node[PATH_MAX];
+    char device_dir[PATH_MAX];
+    char sysfs_path[PATH_MAX];
+
+    assert(enumeration != 0);
+
+    if (enumeration == 0) {
+        return(E_INVALIDARG);
+    }
+
+    dir = opendir(SYSFS_SCSI_GENERIC_DIR);
+
+    /* The sg driver is not loaded */
+    if (dir == 0) {
+        return(SUCCESS);
+    }
+
+    error = SUCCESS;
+
+    while ((entry = readdir(dir)) != 0) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        count = snprintf(device_dir, sizeof(device_dir), 
+            "%s/%s/device", SYSFS_SCSI_GENERIC_DIR, entry->d_name);
+
+        if (count < 0 || count >= (int)sizeof(device_dir)) {
+            continue;
+        }
+
+        if (FAILED(read_sysfs_value(device_dir, "type", &type)) || type != SCSI_TYPE_ROM) {
+            continue;
+        }
+
+        if (realpath(device_dir, sysfs_path) == 0) {
+            continue;
+        }
+
+        count = snprintf(node, sizeof(node), "%s%s", BLOCK_DEVICE_PREFIX, entry->d_name);
+
+        if (count < 0 || count >= (int)sizeof(node)) {
+            continue;
+        }
+
+        error = add_enumerated_drive(enumeration, node, sysfs_path);
+
+        if (FAILED(error)) {
+            break;
+        }
+    }
+
+    closedir(dir);
+
+    return(error);
+}
+
+/*
+ * CD-ROM block devices cover drives without a SCSI generic node and
+ * drives whose generic node the caller may not open. SG_IO works on
+ * both kinds of nodes.
+ */
+static RESULT
+scan_block_drives(struct enumeration *enumeration)
+{
+    int count;
+    DIR *dir;
+    RESULT error;
+    struct dirent *entry;
+    char node[PATH_MAX];
+    char device_dir[PATH_MAX];
+    char sysfs_path[PATH_MAX];
+    struct enumerated_drive *drive;
+
+    assert(enumeration != 0);
+
+    if (enumeration == 0) {
+        return(E_INVALIDARG);
+    }
+
+    dir = opendir(SYSFS_BLOCK_DIR);
+
+    if (dir == 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    error = SUCCESS;
+
+    while ((entry = readdir(dir)) != 0) {
+        if (strncmp(entry->d_name, CDROM_BLOCK_PREFIX, strlen(CDROM_BLOCK_PREFIX)) != 0) {
+            continue;
+        }
+
+        count = snprintf(device_dir, sizeof(device_dir), 
+            "%s/%s/device", SYSFS_BLOCK_DIR, entry->d_name);
+
+        if (count < 0 || count >= (int)sizeof(device_dir)) {
+            continue;
+        }
+
+        if (realpath(device_dir, sysfs_path) == 0) {
+            continue;
+        }
+
+        count = snprintf(node, sizeof(node), "%s%s", BLOCK_DEVICE_PREFIX, entry->d_name);
+
+        if (count < 0 || count >= (int)sizeof(node)) {
+            continue;
+        }
+
+        drive = find_enumerated_drive(enumeration, sysfs_path);
+
+        if (drive == 0) {
+            error = add_enumerated_drive(enumeration, node, sysfs_path);
+
+            if (FAILED(error)) {
+                break;
+            }
+        } else if (access(drive->path, R_OK | W_OK) != 0 && access(node, R_OK | W_OK) == 0) {
+            snprintf(drive->path, sizeof(drive->path), "%s", node);
+        }
+    }
+
+    closedir(dir);
+
+    return(error);
+}
+
+static int
+compare_enumerated_drives(const void *left, const void *right)
+{
+    const struct enumerated_drive *ldrive = (const struct enumerated_drive*)left;
+    const struct enumerated_drive *rdrive = (const struct enumerated_drive*)right;
+
+    return(strcmp(ldrive->sysfs_path, rdrive->sysfs_path));
+}
+
+/*
+ * The unit serial number page is read by the kernel when the drive is
+ * attached, so it costs no command.
+ */
+static void
+read_drive_serial(const char *sysfs_path, char *serial, size_t serial_size)
+{
+    int count;
+    FILE *file;
+    size_t size;
+    size_t start;
+    size_t length;
+    uint8_t page[256];
+    char filename[PATH_MAX];
+
+    serial[0] = 0;
+
+    count = snprintf(filename, sizeof(filename), "%s/vpd_pg80", sysfs_path);
+
+    if (count < 0 || count >= (int)sizeof(filename)) {
+        return;
+    }
+
+    file = fopen(filename, "rb");
+
+    if (file == 0) {
+        return;
+    }
+
+    size = fread(page, 1, sizeof(page), file);
+
+    fclose(file);
+
+    if (size < 4 || page[1] != 0x80) {
+        return;
+    }
+
+    length = ((size_t)page[2] << 8) | page[3];
+
+    if (length > size - 4) {
+        length = size - 4;
+    }
+
+    for (start = 4; length > 0 && page[start] == ' '; ++start, --length) {
+    }
+
+    while (length > 0 && page[start + length - 1] == ' ') {
+        --length;
+    }
+
+    if (length >= serial_size) {
+        length = serial_size - 1;
+    }
+
+    memcpy(serial, &page[start], length);
+    serial[length] = 0;
+}
+
+static void
+get_inquiry_identity(const optcl_mmc_response_inquiry *response,
+                     const char *sysfs_path,
+                     optcl_devcache_identity *identity)
+{
+    int i;
+
+    memset(identity, 0, sizeof(optcl_devcache_identity));
+
+    snprintf(identity->vendor, sizeof(identity->vendor), "%s", (const char*)response->vendor);
+    snprintf(identity->product, sizeof(identity->product), "%s", (const char*)response->product);
+
+    /* The revision field holds four ASCII characters */
+    for (i = 0; i < 4; ++i) {
+        identity->revision[i] = (char)(response->revision_level >> (i * 8));
+    }
+
+    read_drive_serial(sysfs_path, identity->serial, sizeof(identity->serial));
+}
+
+static bool_t
+identity_equals(const optcl_devcache_identity *left, const optcl_devcache_identity *right)
+{
+    if (strcmp(left->vendor, right->vendor) != 0
+        || strcmp(left->product, right->product) != 0
+        || strcmp(left->revision, right->revision) != 0
+        || strcmp(left->serial, right->serial) != 0) {
+        return(False);
+    }
+
+    return(True);
+}
+
+static RESULT
+set_device_string(optcl_device *device,
+                  RESULT (*setter)(optcl_device*, char*),
+                  const char *value)
+{
+    RESULT error;
+    char *nvalue;
+
+    nvalue = xstrdup(value);
+
+    if (nvalue == 0) {
+        return(E_OUTOFMEMORY);
+    }
+
+    error = setter(device, nvalue);
+
+    if (FAILED(error)) {
+        free(nvalue);
+    }
+
+    return(error);
+}
+
+/*
+ * A cached drive costs one INQUIRY, which checks that the drive and its
+ * firmware are still the ones cached. Its features are parsed from the
+ * cached GET CONFIGURATION data.
+ */
+static RESULT
+get_device_attributes(const optcl_devcache *cache,
+                      struct enumerated_drive *drive,
+                      optcl_device *device)
+{
+    RESULT error;
+    RESULT destroy_error;
+    bool_t cached = False;
+    uint32_t features_size = 0;
+    const uint8_t *features = 0;
+    optcl_adapter *adapter = 0;
+    optcl_mmc_inquiry command;
+    optcl_mmc_response_inquiry *response = 0;
+    optcl_devcache_identity cached_identity;
+
+    assert(drive != 0);
+    assert(device != 0);
+
+    if (drive == 0 || device == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = set_device_string(device, optcl_device_set_path, drive->path);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    error = optcl_device_set_type(device, DEVICE_TYPE_CD_DVD);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (cache != 0 && SUCCEEDED(optcl_devcache_get_identity(cache, drive->sysfs_path, &cached_identity))) {
+        cached = SUCCEEDED(optcl_devcache_load(cache, drive->sysfs_path, device, &features, &features_size));
+    }
+
+    if (cached == False) {
+        error = enumerate_device_adapter(device, &adapter);
+
+        if (FAILED(error)) {
+            return(error);
+        }
+
+        error = optcl_device_set_adapter(device, adapter);
+
+        if (FAILED(error)) {
+            return(error);
+        }
+    }
+
+    memset(&command, 0, sizeof(command));
+
+    error = optcl_command_inquiry(device, &command, &response);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    get_inquiry_identity(response, drive->sysfs_path, &drive->identity);
+
+    if (cached == True) {
+        if (identity_equals(&drive->identity, &cached_identity) == True) {
+            error = set_device_features(device, features, features_size);
+
+            if (SUCCEEDED(error)) {
+                drive->cached = True;
+
+                goto error_exit;
+            }
+
+            /* Features of an unusable entry may be partly applied */
+            error = optcl_device_clear_features(device);
+
+            if (FAILED(error)) {
+                goto error_exit;
+            }
+        }
+
+        /* Another drive, new firmware or an unusable entry, probe it in full */
+        drive->stale = True;
+
+        error = enumerate_device_adapter(device, &adapter);
+
+        if (FAILED(error)) {
+            goto error_exit;
+        }
+
+        error = optcl_device_set_adapter(device, adapter);
+
+        if (FAILED(error)) {
+            goto error_exit;
+        }
+    }
+
+    error = optcl_device_set_type(device, response->device_type);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    error = set_device_string(device, optcl_device_set_product, (const char*)response->product);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    error = set_device_string(device, optcl_device_set_vendor, (const char*)response->vendor);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    error = set_device_string(device, optcl_device_set_vendor_string, (const char*)response->vendor_string);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    error = set_device_string(device, optcl_device_set_revision, drive->identity.revision);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    error = read_configuration(device, &drive->features, &drive->features_size);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    error = set_device_features(device, drive->features, drive->features_size);
+
+error_exit:
+
+    if (response != 0) {
+        destroy_error = optcl_command_destroy_response((optcl_mmc_response*)response);
+        error = SUCCEEDED(destroy_error) ? error : destroy_error;
+    }
+
+    return(error);
+}
+
+static void
+probe_drive(const optcl_devcache *cache, struct enumerated_drive *drive)
+{
+    RESULT error;
+    uint64_t start;
+    optcl_device *device = 0;
+
+    assert(drive != 0);
+
+    start = xtime_usec();
+
+    error = optcl_device_create(&device);
+
+    if (FAILED(error)) {
+        drive->error = error;
+        return;
+    }
+
+    error = get_device_attributes(cache, drive, device);
+
+    if (SUCCEEDED(error)) {
+        error = optcl_device_set_probe_time(device, xtime_usec() - start);
+    }
+
+    if (FAILED(error)) {
+        optcl_device_destroy(device);
+        drive->error = error;
+        return;
+    }
+
+    drive->device = device;
+}
+
+/* Worker loop, drives are taken one at a time so slow drives do not stall the rest */
+static void
+probe_drives(void *arg)
+{
+    uint32_t index;
+    struct enumeration *enumeration = (struct enumeration*)arg;
+
+    assert(enumeration != 0);
+
+    for (;;) {
+        index = __sync_fetch_and_add(&enumeration->next, 1);
+
+        if (index >= enumeration->count) {
+            break;
+        }
+
+        probe_drive(enumeration->cache, &enumeration->drives[index]);
+    }
+}
+
+static RESULT
+append_enumerated_drive(struct enumerated_drive *drive, optcl_list *devices)
+{
+    RESULT error;
+
+    assert(drive != 0);
+    assert(devices != 0);
+
+    if (drive == 0 || devices == 0) {
+        return(E_INVALIDARG);
+    }
+
+    /* Drives that went away or can not be opened are left out */
+    if (drive->device == 0) {
+        return(SUCCESS);
+    }
+
+    error = optcl_list_add_tail(devices, (const ptr_t)drive->device);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    drive->device = 0;
+
+    return(SUCCESS);
+}
+
+/* Cache the drives probed in full and drop entries that went stale */
+static RESULT
+update_cache(optcl_devcache *cache, const struct enumeration *enumeration)
+{
+    uint32_t i;
+    RESULT error;
+    const struct enumerated_drive *drive;
+
+    assert(cache != 0);
+    assert(enumeration != 0);
+
+    for (i = 0; i < enumeration->count; ++i) {
+        drive = &enumeration->drives[i];
+
+        if (drive->device != 0 && drive->features != 0) {
+            error = optcl_devcache_store(cache, drive->sysfs_path, &drive->identity,
+                                         drive->device, drive->features, drive->features_size);
+        } else if (drive->stale == True) {
+            error = optcl_devcache_invalidate(cache, drive->sysfs_path);
+        } else {
+            error = SUCCESS;
+        }
+
+        /* Drives with a location too long to cache are probed every time */
+        if (FAILED(error) && error != E_OUTOFRANGE) {
+            return(error);
+        }
+    }
+
+    return(optcl_devcache_save(cache));
+}
+
+static RESULT
+get_default_cache_file(char *filename, size_t filename_size)
+{
+    int count;
+    const char *base;
+    char dir[PATH_MAX];
+
+    base = getenv("XDG_CACHE_HOME");
+
+    if (base != 0 && base[0] == '/') {
+        count = snprintf(dir, sizeof(dir), "%s/%s", base, DEVCACHE_DIR);
+    } else {
+        base = getenv("HOME");
+
+        if (base == 0 || base[0] != '/') {
+            return(E_DEVINVALIDPATH);
+        }
+
+        count = snprintf(dir, sizeof(dir), "%s/.cache", base);
+
+        if (count < 0 || count >= (int)sizeof(dir)) {
+            return(E_OUTOFRANGE);
+        }
+
+        if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+            return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+        }
+
+        count = snprintf(dir, sizeof(dir), "%s/.cache/%s", base, DEVCACHE_DIR);
+    }
+
+    if (count < 0 || count >= (int)sizeof(dir)) {
+        return(E_OUTOFRANGE);
+    }
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    count = snprintf(filename, filename_size, "%s/%s", dir, DEVCACHE_FILE);
+
+    if (count < 0 || count >= (int)filename_size) {
+        return(E_OUTOFRANGE);
+    }
+
+    return(SUCCESS);
+}
+
+RESULT optcl_device_enumerate_cached(const char *cache_file, optcl_list **devices)
+{
+    uint32_t i;
+    RESULT error;
+    RESULT destroy_error = SUCCESS;
+    uint32_t thread_count;
+    uint32_t started = 0;
+    optcl_list *ndevices = 0;
+    optcl_devcache *cache = 0;
+    struct enumeration enumeration;
+    ptr_t threads[ENUMERATE_MAX_THREADS];
+
+    assert(devices != 0);
+
+    if (devices == 0) {
+        return(E_INVALIDARG);
+    }
+
+    memset(&enumeration, 0, sizeof(enumeration));
+
+    error = scan_scsi_generic(&enumeration);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    error = scan_block_drives(&enumeration);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    if (enumeration.count > 1) {
+        qsort(enumeration.drives, enumeration.count, 
+            sizeof(struct enumerated_drive), compare_enumerated_drives);
+    }
+
+    /* Enumeration goes on without the cache when it can not be opened */
+    if (cache_file != 0 && enumeration.count > 0 && SUCCEEDED(optcl_devcache_open(cache_file, &cache))) {
+        enumeration.cache = cache;
+    }
+
+    /*
+     * The calling thread probes too, so enumeration goes on serially
+     * when no worker thread can be started.
+     */
+    thread_count = (enumeration.count < ENUMERATE_MAX_THREADS) 
+        ? enumeration.count : ENUMERATE_MAX_THREADS;
+
+    for (i = 1; i < thread_count; ++i) {
+        if (xthread_create(probe_drives, &enumeration, &threads[started]) != 0) {
+            break;
+        }
+
+        ++started;
+    }
+
+    probe_drives(&enumeration);
+
+    for (i = 0; i < started; ++i) {
+        xthread_join(threads[i]);
+    }
+
+    /* A cache that can not be written only costs the next enumeration */
+    if (cache != 0) {
+        update_cache(cache, &enumeration);
+    }
+
+    error = optcl_list_create(0, &ndevices);
+
+    if (FAILED(error)) {
+        goto error_exit;
+    }
+
+    for (i = 0; i < enumeration.count; ++i) {
+        error = append_enumerated_drive(&enumeration.drives[i], ndevices);
+
+        if (FAILED(error)) {
+            break;
+        }
+    }
+
+error_exit:
+
+    if (SUCCEEDED(error)) {
+        *devices = ndevices;
+    } else if (ndevices != 0) {
+        destroy_error = destroy_devices_list(ndevices);
+    }
+
+    for (i = 0; i < enumeration.count; ++i) {
+        if (enumeration.drives[i].device != 0) {
+            optcl_device_destroy(enumeration.drives[i].device);
+        }
+
+        free(enumeration.drives[i].features);
+    }
+
+    free(enumeration.drives);
+
+    if (cache != 0) {
+        optcl_devcache_close(cache);
+    }
+
+    return(SUCCEEDED(destroy_error) ? error : destroy_error);
+}
+
+RESULT optcl_device_enumerate(optcl_list **devices)
+{
+    char cache_file[PATH_MAX];
+
+    if (FAILED(get_default_cache_file(cache_file, sizeof(cache_file)))) {
+        return(optcl_device_enumerate_cached(0, devices));
+    }
+
+    return(optcl_device_enumerate_cached(cache_file, devices));
+}
+
+/*
+ * Hotplug monitor
+ *
+ * The kernel sends a uevent for the SCSI generic node and one for the
+ * CD-ROM block node of a drive. Both name the SCSI device two levels
+ * up their DEVPATH, which is the sysfs path enumeration uses for the
+ * drive, so the second event of an attach finds the drive queued.
+ */
+
+struct tag_device_monitor {
+    int fd;
+    optcl_list *devices;
+    optcl_device_monitorfn callback;
+    ptr_t context;
+    bool_t resync;              /* Rescan sysfs on the next dispatch */
+    uint64_t retry_time;        /* Next probe of pending drives */
+    char cache_file[PATH_MAX];  /* Empty when there is no cache */
+    struct enumeration pending; /* Drives waiting for a probe */
+};
+
+struct uevent {
+    const char *action;
+    const char *devpath;
+    const char *subsystem;
+    const char *devname;
+    const char *devtype;
+};
+
+static RESULT
+parse_uevent(const char *buffer, size_t length, struct uevent *uevent)
+{
+    size_t offset;
+    const char *value;
+
+    assert(buffer != 0);
+    assert(uevent != 0);
+
+    if (buffer == 0 || uevent == 0) {
+        return(E_INVALIDARG);
+    }
+
+    memset(uevent, 0, sizeof(struct uevent));
+
+    /* The first string is the action@devpath summary */
+    offset = strlen(buffer) + 1;
+
+    while (offset < length) {
+        value = buffer + offset;
+
+        if (strncmp(value, "ACTION=", 7) == 0) {
+            uevent->action = value + 7;
+        } else if (strncmp(value, "DEVPATH=", 8) == 0) {
+            uevent->devpath = value + 8;
+        } else if (strncmp(value, "SUBSYSTEM=", 10) == 0) {
+            uevent->subsystem = value + 10;
+        } else if (strncmp(value, "DEVNAME=", 8) == 0) {
+            uevent->devname = value + 8;
+        } else if (strncmp(value, "DEVTYPE=", 8) == 0) {
+            uevent->devtype = value + 8;
+        }
+
+        offset += strlen(value) + 1;
+    }
+
+    if (uevent->action == 0 || uevent->devpath == 0 
+        || uevent->subsystem == 0 || uevent->devname == 0) 
+    {
+        return(E_UNEXPECTED);
+    }
+
+    return(SUCCESS);
+}
+
+/* The SCSI device holds the scsi_generic or block directory of the node */
+static RESULT
+get_uevent_sysfs_path(const char *devpath, char *sysfs_path, size_t sysfs_path_size)
+{
+    int i;
+    int count;
+    char *separator;
+
+    assert(devpath != 0);
+    assert(sysfs_path != 0);
+
+    if (devpath == 0 || sysfs_path == 0) {
+        return(E_INVALIDARG);
+    }
+
+    count = snprintf(sysfs_path, sysfs_path_size, "/sys%s", devpath);
+
+    if (count < 0 || count >= (int)sysfs_path_size) {
+        return(E_OUTOFRANGE);
+    }
+
+    for (i = 0; i < 2; ++i) {
+        separator = strrchr(sysfs_path, '/');
+
+        if (separator == 0 || separator == sysfs_path) {
+            return(E_DEVINVALIDPATH);
+        }
+
+        *separator = 0;
+    }
+
+    return(SUCCESS);
+}
+
+/*
+ * Devices added by enumeration or by the monitor have a SCSI generic
+ * or a CD-ROM block node path, other paths are not drives.
+ */
+static RESULT
+get_node_sysfs_path(const char *path, char *sysfs_path, size_t sysfs_path_size)
+{
+    int count;
+    const char *name;
+    const char *class_dir;
+    char device_dir[PATH_MAX];
+
+    assert(path != 0);
+    assert(sysfs_path != 0);
+
+    if (path == 0 || sysfs_path == 0) {
+        return(E_INVALIDARG);
+    }
+
+    if (strncmp(path, BLOCK_DEVICE_PREFIX, strlen(BLOCK_DEVICE_PREFIX)) != 0) {
+        return(E_DEVINVALIDPATH);
+    }
+
+    name = path + strlen(BLOCK_DEVICE_PREFIX);
+
+    if (strncmp(name, "sg", 2) == 0) {
+        class_dir = SYSFS_SCSI_GENERIC_DIR;
+    } else if (strncmp(name, CDROM_BLOCK_PREFIX, strlen(CDROM_BLOCK_PREFIX)) == 0) {
+        class_dir = SYSFS_BLOCK_DIR;
+    } else {
+        return(E_DEVINVALIDPATH);
+    }
+
+    count = snprintf(device_dir, sizeof(device_dir), "%s/%s/device", class_dir, name);
+
+    if (count < 0 || count >= (int)sizeof(device_dir) || sysfs_path_size < PATH_MAX) {
+        return(E_OUTOFRANGE);
+    }
+
+    if (realpath(device_dir, sysfs_path) == 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    return(SUCCESS);
+}
+
+/* Find a listed device by node path or, when given, by sysfs path */
+static RESULT
+find_listed_device(const optcl_list *devices, 
+                   const char *path, 
+                   const char *sysfs_path,
+                   optcl_list_iterator *pos)
+{
+    RESULT error;
+    const char *device_path;
+    optcl_device *device = 0;
+    optcl_list_iterator it = 0;
+    char device_sysfs_path[PATH_MAX];
+
+    assert(devices != 0);
+    assert(path != 0);
+    assert(pos != 0);
+
+    if (devices == 0 || path == 0 || pos == 0) {
+        return(E_INVALIDARG);
+    }
+
+    *pos = 0;
+
+    error = optcl_list_get_head_pos(devices, &it);
+
+    while (SUCCEEDED(error) && it != 0) {
+        error = optcl_list_get_at_pos(devices, it, (const pptr_t)&device);
+
+        if (FAILED(error)) {
+            break;
+        }
+
+        if (device != 0 && SUCCEEDED(optcl_device_get_path_ref(device, &device_path)) && device_path != 0) {
+            if (strcmp(device_path, path) == 0) {
+                *pos = it;
+                break;
+            }
+
+            if (sysfs_path != 0 
+                && SUCCEEDED(get_node_sysfs_path(device_path, device_sysfs_path, sizeof(device_sysfs_path)))
+                && strcmp(device_sysfs_path, sysfs_path) == 0) 
+            {
+                *pos = it;
+                break;
+            }
+        }
+
+        error = optcl_list_get_next(devices, it, &it);
+    }
+
+    return(error);
+}
+
+static void
+clear_pending_probe(struct enumerated_drive *drive)
+{
+    assert(drive != 0);
+
+    if (drive->device != 0) {
+        optcl_device_destroy(drive->device);
+        drive->device = 0;
+    }
+
+    free(drive->features);
+
+    drive->features = 0;
+    drive->features_size = 0;
+    drive->cached = False;
+    drive->stale = False;
+    drive->error = SUCCESS;
+}
+
+static void
+remove_pending_drive(struct enumeration *pending, uint32_t index)
+{
+    assert(pending != 0);
+    assert(index < pending->count);
+
+    clear_pending_probe(&pending->drives[index]);
+
+    memmove(&pending->drives[index], &pending->drives[index + 1], 
+        (pending->count - index - 1) * sizeof(struct enumerated_drive));
+
+    --pending->count;
+}
+
+/* Queue a drive for a probe unless it is listed or queued already */
+static RESULT
+queue_drive(optcl_device_monitor *monitor, const char *path, const char *sysfs_path)
+{
+    RESULT error;
+    optcl_list_iterator pos = 0;
+    struct enumerated_drive *drive;
+
+    assert(monitor != 0);
+    assert(path != 0);
+    assert(sysfs_path != 0);
+
+    error = find_listed_device(monitor->devices, path, sysfs_path, &pos);
+
+    if (FAILED(error) || pos != 0) {
+        return(error);
+    }
+
+    drive = find_enumerated_drive(&monitor->pending, sysfs_path);
+
+    if (drive != 0) {
+        if (access(drive->path, R_OK | W_OK) != 0 && access(path, R_OK | W_OK) == 0) {
+            snprintf(drive->path, sizeof(drive->path), "%s", path);
+        }
+
+        return(SUCCESS);
+    }
+
+    error = add_enumerated_drive(&monitor->pending, path, sysfs_path);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    monitor->pending.drives[monitor->pending.count - 1].attach_time = xtime_usec();
+    monitor->retry_time = 0;
+
+    return(SUCCESS);
+}
+
+static RESULT
+remove_listed_device(optcl_device_monitor *monitor, optcl_list_iterator pos)
+{
+    RESULT error;
+    optcl_device *device = 0;
+
+    assert(monitor != 0);
+    assert(pos != 0);
+
+    error = optcl_list_get_at_pos(monitor->devices, pos, (const pptr_t)&device);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    error = optcl_list_remove(monitor->devices, pos);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (monitor->callback != 0) {
+        monitor->callback(DEVICE_MONITOR_REMOVED, device, monitor->context);
+    }
+
+    return(optcl_device_destroy(device));
+}
+
+static RESULT
+remove_drive(optcl_device_monitor *monitor, const char *path)
+{
+    uint32_t i;
+    RESULT error;
+    optcl_list_iterator pos = 0;
+
+    assert(monitor != 0);
+    assert(path != 0);
+
+    for (i = 0; i < monitor->pending.count; ++i) {
+        if (strcmp(monitor->pending.drives[i].path, path) == 0) {
+            remove_pending_drive(&monitor->pending, i);
+            break;
+        }
+    }
+
+    error = find_listed_device(monitor->devices, path, 0, &pos);
+
+    if (FAILED(error) || pos == 0) {
+        return(error);
+    }
+
+    return(remove_listed_device(monitor, pos));
+}
+
+static RESULT
+handle_uevent(optcl_device_monitor *monitor, const char *buffer, size_t length)
+{
+    int count;
+    RESULT error;
+    uint32_t type;
+    bool_t generic;
+    struct uevent uevent;
+    char node[PATH_MAX];
+    char sysfs_path[PATH_MAX];
+
+    assert(monitor != 0);
+    assert(buffer != 0);
+
+    /* Events of other kinds carry fewer fields */
+    if (FAILED(parse_uevent(buffer, length, &uevent))) {
+        return(SUCCESS);
+    }
+
+    generic = (strcmp(uevent.subsystem, "scsi_generic") == 0) ? True : False;
+
+    if (generic == False 
+        && (strcmp(uevent.subsystem, "block") != 0 
+        || uevent.devtype == 0 || strcmp(uevent.devtype, "disk") != 0
+        || strncmp(uevent.devname, CDROM_BLOCK_PREFIX, strlen(CDROM_BLOCK_PREFIX)) != 0)) 
+    {
+        return(SUCCESS);
+    }
+
+    count = snprintf(node, sizeof(node), "%s%s", BLOCK_DEVICE_PREFIX, uevent.devname);
+
+    if (count < 0 || count >= (int)sizeof(node)) {
+        return(SUCCESS);
+    }
+
+    if (strcmp(uevent.action, "remove") == 0) {
+        return(remove_drive(monitor, node));
+    }
+
+    if (strcmp(uevent.action, "add") != 0) {
+        return(SUCCESS);
+    }
+
+    error = get_uevent_sysfs_path(uevent.devpath, sysfs_path, sizeof(sysfs_path));
+
+    if (FAILED(error)) {
+        return(SUCCESS);
+    }
+
+    if (generic == True && (FAILED(read_sysfs_value(sysfs_path, "type", &type)) || type != SCSI_TYPE_ROM)) {
+        return(SUCCESS);
+    }
+
+    return(queue_drive(monitor, node, sysfs_path));
+}
+
+/*
+ * Bring the list in line with sysfs, after uevents were lost or when
+ * drives changed between enumeration and monitor creation.
+ */
+static RESULT
+resync_devices(optcl_device_monitor *monitor)
+{
+    uint32_t i;
+    RESULT error;
+    const char *path;
+    optcl_device *device = 0;
+    optcl_list_iterator it = 0;
+    optcl_list_iterator next = 0;
+    struct enumeration enumeration;
+    char sysfs_path[PATH_MAX];
+
+    assert(monitor != 0);
+
+    error = optcl_list_get_head_pos(monitor->devices, &it);
+
+    while (SUCCEEDED(error) && it != 0) {
+        error = optcl_list_get_next(monitor->devices, it, &next);
+
+        if (FAILED(error)) {
+            break;
+        }
+
+        error = optcl_list_get_at_pos(monitor->devices, it, (const pptr_t)&device);
+
+        if (FAILED(error)) {
+            break;
+        }
+
+        if (device != 0 && SUCCEEDED(optcl_device_get_path_ref(device, &path)) && path != 0) {
+            error = get_node_sysfs_path(path, sysfs_path, sizeof(sysfs_path));
+
+            /* Devices that are not drive nodes are not ours to remove */
+            if (FAILED(error) && error != E_DEVINVALIDPATH && error != E_OUTOFRANGE) {
+                error = remove_listed_device(monitor, it);
+            } else {
+                error = SUCCESS;
+            }
+        }
+
+        it = next;
+    }
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    memset(&enumeration, 0, sizeof(enumeration));
+
+    error = scan_scsi_generic(&enumeration);
+
+    if (SUCCEEDED(error)) {
+        error = scan_block_drives(&enumeration);
+    }
+
+    for (i = 0; SUCCEEDED(error) && i < enumeration.count; ++i) {
+        error = queue_drive(monitor, enumeration.drives[i].path, enumeration.drives[i].sysfs_path);
+    }
+
+    free(enumeration.drives);
+
+    return(error);
+}
+
+/*
+ * Probe the queued drives, a drive whose node can not be opened yet
+ * stays queued until MONITOR_PROBE_TIMEOUT after it was attached.
+ */
+static RESULT
+probe_pending_drives(optcl_device_monitor *monitor, uint64_t now)
+{
+    uint32_t i;
+    RESULT error;
+    optcl_device *device;
+    optcl_devcache *cache = 0;
+    struct enumeration single;
+    struct enumerated_drive *drive;
+
+    assert(monitor != 0);
+
+    if (monitor->pending.count == 0 || now < monitor->retry_time) {
+        return(SUCCESS);
+    }
+
+    if (monitor->cache_file[0] != 0 && FAILED(optcl_devcache_open(monitor->cache_file, &cache))) {
+        cache = 0;
+    }
+
+    error = SUCCESS;
+
+    i = 0;
+
+    while (i < monitor->pending.count) {
+        drive = &monitor->pending.drives[i];
+
+        probe_drive(cache, drive);
+
+        if (drive->device == 0) {
+            if (now - drive->attach_time >= MONITOR_PROBE_TIMEOUT) {
+                remove_pending_drive(&monitor->pending, i);
+            } else {
+                clear_pending_probe(drive);
+                ++i;
+            }
+
+            continue;
+        }
+
+        if (cache != 0) {
+            memset(&single, 0, sizeof(single));
+            single.drives = drive;
+            single.count = 1;
+            update_cache(cache, &single);
+        }
+
+        device = drive->device;
+
+        error = optcl_list_add_tail(monitor->devices, (const ptr_t)device);
+
+        if (FAILED(error)) {
+            remove_pending_drive(&monitor->pending, i);
+            break;
+        }
+
+        drive->device = 0;
+
+        remove_pending_drive(&monitor->pending, i);
+
+        if (monitor->callback != 0) {
+            monitor->callback(DEVICE_MONITOR_ADDED, device, monitor->context);
+        }
+    }
+
+    if (cache != 0) {
+        optcl_devcache_close(cache);
+    }
+
+    monitor->retry_time = xtime_usec() + MONITOR_RETRY_MSEC * 1000U;
+
+    return(error);
+}
+
+RESULT optcl_device_monitor_create(optcl_list *devices,
+                                   optcl_device_monitorfn callback,
+                                   ptr_t context,
+                                   optcl_device_monitor **monitor)
+{
+    int fd;
+    int size;
+    struct sockaddr_nl address;
+    optcl_device_monitor *nmonitor;
+
+    assert(devices != 0);
+    assert(monitor != 0);
+
+    if (devices == 0 || monitor == 0) {
+        return(E_INVALIDARG);
+    }
+
+    fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+
+    if (fd < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    /* Attaching a hub full of drives sends bursts of uevents */
+    size = UEVENT_SOCKET_BUFFER;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    memset(&address, 0, sizeof(address));
+
+    address.nl_family = AF_NETLINK;
+    address.nl_groups = UEVENT_KERNEL_GROUP;
+
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        size = errno;
+        close(fd);
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, size));
+    }
+
+    nmonitor = malloc(sizeof(optcl_device_monitor));
+
+    if (nmonitor == 0) {
+        close(fd);
+        return(E_OUTOFMEMORY);
+    }
+
+    memset(nmonitor, 0, sizeof(optcl_device_monitor));
+
+    nmonitor->fd = fd;
+    nmonitor->devices = devices;
+    nmonitor->callback = callback;
+    nmonitor->context = context;
+    nmonitor->resync = True;
+
+    if (FAILED(get_default_cache_file(nmonitor->cache_file, sizeof(nmonitor->cache_file)))) {
+        nmonitor->cache_file[0] = 0;
+    }
+
+    *monitor = nmonitor;
+
+    return(SUCCESS);
+}
+
+RESULT optcl_device_monitor_destroy(optcl_device_monitor *monitor)
+{
+    uint32_t i;
+
+    assert(monitor != 0);
+
+    if (monitor == 0) {
+        return(E_INVALIDARG);
+    }
+
+    for (i = 0; i < monitor->pending.count; ++i) {
+        clear_pending_probe(&monitor->pending.drives[i]);
+    }
+
+    free(monitor->pending.drives);
+
+    close(monitor->fd);
+
+    free(monitor);
+
+    return(SUCCESS);
+}
+
+RESULT optcl_device_monitor_get_fd(const optcl_device_monitor *monitor, int *fd)
+{
+    assert(monitor != 0);
+    assert(fd != 0);
+
+    if (monitor == 0 || fd == 0) {
+        return(E_INVALIDARG);
+    }
+
+    *fd = monitor->fd;
+
+    return(SUCCESS);
+}
+
+RESULT optcl_device_monitor_dispatch(optcl_device_monitor *monitor, uint32_t *timeout)
+{
+    RESULT error;
+    ssize_t length;
+    uint64_t now;
+    struct iovec iov;
+    struct msghdr message;
+    struct sockaddr_nl address;
+    char buffer[UEVENT_BUFFER_SIZE + 1];
+
+    assert(monitor != 0);
+    assert(timeout != 0);
+
+    if (monitor == 0 || timeout == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = SUCCESS;
+
+    for (;;) {
+        iov.iov_base = buffer;
+        iov.iov_len = UEVENT_BUFFER_SIZE;
+
+        memset(&message, 0, sizeof(message));
+
+        message.msg_name = &address;
+        message.msg_namelen = sizeof(address);
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+
+        length = recvmsg(monitor->fd, &message, MSG_DONTWAIT);
+
+        if (length < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            /* The socket overran, events were dropped */
+            if (errno == ENOBUFS) {
+                monitor->resync = True;
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                error = MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno);
+            }
+
+            break;
+        }
+
+        /* Only the kernel sends uevents to this group */
+        if (address.nl_pid != 0 || (message.msg_flags & MSG_TRUNC) != 0) {
+            continue;
+        }
+
+        buffer[length] = 0;
+
+        error = handle_uevent(monitor, buffer, (size_t)length);
+
+        if (FAILED(error)) {
+            break;
+        }
+    }
+
+    if (SUCCEEDED(error) && monitor->resync == True) {
+        error = resync_devices(monitor);
+
+        if (SUCCEEDED(error)) {
+            monitor->resync = False;
+        }
+    }
+
+    if (SUCCEEDED(error)) {
+        error = probe_pending_drives(monitor, xtime_usec());
+    }
+
+    if (monitor->pending.count == 0) {
+        *timeout = DEVICE_MONITOR_INFINITE;
+    } else {
+        now = xtime_usec();
+
+        *timeout = (monitor->retry_time > now) 
+            ? (uint32_t)((monitor->retry_time - now + 999U) / 1000U) : 0;
+    }
+
+    return(error);
+}
+
+static RESULT
+get_bsg_node(const char *path, char *node, size_t node_size)
+{
+    int count;
+    DIR *dir;
+    struct dirent *entry;
+    const char *name;
+    const char *class_dir;
+    char bsg_dir[PATH_MAX];
+
+    assert(path != 0);
+    assert(node != 0);
+    assert(node_size > 0);
+
+    if (path == 0 || node == 0 || node_size == 0) {
+        return(E_INVALIDARG);
+    }
+
+    /* Devices may be addressed by their bsg node directly */
+    if (strncmp(path, BSG_DEVICE_PREFIX, strlen(BSG_DEVICE_PREFIX)) == 0) {
+        count = snprintf(node, node_size, "%s", path);
+
+        return((count < 0 || count >= (int)node_size) ? E_OUTOFRANGE : SUCCESS);
+    }
+
+    name = strrchr(path, '/');
+    name = (name != 0) ? name + 1 : path;
+
+    /*
+     * Drives enumerated through their block device share the SCSI
+     * device directory with the sg node, so the bsg node is found
+     * without the sg module loaded.
+     */
+    if (strncmp(name, CDROM_BLOCK_PREFIX, strlen(CDROM_BLOCK_PREFIX)) == 0) {
+        class_dir = SYSFS_BLOCK_DIR;
+    } else {
+        class_dir = SYSFS_SCSI_GENERIC_DIR;
+    }
+
+    count = snprintf(bsg_dir, sizeof(bsg_dir), 
+        "%s/%s/device/bsg", class_dir, name);
+
+    if (count < 0 || count >= (int)sizeof(bsg_dir)) {
+        return(E_OUTOFRANGE);
+    }
+
+    dir = opendir(bsg_dir);
+
+    if (dir == 0) {
+        return(E_DEVINVALIDPATH);
+    }
+
+    count = -1;
+
+    while ((entry = readdir(dir)) != 0) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        count = snprintf(node, node_size, "%s%s", BSG_DEVICE_PREFIX, entry->d_name);
+
+        break;
+    }
+
+    closedir(dir);
+
+    if (count < 0) {
+        return(E_DEVINVALIDPATH);
+    }
+
+    return((count >= (int)node_size) ? E_OUTOFRANGE : SUCCESS);
+}
+
+static RESULT
+open_device_node(const optcl_device *device, int *fd)
+{
+    RESULT error;
+
+    int nfd;
+    uint16_t backend;
+    const char *path = 0;
+    char node[PATH_MAX];
+
+    assert(device != 0);
+    assert(fd != 0);
+
+    if (device == 0 || fd == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_backend(device, &backend);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    error = optcl_device_get_path_ref(device, &path);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (path == 0) {
+        return(E_DEVINVALIDPATH);
+    }
+
+    if (backend == DEVICE_BACKEND_BSG) {
+        error = get_bsg_node(path, node, sizeof(node));
+
+        if (FAILED(error)) {
+            return(error);
+        }
+
+        path = node;
+    }
+
+    nfd = open(path, O_RDWR | O_EXCL);
+
+    if (nfd < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    *fd = nfd;
+
+    return(SUCCESS);
+}
+
+/*
+ * Map the host and driver status of a completed request, sg v3 and
+ * bsg requests report timeouts and driver failures the same way.
+ */
+static RESULT
+get_host_status(uint32_t host_status, uint32_t driver_status)
+{
+    if (host_status == SG_HOST_TIME_OUT) {
+        return(E_DEVTIMEOUT);
+    }
+
+    if ((driver_status & SG_DRIVER_MASK) == SG_DRIVER_TIME_OUT) {
+        return(E_DEVTIMEOUT);
+    }
+
+    if ((driver_status & SG_DRIVER_MASK) == SG_DRIVER_ERROR) {
+        return(E_DEVDRIVERERROR);
+    }
+
+    return(SUCCESS);
+}
+
+/* Every path that takes sg requests back maps their status here */
+static RESULT
+get_sg_status(const sg_io_hdr_t *sg_hdr)
+{
+    assert(sg_hdr != 0);
+
+    return(get_host_status(sg_hdr->host_status, sg_hdr->driver_status));
+}
+
+static RESULT
+execute_sg(int fd,
+           const uint8_t cdb[],
+           uint32_t cdb_size,
+           int direction,
+           uint8_t param[],
+           uint32_t param_size,
+           uint8_t sense_buffer[],
+           uint32_t *sense_len,
+           optcl_device_session *session)
+{
+    RESULT error;
+
+    int sg_error;
+    sg_io_hdr_t sg_hdr;
+
+    memset(&sg_hdr, 0, sizeof(sg_hdr));
+
+    sg_hdr.interface_id = 'S';
+    sg_hdr.cmd_len = (uint8_t)cdb_size;
+    sg_hdr.mx_sb_len = SPT_SENSE_LENGTH;
+    sg_hdr.dxfer_len = param_size;
+    sg_hdr.dxferp = param;
+    sg_hdr.cmdp = (unsigned char*)cdb;
+    sg_hdr.sbp = sense_buffer;
+    sg_hdr.timeout = SCSI_COMMAND_TIMEOUT;
+
+    switch(direction) {
+        case MMC_DATA_DIRECTION_IN:
+            sg_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+            sg_hdr.flags = SG_FLAG_DIRECT_IO;
+            break;
+        case MMC_DATA_DIRECTION_OUT:
+            sg_hdr.dxfer_direction = SG_DXFER_TO_DEV;
+            sg_hdr.flags = SG_FLAG_DIRECT_IO;
+            break;
+        default:
+            sg_hdr.dxfer_direction = SG_DXFER_NONE;
+            sg_hdr.dxfer_len = 0;
+            sg_hdr.dxferp = 0;
+            break;
+    }
+
+    sg_error = ioctl(fd, SG_IO, &sg_hdr);
+
+    if (sg_error < 0) {
+        OPTCL_TRACE_ARRAY_MSG("ioctl(SG_IO) error code:", (uint8_t*)&errno, sizeof(errno));
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    error = get_sg_status(&sg_hdr);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    /*
+     * The sg driver silently falls back to indirect I/O when
+     * the buffer can not be mapped, count what actually happened.
+     */
+    if (direction != MMC_DATA_DIRECTION_NONE) {
+        if ((sg_hdr.info & SG_INFO_DIRECT_IO_MASK) == SG_INFO_DIRECT_IO) {
+            ++session->direct_io;
+        } else {
+            ++session->indirect_io;
+        }
+    }
+
+    *sense_len = sg_hdr.sb_len_wr;
+
+    return(SUCCESS);
+}
+
+static RESULT
+execute_bsg(int fd,
+            const uint8_t cdb[],
+            uint32_t cdb_size,
+            int direction,
+            uint8_t param[],
+            uint32_t param_size,
+            uint8_t sense_buffer[],
+            uint32_t *sense_len)
+{
+    RESULT error;
+
+    int bsg_error;
+    struct sg_io_v4 bsg_hdr;
+
+    memset(&bsg_hdr, 0, sizeof(bsg_hdr));
+
+    /* Pointers are passed as 64 bit values regardless of the ABI */
+    bsg_hdr.guard = 'Q';
+    bsg_hdr.protocol = BSG_PROTOCOL_SCSI;
+    bsg_hdr.subprotocol = BSG_SUB_PROTOCOL_SCSI_CMD;
+    bsg_hdr.request_len = cdb_size;
+    bsg_hdr.request = (uint64_t)(uintptr_t)cdb;
+    bsg_hdr.max_response_len = SPT_SENSE_LENGTH;
+    bsg_hdr.response = (uint64_t)(uintptr_t)sense_buffer;
+    bsg_hdr.timeout = SCSI_COMMAND_TIMEOUT;
+
+    switch(direction) {
+        case MMC_DATA_DIRECTION_IN:
+            bsg_hdr.din_xfer_len = param_size;
+            bsg_hdr.din_xferp = (uint64_t)(uintptr_t)param;
+            break;
+        case MMC_DATA_DIRECTION_OUT:
+            bsg_hdr.dout_xfer_len = param_size;
+            bsg_hdr.dout_xferp = (uint64_t)(uintptr_t)param;
+            break;
+        default:
+            break;
+    }
+
+    bsg_error = ioctl(fd, SG_IO, &bsg_hdr);
+
+    if (bsg_error < 0) {
+        OPTCL_TRACE_ARRAY_MSG("ioctl(SG_IO v4) error code:", (uint8_t*)&errno, sizeof(errno));
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    error = get_host_status(bsg_hdr.transport_status, bsg_hdr.driver_status);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    *sense_len = bsg_hdr.response_len;
+
+    return(SUCCESS);
+}
+
+static RESULT
+open_block_node(const optcl_device *device, int *fd)
+{
+    RESULT error;
+
+    int nfd;
+    int count;
+    const char *path = 0;
+    char node[PATH_MAX];
+    char block_name[NAME_MAX + 1];
+
+    assert(device != 0);
+    assert(fd != 0);
+
+    if (device == 0 || fd == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_path_ref(device, &path);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (path == 0) {
+        return(E_DEVINVALIDPATH);
+    }
+
+    error = get_block_name(path, block_name, sizeof(block_name));
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    count = snprintf(node, sizeof(node), "%s%s", BLOCK_DEVICE_PREFIX, block_name);
+
+    if (count < 0 || count >= (int)sizeof(node)) {
+        return(E_OUTOFRANGE);
+    }
+
+    /* Non blocking open succeeds without a medium in the drive */
+    nfd = open(node, O_RDONLY | O_NONBLOCK | O_DIRECT);
+
+    if (nfd < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    *fd = nfd;
+
+    return(SUCCESS);
+}
+
+static RESULT
+probe_block_reads(optcl_device *device, int block_fd, bool_t *faster)
+{
+    RESULT error;
+
+    uint32_t i;
+    uint32_t lba;
+    uint32_t chunk;
+    uint64_t start;
+    uint64_t scsi_time;
+    uint64_t block_time;
+    ptr_t buffer = 0;
+    optcl_mmc_read_10 command;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(faster != 0);
+
+    if (device == 0 || faster == 0) {
+        return(E_INVALIDARG);
+    }
+
+    *faster = False;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    chunk = limits.max_transfer_len - limits.max_transfer_len % BLOCK_SECTOR_SIZE;
+
+    if (chunk == 0) {
+        return(E_DEVINVALIDSIZE);
+    }
+
+    buffer = (ptr_t)xmalloc_aligned(chunk, limits.alignment_mask);
+
+    if (buffer == 0) {
+        return(E_OUTOFMEMORY);
+    }
+
+    memset(&command, 0, sizeof(command));
+
+    command.transfer_length = (uint16_t)(chunk / BLOCK_SECTOR_SIZE);
+
+    /* Spin the medium up before anything is timed */
+    error = optcl_command_read_10_direct(device, &command, buffer, chunk);
+
+    if (FAILED(error)) {
+        xfree_aligned(buffer);
+        return(error);
+    }
+
+    /*
+     * Both paths read different ranges of the same size so that
+     * neither one is served from the drive cache of the other.
+     */
+    lba = command.transfer_length;
+    start = xtime_usec();
+
+    for (i = 0; i < BLOCK_PROBE_CHUNKS && SUCCEEDED(error); ++i) {
+        command.start_lba = lba;
+        error = optcl_command_read_10_direct(device, &command, buffer, chunk);
+        lba += command.transfer_length;
+    }
+
+    scsi_time = xtime_usec() - start;
+    start = xtime_usec();
+
+    for (i = 0; i < BLOCK_PROBE_CHUNKS && SUCCEEDED(error); ++i) {
+        if (pread(block_fd, buffer, chunk, (off_t)lba * BLOCK_SECTOR_SIZE) != (ssize_t)chunk) {
+            error = MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno);
+        }
+
+        lba += command.transfer_length;
+    }
+
+    block_time = xtime_usec() - start;
+
+    xfree_aligned(buffer);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    *faster = (block_time < scsi_time) ? True : False;
+
+    return(SUCCESS);
+}
+
+static RESULT
+open_block_reads(optcl_device *device, optcl_device_session *session)
+{
+    RESULT error;
+
+    int block_fd;
+    uint16_t mode;
+    bool_t faster;
+
+    assert(device != 0);
+    assert(session != 0);
+
+    if (device == 0 || session == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_block_read_mode(device, &mode);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (mode == DEVICE_BLOCKREAD_DISABLED) {
+        return(SUCCESS);
+    }
+
+    error = open_block_node(device, &block_fd);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    faster = True;
+
+    if (mode == DEVICE_BLOCKREAD_AUTO) {
+        error = probe_block_reads(device, block_fd, &faster);
+
+        if (FAILED(error)) {
+            close(block_fd);
+            return(error);
+        }
+    }
+
+    if (faster == False) {
+        close(block_fd);
+        return(SUCCESS);
+    }
+
+    session->block_handle = (ptr_t)(intptr_t)block_fd;
+    session->block_reads = True;
+
+    return(SUCCESS);
+}
+
+static RESULT
+system_open(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+
+    int sg_fd;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+
+    if (device == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (session->is_open == True) {
+        return(SUCCESS);
+    }
+
+    error = open_device_node(device, &sg_fd);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    session->handle = (ptr_t)(intptr_t)sg_fd;
+    session->is_open = True;
+    ++session->opens;
+
+    /*
+     * The block device path was asked for, a drive where it can not
+     * be set up or probed fails to open rather than quietly reading
+     * through SCSI commands.
+     */
+    error = open_block_reads(device, session);
+
+    if (FAILED(error)) {
+        close(sg_fd);
+        session->handle = 0;
+        session->is_open = False;
+        --session->opens;
+        return(error);
+    }
+
+    return(SUCCESS);
+}
+
+static RESULT
+system_close(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+
+    int sg_fd;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+
+    if (device == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (session->is_open == False) {
+        return(SUCCESS);
+    }
+
+    sg_fd = (int)(intptr_t)session->handle;
+
+    session->handle = 0;
+    session->is_open = False;
+
+    /* Commands still in flight are discarded with the handle */
+    free(session->queue);
+
+    session->queue = 0;
+    session->pending = 0;
+
+    if (session->mmap_view != 0) {
+        munmap(session->mmap_view, session->mmap_size);
+    }
+
+    session->mmap_view = 0;
+    session->mmap_size = 0;
+
+    if (session->block_reads == True) {
+        close((int)(intptr_t)session->block_handle);
+    }
+
+    session->block_handle = 0;
+    session->block_reads = False;
+
+    if (close(sg_fd) < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    return(SUCCESS);
+}
+
+static RESULT
+system_execute(const optcl_device *device,
+               ptr_t context,
+               const uint8_t cdb[],
+               uint32_t cdb_size,
+               uint8_t param[],
+               uint32_t param_size)
+{
+    RESULT error;
+    RESULT sense_code;
+
+    int sg_fd;
+    int direction;
+    uint16_t backend;
+    uint32_t sense_len;
+    uint8_t command[CDB_MAX_LENGTH];
+    uint8_t sense_buffer[SPT_SENSE_LENGTH];
+    optcl_device_session *session = 0;
+
+    assert(cdb != 0);
+    assert(device != 0);
+    assert(cdb_size > 0);
+    assert(cdb_size <= sizeof(command));
+
+    if (cdb == 0 || device == 0 || cdb_size == 0 || cdb_size > sizeof(command)) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_command_get_data_direction(cdb, cdb_size, param_size, &direction);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    error = optcl_device_get_backend(device, &backend);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (session->is_open == True) {
+        sg_fd = (int)(intptr_t)session->handle;
+        ++session->opens_saved;
+    } else {
+        error = open_device_node(device, &sg_fd);
+
+        if (FAILED(error)) {
+            return(error);
+        }
+
+        ++session->opens;
+    }
+
+    ++session->commands;
+
+    sense_len = 0;
+
+    memset(sense_buffer, 0, sizeof(sense_buffer));
+    xmemcpy(command, sizeof(command), cdb, cdb_size);
+
+    OPTCL_TRACE_ARRAY_MSG("CDB bytes:", cdb, cdb_size);
+    OPTCL_TRACE_ARRAY_MSG("CDB parameter bytes:", param, param_size);
+
+    if (backend == DEVICE_BACKEND_BSG) {
+        error = execute_bsg(sg_fd, command, cdb_size, direction, 
+                            param, param_size, sense_buffer, &sense_len);
+    } else {
+        error = execute_sg(sg_fd, command, cdb_size, direction, 
+                           param, param_size, sense_buffer, &sense_len, session);
+    }
+
+    if (session->is_open == False) {
+        close(sg_fd);
+    }
+
+    OPTCL_TRACE_ARRAY_MSG("Device response bytes:", param, param_size);
+    OPTCL_TRACE_ARRAY_MSG("Sense bytes:", sense_buffer, sense_len);
+
+    if (SUCCEEDED(error) && sense_len > 0) {
+        optcl_sensedata_get_progress(sense_buffer, sense_len, 
+                                     &session->progress, &session->progress_valid);
+
+        error = optcl_sensedata_get_code(sense_buffer, sense_len, &sense_code);
+
+        if (SUCCEEDED(error)) {
+            error = sense_code;
+        }
+    }
+
+    return(error);
+}
+
+static RESULT
+system_execute_vectored(const optcl_device *device,
+                        ptr_t context,
+                        const uint8_t cdb[],
+                        uint32_t cdb_size,
+                        const optcl_iovec iov[],
+                        uint32_t iov_count)
+{
+    RESULT error;
+    RESULT sense_code;
+
+    int sg_fd;
+    int sg_error;
+    int direction;
+    uint16_t backend;
+    uint32_t i;
+    uint32_t total_len;
+    sg_io_hdr_t sg_hdr;
+    sg_iovec_t sg_iov[MAX_IOVEC_COUNT];
+    uint8_t command[CDB_MAX_LENGTH];
+    uint8_t sense_buffer[SPT_SENSE_LENGTH];
+    optcl_device_session *session = 0;
+
+    assert(cdb != 0);
+    assert(iov != 0);
+    assert(device != 0);
+    assert(cdb_size > 0);
+    assert(cdb_size <= sizeof(command));
+
+    if (cdb == 0 || iov == 0 || device == 0 || cdb_size == 0 || cdb_size > sizeof(command)) {
+        return(E_INVALIDARG);
+    }
+
+    if (iov_count == 0 || iov_count > MAX_IOVEC_COUNT) {
+        return(E_OUTOFRANGE);
+    }
+
+    total_len = 0;
+
+    for (i = 0; i < iov_count; ++i) {
+        if (iov[i].base == 0 || iov[i].len > UINT32_MAX - total_len) {
+            return(E_INVALIDARG);
+        }
+
+        sg_iov[i].iov_base = iov[i].base;
+        sg_iov[i].iov_len = iov[i].len;
+        total_len += iov[i].len;
+    }
+
+    error = optcl_command_get_data_direction(cdb, cdb_size, total_len, &direction);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (direction == MMC_DATA_DIRECTION_NONE) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_backend(device, &backend);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    /* Vectored transfers are only wired up for the sg v3 interface */
+    if (backend != DEVICE_BACKEND_SG) {
+        return(E_NOTIMPL);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (session->is_open == True) {
+        sg_fd = (int)(intptr_t)session->handle;
+        ++session->opens_saved;
+    } else {
+        error = open_device_node(device, &sg_fd);
+
+        if (FAILED(error)) {
+            return(error);
+        }
+
+        ++session->opens;
+    }
+
+    ++session->commands;
+
+    memset(&sg_hdr, 0, sizeof(sg_hdr));
+    memset(sense_buffer, 0, sizeof(sense_buffer));
+    xmemcpy(command, sizeof(command), cdb, cdb_size);
+
+    /*
+     * The sg driver gathers the vector itself, direct I/O is
+     * not available for vectored transfers.
+     */
+    sg_hdr.interface_id = 'S';
+    sg_hdr.dxfer_direction = (direction == MMC_DATA_DIRECTION_IN) 
+        ? SG_DXFER_FROM_DEV : SG_DXFER_TO_DEV;
+    sg_hdr.cmd_len = (uint8_t)cdb_size;
+    sg_hdr.mx_sb_len = sizeof(sense_buffer);
+    sg_hdr.iovec_count = (unsigned short)iov_count;
+    sg_hdr.dxfer_len = total_len;
+    sg_hdr.dxferp = sg_iov;
+    sg_hdr.cmdp = command;
+    sg_hdr.sbp = sense_buffer;
+    sg_hdr.timeout = SCSI_COMMAND_TIMEOUT;
+
+    OPTCL_TRACE_ARRAY_MSG("CDB bytes:", cdb, cdb_size);
+
+    sg_error = ioctl(sg_fd, SG_IO, &sg_hdr);
+
+    if (sg_error < 0) {
+        OPTCL_TRACE_ARRAY_MSG("ioctl(SG_IO) error code:", (uint8_t*)&errno, sizeof(errno));
+        error = MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno);
+    } else {
+        error = get_sg_status(&sg_hdr);
+    }
+
+    if (session->is_open == False) {
+        close(sg_fd);
+    }
+
+    if (sg_error >= 0) {
+        ++session->indirect_io;
+    }
+
+    OPTCL_TRACE_ARRAY_MSG("Sense bytes:", sense_buffer, sg_hdr.sb_len_wr);
+
+    if (SUCCEEDED(error) && sg_hdr.sb_len_wr > 0) {
+        optcl_sensedata_get_progress(sense_buffer, sg_hdr.sb_len_wr, 
+                                     &session->progress, &session->progress_valid);
+
+        error = optcl_sensedata_get_code(sense_buffer,
+                                         sg_hdr.sb_len_wr, &sense_code);
+
+        if (SUCCEEDED(error)) {
+            error = sense_code;
+        }
+    }
+
+    return(error);
+}
+
+RESULT
+optcl_device_block_read(const optcl_device *device,
+                        uint32_t lba,
+                        const optcl_iovec iov[],
+                        uint32_t iov_count)
+{
+    RESULT error;
+
+    int block_fd;
+    ssize_t count;
+    uint32_t i;
+    size_t total_len;
+    struct iovec block_iov[MAX_IOVEC_COUNT];
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(iov != 0);
+
+    if (device == 0 || iov == 0) {
+        return(E_INVALIDARG);
+    }
 
-RESULT optcl_device_enumerate(optcl_list **devices)
+    if (iov_count == 0 || iov_count > MAX_IOVEC_COUNT) {
+        return(E_OUTOFRANGE);
+    }
+
+    error = check_system_transport(device);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (session->is_open == False || session->block_reads == False) {
+        return(E_DEVNOTOPEN);
+    }
+
+    total_len = 0;
+
+    for (i = 0; i < iov_count; ++i) {
+        block_iov[i].iov_base = iov[i].base;
+        block_iov[i].iov_len = iov[i].len;
+        total_len += iov[i].len;
+    }
+
+    block_fd = (int)(intptr_t)session->block_handle;
+
+    count = preadv(block_fd, block_iov, (int)iov_count, (off_t)lba * BLOCK_SECTOR_SIZE);
+
+    if (count < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    if ((size_t)count != total_len) {
+        return(E_DEVNOMOREDATA);
+    }
+
+    return(SUCCESS);
+}
+
+static RESULT
+system_submit(const optcl_device *device,
+              ptr_t context,
+              const uint8_t cdb[],
+              uint32_t cdb_size,
+              uint8_t param[],
+              uint32_t param_size,
+              uint32_t tag)
 {
-    int i;
     RESULT error;
-    RESULT destroy_error = SUCCESS;
-    DBusError dbus_error;
-    LibHalContext *hal_ctx = 0;
-    optcl_list *ndevices = 0;
-    DBusConnection *connection = 0;
 
-    assert(devices != 0);
+    int sg_fd;
+    int direction;
+    uint16_t backend;
+    uint32_t slot;
+    sg_io_hdr_t sg_hdr;
+    struct async_queue *queue = 0;
+    optcl_device_session *session = 0;
 
-    if (devices == 0) {
-        error = E_INVALIDARG;
-        goto error_exit;
+    assert(cdb != 0);
+    assert(device != 0);
+    assert(cdb_size > 0);
+    assert(cdb_size <= CDB_MAX_LENGTH);
+
+    if (cdb == 0 || device == 0 || cdb_size == 0 || cdb_size > CDB_MAX_LENGTH) {
+        return(E_INVALIDARG);
     }
 
-    dbus_error_init(&dbus_error);
+    error = optcl_command_get_data_direction(cdb, cdb_size, param_size, &direction);
+
+    if (FAILED(error)) {
+        return(error);
+    }
 
-    connection = dbus_bus_get(DBUS_BUS_SYSTEM, &dbus_error);
+    error = optcl_device_get_backend(device, &backend);
 
-    if (connection == 0) {
-        error = E_OUTOFMEMORY;
-        goto error_exit;
+    if (FAILED(error)) {
+        return(error);
     }
 
-    hal_ctx = libhal_ctx_new();
+    /* The bsg driver has no asynchronous or mapped transfer mode */
+    if (backend != DEVICE_BACKEND_SG) {
+        return(E_NOTIMPL);
+    }
 
-    if (hal_ctx == 0) {
-        error = E_OUTOFMEMORY;
-        goto error_exit;
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
     }
 
-    if (!libhal_ctx_set_dbus_connection(hal_ctx, connection)) {
-        error = E_OUTOFMEMORY;
-        goto error_exit;
+    if (session->is_open == False) {
+        return(E_DEVNOTOPEN);
     }
 
-    if (!libhal_ctx_init(hal_ctx, &dbus_error)) {
-        error = E_OUTOFMEMORY;
-        goto error_exit;
+    if (session->queue == 0) {
+        session->queue = (ptr_t)malloc(sizeof(struct async_queue));
+
+        if (session->queue == 0) {
+            return(E_OUTOFMEMORY);
+        }
+
+        memset(session->queue, 0, sizeof(struct async_queue));
     }
 
-    error = optcl_list_create(0, &ndevices);
+    queue = (struct async_queue*)session->queue;
 
-    if (FAILED(error)) {
-        goto error_exit;
+    for (slot = 0; slot < ASYNC_QUEUE_DEPTH; ++slot) {
+        if (queue->slots[slot].busy == False) {
+            break;
+        }
     }
 
-    for (i = 0; i < sizeof(__storage_types) / sizeof(__storage_types[0]); ++i) {
-        error = append_enumerated_drive(hal_ctx,
-                                        __storage_types[i], ndevices);
+    if (slot == ASYNC_QUEUE_DEPTH) {
+        return(E_DEVQUEUEFULL);
+    }
 
-        if (FAILED(error)) {
+    memset(&sg_hdr, 0, sizeof(sg_hdr));
+    memset(queue->slots[slot].sense_buffer, 0, SPT_SENSE_LENGTH);
+
+    /* The driver copies the CDB when the command is written */
+    sg_hdr.interface_id = 'S';
+    sg_hdr.cmd_len = (uint8_t)cdb_size;
+    sg_hdr.cmdp = (unsigned char*)cdb;
+    sg_hdr.mx_sb_len = SPT_SENSE_LENGTH;
+    sg_hdr.sbp = queue->slots[slot].sense_buffer;
+    sg_hdr.dxfer_len = param_size;
+    sg_hdr.dxferp = param;
+    sg_hdr.timeout = SCSI_COMMAND_TIMEOUT;
+    sg_hdr.pack_id = (int)slot;
+
+    switch(direction) {
+        case MMC_DATA_DIRECTION_IN:
+            sg_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+            sg_hdr.flags = SG_FLAG_DIRECT_IO;
+            break;
+        case MMC_DATA_DIRECTION_OUT:
+            sg_hdr.dxfer_direction = SG_DXFER_TO_DEV;
+            sg_hdr.flags = SG_FLAG_DIRECT_IO;
             break;
+        default:
+            sg_hdr.dxfer_direction = SG_DXFER_NONE;
+            sg_hdr.dxfer_len = 0;
+            sg_hdr.dxferp = 0;
+            break;
+    }
+
+    OPTCL_TRACE_ARRAY_MSG("Submitted CDB bytes:", cdb, cdb_size);
+
+    sg_fd = (int)(intptr_t)session->handle;
+
+    if (write(sg_fd, &sg_hdr, sizeof(sg_hdr)) < 0) {
+        OPTCL_TRACE_ARRAY_MSG("write(sg) error code:", (uint8_t*)&errno, sizeof(errno));
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    queue->slots[slot].busy = True;
+    queue->slots[slot].tag = tag;
+    queue->slots[slot].direction = direction;
+
+    ++session->commands;
+    ++session->pending;
+
+    return(SUCCESS);
+}
+
+static RESULT
+system_complete(const optcl_device *device,
+                ptr_t context,
+                uint32_t *tag,
+                RESULT *status)
+{
+    RESULT error;
+    RESULT sense_code;
+
+    int sg_fd;
+    sg_io_hdr_t sg_hdr;
+    struct async_slot *slot = 0;
+    struct async_queue *queue = 0;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(tag != 0);
+    assert(status != 0);
+
+    if (device == 0 || tag == 0 || status == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (session->is_open == False) {
+        return(E_DEVNOTOPEN);
+    }
+
+    if (session->pending == 0 || session->queue == 0) {
+        return(E_DEVNOMOREITEMS);
+    }
+
+    queue = (struct async_queue*)session->queue;
+
+    memset(&sg_hdr, 0, sizeof(sg_hdr));
+
+    /* Take whichever command completes first */
+    sg_hdr.interface_id = 'S';
+    sg_hdr.pack_id = -1;
+
+    sg_fd = (int)(intptr_t)session->handle;
+
+    if (read(sg_fd, &sg_hdr, sizeof(sg_hdr)) < 0) {
+        OPTCL_TRACE_ARRAY_MSG("read(sg) error code:", (uint8_t*)&errno, sizeof(errno));
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    if (sg_hdr.pack_id < 0 || sg_hdr.pack_id >= (int)ASYNC_QUEUE_DEPTH) {
+        return(E_UNEXPECTED);
+    }
+
+    slot = &queue->slots[sg_hdr.pack_id];
+
+    assert(slot->busy == True);
+
+    if (slot->busy == False) {
+        return(E_UNEXPECTED);
+    }
+
+    if (slot->direction != MMC_DATA_DIRECTION_NONE) {
+        if ((sg_hdr.info & SG_INFO_DIRECT_IO_MASK) == SG_INFO_DIRECT_IO) {
+            ++session->direct_io;
+        } else {
+            ++session->indirect_io;
         }
     }
 
-error_exit:
+    OPTCL_TRACE_ARRAY_MSG("Sense bytes:", slot->sense_buffer, sg_hdr.sb_len_wr);
 
-    if (SUCCEEDED(error)) {
-        *devices = ndevices;
-    } else {
-        destroy_error = destroy_devices_list(ndevices);
+    *status = get_sg_status(&sg_hdr);
+
+    if (SUCCEEDED(*status) && sg_hdr.sb_len_wr > 0) {
+        error = optcl_sensedata_get_code(slot->sense_buffer,
+                                         sg_hdr.sb_len_wr, &sense_code);
+
+        *status = SUCCEEDED(error) ? sense_code : error;
+    }
+
+    *tag = slot->tag;
+
+    slot->busy = False;
+
+    --session->pending;
+
+    return(SUCCESS);
+}
+
+static RESULT
+system_poll(const optcl_device *device,
+            ptr_t context,
+            int32_t timeout,
+            bool_t *ready)
+{
+    RESULT error;
+
+    int count;
+    struct pollfd pfd;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(ready != 0);
+
+    if (device == 0 || ready == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
     }
 
-    if (hal_ctx != 0) {
-        libhal_ctx_shutdown(hal_ctx, &dbus_error);
-        libhal_ctx_free(hal_ctx);
+    if (session->is_open == False) {
+        return(E_DEVNOTOPEN);
     }
 
-    LIBHAL_FREE_DBUS_ERROR(&dbus_error);
+    *ready = False;
 
-    return(SUCCEEDED(destroy_error) ? error : destroy_error);
+    if (session->pending == 0) {
+        return(SUCCESS);
+    }
+
+    pfd.fd = (int)(intptr_t)session->handle;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    count = poll(&pfd, 1, (int)timeout);
+
+    if (count < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    *ready = (count > 0 && (pfd.revents & POLLIN) != 0) ? True : False;
+
+    return(SUCCESS);
 }
 
 RESULT
-optcl_device_command_execute(const optcl_device *device,
-                             const uint8_t cdb[], uint32_t cdb_size, uint8_t param[], uint32_t param_size)
+optcl_device_set_mmap_io(optcl_device *device, bool_t enable)
+{
+    RESULT error;
+
+    int sg_fd;
+    int reserved_size;
+    void *view;
+    uint16_t backend;
+    optcl_device_session *session = 0;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+
+    if (device == 0) {
+        return(E_INVALIDARG);
+    }
+
+    error = check_system_transport(device);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    error = optcl_device_get_backend(device, &backend);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    /* The bsg driver has no asynchronous or mapped transfer mode */
+    if (backend != DEVICE_BACKEND_SG) {
+        return(E_NOTIMPL);
+    }
+
+    error = optcl_device_get_session(device, &session);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    if (session->is_open == False) {
+        return(E_DEVNOTOPEN);
+    }
+
+    if (enable == False) {
+        if (session->mmap_view != 0) {
+            munmap(session->mmap_view, session->mmap_size);
+        }
+
+        session->mmap_view = 0;
+        session->mmap_size = 0;
+
+        return(SUCCESS);
+    }
+
+    if (session->mmap_view != 0) {
+        return(SUCCESS);
+    }
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+
+    if (FAILED(error)) {
+        return(error);
+    }
+
+    sg_fd = (int)(intptr_t)session->handle;
+
+    /*
+     * The driver may round the reserved buffer size or cap it,
+     * map whatever it actually reserved.
+     */
+    reserved_size = (int)limits.max_transfer_len;
+
+    if (ioctl(sg_fd, SG_SET_RESERVED_SIZE, &reserved_size) < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    if (ioctl(sg_fd, SG_GET_RESERVED_SIZE, &reserved_size) < 0) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    if (reserved_size <= 0) {
+        return(E_DEVINVALIDSIZE);
+    }
+
+    view = mmap(0, (size_t)reserved_size, PROT_READ, MAP_SHARED, sg_fd, 0);
+
+    if (view == MAP_FAILED) {
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    }
+
+    session->mmap_view = (ptr_t)view;
+    session->mmap_size = (uint32_t)reserved_size;
+
+    return(SUCCESS);
+}
+
+static RESULT
+system_execute_mapped(const optcl_device *device,
+                      ptr_t context,
+                      const uint8_t cdb[],
+                      uint32_t cdb_size,
+                      uint32_t transfer_size,
+                      const uint8_t **view)
 {
     RESULT error;
     RESULT sense_code;
 
     int sg_fd;
     int sg_error;
-    char *path = 0;
     sg_io_hdr_t sg_hdr;
     uint8_t command[CDB_MAX_LENGTH];
     uint8_t sense_buffer[SPT_SENSE_LENGTH];
+    optcl_device_session *session = 0;
 
     assert(cdb != 0);
     assert(device != 0);
+    assert(view != 0);
     assert(cdb_size > 0);
     assert(cdb_size <= sizeof(command));
 
-    if (cdb == 0 || device == 0 || cdb_size == 0 || cdb_size > sizeof(command)) {
+    if (cdb == 0 || device == 0 || view == 0 || cdb_size == 0 || cdb_size > sizeof(command)) {
         return(E_INVALIDARG);
     }
 
-    error = optcl_device_get_path(device, &path);
+    error = optcl_device_get_session(device, &session);
 
     if (FAILED(error)) {
         return(error);
     }
 
-    sg_fd = open(path, O_RDWR | O_EXCL);
+    if (session->is_open == False) {
+        return(E_DEVNOTOPEN);
+    }
 
-    free(path);
+    if (session->mmap_view == 0) {
+        return(E_DEVNOTMAPPED);
+    }
 
-    if (sg_fd < 0) {
-        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
+    if (transfer_size > session->mmap_size) {
+        return(E_DEVINVALIDSIZE);
     }
 
+    ++session->commands;
+    ++session->opens_saved;
+
     memset(&sg_hdr, 0, sizeof(sg_hdr));
     memset(sense_buffer, 0, sizeof(sense_buffer));
     xmemcpy(command, sizeof(command), cdb, cdb_size);
 
+    /*
+     * Data lands in the reserved buffer, no user pages are involved.
+     * Indirect commands use the same buffer, so the view only holds
+     * until the next command on the device.
+     */
     sg_hdr.interface_id = 'S';
-    sg_hdr.dxfer_direction = SG_DXFER_TO_FROM_DEV;
     sg_hdr.cmd_len = (uint8_t)cdb_size;
     sg_hdr.mx_sb_len = sizeof(sense_buffer);
-    sg_hdr.dxfer_len = param_size;
-    sg_hdr.dxferp = param;
+    sg_hdr.dxfer_direction = SG_DXFER_FROM_DEV;
+    sg_hdr.dxfer_len = transfer_size;
+    sg_hdr.dxferp = 0;
     sg_hdr.cmdp = command;
     sg_hdr.sbp = sense_buffer;
-    sg_hdr.flags = SG_FLAG_DIRECT_IO;
+    sg_hdr.flags = SG_FLAG_MMAP_IO;
     sg_hdr.timeout = SCSI_COMMAND_TIMEOUT;
 
     OPTCL_TRACE_ARRAY_MSG("CDB bytes:", cdb, cdb_size);
-    OPTCL_TRACE_ARRAY_MSG("CDB parameter bytes:", param, param_size);
 
+    sg_fd = (int)(intptr_t)session->handle;
     sg_error = ioctl(sg_fd, SG_IO, &sg_hdr);
 
-    close(sg_fd);
-
     if (sg_error < 0) {
         OPTCL_TRACE_ARRAY_MSG("ioctl(SG_IO) error code:", (uint8_t*)&errno, sizeof(errno));
-        error = MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno);
+        return(MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, errno));
     }
 
-    OPTCL_TRACE_ARRAY_MSG("Device response bytes:", param, sg_hdr.dxfer_len);
     OPTCL_TRACE_ARRAY_MSG("Sense bytes:", sense_buffer, sg_hdr.sb_len_wr);
 
+    error = get_sg_status(&sg_hdr);
+
     if (SUCCEEDED(error) && sg_hdr.sb_len_wr > 0) {
         error = optcl_sensedata_get_code(sense_buffer,
                                          sg_hdr.sb_len_wr, &sense_code);
@@ -578,5 +3585,53 @@ optcl_device_command_execute(const optcl_device *device,
         }
     }
 
+    if (SUCCEEDED(error)) {
+        *view = session->mmap_view;
+    }
+
     return(error);
 }
+
+static RESULT
+system_query_limits(const optcl_device *device,
+                    ptr_t context,
+                    optcl_transfer_limits *limits)
+{
+    assert(device != 0);
+    assert(limits != 0);
+
+    if (device == 0 || limits == 0) {
+        return(E_INVALIDARG);
+    }
+
+    return(query_transfer_limits(device, 
+                                 &limits->alignment_mask, 
+                                 &limits->max_physical_pages, 
+                                 &limits->max_transfer_len));
+}
+
+static const optcl_transport __system_transport = {
+    "sg",
+    system_open,
+    system_close,
+    system_execute,
+    system_execute_vectored,
+    system_submit,
+    system_complete,
+    system_poll,
+    system_query_limits,
+    system_execute_mapped
+};
+
+RESULT optcl_device_get_system_transport(const optcl_transport **transport)
+{
+    assert(transport != 0);
+
+    if (transport == 0) {
+        return(E_INVALIDARG);
+    }
+
+    *transport = &__system_transport;
+
+    return(SUCCESS);
+}
@@ -24,6 +24,8 @@
 #include <malloc.h>
 #include <memory.h>
 #include <string.h>
+#include <windows.h>
+#include <winioctl.h>
 
 
 /*
@@ -88,3 +90,272 @@ errno_t xmemcpy(void *dest, size_t dest_size, const void *src, size_t count)
     assert(err == 0);
     return(err);
 }
+
+/*
+ * Time routines
+ */
+
+uint64_t xtime_usec(void)
+{
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+
+    QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)counter.QuadPart * 1000000 / (uint64_t)frequency.QuadPart;
+}
+
+void xsleep_usec(uint32_t usec)
+{
+    Sleep((usec + 999) / 1000);
+}
+
+/*
+ * File mapping routines
+ */
+
+errno_t xmap_file(const char *filename, bool_t writable, xfile_map *map)
+{
+    HANDLE hFile;
+    HANDLE hMapping = NULL;
+    LPVOID view = NULL;
+    LARGE_INTEGER size;
+    DWORD dwErrorCode;
+    DWORD dwBytesReturned;
+
+    assert(filename != 0);
+    assert(map != 0);
+    if (filename == 0 || map == 0)
+        return(EINVAL);
+
+    memset(map, 0, sizeof(xfile_map));
+
+    hFile = CreateFileA(filename, 
+        (writable == True) ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+        FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+        return(ENOENT);
+
+    if (GetFileSizeEx(hFile, &size) == FALSE) {
+        CloseHandle(hFile);
+        return(EIO);
+    }
+
+    /* Zero ranges of sparse files take no space, see xpunch_file */
+    if (writable == True) {
+        DeviceIoControl(hFile, FSCTL_SET_SPARSE, NULL, 0, NULL, 0, 
+            &dwBytesReturned, NULL);
+    }
+
+    if (size.QuadPart > 0) {
+        hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (hMapping != NULL)
+            view = MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+
+        if (view == NULL) {
+            dwErrorCode = GetLastError();
+            if (hMapping != NULL)
+                CloseHandle(hMapping);
+
+            CloseHandle(hFile);
+            return((dwErrorCode == ERROR_NOT_ENOUGH_MEMORY) ? ENOMEM : EIO);
+        }
+    }
+
+    map->view = (ptr_t)view;
+    map->size = (uint64_t)size.QuadPart;
+    map->handle = (ptr_t)hFile;
+    map->mapping = (ptr_t)hMapping;
+    return(0);
+}
+
+void xunmap_file(xfile_map *map)
+{
+    assert(map != 0);
+    if (map == 0)
+        return;
+
+    if (map->view != 0)
+        UnmapViewOfFile(map->view);
+
+    if (map->mapping != 0)
+        CloseHandle((HANDLE)map->mapping);
+
+    if (map->handle != 0)
+        CloseHandle((HANDLE)map->handle);
+
+    memset(map, 0, sizeof(xfile_map));
+}
+
+errno_t xpwrite_file(const xfile_map *map, 
+                     const void *data, 
+                     size_t size, 
+                     uint64_t offset)
+{
+    DWORD written;
+    OVERLAPPED overlapped;
+
+    assert(map != 0);
+    assert(data != 0 || size == 0);
+    if (map == 0 || (data == 0 && size > 0))
+        return(EINVAL);
+
+    while (size > 0) {
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset = (DWORD)offset;
+        overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+        if (WriteFile((HANDLE)map->handle, data, 
+            (size > 0x40000000) ? 0x40000000 : (DWORD)size, 
+            &written, &overlapped) == FALSE || written == 0)
+            return(EIO);
+
+        data = (const uint8_t*)data + written;
+        size -= written;
+        offset += written;
+    }
+
+    return(0);
+}
+
+errno_t xpunch_file(const xfile_map *map, uint64_t offset, uint64_t size)
+{
+    DWORD dwBytesReturned;
+    FILE_ZERO_DATA_INFORMATION zero_data;
+
+    assert(map != 0);
+    if (map == 0)
+        return(EINVAL);
+
+    if (size == 0)
+        return(0);
+
+    /* Files that are not sparse get the zeros written */
+    zero_data.FileOffset.QuadPart = (LONGLONG)offset;
+    zero_data.BeyondFinalZero.QuadPart = (LONGLONG)(offset + size);
+
+    if (DeviceIoControl((HANDLE)map->handle, FSCTL_SET_ZERO_DATA, 
+        &zero_data, sizeof(zero_data), NULL, 0, &dwBytesReturned, 
+        NULL) == FALSE)
+        return(EIO);
+
+    return(0);
+}
+
+errno_t xfind_data(const xfile_map *map, 
+                   uint64_t offset, 
+                   uint64_t *data_start, 
+                   uint64_t *data_end)
+{
+    DWORD dwBytesReturned;
+    FILE_ALLOCATED_RANGE_BUFFER query;
+    FILE_ALLOCATED_RANGE_BUFFER range;
+
+    assert(map != 0);
+    assert(data_start != 0);
+    assert(data_end != 0);
+    if (map == 0 || data_start == 0 || data_end == 0)
+        return(EINVAL);
+
+    *data_start = map->size;
+    *data_end = map->size;
+
+    if (offset >= map->size)
+        return(0);
+
+    query.FileOffset.QuadPart = (LONGLONG)offset;
+    query.Length.QuadPart = (LONGLONG)(map->size - offset);
+
+    /* Only the first range is needed, more data is not an error */
+    if (DeviceIoControl((HANDLE)map->handle, FSCTL_QUERY_ALLOCATED_RANGES, 
+        &query, sizeof(query), &range, sizeof(range), &dwBytesReturned, 
+        NULL) == FALSE && GetLastError() != ERROR_MORE_DATA) {
+        /* Without range reporting the whole file is data */
+        *data_start = offset;
+        return(0);
+    }
+
+    if (dwBytesReturned < sizeof(range))
+        return(0);
+
+    *data_start = (uint64_t)range.FileOffset.QuadPart;
+    *data_end = *data_start + (uint64_t)range.Length.QuadPart;
+
+    if (*data_start < offset)
+        *data_start = offset;
+
+    if (*data_end > map->size)
+        *data_end = map->size;
+
+    return(0);
+}
+
+/*
+ * Thread routines
+ */
+
+/* Thread started by xthread_create */
+typedef struct tag_xthread {
+    HANDLE hThread;
+    xthread_proc proc;
+    void *arg;
+} xthread;
+
+static DWORD WINAPI thread_start(LPVOID lpParameter)
+{
+    xthread *thread = (xthread*)lpParameter;
+
+    thread->proc(thread->arg);
+    return(0);
+}
+
+errno_t xthread_create(xthread_proc proc, void *arg, ptr_t *thread)
+{
+    xthread *nthread;
+
+    assert(proc != 0);
+    assert(thread != 0);
+    if (proc == 0 || thread == 0)
+        return(EINVAL);
+
+    nthread = (xthread*)malloc(sizeof(xthread));
+    if (nthread == 0)
+        return(ENOMEM);
+
+    nthread->proc = proc;
+    nthread->arg = arg;
+    nthread->hThread = CreateThread(NULL, 0, thread_start, nthread, 0, NULL);
+
+    if (nthread->hThread == NULL) {
+        free(nthread);
+        return(EAGAIN);
+    }
+
+    *thread = (ptr_t)nthread;
+    return(0);
+}
+
+errno_t xthread_join(ptr_t thread)
+{
+    DWORD dwResult;
+    xthread *nthread = (xthread*)thread;
+
+    assert(nthread != 0);
+    if (nthread == 0)
+        return(EINVAL);
+
+    dwResult = WaitForSingleObject(nthread->hThread, INFINITE);
+    CloseHandle(nthread->hThread);
+    free(nthread);
+
+    return((dwResult == WAIT_OBJECT_0) ? 0 : EIO);
+}
+
+uint32_t xcpu_count(void)
+{
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return((info.dwNumberOfProcessors > 0) ? info.dwNumberOfProcessors : 1);
+}
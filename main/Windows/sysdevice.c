@@ -516,45 +516,182 @@ RESULT optcl_device_enumerate(optcl_list **devices)
     return SUCCEEDED(destroy_error) ? error : destroy_error;
 }
 
-RESULT optcl_device_command_execute(const optcl_device *device,
-                                    const uint8_t cdb[],
-                                    uint32_t cdb_size,
-                                    uint8_t param[],
-                                    uint32_t param_size)
+/* The enumeration cache is not used here, every drive is probed */
+RESULT optcl_device_enumerate_cached(const char *cache_file, optcl_list **devices)
 {
-    RESULT error;
-    RESULT sense_code;
+    return optcl_device_enumerate(devices);
+}
 
-    DWORD bytes;
-    BOOL success;
+/* Device arrival notifications are not hooked up, there is no monitor */
+RESULT optcl_device_monitor_create(optcl_list *devices,
+                                   optcl_device_monitorfn callback,
+                                   ptr_t context,
+                                   optcl_device_monitor **monitor)
+{
+    assert(devices != 0);
+    assert(monitor != 0);
+    if (devices == 0 || monitor == 0)
+        return E_INVALIDARG;
+
+    return E_NOTIMPL;
+}
+
+RESULT optcl_device_monitor_destroy(optcl_device_monitor *monitor)
+{
+    assert(monitor != 0);
+    if (monitor == 0)
+        return E_INVALIDARG;
+
+    return E_NOTIMPL;
+}
+
+RESULT optcl_device_monitor_get_fd(const optcl_device_monitor *monitor, int *fd)
+{
+    assert(monitor != 0);
+    assert(fd != 0);
+    if (monitor == 0 || fd == 0)
+        return E_INVALIDARG;
+
+    return E_NOTIMPL;
+}
+
+RESULT optcl_device_monitor_dispatch(optcl_device_monitor *monitor, 
+                                     uint32_t *timeout)
+{
+    assert(monitor != 0);
+    assert(timeout != 0);
+    if (monitor == 0 || timeout == 0)
+        return E_INVALIDARG;
+
+    return E_NOTIMPL;
+}
+
+static RESULT system_open(optcl_device *device, ptr_t context)
+{
+    RESULT error;
     HANDLE hDevice;
     char *path = 0;
-    DWORD dwErrorCode;
-    SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER sptdwb;
+    optcl_device_session *session = 0;
 
-    assert(cdb != 0);
     assert(device != 0);
-    assert(cdb_size > 0);
-    if (cdb == 0 || device == 0 || cdb_size == 0)
+    if (device == 0)
         return E_INVALIDARG;
 
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->is_open == True)
+        return SUCCESS;
+
     error = optcl_device_get_path(device, &path);
     if (FAILED(error))
         return error;
 
+    if (path == 0)
+        return E_DEVINVALIDPATH;
+
     hDevice = CreateFileA(
                   path,                                 /* device interface name */
                   GENERIC_READ | GENERIC_WRITE,         /* dwDesiredAccess */
-                  FILE_SHARE_READ | FILE_SHARE_WRITE,   /* dwShareMode */
+                  0,                                    /* dwShareMode (exclusive) */
                   NULL,                                 /* lpSecurityAttributes */
                   OPEN_EXISTING,                        /* dwCreationDistribution */
                   0,                                    /* dwFlagsAndAttributes */
                   NULL);                                /* hTemplateFile */
 
     free(path);
-    if (hDevice == NULL)
+    if (hDevice == INVALID_HANDLE_VALUE)
+        return MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, GetLastError());
+
+    session->handle = (ptr_t)hDevice;
+    session->is_open = True;
+    ++session->opens;
+    return SUCCESS;
+}
+
+static RESULT system_close(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+    HANDLE hDevice;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->is_open == False)
+        return SUCCESS;
+
+    hDevice = (HANDLE)session->handle;
+    session->handle = 0;
+    session->is_open = False;
+    if (CloseHandle(hDevice) == FALSE)
         return MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, GetLastError());
 
+    return SUCCESS;
+}
+
+static RESULT system_execute(const optcl_device *device,
+                             ptr_t context,
+                             const uint8_t cdb[],
+                             uint32_t cdb_size,
+                             uint8_t param[],
+                             uint32_t param_size)
+{
+    RESULT error;
+    RESULT sense_code;
+
+    DWORD bytes;
+    BOOL success;
+    HANDLE hDevice;
+    const char *path = 0;
+    DWORD dwErrorCode;
+    optcl_device_session *session = 0;
+    SCSI_PASS_THROUGH_DIRECT_WITH_BUFFER sptdwb;
+
+    assert(cdb != 0);
+    assert(device != 0);
+    assert(cdb_size > 0);
+    if (cdb == 0 || device == 0 || cdb_size == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->is_open == True) {
+        hDevice = (HANDLE)session->handle;
+        ++session->opens_saved;
+    } else {
+        error = optcl_device_get_path_ref(device, &path);
+        if (FAILED(error))
+            return error;
+
+        if (path == 0)
+            return E_DEVINVALIDPATH;
+
+        hDevice = CreateFileA(
+                      path,                                 /* device interface name */
+                      GENERIC_READ | GENERIC_WRITE,         /* dwDesiredAccess */
+                      FILE_SHARE_READ | FILE_SHARE_WRITE,   /* dwShareMode */
+                      NULL,                                 /* lpSecurityAttributes */
+                      OPEN_EXISTING,                        /* dwCreationDistribution */
+                      0,                                    /* dwFlagsAndAttributes */
+                      NULL);                                /* hTemplateFile */
+
+        if (hDevice == INVALID_HANDLE_VALUE)
+            return MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, GetLastError());
+
+        ++session->opens;
+    }
+
+    ++session->commands;
+
     memset(&sptdwb, 0, sizeof(sptdwb));
     memcpy(sptdwb.sptd.Cdb, cdb, cdb_size);
     sptdwb.sptd.CdbLength = (UCHAR)cdb_size;
@@ -572,8 +709,10 @@ RESULT optcl_device_command_execute(const optcl_device *device,
     /* Execute command */
     success = DeviceIoControl(hDevice, IOCTL_SCSI_PASS_THROUGH_DIRECT, &sptdwb,
         sizeof(sptdwb), &sptdwb, sizeof(sptdwb), &bytes, FALSE);
-    CloseHandle(hDevice);
     dwErrorCode = GetLastError();
+    if (session->is_open == False)
+        CloseHandle(hDevice);
+
     if (success == FALSE && dwErrorCode != ERROR_INSUFFICIENT_BUFFER) {
         OPTCL_TRACE_ARRAY_MSG("DeviceIoControl error code:", 
             (uint8_t*)&dwErrorCode, sizeof(dwErrorCode));
@@ -590,6 +729,10 @@ RESULT optcl_device_command_execute(const optcl_device *device,
         return error;
 
     if (sptdwb.sptd.SenseInfoLength > 0) {
+        optcl_sensedata_get_progress(sptdwb.ucSenseBuf, 
+            sptdwb.sptd.SenseInfoLength, &session->progress, 
+            &session->progress_valid);
+
         error = optcl_sensedata_get_code(sptdwb.ucSenseBuf, 
             sptdwb.sptd.SenseInfoLength, &sense_code);
         if (SUCCEEDED(error))
@@ -598,3 +741,54 @@ RESULT optcl_device_command_execute(const optcl_device *device,
 
     return error;
 }
+
+RESULT optcl_device_block_read(const optcl_device *device,
+                               uint32_t lba,
+                               const optcl_iovec iov[],
+                               uint32_t iov_count)
+{
+    assert(device != 0);
+    assert(iov != 0);
+    if (device == 0 || iov == 0)
+        return E_INVALIDARG;
+
+    /* Block device reads are not set up on this platform */
+    return E_NOTIMPL;
+}
+
+RESULT optcl_device_set_mmap_io(optcl_device *device, bool_t enable)
+{
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    /* Pass through requests can not use a mapped driver buffer */
+    return E_NOTIMPL;
+}
+
+/*
+ * Overlapped, vectored and mapped pass through requests are not
+ * supported yet, the dispatcher reports them as not implemented.
+ */
+static const optcl_transport __system_transport = {
+    "spti",
+    system_open,
+    system_close,
+    system_execute,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0
+};
+
+RESULT optcl_device_get_system_transport(const optcl_transport **transport)
+{
+    assert(transport != 0);
+    if (transport == 0)
+        return E_INVALIDARG;
+
+    *transport = &__system_transport;
+    return SUCCESS;
+}
@@ -32,8 +32,27 @@ struct tag_adapter {
     uint32_t max_transfer_len;
     uint32_t max_physical_pages;
     uint32_t alignment_mask;
+    uint32_t read_chunk_size;
+    uint32_t write_chunk_size;
 };
 
+/*
+ * Helper functions
+ */
+
+static uint32_t get_default_chunk_size(const optcl_adapter *adapter)
+{
+    assert(adapter);
+
+    /* USB bridges usually stall on transfers near the limit */
+    if (adapter->bus_type == ADAPTER_BUSTYPE_USB 
+        && (adapter->max_transfer_len == 0 
+        || adapter->max_transfer_len > ADAPTER_USB_CHUNK_SIZE))
+        return ADAPTER_USB_CHUNK_SIZE;
+
+    return adapter->max_transfer_len;
+}
+
 /*
  * Adapter functions
  */
@@ -106,6 +125,49 @@ RESULT optcl_adapter_get_max_transfer_len(const optcl_adapter *adapter,
     return SUCCESS;
 }
 
+RESULT optcl_adapter_get_read_chunk_size(const optcl_adapter *adapter,
+                                         uint32_t *chunk_size)
+{
+    assert(adapter);
+    assert(chunk_size);
+    if (adapter == 0 || chunk_size == 0)
+        return E_INVALIDARG;
+
+    *chunk_size = (adapter->read_chunk_size > 0) 
+        ? adapter->read_chunk_size : get_default_chunk_size(adapter);
+
+    return SUCCESS;
+}
+
+RESULT optcl_adapter_get_write_chunk_size(const optcl_adapter *adapter,
+                                          uint32_t *chunk_size)
+{
+    assert(adapter);
+    assert(chunk_size);
+    if (adapter == 0 || chunk_size == 0)
+        return E_INVALIDARG;
+
+    *chunk_size = (adapter->write_chunk_size > 0) 
+        ? adapter->write_chunk_size : get_default_chunk_size(adapter);
+
+    return SUCCESS;
+}
+
+RESULT optcl_adapter_get_calibrated_chunk_sizes(const optcl_adapter *adapter,
+                                                uint32_t *read_chunk_size,
+                                                uint32_t *write_chunk_size)
+{
+    assert(adapter);
+    assert(read_chunk_size);
+    assert(write_chunk_size);
+    if (adapter == 0 || read_chunk_size == 0 || write_chunk_size == 0)
+        return E_INVALIDARG;
+
+    *read_chunk_size = adapter->read_chunk_size;
+    *write_chunk_size = adapter->write_chunk_size;
+    return SUCCESS;
+}
+
 RESULT optcl_adapter_get_max_physical_pages(const optcl_adapter *adapter,
                                             uint32_t *max_physical_pages)
 {
@@ -151,6 +213,28 @@ RESULT optcl_adapter_set_max_transfer_length(optcl_adapter *adapter,
     return SUCCESS;
 }
 
+RESULT optcl_adapter_set_read_chunk_size(optcl_adapter *adapter,
+                                         uint32_t chunk_size)
+{
+    assert(adapter);
+    if (adapter == 0)
+        return E_INVALIDARG;
+
+    adapter->read_chunk_size = chunk_size;
+    return SUCCESS;
+}
+
+RESULT optcl_adapter_set_write_chunk_size(optcl_adapter *adapter,
+                                          uint32_t chunk_size)
+{
+    assert(adapter);
+    if (adapter == 0)
+        return E_INVALIDARG;
+
+    adapter->write_chunk_size = chunk_size;
+    return SUCCESS;
+}
+
 RESULT optcl_adapter_set_max_physical_pages(optcl_adapter *adapter,
                                             uint32_t max_physical_pages)
 {
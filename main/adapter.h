@@ -36,6 +36,9 @@
 #define ADAPTER_BUSTYPE_USB		    0x07
 #define ADAPTER_BUSTYPE_RAID		0x08
 
+/* Chunk size used on USB bridges that were not calibrated */
+#define ADAPTER_USB_CHUNK_SIZE		0x10000
+
 
 struct tag_adapter;
 typedef struct tag_adapter optcl_adapter;
@@ -66,6 +69,25 @@ extern
 RESULT optcl_adapter_get_max_transfer_len(const optcl_adapter *adapter,
                                           uint32_t *max_transfer_len);
 
+/* 
+ * Get read chunk size, adapters that were not calibrated get a
+ * default for their bus type
+ */
+extern 
+RESULT optcl_adapter_get_read_chunk_size(const optcl_adapter *adapter,
+                                         uint32_t *chunk_size);
+
+/* Get write chunk size, defaults like the read chunk size */
+extern 
+RESULT optcl_adapter_get_write_chunk_size(const optcl_adapter *adapter,
+                                          uint32_t *chunk_size);
+
+/* Get calibrated chunk sizes, zero for sizes left at the default */
+extern 
+RESULT optcl_adapter_get_calibrated_chunk_sizes(const optcl_adapter *adapter,
+                                                uint32_t *read_chunk_size,
+                                                uint32_t *write_chunk_size);
+
 /* Get maximum physical pages */
 extern 
 RESULT optcl_adapter_get_max_physical_pages(const optcl_adapter *adapter,
@@ -85,6 +107,16 @@ extern
 RESULT optcl_adapter_set_max_transfer_length(optcl_adapter *adapter, 
                                              uint32_t max_transfer_len);
 
+/* Set calibrated read chunk size, zero restores the default */
+extern 
+RESULT optcl_adapter_set_read_chunk_size(optcl_adapter *adapter,
+                                         uint32_t chunk_size);
+
+/* Set calibrated write chunk size, zero restores the default */
+extern 
+RESULT optcl_adapter_set_write_chunk_size(optcl_adapter *adapter,
+                                          uint32_t chunk_size);
+
 /* Set physical pages */
 extern 
 RESULT optcl_adapter_set_max_physical_pages(optcl_adapter *adapter,
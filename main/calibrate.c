@@ -0,0 +1,451 @@
+/*
+    calibrate.c - Transfer chunk size calibration
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "adapter.h"
+#include "calibrate.h"
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+#define CALIBRATE_BLOCK_SIZE		2048U
+#define CALIBRATE_MAX_BLOCKS		0xFFFFU	/* READ(10) and WRITE(10) limit */
+#define CALIBRATE_TOLERANCE		3U	/* Percent of the best rate */
+#define CALIBRATE_MAX_LINE		512
+#define CALIBRATE_TEMP_SUFFIX		".tmp"
+
+
+/*
+ * Helper functions
+ */
+
+static RESULT measure_rate(optcl_device *device,
+                           bool_t write,
+                           uint32_t lba,
+                           uint32_t blocks,
+                           uint32_t chunk_blocks,
+                           ptr_t buffer,
+                           uint32_t *rate)
+{
+    RESULT error;
+    uint32_t done;
+    uint32_t count;
+    uint64_t start;
+    uint64_t elapsed;
+    optcl_mmc_write write_command;
+    optcl_mmc_read_10 read_command;
+
+    assert(device != 0);
+    assert(buffer != 0);
+    assert(rate != 0);
+    assert(chunk_blocks > 0);
+
+    start = xtime_usec();
+
+    for (done = 0; done < blocks; done += count) {
+        count = (blocks - done < chunk_blocks) ? blocks - done : chunk_blocks;
+
+        if (write == True) {
+            memset(&write_command, 0, sizeof(write_command));
+            write_command.lba = lba + done;
+            write_command.transfer_len = (uint16_t)count;
+            error = optcl_command_write(device, &write_command, buffer,
+                count * CALIBRATE_BLOCK_SIZE);
+        } else {
+            memset(&read_command, 0, sizeof(read_command));
+            read_command.start_lba = lba + done;
+            read_command.transfer_length = (uint16_t)count;
+            error = optcl_command_read_10_direct(device, &read_command,
+                buffer, count * CALIBRATE_BLOCK_SIZE);
+        }
+
+        if (FAILED(error))
+            return error;
+    }
+
+    elapsed = xtime_usec() - start;
+    if (elapsed == 0)
+        elapsed = 1;
+
+    *rate = (uint32_t)((uint64_t)blocks * CALIBRATE_BLOCK_SIZE
+        * 1000000 / 1024 / elapsed);
+
+    return SUCCESS;
+}
+
+/* Smallest chunk size with a rate close to the best one */
+static uint32_t select_chunk_size(const uint32_t chunk_sizes[],
+                                  const uint32_t rates[],
+                                  uint32_t count)
+{
+    uint32_t i;
+    uint32_t best = 0;
+
+    for (i = 0; i < count; ++i) {
+        if (rates[i] > best)
+            best = rates[i];
+    }
+
+    for (i = 0; i < count; ++i) {
+        if ((uint64_t)rates[i] * 100
+            >= (uint64_t)best * (100 - CALIBRATE_TOLERANCE))
+            return chunk_sizes[i];
+    }
+
+    return 0;
+}
+
+static RESULT store_chunk_sizes(optcl_device *device,
+                                uint32_t read_chunk,
+                                uint32_t write_chunk)
+{
+    RESULT error;
+    optcl_adapter *adapter = 0;
+
+    assert(device != 0);
+
+    error = optcl_device_get_adapter(device, &adapter);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_adapter_set_read_chunk_size(adapter, read_chunk);
+    if (SUCCEEDED(error) && write_chunk > 0)
+        error = optcl_adapter_set_write_chunk_size(adapter, write_chunk);
+
+    if (SUCCEEDED(error))
+        error = optcl_device_set_adapter(device, adapter);
+
+    if (FAILED(error))
+        optcl_adapter_destroy(adapter);
+
+    return error;
+}
+
+/* Copy field into the key, tabs and line breaks separate fields */
+static void append_key_field(char *key, size_t key_size, const char *field)
+{
+    size_t i;
+    size_t length;
+
+    length = strlen(key);
+
+    if (field != 0) {
+        for (i = 0; field[i] != 0 && length + 2 < key_size; ++i) {
+            key[length++] = (field[i] == '\t' || field[i] == '\n'
+                || field[i] == '\r') ? ' ' : field[i];
+        }
+    }
+
+    key[length++] = '\t';
+    key[length] = 0;
+}
+
+/* Build entry key from device identification and bus type */
+static RESULT get_device_key(const optcl_device *device,
+                             char *key,
+                             size_t key_size)
+{
+    RESULT error;
+    uint32_t bus_type;
+    char number[16];
+    char *vendor = 0;
+    char *product = 0;
+    char *revision = 0;
+    const optcl_adapter *adapter = 0;
+
+    assert(device != 0);
+    assert(key != 0);
+
+    error = optcl_device_get_adapter_ref(device, &adapter);
+    if (SUCCEEDED(error))
+        error = optcl_adapter_get_bus_type(adapter, &bus_type);
+
+    if (SUCCEEDED(error))
+        error = optcl_device_get_vendor(device, &vendor);
+
+    if (SUCCEEDED(error))
+        error = optcl_device_get_product(device, &product);
+
+    if (SUCCEEDED(error))
+        error = optcl_device_get_revision(device, &revision);
+
+    if (SUCCEEDED(error)) {
+        key[0] = 0;
+        append_key_field(key, key_size, vendor);
+        append_key_field(key, key_size, product);
+        append_key_field(key, key_size, revision);
+        sprintf(number, "%u", (unsigned int)bus_type);
+        append_key_field(key, key_size, number);
+    }
+
+    free(vendor);
+    free(product);
+    free(revision);
+    return error;
+}
+
+
+/*
+ * Calibration functions
+ */
+
+RESULT optcl_calibrate_chunk_size(optcl_device *device,
+                                  const optcl_calibration_params *params,
+                                  optcl_calibration_result *result)
+{
+    RESULT error;
+    uint32_t i;
+    uint32_t chunk;
+    uint32_t max_chunk;
+    uint32_t warmup_blocks;
+    bool_t block_reads;
+    ptr_t buffer = 0;
+    optcl_transfer_limits limits;
+    optcl_calibration_result nresult;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(params != 0);
+    assert(result != 0);
+    if (device == 0 || params == 0 || result == 0 || params->blocks == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    max_chunk = limits.max_transfer_len;
+    if (max_chunk > CALIBRATE_MAX_BLOCKS * CALIBRATE_BLOCK_SIZE)
+        max_chunk = CALIBRATE_MAX_BLOCKS * CALIBRATE_BLOCK_SIZE;
+
+    max_chunk -= max_chunk % CALIBRATE_BLOCK_SIZE;
+    if (max_chunk == 0)
+        return E_DEVINVALIDSIZE;
+
+    memset(&nresult, 0, sizeof(nresult));
+
+    for (chunk = CALIBRATE_MIN_CHUNK;
+        chunk <= max_chunk && nresult.count < CALIBRATE_MAX_SIZES;
+        chunk *= 2)
+        nresult.chunk_sizes[nresult.count++] = chunk;
+
+    if (nresult.count < CALIBRATE_MAX_SIZES
+        && (nresult.count == 0
+        || nresult.chunk_sizes[nresult.count - 1] < max_chunk))
+        nresult.chunk_sizes[nresult.count++] = max_chunk;
+
+    error = optcl_device_alloc_buffer(device, max_chunk, &buffer);
+    if (FAILED(error))
+        return error;
+
+    /* Chunk sizes apply to SCSI commands, not to block device reads */
+    block_reads = session->block_reads;
+    session->block_reads = False;
+
+    /* Spin the drive up before anything is timed */
+    warmup_blocks = nresult.chunk_sizes[0] / CALIBRATE_BLOCK_SIZE;
+    error = measure_rate(device, False, params->read_lba, warmup_blocks,
+        warmup_blocks, buffer, &nresult.read_rates[0]);
+
+    for (i = 0; i < nresult.count && SUCCEEDED(error); ++i) {
+        error = measure_rate(device, False,
+            params->read_lba + warmup_blocks + i * params->blocks,
+            params->blocks, nresult.chunk_sizes[i] / CALIBRATE_BLOCK_SIZE,
+            buffer, &nresult.read_rates[i]);
+    }
+
+    if (SUCCEEDED(error) && (params->flags & CALIBRATE_FLAG_WRITE) != 0) {
+        memset(buffer, 0, max_chunk);
+
+        for (i = 0; i < nresult.count && SUCCEEDED(error); ++i) {
+            error = measure_rate(device, True,
+                params->write_lba + i * params->blocks, params->blocks,
+                nresult.chunk_sizes[i] / CALIBRATE_BLOCK_SIZE, buffer,
+                &nresult.write_rates[i]);
+        }
+
+        if (SUCCEEDED(error)) {
+            nresult.best_write = select_chunk_size(nresult.chunk_sizes,
+                nresult.write_rates, nresult.count);
+        }
+    }
+
+    session->block_reads = block_reads;
+    optcl_device_free_buffer(device, buffer);
+
+    if (FAILED(error))
+        return error;
+
+    nresult.best_read = select_chunk_size(nresult.chunk_sizes,
+        nresult.read_rates, nresult.count);
+
+    error = store_chunk_sizes(device, nresult.best_read, nresult.best_write);
+    if (FAILED(error))
+        return error;
+
+    memcpy(result, &nresult, sizeof(optcl_calibration_result));
+    return SUCCESS;
+}
+
+RESULT optcl_calibrate_load(optcl_device *device,
+                            const char *filename,
+                            bool_t *found)
+{
+    RESULT error;
+    FILE *file;
+    size_t key_len;
+    unsigned int read_chunk;
+    unsigned int write_chunk;
+    char key[CALIBRATE_MAX_LINE];
+    char line[CALIBRATE_MAX_LINE];
+
+    assert(device != 0);
+    assert(filename != 0);
+    assert(found != 0);
+    if (device == 0 || filename == 0 || found == 0)
+        return E_INVALIDARG;
+
+    *found = False;
+
+    error = get_device_key(device, key, sizeof(key));
+    if (FAILED(error))
+        return error;
+
+    file = fopen(filename, "r");
+    if (file == 0)
+        return SUCCESS;
+
+    key_len = strlen(key);
+
+    while (fgets(line, sizeof(line), file) != 0) {
+        if (strncmp(line, key, key_len) != 0)
+            continue;
+
+        if (sscanf(line + key_len, "%u\t%u", &read_chunk, &write_chunk) != 2)
+            continue;
+
+        error = store_chunk_sizes(device, read_chunk, write_chunk);
+        if (SUCCEEDED(error))
+            *found = True;
+
+        break;
+    }
+
+    fclose(file);
+    return error;
+}
+
+RESULT optcl_calibrate_save(const optcl_device *device, const char *filename)
+{
+    RESULT error;
+    int failed;
+    FILE *file;
+    FILE *temp;
+    size_t key_len;
+    char *temp_name;
+    uint32_t read_chunk;
+    uint32_t write_chunk;
+    char key[CALIBRATE_MAX_LINE];
+    char line[CALIBRATE_MAX_LINE];
+    const optcl_adapter *adapter = 0;
+
+    assert(device != 0);
+    assert(filename != 0);
+    if (device == 0 || filename == 0)
+        return E_INVALIDARG;
+
+    error = get_device_key(device, key, sizeof(key));
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_get_adapter_ref(device, &adapter);
+    if (SUCCEEDED(error)) {
+        error = optcl_adapter_get_calibrated_chunk_sizes(adapter,
+            &read_chunk, &write_chunk);
+    }
+
+    if (FAILED(error))
+        return error;
+
+    /* Bus defaults would stay frozen in the file */
+    if (read_chunk == 0 && write_chunk == 0)
+        return E_INVALIDARG;
+
+    temp_name = (char*)malloc(strlen(filename) + sizeof(CALIBRATE_TEMP_SUFFIX));
+    if (temp_name == 0)
+        return E_OUTOFMEMORY;
+
+    strcpy(temp_name, filename);
+    strcat(temp_name, CALIBRATE_TEMP_SUFFIX);
+
+    temp = fopen(temp_name, "w");
+    if (temp == 0) {
+        free(temp_name);
+        return E_DEVINVALIDPATH;
+    }
+
+    /* Keep entries of other drives */
+    key_len = strlen(key);
+    failed = 0;
+    file = fopen(filename, "r");
+    if (file != 0) {
+        while (fgets(line, sizeof(line), file) != 0 && failed == 0) {
+            if (strncmp(line, key, key_len) != 0)
+                failed = (fputs(line, temp) < 0);
+        }
+
+        fclose(file);
+    }
+
+    if (failed == 0) {
+        failed = (fprintf(temp, "%s%u\t%u\n", key,
+            (unsigned int)read_chunk, (unsigned int)write_chunk) < 0);
+    }
+
+    failed |= (fclose(temp) != 0);
+
+    /* Rename does not replace existing files everywhere */
+    if (failed == 0 && rename(temp_name, filename) != 0) {
+        remove(filename);
+        failed = (rename(temp_name, filename) != 0);
+    }
+
+    if (failed != 0)
+        remove(temp_name);
+
+    free(temp_name);
+    return (failed == 0) ? SUCCESS : E_UNEXPECTED;
+}
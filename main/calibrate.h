@@ -0,0 +1,106 @@
+/*
+    calibrate.h - Transfer chunk size calibration
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _CALIBRATE_H
+#define _CALIBRATE_H
+
+#include "device.h"
+#include "errors.h"
+#include "types.h"
+
+
+/* Maximum number of chunk sizes measured */
+#define CALIBRATE_MAX_SIZES		16
+
+/* Smallest chunk size measured */
+#define CALIBRATE_MIN_CHUNK		0x4000
+
+/* Calibration flags */
+#define CALIBRATE_FLAG_WRITE		0x01	/* Also measure writes on scratch media */
+
+
+/*
+ * Calibration parameters
+ *
+ * Every chunk size transfers blocks logical blocks from its own area,
+ * so that drive caches do not favour the sizes measured later. Reads
+ * start at read_lba with one untimed chunk of the smallest size that
+ * spins the drive up, at most CALIBRATE_MIN_CHUNK bytes or 8 blocks.
+ * The timed reads follow it, so read_lba must have room for those
+ * warm-up blocks plus blocks times the number of chunk sizes. Writes
+ * start at write_lba, which needs room for blocks times the number
+ * of chunk sizes.
+ */
+typedef struct tag_calibration_params {
+    uint32_t flags;
+    uint32_t blocks;
+    uint32_t read_lba;
+    uint32_t write_lba;
+} optcl_calibration_params;
+
+/*
+ * Calibration result, rates are in kilobytes per second
+ */
+typedef struct tag_calibration_result {
+    uint32_t count;
+    uint32_t chunk_sizes[CALIBRATE_MAX_SIZES];
+    uint32_t read_rates[CALIBRATE_MAX_SIZES];
+    uint32_t write_rates[CALIBRATE_MAX_SIZES];
+    uint32_t best_read;         /* Best read chunk size in bytes */
+    uint32_t best_write;        /* Best write chunk size, zero if not measured */
+} optcl_calibration_result;
+
+
+/*
+ * Measure throughput at chunk sizes up to the adapter limit
+ *
+ * The smallest chunk size within a few percent of the best rate is
+ * stored in the device adapter. The device must be open. Reads are
+ * measured with SCSI commands even when plain reads go through the
+ * block device.
+ */
+extern 
+RESULT optcl_calibrate_chunk_size(optcl_device *device,
+                                  const optcl_calibration_params *params,
+                                  optcl_calibration_result *result);
+
+/*
+ * Load chunk sizes stored for the device into its adapter
+ *
+ * Entries are keyed by INQUIRY vendor, product and revision and by
+ * the adapter bus type. A missing file is not an error.
+ */
+extern 
+RESULT optcl_calibrate_load(optcl_device *device,
+                            const char *filename,
+                            bool_t *found);
+
+/*
+ * Store device adapter chunk sizes, replacing an older entry
+ *
+ * Only calibrated or loaded chunk sizes are stored, sizes left at the
+ * bus default are stored as zero. Adapters without any calibrated
+ * chunk size fail with E_INVALIDARG.
+ */
+extern 
+RESULT optcl_calibrate_save(const optcl_device *device, const char *filename);
+
+#endif /* _CALIBRATE_H */
@@ -0,0 +1,1715 @@
+/*
+    cdimage.c - Raw CD image device backend
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "cdimage.h"
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "feature.h"
+#include "helpers.h"
+#include "profile.h"
+#include "sensedata.h"
+#include "transport.h"
+#include "types.h"
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+#define CDIMAGE_INQUIRY_LEN		96U
+#define CDIMAGE_CONFIG_LEN		64U
+#define CDIMAGE_MAX_LINE		1024
+
+/* User data size of a block read with READ 10 and READ 12 */
+#define CDIMAGE_BLOCK_SIZE		2048U
+
+/* MSF address of LBA 0 */
+#define CDIMAGE_MSF_OFFSET		150U
+
+/* Smallest alignment xmalloc_aligned accepts, memory needs no more */
+#define CDIMAGE_ALIGNMENT		sizeof(ptr_t)
+
+#define CDIMAGE_VENDOR			"OPTCL   "
+#define CDIMAGE_PRODUCT			"CUE IMAGE       "
+#define CDIMAGE_REVISION		"1.00"
+
+/* Track types */
+#define CDIMAGE_TRACK_AUDIO		0
+#define CDIMAGE_TRACK_MODE1		1
+#define CDIMAGE_TRACK_MODE2		2
+
+/* Q sub-channel control bits set by the CUE sheet FLAGS command */
+#define CDIMAGE_CONTROL_PRE		0x01
+#define CDIMAGE_CONTROL_DCP		0x02
+#define CDIMAGE_CONTROL_DATA		0x04
+#define CDIMAGE_CONTROL_4CH		0x08
+
+
+/*
+ * MMC opcodes served by CD image devices
+ */
+
+#define MMC_OPCODE_GET_CONFIG			    0x0046
+#define MMC_OPCODE_INQUIRY			        0x0012
+#define MMC_OPCODE_PREVENT_ALLOW_REMOVAL	0x001E
+#define MMC_OPCODE_READ_10			        0x0028
+#define MMC_OPCODE_READ_12			        0x00A8
+#define MMC_OPCODE_READ_CAPACITY		    0x0025
+#define MMC_OPCODE_READ_CD			        0x00BE
+#define MMC_OPCODE_READ_TOC			        0x0043
+#define MMC_OPCODE_READ_TRACK_INFORMATION	0x0052
+#define MMC_OPCODE_REQUEST_SENSE		    0x0003
+#define MMC_OPCODE_SEEK				        0x002B
+#define MMC_OPCODE_SET_CD_SPEED			    0x00BB
+#define MMC_OPCODE_START_STOP_UNIT		    0x001B
+#define MMC_OPCODE_TEST_UNIT_READY		    0x0000
+#define MMC_OPCODE_VERIFY			        0x002F
+
+
+/*
+ * Internal CD image structures
+ */
+
+/* Track of an image, addresses are logical block addresses */
+typedef struct tag_cdimage_track {
+    uint8_t number;
+    uint8_t type;
+    uint8_t control;
+    uint8_t file;
+    uint32_t sector_size;       /* Size of the sectors stored in the file */
+    uint32_t begin;             /* First sector, including the pregap */
+    uint32_t data_begin;        /* First sector stored in the file */
+    uint32_t start;             /* INDEX 01 */
+    uint32_t end;
+    uint64_t offset;            /* File offset of the sector at data_begin */
+} optcl_cdimage_track;
+
+/* CD image opened on a device */
+typedef struct tag_cdimage {
+    uint32_t blocks;
+    uint32_t file_count;
+    uint32_t track_count;
+    xfile_map subchannel;
+    xfile_map files[CDIMAGE_MAX_TRACKS];
+    optcl_cdimage_track tracks[CDIMAGE_MAX_TRACKS];
+} optcl_cdimage;
+
+/* Track as described by the CUE sheet */
+typedef struct tag_cue_track {
+    uint8_t number;
+    uint8_t type;
+    uint8_t control;
+    uint8_t file;
+    uint32_t sector_size;
+    uint32_t pregap;
+    uint32_t index0;
+    uint32_t index1;
+    bool_t has_index0;
+    bool_t has_index1;
+} optcl_cue_track;
+
+/* Host buffers filled sector by sector */
+typedef struct tag_iov_writer {
+    const optcl_iovec *iov;
+    uint32_t count;
+    uint32_t index;
+    uint32_t offset;
+    bool_t overflow;
+} optcl_iov_writer;
+
+
+/*
+ * Sector encoding tables
+ */
+
+static bool_t __tables_ready = False;
+static uint8_t __ecc_f_lut[256];
+static uint8_t __ecc_b_lut[256];
+static uint32_t __edc_lut[256];
+
+static const uint8_t __zeros[296] = { 0 };
+
+
+/*
+ * Helper functions
+ */
+
+static uint32_t get_be32(const uint8_t data[])
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+        | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static uint32_t get_be24(const uint8_t data[])
+{
+    return ((uint32_t)data[0] << 16) | ((uint32_t)data[1] << 8)
+        | (uint32_t)data[2];
+}
+
+static uint16_t get_be16(const uint8_t data[])
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static void put_be32(uint8_t data[], uint32_t value)
+{
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+static void put_be16(uint8_t data[], uint16_t value)
+{
+    data[0] = (uint8_t)(value >> 8);
+    data[1] = (uint8_t)value;
+}
+
+static uint8_t to_bcd(uint32_t value)
+{
+    return (uint8_t)(((value / 10) << 4) | (value % 10));
+}
+
+static void put_msf(uint8_t data[], uint32_t frames, bool_t bcd)
+{
+    uint32_t minutes = frames / (60 * 75);
+    uint32_t seconds = (frames / 75) % 60;
+
+    frames %= 75;
+    data[0] = (bcd == True) ? to_bcd(minutes) : (uint8_t)minutes;
+    data[1] = (bcd == True) ? to_bcd(seconds) : (uint8_t)seconds;
+    data[2] = (bcd == True) ? to_bcd(frames) : (uint8_t)frames;
+}
+
+static void copy_to_iov(const optcl_iovec iov[],
+                        uint32_t iov_count,
+                        const uint8_t data[],
+                        uint32_t size)
+{
+    uint32_t i;
+    uint32_t chunk;
+
+    for (i = 0; i < iov_count && size > 0; ++i) {
+        chunk = (iov[i].len < size) ? iov[i].len : size;
+        memcpy(iov[i].base, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void write_iov(optcl_iov_writer *writer,
+                      const uint8_t data[],
+                      uint32_t size)
+{
+    uint32_t chunk;
+    const optcl_iovec *iov;
+
+    while (size > 0 && writer->index < writer->count) {
+        iov = &writer->iov[writer->index];
+        chunk = iov->len - writer->offset;
+        if (chunk > size)
+            chunk = size;
+
+        memcpy((uint8_t*)iov->base + writer->offset, data, chunk);
+        data += chunk;
+        size -= chunk;
+        writer->offset += chunk;
+
+        if (writer->offset == iov->len) {
+            ++writer->index;
+            writer->offset = 0;
+        }
+    }
+
+    if (size > 0)
+        writer->overflow = True;
+}
+
+
+/*
+ * Sector encoding functions
+ */
+
+static void init_tables(void)
+{
+    uint32_t i;
+    uint32_t j;
+    uint32_t edc;
+
+    if (__tables_ready == True)
+        return;
+
+    for (i = 0; i < 256; ++i) {
+        j = (i << 1) ^ ((i & 0x80) ? 0x11D : 0);
+        __ecc_f_lut[i] = (uint8_t)j;
+        __ecc_b_lut[i ^ j] = (uint8_t)i;
+
+        edc = i;
+        for (j = 0; j < 8; ++j)
+            edc = (edc >> 1) ^ ((edc & 1) ? 0xD8018001 : 0);
+
+        __edc_lut[i] = edc;
+    }
+
+    __tables_ready = True;
+}
+
+/* Compute the P or Q parity of a mode 1 sector */
+static void compute_ecc(const uint8_t data[],
+                        uint32_t major_count,
+                        uint32_t minor_count,
+                        uint32_t major_mult,
+                        uint32_t minor_inc,
+                        uint8_t ecc[])
+{
+    uint8_t a;
+    uint8_t b;
+    uint32_t index;
+    uint32_t major;
+    uint32_t minor;
+    uint32_t size = major_count * minor_count;
+
+    for (major = 0; major < major_count; ++major) {
+        index = (major >> 1) * major_mult + (major & 1);
+        a = 0;
+        b = 0;
+
+        for (minor = 0; minor < minor_count; ++minor) {
+            a ^= data[index];
+            b ^= data[index];
+            a = __ecc_f_lut[a];
+
+            index += minor_inc;
+            if (index >= size)
+                index -= size;
+        }
+
+        a = __ecc_b_lut[__ecc_f_lut[a] ^ b];
+        ecc[major] = a;
+        ecc[major + major_count] = a ^ b;
+    }
+}
+
+static void encode_header(uint8_t sector[], uint32_t lba, uint8_t mode)
+{
+    sector[0] = 0x00;
+    memset(&sector[1], 0xFF, 10);
+    sector[11] = 0x00;
+    put_msf(&sector[12], lba + CDIMAGE_MSF_OFFSET, True);
+    sector[15] = mode;
+}
+
+static void encode_mode1_edc_ecc(uint8_t sector[])
+{
+    uint32_t i;
+    uint32_t edc = 0;
+
+    for (i = 0; i < 0x810; ++i)
+        edc = (edc >> 8) ^ __edc_lut[(edc ^ sector[i]) & 0xFF];
+
+    sector[0x810] = (uint8_t)edc;
+    sector[0x811] = (uint8_t)(edc >> 8);
+    sector[0x812] = (uint8_t)(edc >> 16);
+    sector[0x813] = (uint8_t)(edc >> 24);
+    memset(&sector[0x814], 0, 8);
+
+    compute_ecc(&sector[0x0C], 86, 24, 2, 86, &sector[0x81C]);
+    compute_ecc(&sector[0x0C], 52, 43, 86, 88, &sector[0x8C8]);
+}
+
+/* Q sub-channel of a sector, mode 1 position data */
+static void encode_q(const optcl_cdimage_track *track,
+                     uint32_t lba,
+                     uint8_t q[])
+{
+    uint32_t i;
+    uint32_t j;
+    uint16_t crc = 0;
+
+    q[0] = (uint8_t)((track->control << 4) | 0x01);
+    q[1] = to_bcd(track->number);
+    q[2] = (lba < track->start) ? 0 : 1;
+    put_msf(&q[3], (lba < track->start)
+        ? track->start - lba : lba - track->start, True);
+    q[6] = 0;
+    put_msf(&q[7], lba + CDIMAGE_MSF_OFFSET, True);
+
+    for (i = 0; i < 10; ++i) {
+        crc ^= (uint16_t)(q[i] << 8);
+        for (j = 0; j < 8; ++j)
+            crc = (uint16_t)((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1);
+    }
+
+    put_be16(&q[10], (uint16_t)~crc);
+}
+
+
+/*
+ * CUE sheet parsing
+ */
+
+static const char* read_token(const char *line, char token[], size_t size)
+{
+    size_t len = 0;
+    char terminator = ' ';
+
+    while (*line != '\0' && isspace((unsigned char)*line))
+        ++line;
+
+    if (*line == '"') {
+        terminator = '"';
+        ++line;
+    }
+
+    while (*line != '\0' && *line != terminator
+        && (terminator == '"' || !isspace((unsigned char)*line))) {
+        if (len + 1 < size)
+            token[len++] = *line;
+
+        ++line;
+    }
+
+    if (*line == '"')
+        ++line;
+
+    token[len] = '\0';
+    return line;
+}
+
+static bool_t is_keyword(const char *token, const char *keyword)
+{
+    while (*token != '\0' && *keyword != '\0') {
+        if (toupper((unsigned char)*token) != *keyword)
+            return False;
+
+        ++token;
+        ++keyword;
+    }
+
+    return (*token == *keyword) ? True : False;
+}
+
+static RESULT parse_msf(const char *token, uint32_t *frames)
+{
+    unsigned int minutes;
+    unsigned int seconds;
+    unsigned int nframes;
+
+    if (sscanf(token, "%u:%u:%u", &minutes, &seconds, &nframes) != 3)
+        return E_DEVINVALIDIMAGE;
+
+    if (seconds >= 60 || nframes >= 75)
+        return E_DEVINVALIDIMAGE;
+
+    *frames = (minutes * 60 + seconds) * 75 + nframes;
+    return SUCCESS;
+}
+
+static RESULT parse_track_mode(const char *token, optcl_cue_track *track)
+{
+    if (is_keyword(token, "AUDIO") == True) {
+        track->type = CDIMAGE_TRACK_AUDIO;
+        track->sector_size = CDIMAGE_SECTOR_SIZE;
+    } else if (is_keyword(token, "MODE1/2048") == True) {
+        track->type = CDIMAGE_TRACK_MODE1;
+        track->sector_size = 2048;
+    } else if (is_keyword(token, "MODE1/2352") == True) {
+        track->type = CDIMAGE_TRACK_MODE1;
+        track->sector_size = CDIMAGE_SECTOR_SIZE;
+    } else if (is_keyword(token, "MODE2/2336") == True) {
+        track->type = CDIMAGE_TRACK_MODE2;
+        track->sector_size = 2336;
+    } else if (is_keyword(token, "MODE2/2352") == True) {
+        track->type = CDIMAGE_TRACK_MODE2;
+        track->sector_size = CDIMAGE_SECTOR_SIZE;
+    } else {
+        return E_DEVINVALIDIMAGE;
+    }
+
+    track->control = (track->type == CDIMAGE_TRACK_AUDIO)
+        ? 0 : CDIMAGE_CONTROL_DATA;
+
+    return SUCCESS;
+}
+
+/* Map a file named in the sheet, relative names start at the sheet */
+static RESULT map_track_file(optcl_cdimage *image,
+                             const char *cuepath,
+                             const char *name)
+{
+    errno_t err;
+    size_t dir_len = 0;
+    size_t name_len;
+    char *path;
+    const char *p;
+
+    if (name[0] != '/' && name[0] != '\\'
+        && (name[0] == '\0' || name[1] != ':')) {
+        for (p = cuepath; *p != '\0'; ++p) {
+            if (*p == '/' || *p == '\\')
+                dir_len = p - cuepath + 1;
+        }
+    }
+
+    name_len = strlen(name);
+    path = (char*)malloc(dir_len + name_len + 1);
+    if (path == 0)
+        return E_OUTOFMEMORY;
+
+    memcpy(path, cuepath, dir_len);
+    memcpy(path + dir_len, name, name_len + 1);
+
+    err = xmap_file(path, False, &image->files[image->file_count]);
+    free(path);
+
+    if (err != 0)
+        return E_DEVINVALIDPATH;
+
+    ++image->file_count;
+    return SUCCESS;
+}
+
+static RESULT parse_cue(optcl_cdimage *image,
+                        const char *cuepath,
+                        optcl_cue_track tracks[])
+{
+    FILE *file;
+    uint32_t frames;
+    unsigned int number;
+    RESULT error = SUCCESS;
+    const char *p;
+    char token[CDIMAGE_MAX_LINE];
+    char line[CDIMAGE_MAX_LINE];
+    optcl_cue_track *track = 0;
+
+    file = fopen(cuepath, "r");
+    if (file == 0)
+        return E_DEVINVALIDPATH;
+
+    while (SUCCEEDED(error) && fgets(line, sizeof(line), file) != 0) {
+        p = read_token(line, token, sizeof(token));
+
+        if (is_keyword(token, "FILE") == True) {
+            p = read_token(p, token, sizeof(token));
+            if (image->file_count == CDIMAGE_MAX_TRACKS) {
+                error = E_DEVINVALIDIMAGE;
+                break;
+            }
+
+            error = map_track_file(image, cuepath, token);
+            if (FAILED(error))
+                break;
+
+            /* Byte swapped audio and audio containers are not supported */
+            read_token(p, token, sizeof(token));
+            if (is_keyword(token, "BINARY") == False)
+                error = E_DEVINVALIDIMAGE;
+
+        } else if (is_keyword(token, "TRACK") == True) {
+            if (image->file_count == 0
+                || image->track_count == CDIMAGE_MAX_TRACKS) {
+                error = E_DEVINVALIDIMAGE;
+                break;
+            }
+
+            p = read_token(p, token, sizeof(token));
+            if (sscanf(token, "%u", &number) != 1
+                || number == 0 || number > CDIMAGE_MAX_TRACKS) {
+                error = E_DEVINVALIDIMAGE;
+                break;
+            }
+
+            track = &tracks[image->track_count++];
+            memset(track, 0, sizeof(optcl_cue_track));
+            track->number = (uint8_t)number;
+            track->file = (uint8_t)(image->file_count - 1);
+
+            read_token(p, token, sizeof(token));
+            error = parse_track_mode(token, track);
+
+        } else if (is_keyword(token, "INDEX") == True) {
+            if (track == 0) {
+                error = E_DEVINVALIDIMAGE;
+                break;
+            }
+
+            p = read_token(p, token, sizeof(token));
+            if (sscanf(token, "%u", &number) != 1) {
+                error = E_DEVINVALIDIMAGE;
+                break;
+            }
+
+            read_token(p, token, sizeof(token));
+            error = parse_msf(token, &frames);
+            if (FAILED(error))
+                break;
+
+            /* Indexes past 01 do not change the track layout */
+            if (number == 0) {
+                track->index0 = frames;
+                track->has_index0 = True;
+            } else if (number == 1) {
+                track->index1 = frames;
+                track->has_index1 = True;
+            }
+
+        } else if (is_keyword(token, "PREGAP") == True) {
+            if (track == 0) {
+                error = E_DEVINVALIDIMAGE;
+                break;
+            }
+
+            read_token(p, token, sizeof(token));
+            error = parse_msf(token, &track->pregap);
+
+        } else if (is_keyword(token, "FLAGS") == True && track != 0) {
+            for (;;) {
+                p = read_token(p, token, sizeof(token));
+                if (token[0] == '\0')
+                    break;
+
+                if (is_keyword(token, "PRE") == True)
+                    track->control |= CDIMAGE_CONTROL_PRE;
+                else if (is_keyword(token, "DCP") == True)
+                    track->control |= CDIMAGE_CONTROL_DCP;
+                else if (is_keyword(token, "4CH") == True)
+                    track->control |= CDIMAGE_CONTROL_4CH;
+            }
+        }
+
+        /* REM, CATALOG, CD-TEXT and POSTGAP entries are ignored */
+    }
+
+    fclose(file);
+
+    if (SUCCEEDED(error) && image->track_count == 0)
+        error = E_DEVINVALIDIMAGE;
+
+    return error;
+}
+
+static RESULT finish_track(optcl_cdimage *image, optcl_cdimage_track *track)
+{
+    uint64_t size = image->files[track->file].size;
+
+    if (track->offset > size)
+        return E_DEVINVALIDIMAGE;
+
+    track->end = track->data_begin
+        + (uint32_t)((size - track->offset) / track->sector_size);
+
+    return SUCCESS;
+}
+
+/*
+ * Lay tracks out on the disc. Sectors of a file before the first index
+ * of its first track are in the pregap of that track, PREGAP sectors
+ * are not stored in any file and move the sectors after them.
+ */
+static RESULT build_track_index(optcl_cdimage *image,
+                                const optcl_cue_track tracks[])
+{
+    RESULT error;
+    uint32_t i;
+    uint32_t base = 0;
+    uint32_t first;
+    uint32_t prev_first = 0;
+    optcl_cdimage_track *track;
+    optcl_cdimage_track *prev = 0;
+
+    for (i = 0; i < image->track_count; ++i) {
+        if (tracks[i].has_index1 == False)
+            return E_DEVINVALIDIMAGE;
+
+        if (prev != 0 && tracks[i].number != prev->number + 1)
+            return E_DEVINVALIDIMAGE;
+
+        track = &image->tracks[i];
+        track->number = tracks[i].number;
+        track->type = tracks[i].type;
+        track->control = tracks[i].control;
+        track->file = tracks[i].file;
+        track->sector_size = tracks[i].sector_size;
+
+        if (prev != 0 && prev->file == track->file) {
+            first = (tracks[i].has_index0 == True)
+                ? tracks[i].index0 : tracks[i].index1;
+
+            if (first < prev_first || first > tracks[i].index1)
+                return E_DEVINVALIDIMAGE;
+
+            track->offset = prev->offset
+                + (uint64_t)(first - prev_first) * prev->sector_size;
+
+            prev->end = base + first;
+        } else {
+            if (prev != 0) {
+                error = finish_track(image, prev);
+                if (FAILED(error))
+                    return error;
+
+                base = prev->end;
+            }
+
+            first = 0;
+            track->offset = 0;
+        }
+
+        track->begin = base + first;
+        base += tracks[i].pregap;
+        track->data_begin = track->begin + tracks[i].pregap;
+        track->start = base + tracks[i].index1;
+
+        prev = track;
+        prev_first = first;
+    }
+
+    error = finish_track(image, prev);
+    if (FAILED(error))
+        return error;
+
+    for (i = 0; i < image->track_count; ++i) {
+        if (image->tracks[i].end < image->tracks[i].start)
+            return E_DEVINVALIDIMAGE;
+    }
+
+    image->blocks = prev->end;
+    return SUCCESS;
+}
+
+/* Raw sub-channel data is kept next to the sheet, as image.sub */
+static void map_subchannel(optcl_cdimage *image, const char *cuepath)
+{
+    char *path;
+    size_t len;
+    const char *p;
+    const char *dot = 0;
+
+    for (p = cuepath; *p != '\0'; ++p) {
+        if (*p == '.')
+            dot = p;
+        else if (*p == '/' || *p == '\\')
+            dot = 0;
+    }
+
+    len = (dot != 0) ? (size_t)(dot - cuepath) : strlen(cuepath);
+    path = (char*)malloc(len + 5);
+    if (path == 0)
+        return;
+
+    memcpy(path, cuepath, len);
+    memcpy(path + len, ".sub", 5);
+
+    if (xmap_file(path, False, &image->subchannel) == 0
+        && image->subchannel.size
+            < (uint64_t)image->blocks * CDIMAGE_SUBCHANNEL_SIZE) {
+        xunmap_file(&image->subchannel);
+        memset(&image->subchannel, 0, sizeof(xfile_map));
+    }
+
+    free(path);
+}
+
+static void close_cdimage(optcl_cdimage *image)
+{
+    uint32_t i;
+
+    assert(image != 0);
+
+    for (i = 0; i < image->file_count; ++i)
+        xunmap_file(&image->files[i]);
+
+    if (image->subchannel.view != 0)
+        xunmap_file(&image->subchannel);
+
+    free(image);
+}
+
+static RESULT open_cdimage(const optcl_device *device, optcl_cdimage **image)
+{
+    RESULT error;
+    const char *path = 0;
+    optcl_cdimage *nimage;
+    optcl_cue_track *tracks;
+
+    assert(device != 0);
+    assert(image != 0);
+
+    error = optcl_device_get_path_ref(device, &path);
+    if (FAILED(error))
+        return error;
+
+    if (path == 0)
+        return E_DEVINVALIDPATH;
+
+    nimage = (optcl_cdimage*)malloc(sizeof(optcl_cdimage));
+    if (nimage == 0)
+        return E_OUTOFMEMORY;
+
+    tracks = (optcl_cue_track*)
+        malloc(CDIMAGE_MAX_TRACKS * sizeof(optcl_cue_track));
+    if (tracks == 0) {
+        free(nimage);
+        return E_OUTOFMEMORY;
+    }
+
+    memset(nimage, 0, sizeof(optcl_cdimage));
+
+    error = parse_cue(nimage, path, tracks);
+    if (SUCCEEDED(error))
+        error = build_track_index(nimage, tracks);
+
+    free(tracks);
+
+    if (FAILED(error)) {
+        close_cdimage(nimage);
+        return error;
+    }
+
+    map_subchannel(nimage, path);
+    init_tables();
+
+    *image = nimage;
+    return SUCCESS;
+}
+
+/* Get image of an open device or open it for a single command */
+static RESULT acquire_cdimage(const optcl_device *device,
+                              optcl_cdimage **image,
+                              bool_t *temporary)
+{
+    RESULT error;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(image != 0);
+    assert(temporary != 0);
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    ++session->commands;
+
+    if (session->is_open == True && session->handle != 0) {
+        *image = (optcl_cdimage*)session->handle;
+        *temporary = False;
+        ++session->opens_saved;
+        return SUCCESS;
+    }
+
+    ++session->opens;
+    *temporary = True;
+    return open_cdimage(device, image);
+}
+
+static RESULT check_range(const optcl_cdimage *image,
+                          uint32_t lba,
+                          uint32_t count)
+{
+    assert(image != 0);
+
+    if (lba > image->blocks || count > image->blocks - lba)
+        return E_SENSE_LBAOOR;
+
+    return SUCCESS;
+}
+
+static const optcl_cdimage_track* find_track(const optcl_cdimage *image,
+                                             uint32_t lba)
+{
+    uint32_t low = 0;
+    uint32_t mid;
+    uint32_t high = image->track_count - 1;
+
+    /* Tracks cover the disc without holes */
+    while (low < high) {
+        mid = (low + high) / 2;
+        if (lba >= image->tracks[mid].end)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return &image->tracks[low];
+}
+
+/* Get the raw sector, from the mapping when it is stored raw */
+static const uint8_t* get_sector(const optcl_cdimage *image,
+                                 const optcl_cdimage_track *track,
+                                 uint32_t lba,
+                                 uint8_t scratch[])
+{
+    const uint8_t *data;
+
+    if (lba < track->data_begin) {
+        memset(scratch, 0, CDIMAGE_SECTOR_SIZE);
+        if (track->type == CDIMAGE_TRACK_AUDIO)
+            return scratch;
+
+        encode_header(scratch, lba, track->type);
+        if (track->type == CDIMAGE_TRACK_MODE1)
+            encode_mode1_edc_ecc(scratch);
+
+        return scratch;
+    }
+
+    data = (const uint8_t*)image->files[track->file].view + track->offset
+        + (uint64_t)(lba - track->data_begin) * track->sector_size;
+
+    switch (track->sector_size) {
+    case CDIMAGE_SECTOR_SIZE:
+        return data;
+
+    case 2048:
+        encode_header(scratch, lba, 1);
+        memcpy(&scratch[16], data, 2048);
+        encode_mode1_edc_ecc(scratch);
+        return scratch;
+
+    default:
+        encode_header(scratch, lba, 2);
+        memcpy(&scratch[16], data, track->sector_size);
+        return scratch;
+    }
+}
+
+/* Get the READ CD sector type, checking it against the expected one */
+static RESULT get_sector_type(const optcl_cdimage_track *track,
+                              const uint8_t sector[],
+                              uint8_t est,
+                              uint8_t *type)
+{
+    switch (track->type) {
+    case CDIMAGE_TRACK_AUDIO:
+        *type = MMC_READ_CD_EST_CDDA;
+        break;
+
+    case CDIMAGE_TRACK_MODE1:
+        *type = MMC_READ_CD_EST_MODE1;
+        break;
+
+    default:
+        if (est == MMC_READ_CD_EST_MODE2_FORMLESS)
+            *type = MMC_READ_CD_EST_MODE2_FORMLESS;
+        else if (sector[18] & 0x20)
+            *type = MMC_READ_CD_EST_MODE2_FORM2;
+        else
+            *type = MMC_READ_CD_EST_MODE2_FORM1;
+        break;
+    }
+
+    if (est != MMC_READ_CD_EST_ALL && est != *type)
+        return E_SENSE_IMFTT;
+
+    return SUCCESS;
+}
+
+static void write_main_channel(optcl_iov_writer *writer,
+                               uint8_t flags,
+                               uint8_t type,
+                               const uint8_t sector[])
+{
+    uint32_t subheader = 0;
+    uint32_t user_data;
+    uint32_t edc_ecc = 0;
+
+    if (type == MMC_READ_CD_EST_CDDA) {
+        if (flags & 0x10)
+            write_iov(writer, sector, CDIMAGE_SECTOR_SIZE);
+
+        return;
+    }
+
+    switch (type) {
+    case MMC_READ_CD_EST_MODE1:
+        user_data = 2048;
+        edc_ecc = 288;
+        break;
+
+    case MMC_READ_CD_EST_MODE2_FORM1:
+        subheader = 8;
+        user_data = 2048;
+        edc_ecc = 280;
+        break;
+
+    case MMC_READ_CD_EST_MODE2_FORM2:
+        subheader = 8;
+        user_data = 2324;
+        edc_ecc = 4;
+        break;
+
+    default:
+        user_data = 2336;
+        break;
+    }
+
+    if (flags & 0x80)
+        write_iov(writer, sector, 12);
+
+    if (flags & 0x20)
+        write_iov(writer, &sector[12], 4);
+
+    if (flags & 0x40)
+        write_iov(writer, &sector[16], subheader);
+
+    if (flags & 0x10)
+        write_iov(writer, &sector[16 + subheader], user_data);
+
+    if (flags & 0x08)
+        write_iov(writer, &sector[16 + subheader + user_data], edc_ecc);
+}
+
+static void write_subchannel(optcl_iov_writer *writer,
+                             const optcl_cdimage *image,
+                             const optcl_cdimage_track *track,
+                             uint32_t lba,
+                             uint8_t selection)
+{
+    uint32_t i;
+    uint32_t channel;
+    uint8_t pw[CDIMAGE_SUBCHANNEL_SIZE];
+    uint8_t raw[CDIMAGE_SUBCHANNEL_SIZE];
+    const uint8_t *sub;
+
+    /* Sub-channel files hold each of the P-W channels in 12 bytes */
+    if (image->subchannel.view != 0) {
+        sub = (const uint8_t*)image->subchannel.view
+            + (uint64_t)lba * CDIMAGE_SUBCHANNEL_SIZE;
+    } else {
+        memset(pw, 0, sizeof(pw));
+        if (lba < track->start)
+            memset(pw, 0xFF, 12);
+
+        encode_q(track, lba, &pw[12]);
+        sub = pw;
+    }
+
+    if (selection == MMC_READ_CD_SCSB_FORMQ_SUBCH) {
+        write_iov(writer, &sub[12], 12);
+        write_iov(writer, __zeros, 4);
+        return;
+    }
+
+    /* Raw data carries one bit of every channel in each byte */
+    for (i = 0; i < CDIMAGE_SUBCHANNEL_SIZE; ++i) {
+        raw[i] = 0;
+        for (channel = 0; channel < 8; ++channel) {
+            if (sub[channel * 12 + i / 8] & (0x80 >> (i % 8)))
+                raw[i] |= (uint8_t)(0x80 >> channel);
+        }
+
+        if (selection == MMC_READ_CD_SCSB_CORINTRW_SUBCH)
+            raw[i] &= 0x3F;
+    }
+
+    write_iov(writer, raw, sizeof(raw));
+}
+
+
+/*
+ * Command handlers
+ */
+
+static RESULT cdimage_inquiry(const uint8_t cdb[],
+                              const optcl_iovec iov[],
+                              uint32_t iov_count)
+{
+    uint16_t alloc_len;
+    uint8_t response[CDIMAGE_INQUIRY_LEN];
+
+    memset(response, 0, sizeof(response));
+    response[0] = 0x05;             /* CD/DVD device */
+    response[1] = 0x80;             /* Removable medium */
+    response[2] = 0x05;
+    response[3] = 0x02;
+    response[4] = CDIMAGE_INQUIRY_LEN - 5;
+    memcpy(&response[8], CDIMAGE_VENDOR, 8);
+    memcpy(&response[16], CDIMAGE_PRODUCT, 16);
+    memcpy(&response[32], CDIMAGE_REVISION, 4);
+
+    alloc_len = get_be16(&cdb[3]);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < sizeof(response)) ? alloc_len : sizeof(response));
+
+    return SUCCESS;
+}
+
+static RESULT cdimage_get_configuration(const uint8_t cdb[],
+                                        const optcl_iovec iov[],
+                                        uint32_t iov_count)
+{
+    int i;
+    uint8_t rt;
+    uint8_t *feature;
+    uint32_t offset;
+    uint16_t alloc_len;
+    uint16_t start_feature;
+    uint8_t response[CDIMAGE_CONFIG_LEN];
+    const uint16_t features[] = {
+        FEATURE_PROFILE_LIST,
+        FEATURE_CORE,
+        FEATURE_REMOVABLE_MEDIUM,
+        FEATURE_RANDOM_READABLE,
+        FEATURE_CD_READ
+    };
+
+    rt = cdb[1] & 0x03;
+    start_feature = get_be16(&cdb[2]);
+    alloc_len = get_be16(&cdb[7]);
+
+    memset(response, 0, sizeof(response));
+    put_be16(&response[6], PROFILE_CD_ROM);
+    offset = 8;
+
+    /* Every feature of an image is current, so RT 01b is RT 00b */
+    for (i = 0; i < (int)(sizeof(features) / sizeof(features[0])); ++i) {
+        if (features[i] < start_feature)
+            continue;
+
+        if (rt == 0x02 && features[i] != start_feature)
+            break;
+
+        feature = &response[offset];
+        put_be16(&feature[0], features[i]);
+        feature[2] = 0x03;          /* Persistent, current */
+
+        switch (features[i]) {
+        case FEATURE_PROFILE_LIST:
+            put_be16(&feature[4], PROFILE_CD_ROM);
+            feature[6] = 0x01;
+            feature[3] = 4;
+            break;
+
+        case FEATURE_CORE:
+            put_be32(&feature[4], 0x00000001);  /* SCSI */
+            feature[3] = 8;
+            break;
+
+        case FEATURE_REMOVABLE_MEDIUM:
+            feature[4] = 0x29;                  /* Tray, eject, lock */
+            feature[3] = 4;
+            break;
+
+        case FEATURE_RANDOM_READABLE:
+            put_be32(&feature[4], CDIMAGE_BLOCK_SIZE);
+            put_be16(&feature[8], 1);
+            feature[3] = 8;
+            break;
+
+        case FEATURE_CD_READ:
+            feature[4] = 0x02;                  /* C2 error pointers */
+            feature[3] = 4;
+            break;
+        }
+
+        offset += 4 + feature[3];
+    }
+
+    put_be32(&response[0], offset - 4);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < offset) ? alloc_len : offset);
+
+    return SUCCESS;
+}
+
+static RESULT cdimage_read_capacity(const optcl_cdimage *image,
+                                    const optcl_iovec iov[],
+                                    uint32_t iov_count)
+{
+    uint8_t response[8];
+
+    put_be32(&response[0], (image->blocks > 0) ? image->blocks - 1 : 0);
+    put_be32(&response[4], CDIMAGE_BLOCK_SIZE);
+    copy_to_iov(iov, iov_count, response, sizeof(response));
+    return SUCCESS;
+}
+
+static uint32_t append_toc_descriptor(uint8_t response[],
+                                      uint32_t offset,
+                                      uint8_t control,
+                                      uint8_t number,
+                                      uint32_t lba,
+                                      bool_t msf)
+{
+    uint8_t *descriptor = &response[offset];
+
+    memset(descriptor, 0, 8);
+    descriptor[1] = (uint8_t)(0x10 | control);
+    descriptor[2] = number;
+
+    if (msf == True)
+        put_msf(&descriptor[5], lba + CDIMAGE_MSF_OFFSET, False);
+    else
+        put_be32(&descriptor[4], lba);
+
+    return offset + 8;
+}
+
+static RESULT cdimage_read_toc(const optcl_cdimage *image,
+                               const uint8_t cdb[],
+                               const optcl_iovec iov[],
+                               uint32_t iov_count)
+{
+    bool_t msf;
+    uint8_t format;
+    uint32_t i;
+    uint32_t offset = 4;
+    uint16_t alloc_len;
+    const optcl_cdimage_track *track;
+    const optcl_cdimage_track *last;
+    uint8_t response[4 + (CDIMAGE_MAX_TRACKS + 1) * 8];
+
+    msf = (cdb[1] & 0x02) ? True : False;
+    format = cdb[2] & 0x0F;
+    alloc_len = get_be16(&cdb[7]);
+    last = &image->tracks[image->track_count - 1];
+
+    memset(response, 0, sizeof(response));
+    response[2] = image->tracks[0].number;
+    response[3] = last->number;
+
+    switch (format) {
+    case 0x00:
+        if (cdb[6] > last->number && cdb[6] != 0xAA)
+            return E_SENSE_IFICDB;
+
+        for (i = 0; i < image->track_count; ++i) {
+            track = &image->tracks[i];
+            if (track->number < cdb[6])
+                continue;
+
+            offset = append_toc_descriptor(response, offset,
+                track->control, track->number, track->start, msf);
+        }
+
+        offset = append_toc_descriptor(response, offset,
+            last->control, 0xAA, image->blocks, msf);
+        break;
+
+    case 0x01:
+        /* Images hold a single session */
+        response[2] = 1;
+        response[3] = 1;
+        offset = append_toc_descriptor(response, offset,
+            image->tracks[0].control, image->tracks[0].number,
+            image->tracks[0].start, msf);
+        break;
+
+    default:
+        return E_SENSE_IFICDB;
+    }
+
+    put_be16(&response[0], (uint16_t)(offset - 2));
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < offset) ? alloc_len : offset);
+
+    return SUCCESS;
+}
+
+static RESULT cdimage_read_track_information(const optcl_cdimage *image,
+                                             const uint8_t cdb[],
+                                             const optcl_iovec iov[],
+                                             uint32_t iov_count)
+{
+    uint32_t i;
+    uint32_t address;
+    uint16_t alloc_len;
+    uint8_t response[48];
+    const optcl_cdimage_track *track = 0;
+
+    address = get_be32(&cdb[2]);
+
+    switch (cdb[1] & 0x03) {
+    case 0x00:
+        if (address >= image->blocks)
+            return E_SENSE_LBAOOR;
+
+        track = find_track(image, address);
+        break;
+
+    case 0x01:
+        for (i = 0; i < image->track_count; ++i) {
+            if (image->tracks[i].number == address)
+                track = &image->tracks[i];
+        }
+        break;
+
+    case 0x02:
+        if (address == 1)
+            track = &image->tracks[0];
+        break;
+    }
+
+    if (track == 0)
+        return E_SENSE_IFICDB;
+
+    memset(response, 0, sizeof(response));
+    put_be16(&response[0], sizeof(response) - 2);
+    response[2] = track->number;
+    response[3] = 1;
+    response[5] = track->control;
+    response[6] = (track->type == CDIMAGE_TRACK_AUDIO) ? 0x0F : track->type;
+    put_be32(&response[8], track->start);
+    put_be32(&response[24], track->end - track->start);
+    put_be32(&response[28], track->end - 1);
+
+    alloc_len = get_be16(&cdb[7]);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < sizeof(response)) ? alloc_len : sizeof(response));
+
+    return SUCCESS;
+}
+
+static RESULT cdimage_read_cd(const optcl_cdimage *image,
+                              const uint8_t cdb[],
+                              const optcl_iovec iov[],
+                              uint32_t iov_count)
+{
+    RESULT error;
+    uint8_t est;
+    uint8_t type;
+    uint8_t flags;
+    uint8_t c2_error_info;
+    uint8_t selection;
+    uint32_t i;
+    uint32_t lba;
+    uint32_t count;
+    optcl_iov_writer writer;
+    const uint8_t *sector;
+    const optcl_cdimage_track *track = 0;
+    uint8_t scratch[CDIMAGE_SECTOR_SIZE];
+
+    est = (cdb[1] >> 2) & 0x07;
+    lba = get_be32(&cdb[2]);
+    count = get_be24(&cdb[6]);
+    flags = cdb[9];
+    c2_error_info = (flags >> 1) & 0x03;
+    selection = cdb[10] & 0x07;
+
+    if (est > MMC_READ_CD_EST_MODE2_FORM2
+        || c2_error_info > MMC_READ_CD_C2EI_C2EC296
+        || (selection != MMC_READ_CD_SCSB_NO_DATA
+            && selection != MMC_READ_CD_SCSB_RAW_PW
+            && selection != MMC_READ_CD_SCSB_FORMQ_SUBCH
+            && selection != MMC_READ_CD_SCSB_CORINTRW_SUBCH))
+        return E_SENSE_IFICDB;
+
+    error = check_range(image, lba, count);
+    if (FAILED(error))
+        return error;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.iov = iov;
+    writer.count = iov_count;
+
+    for (i = 0; i < count; ++i, ++lba) {
+        if (track == 0 || lba >= track->end)
+            track = find_track(image, lba);
+
+        sector = get_sector(image, track, lba, scratch);
+
+        error = get_sector_type(track, sector, est, &type);
+        if (FAILED(error))
+            return error;
+
+        write_main_channel(&writer, flags, type, sector);
+
+        /* Images have no read errors */
+        if (c2_error_info == MMC_READ_CD_C2EI_C2EC294)
+            write_iov(&writer, __zeros, 294);
+        else if (c2_error_info == MMC_READ_CD_C2EI_C2EC296)
+            write_iov(&writer, __zeros, 296);
+
+        if (selection != MMC_READ_CD_SCSB_NO_DATA)
+            write_subchannel(&writer, image, track, lba, selection);
+    }
+
+    return (writer.overflow == True) ? E_INVALIDARG : SUCCESS;
+}
+
+static RESULT cdimage_read(const optcl_cdimage *image,
+                           uint32_t lba,
+                           uint32_t count,
+                           const optcl_iovec iov[],
+                           uint32_t iov_count)
+{
+    RESULT error;
+    uint32_t i;
+    optcl_iov_writer writer;
+    const uint8_t *sector;
+    const optcl_cdimage_track *track = 0;
+    uint8_t scratch[CDIMAGE_SECTOR_SIZE];
+
+    error = check_range(image, lba, count);
+    if (FAILED(error))
+        return error;
+
+    memset(&writer, 0, sizeof(writer));
+    writer.iov = iov;
+    writer.count = iov_count;
+
+    for (i = 0; i < count; ++i, ++lba) {
+        if (track == 0 || lba >= track->end)
+            track = find_track(image, lba);
+
+        if (track->type == CDIMAGE_TRACK_AUDIO)
+            return E_SENSE_IMFTT;
+
+        /* Cooked sectors are copied straight from the mapping */
+        if (track->sector_size == CDIMAGE_BLOCK_SIZE
+            && lba >= track->data_begin) {
+            write_iov(&writer, (const uint8_t*)image->files[track->file].view
+                + track->offset
+                + (uint64_t)(lba - track->data_begin) * CDIMAGE_BLOCK_SIZE,
+                CDIMAGE_BLOCK_SIZE);
+            continue;
+        }
+
+        sector = get_sector(image, track, lba, scratch);
+
+        if (track->type == CDIMAGE_TRACK_MODE1)
+            write_iov(&writer, &sector[16], CDIMAGE_BLOCK_SIZE);
+        else if ((sector[18] & 0x20) == 0)
+            write_iov(&writer, &sector[24], CDIMAGE_BLOCK_SIZE);
+        else
+            return E_SENSE_IMFTT;
+    }
+
+    return (writer.overflow == True) ? E_INVALIDARG : SUCCESS;
+}
+
+static RESULT cdimage_command(const optcl_cdimage *image,
+                              const uint8_t cdb[],
+                              uint32_t cdb_size,
+                              const optcl_iovec iov[],
+                              uint32_t iov_count)
+{
+    uint8_t sense[18];
+
+    switch (cdb[0]) {
+    case MMC_OPCODE_TEST_UNIT_READY:
+    case MMC_OPCODE_PREVENT_ALLOW_REMOVAL:
+    case MMC_OPCODE_START_STOP_UNIT:
+    case MMC_OPCODE_SET_CD_SPEED:
+        return SUCCESS;
+
+    case MMC_OPCODE_INQUIRY:
+        return cdimage_inquiry(cdb, iov, iov_count);
+
+    case MMC_OPCODE_REQUEST_SENSE:
+        memset(sense, 0, sizeof(sense));
+        sense[0] = 0x70;
+        sense[7] = sizeof(sense) - 8;
+        copy_to_iov(iov, iov_count, sense,
+            (cdb[4] < sizeof(sense)) ? cdb[4] : sizeof(sense));
+        return SUCCESS;
+
+    case MMC_OPCODE_GET_CONFIG:
+        return cdimage_get_configuration(cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_CAPACITY:
+        return cdimage_read_capacity(image, iov, iov_count);
+
+    case MMC_OPCODE_READ_TOC:
+        return cdimage_read_toc(image, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_TRACK_INFORMATION:
+        return cdimage_read_track_information(image, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_CD:
+        if (cdb_size < 12)
+            return E_SENSE_IFICDB;
+
+        return cdimage_read_cd(image, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_10:
+        return cdimage_read(image, get_be32(&cdb[2]), get_be16(&cdb[7]),
+            iov, iov_count);
+
+    case MMC_OPCODE_READ_12:
+        return cdimage_read(image, get_be32(&cdb[2]), get_be32(&cdb[6]),
+            iov, iov_count);
+
+    case MMC_OPCODE_VERIFY:
+        return check_range(image, get_be32(&cdb[2]), get_be16(&cdb[7]));
+
+    case MMC_OPCODE_SEEK:
+        return (get_be32(&cdb[2]) < image->blocks) ? SUCCESS : E_SENSE_LBAOOR;
+
+    default:
+        return E_SENSE_ICOC;
+    }
+}
+
+
+/*
+ * CD image transport
+ */
+
+static RESULT cdimage_open(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+    optcl_cdimage *image = 0;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    error = open_cdimage(device, &image);
+    if (FAILED(error))
+        return error;
+
+    session->handle = (ptr_t)image;
+    session->is_open = True;
+    session->block_reads = False;
+    ++session->opens;
+    return SUCCESS;
+}
+
+static RESULT cdimage_close(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->handle != 0)
+        close_cdimage((optcl_cdimage*)session->handle);
+
+    session->handle = 0;
+    return SUCCESS;
+}
+
+static RESULT cdimage_execute_vectored(const optcl_device *device,
+                                       ptr_t context,
+                                       const uint8_t cdb[],
+                                       uint32_t cdb_size,
+                                       const optcl_iovec iov[],
+                                       uint32_t iov_count)
+{
+    RESULT error;
+    bool_t temporary;
+    optcl_cdimage *image = 0;
+
+    assert(device != 0);
+    assert(cdb != 0);
+    assert(cdb_size > 0);
+    if (device == 0 || cdb == 0 || cdb_size == 0)
+        return E_INVALIDARG;
+
+    assert(iov != 0 || iov_count == 0);
+    if (iov == 0 && iov_count > 0)
+        return E_INVALIDARG;
+
+    error = acquire_cdimage(device, &image, &temporary);
+    if (FAILED(error))
+        return error;
+
+    error = cdimage_command(image, cdb, cdb_size, iov, iov_count);
+
+    if (temporary == True)
+        close_cdimage(image);
+
+    return error;
+}
+
+static RESULT cdimage_execute(const optcl_device *device,
+                              ptr_t context,
+                              const uint8_t cdb[],
+                              uint32_t cdb_size,
+                              uint8_t param[],
+                              uint32_t param_size)
+{
+    optcl_iovec iov;
+
+    iov.base = param;
+    iov.len = (param != 0) ? param_size : 0;
+
+    return cdimage_execute_vectored(device, context, cdb, cdb_size,
+        &iov, (param != 0) ? 1 : 0);
+}
+
+static RESULT cdimage_query_limits(const optcl_device *device,
+                                   ptr_t context,
+                                   optcl_transfer_limits *limits)
+{
+    assert(device != 0);
+    assert(limits != 0);
+    if (device == 0 || limits == 0)
+        return E_INVALIDARG;
+
+    limits->alignment_mask = CDIMAGE_ALIGNMENT;
+    limits->max_transfer_len = CDIMAGE_MAX_TRANSFER_LEN;
+    limits->max_physical_pages = 0;
+    return SUCCESS;
+}
+
+/* Check if a READ CD transfers the sectors exactly as they are stored */
+static bool_t is_stored_layout(const optcl_cdimage_track *track,
+                               const uint8_t cdb[])
+{
+    uint8_t est = (cdb[1] >> 2) & 0x07;
+
+    if (cdb[10] != 0 || (cdb[9] & 0x06) != 0)
+        return False;
+
+    switch (track->type) {
+    case CDIMAGE_TRACK_AUDIO:
+        return ((est == MMC_READ_CD_EST_ALL || est == MMC_READ_CD_EST_CDDA)
+            && (cdb[9] & 0x10)) ? True : False;
+
+    case CDIMAGE_TRACK_MODE1:
+        if (est != MMC_READ_CD_EST_ALL && est != MMC_READ_CD_EST_MODE1)
+            return False;
+        break;
+
+    default:
+        /* Forms of mode 2 sectors are only known after reading them */
+        if (est != MMC_READ_CD_EST_ALL
+            && est != MMC_READ_CD_EST_MODE2_FORMLESS)
+            return False;
+        break;
+    }
+
+    return ((cdb[9] & 0xF8) == 0xF8) ? True : False;
+}
+
+/*
+ * Reads of stored sectors return a view of the image mapping, valid
+ * until the device closes
+ */
+static RESULT cdimage_execute_mapped(const optcl_device *device,
+                                     ptr_t context,
+                                     const uint8_t cdb[],
+                                     uint32_t cdb_size,
+                                     uint32_t transfer_size,
+                                     const uint8_t **view)
+{
+    RESULT error;
+    uint32_t lba;
+    uint32_t count;
+    uint32_t block_size;
+    optcl_cdimage *image;
+    const optcl_cdimage_track *track;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(cdb != 0);
+    assert(view != 0);
+    if (device == 0 || cdb == 0 || cdb_size == 0 || view == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->is_open == False || session->handle == 0)
+        return E_DEVNOTOPEN;
+
+    if (cdb[0] == MMC_OPCODE_READ_10 && cdb_size >= 10) {
+        count = get_be16(&cdb[7]);
+        block_size = CDIMAGE_BLOCK_SIZE;
+    } else if (cdb[0] == MMC_OPCODE_READ_12 && cdb_size >= 12) {
+        count = get_be32(&cdb[6]);
+        block_size = CDIMAGE_BLOCK_SIZE;
+    } else if (cdb[0] == MMC_OPCODE_READ_CD && cdb_size >= 12) {
+        count = get_be24(&cdb[6]);
+        block_size = CDIMAGE_SECTOR_SIZE;
+    } else {
+        return E_NOTIMPL;
+    }
+
+    image = (optcl_cdimage*)session->handle;
+    lba = get_be32(&cdb[2]);
+
+    error = check_range(image, lba, count);
+    if (FAILED(error))
+        return error;
+
+    if (count == 0)
+        return E_NOTIMPL;
+
+    /* Views never span tracks or sectors generated for the pregap */
+    track = find_track(image, lba);
+    if (lba < track->data_begin || count > track->end - lba
+        || track->sector_size != block_size)
+        return E_NOTIMPL;
+
+    if (cdb[0] == MMC_OPCODE_READ_CD && is_stored_layout(track, cdb) == False)
+        return E_NOTIMPL;
+
+    if ((uint64_t)count * block_size < transfer_size)
+        return E_DEVINVALIDSIZE;
+
+    ++session->commands;
+    ++session->opens_saved;
+    *view = (const uint8_t*)image->files[track->file].view + track->offset
+        + (uint64_t)(lba - track->data_begin) * block_size;
+
+    return SUCCESS;
+}
+
+static const optcl_transport __cdimage_transport = {
+    "cue",
+    cdimage_open,
+    cdimage_close,
+    cdimage_execute,
+    cdimage_execute_vectored,
+    0,
+    0,
+    0,
+    cdimage_query_limits,
+    cdimage_execute_mapped
+};
+
+
+/*
+ * CD image functions
+ */
+
+RESULT optcl_cdimage_get_transport(const optcl_transport **transport)
+{
+    assert(transport != 0);
+    if (transport == 0)
+        return E_INVALIDARG;
+
+    *transport = &__cdimage_transport;
+    return SUCCESS;
+}
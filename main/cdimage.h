@@ -0,0 +1,62 @@
+/*
+    cdimage.h - Raw CD image device backend
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _CDIMAGE_H
+#define _CDIMAGE_H
+
+#include "device.h"
+#include "errors.h"
+#include "transport.h"
+#include "types.h"
+
+
+/* Raw CD sector size */
+#define CDIMAGE_SECTOR_SIZE		2352U
+
+/* Raw sub-channel data size of a sector */
+#define CDIMAGE_SUBCHANNEL_SIZE		96U
+
+/* Largest data transfer accepted by CD image devices */
+#define CDIMAGE_MAX_TRANSFER_LEN	0x800000U
+
+/* Most tracks on a CD */
+#define CDIMAGE_MAX_TRACKS		99
+
+
+/*
+ * Get CD image file transport
+ *
+ * Devices bound with optcl_device_bind2file to a CUE sheet use this
+ * transport. The tracks of the sheet are indexed when the device is
+ * opened and their BIN files are mapped into memory. A raw sub-channel
+ * file with the name of the sheet and the .sub extension, holding 96
+ * bytes of P-W data per sector, is used when present, otherwise the
+ * Q sub-channel is generated from the track index.
+ *
+ * READ CD is served with every sector type, header, EDC/ECC, C2 and
+ * sub-channel selection. Full raw sectors of tracks stored with 2352
+ * byte sectors can also be read without copying through
+ * optcl_command_read_cd_mapped.
+ */
+extern 
+RESULT optcl_cdimage_get_transport(const optcl_transport **transport);
+
+#endif /* _CDIMAGE_H */
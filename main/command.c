@@ -48,7 +48,7 @@
 #define MMC_OPCODE_MODE_SELECT			    0x0055
 #define MMC_OPCODE_PREVENT_ALLOW_REMOVAL	0x001E
 #define MMC_OPCODE_READ_10			        0x0028
-#define MMC_OPCODE_READ_12			        0x0028
+#define MMC_OPCODE_READ_12			        0x00A8
 #define MMC_OPCODE_READ_BUFFER			    0x003C
 #define MMC_OPCODE_READ_BUFFER_CAPACITY		0x005C
 #define MMC_OPCODE_READ_CAPACITY		    0x0025
@@ -59,7 +59,9 @@
 #define MMC_OPCODE_REQUEST_SENSE		    0x0003
 #define MMC_OPCODE_RESERVE_TRACK		    0x0053
 #define MMC_OPCODE_SEEK				        0x002B
+#define MMC_OPCODE_SEND_CUE_SHEET		    0x005D
 #define MMC_OPCODE_SEND_DISC_STRUCTURE		0x00BF
+#define MMC_OPCODE_SEND_KEY			        0x00A3
 #define MMC_OPCODE_SEND_OPC_INFORMATION		0x0054
 #define MMC_OPCODE_SET_CD_SPEED			    0x00BB
 #define MMC_OPCODE_SET_READ_AHEAD		    0x00A7
@@ -79,6 +81,7 @@
  */
 
 #define READ_BLOCK_SIZE			            2048U
+#define MIN_WRITE_BLOCK_SIZE		        2048U
 #define MAX_SENSEDATA_LENGTH		        252
 #define MAX_GET_CONFIG_TRANSFER_LEN	        65530
 #define MECHSTATUS_RESPSIZE		            1032
@@ -132,6 +135,346 @@ static int8_t equalfn_descriptors(const ptr_t left, const ptr_t right)
         return 1;
 }
 
+static RESULT check_data_buffer(const optcl_device *device,
+                                const optcl_transfer_limits *limits,
+                                const ptr_t buffer,
+                                uint32_t buffer_len,
+                                uint32_t transfer_size)
+{
+    RESULT error;
+    bool_t registered;
+
+    assert(device != 0);
+    assert(limits != 0);
+    assert(buffer != 0);
+    if (device == 0 || limits == 0 || buffer == 0)
+        return E_INVALIDARG;
+
+    if (transfer_size > limits->max_transfer_len)
+        return E_INVALIDARG;
+
+    if (buffer_len < transfer_size)
+        return E_DEVINVALIDSIZE;
+
+    error = optcl_device_is_buffer_registered(device, buffer, 
+        transfer_size, &registered);
+    if (FAILED(error))
+        return error;
+
+    if (registered == True)
+        return SUCCESS;
+
+    /*
+     * NOTE that the adapter alignment value is used as the
+     * buffer alignment in bytes, as in xmalloc_aligned.
+     */
+    if (limits->alignment_mask > 1 
+        && (size_t)buffer % limits->alignment_mask != 0)
+        return E_DEVUNALIGNEDBUF;
+
+    return SUCCESS;
+}
+
+static RESULT check_data_vector(const optcl_device *device,
+                                const optcl_iovec iov[],
+                                uint32_t iov_count,
+                                uint32_t *total_len)
+{
+    RESULT error;
+    uint32_t i;
+    uint32_t len;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(iov != 0);
+    assert(total_len != 0);
+    if (device == 0 || iov == 0 || iov_count == 0 || total_len == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    for (i = 0, len = 0; i < iov_count; ++i) {
+        if (iov[i].len > limits.max_transfer_len - len)
+            return E_INVALIDARG;
+
+        len += iov[i].len;
+    }
+
+    *total_len = len;
+    return SUCCESS;
+}
+
+static RESULT use_block_reads(const optcl_device *device, 
+                              bool_t plain, 
+                              bool_t *use)
+{
+    RESULT error;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(use != 0);
+    if (device == 0 || use == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * Only plain data reads go through the block device, FUA
+     * and streaming reads need the SCSI command.
+     */
+    *use = (plain == True && session->block_reads == True) ? True : False;
+    return SUCCESS;
+}
+
+static RESULT prepare_dataout(const optcl_device *device,
+                              const optcl_transfer_limits *limits,
+                              const ptr_t data,
+                              uint32_t data_len,
+                              ptr_t *dataout)
+{
+    RESULT error;
+    ptr_t ndata;
+    bool_t registered;
+
+    assert(device != 0);
+    assert(limits != 0);
+    assert(data != 0);
+    assert(dataout != 0);
+    if (device == 0 || limits == 0 || data == 0 || dataout == 0)
+        return E_INVALIDARG;
+
+    /*
+     * Registered and suitably aligned buffers go to the 
+     * transport as they are, anything else is bounced.
+     */
+    error = optcl_device_is_buffer_registered(device, data, data_len, 
+        &registered);
+    if (FAILED(error))
+        return error;
+
+    if (registered == True 
+        || limits->alignment_mask < 2
+        || (size_t)data % limits->alignment_mask == 0) {
+        *dataout = data;
+        return SUCCESS;
+    }
+
+    ndata = (ptr_t)xmalloc_aligned(data_len, limits->alignment_mask);
+    if (ndata == 0)
+        return E_OUTOFMEMORY;
+
+    xmemcpy(ndata, data_len, data, data_len);
+    *dataout = ndata;
+    return SUCCESS;
+}
+
+static void encode_read_10(const optcl_mmc_read_10 *command, cdb10 cdb)
+{
+    assert(command != 0);
+    assert(cdb != 0);
+
+    memset(cdb, 0, sizeof(cdb10));
+    cdb[0] = MMC_OPCODE_READ_10;
+    cdb[1] = (command->fua << 3);
+    cdb[2] = (uint8_t)(command->start_lba >> 24);
+    cdb[3] = (uint8_t)((command->start_lba << 8) >> 24);
+    cdb[4] = (uint8_t)((command->start_lba << 16) >> 24);
+    cdb[5] = (uint8_t)((command->start_lba << 24) >> 24);
+    cdb[7] = (uint8_t)(command->transfer_length >> 8);
+    cdb[8] = (uint8_t)((command->transfer_length << 8) >> 8);
+}
+
+static RESULT prepare_read_10(const optcl_device *device,
+                              const optcl_mmc_read_10 *command,
+                              const ptr_t buffer,
+                              uint32_t buffer_len,
+                              cdb10 cdb,
+                              uint32_t *transfer_size)
+{
+    RESULT error;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(buffer != 0);
+    assert(transfer_size != 0);
+    if (device == 0 || command == 0 || buffer == 0 || transfer_size == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)command->transfer_length * READ_BLOCK_SIZE 
+        > limits.max_transfer_len)
+        return E_INVALIDARG;
+
+    *transfer_size = command->transfer_length * READ_BLOCK_SIZE;
+    error = check_data_buffer(device, &limits, buffer, buffer_len, 
+        *transfer_size);
+    if (FAILED(error))
+        return error;
+
+    encode_read_10(command, cdb);
+    return SUCCESS;
+}
+
+static void encode_read_12(const optcl_mmc_read_12 *command, cdb12 cdb)
+{
+    assert(command != 0);
+    assert(cdb != 0);
+
+    memset(cdb, 0, sizeof(cdb12));
+    cdb[0] = MMC_OPCODE_READ_12;
+    cdb[1] = (command->fua << 3);
+    cdb[2] = (uint8_t)(command->start_lba >> 24);
+    cdb[3] = (uint8_t)((command->start_lba << 8) >> 24);
+    cdb[4] = (uint8_t)((command->start_lba << 16) >> 24);
+    cdb[5] = (uint8_t)((command->start_lba << 24) >> 24);
+    cdb[6] = (uint8_t)(command->transfer_length >> 24);
+    cdb[7] = (uint8_t)((command->transfer_length << 8) >> 24);
+    cdb[8] = (uint8_t)((command->transfer_length << 16) >> 24);
+    cdb[9] = (uint8_t)((command->transfer_length << 24) >> 24);
+    cdb[10] = (command->streaming << 7);
+}
+
+static RESULT prepare_read_12(const optcl_device *device,
+                              const optcl_mmc_read_12 *command,
+                              const ptr_t buffer,
+                              uint32_t buffer_len,
+                              cdb12 cdb,
+                              uint32_t *transfer_size)
+{
+    RESULT error;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(buffer != 0);
+    assert(transfer_size != 0);
+    if (device == 0 || command == 0 || buffer == 0 || transfer_size == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)command->transfer_length * READ_BLOCK_SIZE 
+        > limits.max_transfer_len)
+        return E_INVALIDARG;
+
+    *transfer_size = command->transfer_length * READ_BLOCK_SIZE;
+    error = check_data_buffer(device, &limits, buffer, buffer_len, 
+        *transfer_size);
+    if (FAILED(error))
+        return error;
+
+    encode_read_12(command, cdb);
+    return SUCCESS;
+}
+
+static void encode_read_cd(const optcl_mmc_read_cd *command, cdb12 cdb)
+{
+    assert(command != 0);
+    assert(cdb != 0);
+
+    memset(cdb, 0, sizeof(cdb12));
+    cdb[0] = MMC_OPCODE_READ_CD;
+    cdb[1] = (uint8_t)(((command->est & 0x07) << 2) | (command->dap << 1));
+    cdb[2] = (uint8_t)(command->starting_lba >> 24);
+    cdb[3] = (uint8_t)((command->starting_lba << 8) >> 24);
+    cdb[4] = (uint8_t)((command->starting_lba << 16) >> 24);
+    cdb[5] = (uint8_t)((command->starting_lba << 24) >> 24);
+    cdb[6] = (uint8_t)((command->transfer_len << 8) >> 24);
+    cdb[7] = (uint8_t)((command->transfer_len << 16) >> 24);
+    cdb[8] = (uint8_t)((command->transfer_len << 24) >> 24);
+    cdb[9] = (uint8_t)((command->sync << 7) 
+        | ((command->header_codes & 0x03) << 5) 
+        | (command->user_data << 4) 
+        | (command->edc_ecc << 3) 
+        | ((command->c2_error_info & 0x03) << 1));
+    cdb[10] = command->subchannel_sel & 0x07;
+}
+
+static RESULT prepare_read_cd(const optcl_device *device,
+                              const optcl_mmc_read_cd *command,
+                              const ptr_t buffer,
+                              uint32_t buffer_len,
+                              cdb12 cdb,
+                              uint32_t *transfer_size)
+{
+    RESULT error;
+    uint32_t block_size;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(buffer != 0);
+    assert(transfer_size != 0);
+    if (device == 0 || command == 0 || buffer == 0 || transfer_size == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_command_read_cd_block_size(command, &block_size);
+    if (FAILED(error))
+        return error;
+
+    if (command->transfer_len > 0x00FFFFFF 
+        || (uint64_t)command->transfer_len * block_size > limits.max_transfer_len)
+        return E_INVALIDARG;
+
+    *transfer_size = command->transfer_len * block_size;
+    error = check_data_buffer(device, &limits, buffer, buffer_len, 
+        *transfer_size);
+    if (FAILED(error))
+        return error;
+
+    encode_read_cd(command, cdb);
+    return SUCCESS;
+}
+
+static void encode_write_10(const optcl_mmc_write *command, cdb10 cdb)
+{
+    assert(command != 0);
+    assert(cdb != 0);
+
+    memset(cdb, 0, sizeof(cdb10));
+    cdb[0] = MMC_OPCODE_WRITE;
+    cdb[1] = (uint8_t)((command->fua << 3) | (command->tsr << 2));
+    cdb[2] = (uint8_t)(command->lba >> 24);
+    cdb[3] = (uint8_t)((command->lba << 8) >> 24);
+    cdb[4] = (uint8_t)((command->lba << 16) >> 24);
+    cdb[5] = (uint8_t)((command->lba << 24) >> 24);
+    cdb[7] = (uint8_t)(command->transfer_len >> 8);
+    cdb[8] = (uint8_t)((command->transfer_len << 8) >> 8);
+}
+
+static void encode_write_12(const optcl_mmc_write_12 *command, cdb12 cdb)
+{
+    assert(command != 0);
+    assert(cdb != 0);
+
+    memset(cdb, 0, sizeof(cdb12));
+    cdb[0] = MMC_OPCODE_WRITE_12;
+    cdb[1] = (uint8_t)((command->fua << 3) | (command->tsr << 2));
+    cdb[2] = (uint8_t)(command->lba >> 24);
+    cdb[3] = (uint8_t)((command->lba << 8) >> 24);
+    cdb[4] = (uint8_t)((command->lba << 16) >> 24);
+    cdb[5] = (uint8_t)((command->lba << 24) >> 24);
+    cdb[6] = (uint8_t)(command->transfer_len >> 24);
+    cdb[7] = (uint8_t)((command->transfer_len << 8) >> 24);
+    cdb[8] = (uint8_t)((command->transfer_len << 16) >> 24);
+    cdb[9] = (uint8_t)((command->transfer_len << 24) >> 24);
+    cdb[10] = (uint8_t)((command->streaming << 7) | (command->vnr << 6));
+}
+
 static RESULT create_dataout_from_descriptor(const optcl_mmc_msdesc_header *descriptor,
                                              pptr_t data_out,
                                              uint16_t *data_out_len)
@@ -970,8 +1313,8 @@ static RESULT parse_raw_event_status_descriptor_data(uint8_t event_class,
             }
 
             opchange->persistent_prev = bool_from_uint8(raw_data[1] & 0x80);    /* 10000000 */
-            opchange->event_code = raw_data[0] & 0x15;			                /* 00001111 */
-            opchange->status = raw_data[1] & 0x15;				                /* 00001111 */
+            opchange->event_code = raw_data[0] & 0x0F;			                /* 00001111 */
+            opchange->status = raw_data[1] & 0x0F;				                /* 00001111 */
             opchange->change = uint16_from_be(*(uint16_t*)&raw_data[2]);
             *descriptor = (optcl_mmc_ges_descriptor*)opchange;
             break;
@@ -984,7 +1327,7 @@ static RESULT parse_raw_event_status_descriptor_data(uint8_t event_class,
                 break;
             }
 
-            pwrmngmnt->event_code = raw_data[0] & 0x15;			                /* 00001111 */
+            pwrmngmnt->event_code = raw_data[0] & 0x0F;			                /* 00001111 */
             pwrmngmnt->power_status = raw_data[1];
             *descriptor = (optcl_mmc_ges_descriptor*)pwrmngmnt;
             break;
@@ -998,8 +1341,8 @@ static RESULT parse_raw_event_status_descriptor_data(uint8_t event_class,
             }
 
             exterrequest->persistent_prev = bool_from_uint8(raw_data[1] & 0x80);/* 10000000 */
-            exterrequest->event_code = raw_data[0] & 0x15;			            /* 00001111 */
-            exterrequest->ext_req_status = raw_data[0] & 0x15;		            /* 00001111 */
+            exterrequest->event_code = raw_data[0] & 0x0F;			            /* 00001111 */
+            exterrequest->ext_req_status = raw_data[1] & 0x0F;		            /* 00001111 */
             exterrequest->external_request = 
                 uint16_from_be(*(uint16_t*)&raw_data[2]);
             *descriptor = (optcl_mmc_ges_descriptor*)exterrequest;
@@ -1012,7 +1355,7 @@ static RESULT parse_raw_event_status_descriptor_data(uint8_t event_class,
                 break;
             }
 
-            media->event_code = raw_data[0] & 0x15;				                /* 00001111 */
+            media->event_code = raw_data[0] & 0x0F;				                /* 00001111 */
             media->media_present = bool_from_uint8(raw_data[1] & 0x02);	        /* 00000010 */
             media->tray_open = bool_from_uint8(raw_data[1] & 0x01);		        /* 00000001 */
             media->start_slot = raw_data[2];
@@ -1028,9 +1371,9 @@ static RESULT parse_raw_event_status_descriptor_data(uint8_t event_class,
                 break;
             }
 
-            multihost->event_code = raw_data[0] & 0x15;			                /* 00001111 */
+            multihost->event_code = raw_data[0] & 0x0F;			                /* 00001111 */
             multihost->persistent_prev = bool_from_uint8(raw_data[1] & 0x80);   /* 10000000 */
-            multihost->multi_host_status = raw_data[1] & 0x15;		            /* 00001111 */
+            multihost->multi_host_status = raw_data[1] & 0x0F;		            /* 00001111 */
             multihost->multi_host_priority = 
                 uint16_from_be(*(uint16_t*)&raw_data[2]);
             *descriptor = (optcl_mmc_ges_descriptor*)multihost;
@@ -1044,7 +1387,7 @@ static RESULT parse_raw_event_status_descriptor_data(uint8_t event_class,
                 break;
             }
 
-            devicebusy->event_code = raw_data[0] & 0x15;			/* 00001111 */
+            devicebusy->event_code = raw_data[0] & 0x0F;			/* 00001111 */
             devicebusy->busy_status = raw_data[1];
             devicebusy->time = uint16_from_be(*(uint16_t*)&raw_data[2]);
             *descriptor = (optcl_mmc_ges_descriptor*)devicebusy;
@@ -1141,7 +1484,8 @@ static RESULT parse_raw_get_event_status_data(const uint8_t mmc_response[],
     RESULT error;
     RESULT destroy_error;
 
-    uint16_t offset;
+    uint32_t offset;
+    uint32_t length;
     uint16_t descriptor_len;
     optcl_list *descriptors = 0;
     optcl_mmc_ges_descriptor *ndescriptor = 0;
@@ -1177,17 +1521,34 @@ static RESULT parse_raw_get_event_status_data(const uint8_t mmc_response[],
         return E_POINTER;
     }
 
+    /*
+     * Event data length counts the bytes after the length field. The
+     * descriptors are of the class in the notification class field,
+     * 1 is operational change and 6 is device busy.
+     */
+    length = (uint32_t)descriptor_len + 2;
+    if (length > size)
+        length = size;
+
     offset = 4;
     error = SUCCESS;
-    while (offset < descriptor_len + 4) {
-        error = parse_raw_event_status_descriptor_data(nresponse->event_class,
-            &mmc_response[offset], size - offset, &ndescriptor);
+    while (nresponse->ges_header.nea == False 
+        && nresponse->ges_header.notification_class >= 1
+        && nresponse->ges_header.notification_class <= 6
+        && offset + 4 <= length) 
+    {
+        error = parse_raw_event_status_descriptor_data(
+            (uint8_t)(1 << nresponse->ges_header.notification_class),
+            &mmc_response[offset], length - offset, &ndescriptor);
         if (FAILED(error))
             break;
 
+        *ndescriptor = nresponse->ges_header;
         error = optcl_list_add_tail(descriptors, (const ptr_t)ndescriptor);
-        if (FAILED(error))
+        if (FAILED(error)) {
+            free(ndescriptor);
             break;
+        }
 
         offset += 4;
     }
@@ -2322,37 +2683,16 @@ RESULT optcl_command_destroy_response(optcl_mmc_response *response)
 RESULT optcl_command_format_unit(const optcl_device *device,
                                  const optcl_mmc_format_unit *command)
 {
-    RESULT error;
-    RESULT destroy_error;
+    RESULT error = SUCCESS;
 
     cdb6 cdb;
-    uint32_t alignment;
     uint8_t cdbparams[12];
-    optcl_adapter *adapter = 0;
 
     assert(device != 0);
     assert(command != 0);
     if (device == 0 || command == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
-    if (FAILED(error))
-        return error;
-
-    assert(adapter);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
-
     /*
      * Execute command
      */
@@ -2432,6 +2772,44 @@ RESULT optcl_command_format_unit(const optcl_device *device,
 }
 
 
+RESULT optcl_command_get_data_direction(const uint8_t cdb[],
+                                        uint32_t cdb_size,
+                                        uint32_t param_size,
+                                        int *direction)
+{
+    assert(cdb != 0);
+    assert(cdb_size > 0);
+    assert(direction != 0);
+    if (cdb == 0 || cdb_size == 0 || direction == 0)
+        return E_INVALIDARG;
+
+    if (param_size == 0) {
+        *direction = MMC_DATA_DIRECTION_NONE;
+        return SUCCESS;
+    }
+
+    switch(cdb[0]) {
+        case MMC_OPCODE_FORMAT_UNIT:
+        case MMC_OPCODE_MODE_SELECT:
+        case MMC_OPCODE_SEND_CUE_SHEET:
+        case MMC_OPCODE_SEND_DISC_STRUCTURE:
+        case MMC_OPCODE_SEND_KEY:
+        case MMC_OPCODE_SEND_OPC_INFORMATION:
+        case MMC_OPCODE_SET_STREAMING:
+        case MMC_OPCODE_WRITE:
+        case MMC_OPCODE_WRITE_12:
+        case MMC_OPCODE_WRITE_AND_VERIFY_10:
+        case MMC_OPCODE_WRITE_BUFFER:
+            *direction = MMC_DATA_DIRECTION_OUT;
+            break;
+        default:
+            *direction = MMC_DATA_DIRECTION_IN;
+            break;
+    }
+
+    return SUCCESS;
+}
+
 RESULT optcl_command_get_configuration(const optcl_device *device,
                                        const optcl_mmc_get_configuration *command,
                                        optcl_mmc_response_get_configuration **response)
@@ -2447,7 +2825,7 @@ RESULT optcl_command_get_configuration(const optcl_device *device,
     uint32_t transfer_size;
     uint32_t alignment_mask;
     uint32_t max_transfer_len;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_list_iterator it = 0;
     optcl_feature_descriptor *descriptor = 0;
     optcl_mmc_response_get_configuration *nresponse0 = 0;
@@ -2468,29 +2846,12 @@ RESULT optcl_command_get_configuration(const optcl_device *device,
         return E_INVALIDARG;
     }
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment_mask);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_get_max_transfer_len(adapter, &max_transfer_len);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment_mask = limits.alignment_mask;
+    max_transfer_len = limits.max_transfer_len;
 
     /*
      * Execute command just to get data length
@@ -2631,61 +2992,79 @@ RESULT optcl_command_get_configuration(const optcl_device *device,
     return error;
 }
 
-RESULT optcl_command_get_event_status(const optcl_device *device,
-                                      const optcl_mmc_get_event_status *command,
-                                      optcl_mmc_response_get_event_status **response)
+RESULT optcl_command_parse_configuration(const uint8_t data[],
+                                         uint32_t size,
+                                         optcl_mmc_response_get_configuration **response)
 {
     RESULT error;
+    optcl_mmc_response_get_configuration *nresponse = 0;
 
-    cdb10 cdb;
-    uint32_t alignment;
-    uint16_t descriptor_len;
-    ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
-    optcl_mmc_response_get_event_status *nresponse = 0;
-
-    assert(device != 0);
-    assert(command != 0);
+    assert(data != 0);
     assert(response != 0);
-    if (device == 0 || command == 0 || response == 0)
+    if (data == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
-    if (FAILED(error))
-        return error;
-
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
+    if (size < 8 || (size % 4) != 0)
+        return E_FEATINVHEADER;
 
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
+    error = parse_raw_get_configuration_data(data, size, &nresponse);
     if (FAILED(error))
         return error;
 
-    error = optcl_adapter_destroy(adapter);
+    nresponse->header.command_opcode = MMC_OPCODE_GET_CONFIG;
+    *response = nresponse;
+    return SUCCESS;
+}
+
+RESULT optcl_command_get_event_status(const optcl_device *device,
+                                      const optcl_mmc_get_event_status *command,
+                                      optcl_mmc_response_get_event_status **response)
+{
+    RESULT error;
+    RESULT destroy_error;
+
+    cdb10 cdb;
+    uint32_t length;
+    uint32_t alignment;
+    ptr_t mmc_response = 0;
+    optcl_transfer_limits limits;
+    optcl_mmc_response_get_event_status *nresponse = 0;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(response != 0);
+    if (device == 0 || command == 0 || response == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
+    alignment = limits.alignment_mask;
+
     /*
-     * Execute command
+     * Execute command, a polled event is reported once so an allocation
+     * length that holds the event gets it with a single command
      */
+    length = (command->allocation_length >= 4) ? command->allocation_length : 4;
     memset(cdb, 0, sizeof(cdb));
     cdb[0] = MMC_OPCODE_GET_EVENT_STATUS;
     cdb[1] = command->polled;
     cdb[4] = command->class_request;
-    cdb[8] = 4; /* request only event header */
-    mmc_response = (ptr_t)xmalloc_aligned(cdb[8], alignment);
+    cdb[7] = (uint8_t)(length >> 8);
+    cdb[8] = (uint8_t)length;
+    mmc_response = (ptr_t)xmalloc_aligned(length, alignment);
     if (mmc_response == 0)
         return E_OUTOFMEMORY;
 
     error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
-        mmc_response, cdb[8]);
+        mmc_response, length);
     if (FAILED(error)) {
         xfree_aligned(mmc_response);
         return error;
     }
 
-    error = parse_raw_get_event_status_data(mmc_response, cdb[8], &nresponse);
+    error = parse_raw_get_event_status_data(mmc_response, length, &nresponse);
     xfree_aligned(mmc_response);
     if (FAILED(error))
         return error;
@@ -2695,29 +3074,67 @@ RESULT optcl_command_get_event_status(const optcl_device *device,
         return E_POINTER;
 
     /*
-     * Execute command
+     * Execute command again for the whole event data when only the
+     * header was requested
      */
-    descriptor_len = nresponse->ges_header.descriptor_len;
-    cdb[7] = (uint8_t)(descriptor_len >> 8);
-    cdb[8] = (uint8_t)((descriptor_len << 8) >> 8) + 4;
-    mmc_response = (ptr_t)xmalloc_aligned(descriptor_len + 4, alignment);
-    if (mmc_response == 0)
-        return E_OUTOFMEMORY;
+    if (command->allocation_length == 0) {
+        length = (uint32_t)nresponse->ges_header.descriptor_len + 2;
+        if (length < 4)
+            length = 4;
 
-    error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
-        mmc_response, descriptor_len + 4);
-    if (FAILED(error)) {
+        destroy_error = optcl_list_destroy(nresponse->descriptors, True);
+        free(nresponse);
+        nresponse = 0;
+        if (FAILED(destroy_error))
+            return destroy_error;
+
+        cdb[7] = (uint8_t)(length >> 8);
+        cdb[8] = (uint8_t)length;
+        mmc_response = (ptr_t)xmalloc_aligned(length, alignment);
+        if (mmc_response == 0)
+            return E_OUTOFMEMORY;
+
+        error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
+            mmc_response, length);
+        if (FAILED(error)) {
+            xfree_aligned(mmc_response);
+            return error;
+        }
+
+        error = parse_raw_get_event_status_data(mmc_response, length, &nresponse);
         xfree_aligned(mmc_response);
-        return error;
+        if (FAILED(error))
+            return error;
     }
 
-    free(nresponse);
-    error = parse_raw_get_event_status_data(mmc_response, descriptor_len + 4, 
-        &nresponse);
-    xfree_aligned(mmc_response);
+    nresponse->header.command_opcode = MMC_OPCODE_GET_EVENT_STATUS;
+    *response = nresponse;
+    return SUCCESS;
+}
+
+RESULT optcl_command_parse_event_status(const uint8_t data[],
+                                        uint32_t size,
+                                        optcl_mmc_response_get_event_status **response)
+{
+    RESULT error;
+    optcl_mmc_response_get_event_status *nresponse = 0;
+
+    assert(data != 0);
+    assert(response != 0);
+    if (data == 0 || response == 0)
+        return E_INVALIDARG;
+
+    if (size < 4)
+        return E_INVALIDARG;
+
+    error = parse_raw_get_event_status_data(data, size, &nresponse);
     if (FAILED(error))
         return error;
 
+    assert(nresponse != 0);
+    if (nresponse == 0)
+        return E_POINTER;
+
     nresponse->header.command_opcode = MMC_OPCODE_GET_EVENT_STATUS;
     *response = nresponse;
     return SUCCESS;
@@ -2728,14 +3145,13 @@ RESULT optcl_command_get_performance(const optcl_device *device,
                                      optcl_mmc_response_get_performance **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb12 cdb;
     uint32_t alignment;
     uint32_t perf_data_len;
     uint32_t max_transfer_len;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_get_performance *nresponse = 0;
 
     assert(device != 0);
@@ -2744,29 +3160,12 @@ RESULT optcl_command_get_performance(const optcl_device *device,
     if (device == 0 || command == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_get_max_transfer_len(adapter, &max_transfer_len);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
+    max_transfer_len = limits.max_transfer_len;
 
     /*
      * Execute command just to get response header
@@ -2848,12 +3247,11 @@ RESULT optcl_command_inquiry(const optcl_device *device,
                              optcl_mmc_response_inquiry **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb6 cdb;
     ptr_t mmc_response = 0;
     uint32_t alignment_mask;
-    optcl_adapter *adapter;
+    optcl_transfer_limits limits;
     optcl_mmc_response_inquiry *nresponse;
 
     assert(device != 0);
@@ -2867,23 +3265,11 @@ RESULT optcl_command_inquiry(const optcl_device *device,
     if (command->evpd != 0 || command->page_code != 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment_mask);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment_mask = limits.alignment_mask;
 
     /*
      * Execute command just to get additional length
@@ -2961,14 +3347,13 @@ RESULT optcl_command_mechanism_status(const optcl_device *device,
                                       optcl_mmc_response_mechanism_status **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     int i;
     cdb12 cdb;
     uint32_t alignment;
     uint16_t response_size;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_mechanism_status *nresponse = 0;
 
     assert(device != 0);
@@ -2976,23 +3361,11 @@ RESULT optcl_command_mechanism_status(const optcl_device *device,
     if (device == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     /*
      * Execute command
@@ -3053,13 +3426,12 @@ RESULT optcl_command_mode_sense_10(const optcl_device *device,
                                    optcl_mmc_response_mode_sense **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     uint32_t alignment;
     uint16_t mode_data_len;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_mode_sense *nresponse = 0;
 
     assert(device != 0);
@@ -3068,23 +3440,11 @@ RESULT optcl_command_mode_sense_10(const optcl_device *device,
     if (device == 0 || command == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     /*
      * Execute command to get response buffer size
@@ -3139,13 +3499,12 @@ RESULT optcl_command_mode_select_10(const optcl_device *device,
                                     const optcl_mmc_mode_select *command)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     ptr_t data_out = 0;
     uint32_t alignment;
     uint16_t data_out_len;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != 0);
     assert(command != 0);
@@ -3156,23 +3515,11 @@ RESULT optcl_command_mode_select_10(const optcl_device *device,
     if (command->descriptors == 0)
         return E_POINTER;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     error = create_dataout_mode_select(command, alignment, &data_out, &data_out_len);
     if (FAILED(error))
@@ -3222,14 +3569,10 @@ RESULT optcl_command_read_10(const optcl_device *device,
                              optcl_mmc_response_read **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
-    cdb10 cdb;
-    uint32_t alignment;
-    ptr_t mmc_response = 0;
+    ptr_t data = 0;
     uint32_t transfer_size;
-    uint32_t max_transfer_len;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_read *nresponse = 0;
 
     assert(device != 0);
@@ -3238,157 +3581,329 @@ RESULT optcl_command_read_10(const optcl_device *device,
     if (device == 0 || command == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
+    if ((uint64_t)command->transfer_length * READ_BLOCK_SIZE 
+        > limits.max_transfer_len)
+        return E_INVALIDARG;
 
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
+    transfer_size = command->transfer_length * READ_BLOCK_SIZE;
+
+    nresponse = (optcl_mmc_response_read*)
+        malloc(sizeof(optcl_mmc_response_read));
+    if (nresponse == 0)
+        return E_OUTOFMEMORY;
+
+    data = (ptr_t)xmalloc_aligned(transfer_size, limits.alignment_mask);
+    if (data == 0) {
+        free(nresponse);
+        return E_OUTOFMEMORY;
     }
 
-    error = optcl_adapter_get_max_transfer_len(adapter, &max_transfer_len);
+    error = optcl_command_read_10_direct(device, command, data, transfer_size);
     if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
+        free(nresponse);
+        xfree_aligned(data);
+        return error;
     }
 
-    error = optcl_adapter_destroy(adapter);
+    nresponse->header.command_opcode = MMC_OPCODE_READ_10;
+    nresponse->data = data;
+    *response = nresponse;
+    return error;
+}
+
+RESULT optcl_command_read_10_direct(const optcl_device *device,
+                                    const optcl_mmc_read_10 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len)
+{
+    RESULT error;
+
+    cdb10 cdb;
+    bool_t block_read;
+    optcl_iovec iov;
+    uint32_t transfer_size;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(buffer != 0);
+    if (device == 0 || command == 0 || buffer == 0)
+        return E_INVALIDARG;
+
+    error = prepare_read_10(device, command, buffer, buffer_len, cdb, 
+        &transfer_size);
     if (FAILED(error))
         return error;
 
-    nresponse = (optcl_mmc_response_read*)
-        malloc(sizeof(optcl_mmc_response_read));
-    if (nresponse == 0)
-        return E_OUTOFMEMORY;
+    error = use_block_reads(device, 
+        (command->fua == False) ? True : False, &block_read);
+    if (FAILED(error))
+        return error;
+
+    if (block_read == True) {
+        iov.base = buffer;
+        iov.len = transfer_size;
+        return optcl_device_block_read(device, command->start_lba, &iov, 1);
+    }
+
+    /*
+     * Execute command
+     */
+    return optcl_device_command_execute(device, cdb, sizeof(cdb), 
+        buffer, transfer_size);
+}
+
+RESULT optcl_command_read_10_mapped(const optcl_device *device,
+                                    const optcl_mmc_read_10 *command,
+                                    const uint8_t **data)
+{
+    cdb10 cdb;
+    RESULT error;
+    uint32_t transfer_size;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(data != 0);
+    if (device == 0 || command == 0 || data == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)command->transfer_length * READ_BLOCK_SIZE 
+        > limits.max_transfer_len)
+        return E_INVALIDARG;
 
     transfer_size = command->transfer_length * READ_BLOCK_SIZE;
-    if (transfer_size > max_transfer_len)
+    encode_read_10(command, cdb);
+
+    /*
+     * Execute command, the data view stays valid until the next
+     * command on the device
+     */
+    return optcl_device_command_execute_mapped(device, cdb, sizeof(cdb), 
+        transfer_size, data);
+}
+
+RESULT optcl_command_read_10_submit(const optcl_device *device,
+                                    const optcl_mmc_read_10 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len,
+                                    uint32_t tag)
+{
+    RESULT error;
+
+    cdb10 cdb;
+    uint32_t transfer_size;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(buffer != 0);
+    if (device == 0 || command == 0 || buffer == 0)
         return E_INVALIDARG;
 
+    error = prepare_read_10(device, command, buffer, buffer_len, cdb, 
+        &transfer_size);
+    if (FAILED(error))
+        return error;
+
     /*
-     * Execute command
+     * Submit command, buffer must stay valid until it completes
      */
-    memset(cdb, 0, sizeof(cdb));
-    cdb[0] = MMC_OPCODE_READ_10;
-    cdb[1] = (command->fua << 3);
-    cdb[2] = (uint8_t)(command->start_lba >> 24);
-    cdb[3] = (uint8_t)((command->start_lba << 8) >> 24);
-    cdb[4] = (uint8_t)((command->start_lba << 16) >> 24);
-    cdb[5] = (uint8_t)((command->start_lba << 24) >> 24);
-    cdb[7] = (uint8_t)(command->transfer_length >> 8);
-    cdb[8] = (uint8_t)((command->transfer_length << 8) >> 8);
-    mmc_response = (ptr_t)xmalloc_aligned(transfer_size, alignment);
-    if (mmc_response == 0)
+    return optcl_device_command_submit(device, cdb, sizeof(cdb), 
+        buffer, transfer_size, tag);
+}
+
+RESULT optcl_command_read_12(const optcl_device *device,
+                             const optcl_mmc_read_12 *command,
+                             optcl_mmc_response_read **response)
+{
+    RESULT error;
+
+    ptr_t data = 0;
+    uint32_t transfer_size;
+    optcl_transfer_limits limits;
+    optcl_mmc_response_read *nresponse = 0;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(response != 0);
+    if (device == 0 || command == 0 || response == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)command->transfer_length * READ_BLOCK_SIZE 
+        > limits.max_transfer_len)
+        return E_INVALIDARG;
+
+    transfer_size = command->transfer_length * READ_BLOCK_SIZE;
+
+    nresponse = (optcl_mmc_response_read*)
+        malloc(sizeof(optcl_mmc_response_read));
+    if (nresponse == 0)
         return E_OUTOFMEMORY;
 
-    error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
-        mmc_response, transfer_size);
-    if (FAILED(error)) {
+    data = (ptr_t)xmalloc_aligned(transfer_size, limits.alignment_mask);
+    if (data == 0) {
         free(nresponse);
-        xfree_aligned(mmc_response);
+        return E_OUTOFMEMORY;
     }
 
-    nresponse->data = (ptr_t)malloc(transfer_size);
-    if (nresponse->data == 0) {
+    error = optcl_command_read_12_direct(device, command, data, transfer_size);
+    if (FAILED(error)) {
         free(nresponse);
-        xfree_aligned(mmc_response);
-        return E_OUTOFMEMORY;
+        xfree_aligned(data);
+        return error;
     }
 
-    xmemcpy(nresponse->data, transfer_size, mmc_response, transfer_size);
-    xfree_aligned(mmc_response);
+    nresponse->header.command_opcode = MMC_OPCODE_READ_12;
+    nresponse->data = data;
     *response = nresponse;
     return error;
 }
 
-RESULT optcl_command_read_12(const optcl_device *device,
-                             const optcl_mmc_read_12 *command,
-                             optcl_mmc_response_read **response)
+RESULT optcl_command_read_12_direct(const optcl_device *device,
+                                    const optcl_mmc_read_12 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb12 cdb;
-    uint32_t alignment;
-    ptr_t mmc_response = 0;
-    uint32_t max_transfer_len;
-    optcl_adapter *adapter = 0;
-    optcl_mmc_response_read *nresponse = 0;
+    bool_t block_read;
+    optcl_iovec iov;
+    uint32_t transfer_size;
 
     assert(device != 0);
     assert(command != 0);
-    assert(response != 0);
-    if (device == 0 || command == 0 || response == 0)
+    assert(buffer != 0);
+    if (device == 0 || command == 0 || buffer == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = prepare_read_12(device, command, buffer, buffer_len, cdb, 
+        &transfer_size);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
+    error = use_block_reads(device, 
+        (command->fua == False && command->streaming == False) ? True : False, &block_read);
+    if (FAILED(error))
+        return error;
 
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
+    if (block_read == True) {
+        iov.base = buffer;
+        iov.len = transfer_size;
+        return optcl_device_block_read(device, command->start_lba, &iov, 1);
     }
 
-    error = optcl_adapter_get_max_transfer_len(adapter, &max_transfer_len);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
+    /*
+     * Execute command
+     */
+    return optcl_device_command_execute(device, cdb, sizeof(cdb), 
+        buffer, transfer_size);
+}
 
-    error = optcl_adapter_destroy(adapter);
+RESULT optcl_command_read_12_mapped(const optcl_device *device,
+                                    const optcl_mmc_read_12 *command,
+                                    const uint8_t **data)
+{
+    cdb12 cdb;
+    RESULT error;
+    uint32_t transfer_size;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(data != 0);
+    if (device == 0 || command == 0 || data == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    nresponse = (optcl_mmc_response_read*)
-        malloc(sizeof(optcl_mmc_response_read));
-    if (nresponse == 0)
-        return E_OUTOFMEMORY;
+    if ((uint64_t)command->transfer_length * READ_BLOCK_SIZE 
+        > limits.max_transfer_len)
+        return E_INVALIDARG;
+
+    transfer_size = command->transfer_length * READ_BLOCK_SIZE;
+    encode_read_12(command, cdb);
+
+    /*
+     * Execute command, the data view stays valid until the next
+     * command on the device
+     */
+    return optcl_device_command_execute_mapped(device, cdb, sizeof(cdb), 
+        transfer_size, data);
+}
+
+RESULT optcl_command_read_12_vectored(const optcl_device *device,
+                                      const optcl_mmc_read_12 *command,
+                                      const optcl_iovec iov[],
+                                      uint32_t iov_count)
+{
+    RESULT error;
+
+    cdb12 cdb;
+    uint32_t total_len;
 
-    if (command->transfer_length * READ_BLOCK_SIZE > max_transfer_len)
+    assert(device != 0);
+    assert(command != 0);
+    assert(iov != 0);
+    assert(iov_count > 0);
+    if (device == 0 || command == 0 || iov == 0 || iov_count == 0)
         return E_INVALIDARG;
 
+    error = check_data_vector(device, iov, iov_count, &total_len);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)command->transfer_length * READ_BLOCK_SIZE > total_len)
+        return E_DEVINVALIDSIZE;
+
     /*
      * Execute command
      */
-    memset(cdb, 0, sizeof(cdb));
-    cdb[0] = MMC_OPCODE_READ_12;
-    cdb[1] = (command->fua << 3);
-    cdb[2] = (uint8_t)(command->start_lba >> 24);
-    cdb[3] = (uint8_t)((command->start_lba << 8) >> 24);
-    cdb[4] = (uint8_t)((command->start_lba << 16) >> 24);
-    cdb[5] = (uint8_t)((command->start_lba << 24) >> 24);
-    cdb[6] = (uint8_t)(command->transfer_length >> 24);
-    cdb[7] = (uint8_t)((command->transfer_length << 8) >> 24);
-    cdb[8] = (uint8_t)((command->transfer_length << 16) >> 24);
-    cdb[9] = (uint8_t)((command->transfer_length << 24) >> 24);
-    cdb[10] = (command->streaming << 7);
-    mmc_response = (ptr_t)xmalloc_aligned(
-        command->transfer_length * READ_BLOCK_SIZE, alignment);
-    if (mmc_response == 0)
-        return E_OUTOFMEMORY;
+    encode_read_12(command, cdb);
+    return optcl_device_command_execute_vectored(device, cdb, sizeof(cdb), 
+        iov, iov_count);
+}
 
-    error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
-        mmc_response, command->transfer_length * READ_BLOCK_SIZE);
-    if (FAILED(error)) {
-        free(nresponse);
-        xfree_aligned(mmc_response);
-    }
+RESULT optcl_command_read_12_submit(const optcl_device *device,
+                                    const optcl_mmc_read_12 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len,
+                                    uint32_t tag)
+{
+    RESULT error;
 
-    nresponse->data = mmc_response;
-    *response = nresponse;
-    return error;
+    cdb12 cdb;
+    uint32_t transfer_size;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(buffer != 0);
+    if (device == 0 || command == 0 || buffer == 0)
+        return E_INVALIDARG;
+
+    error = prepare_read_12(device, command, buffer, buffer_len, cdb, 
+        &transfer_size);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * Submit command, buffer must stay valid until it completes
+     */
+    return optcl_device_command_submit(device, cdb, sizeof(cdb), 
+        buffer, transfer_size, tag);
 }
 
 RESULT optcl_command_read_buffer(const optcl_device *device,
@@ -3396,13 +3911,12 @@ RESULT optcl_command_read_buffer(const optcl_device *device,
                                  optcl_mmc_response_read_buffer **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     uint32_t alignment;
     uint32_t max_transfer_len;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_read_buffer *nresponse = 0;
 
     assert(device != 0);
@@ -3411,29 +3925,12 @@ RESULT optcl_command_read_buffer(const optcl_device *device,
     if (device == 0 || command == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_get_max_transfer_len(adapter, &max_transfer_len);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
+    max_transfer_len = limits.max_transfer_len;
 
     if (command->allocation_len > max_transfer_len)
         return E_INVALIDARG;
@@ -3490,12 +3987,11 @@ RESULT optcl_command_read_buffer_capacity(const optcl_device *device,
                                           optcl_mmc_response_read_buffer_capacity **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     uint32_t alignment;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_read_buffer_capacity *nresponse = 0;
     assert(device != 0);
     assert(command != 0);
@@ -3503,23 +3999,11 @@ RESULT optcl_command_read_buffer_capacity(const optcl_device *device,
     if (device == 0 || command == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     /*
      * Execute command
@@ -3568,80 +4052,294 @@ RESULT optcl_command_read_capacity(const optcl_device *device,
                                    optcl_mmc_response_read_capacity **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     uint32_t alignment;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_read_capacity *nresponse = 0;
     assert(device != 0);
     assert(response != 0);
     if (device == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
+    alignment = limits.alignment_mask;
+
+    /*
+     * Execute command
+     */
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = MMC_OPCODE_READ_CAPACITY;
+    mmc_response = (ptr_t)xmalloc_aligned(8, alignment);
+    if (mmc_response == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
+        mmc_response, 8);
     if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
+        xfree_aligned(mmc_response);
+        return error;
+    }
+
+    nresponse = (optcl_mmc_response_read_capacity*)
+        malloc(sizeof(optcl_mmc_response_read_capacity));
+    if (nresponse == 0) {
+        xfree_aligned(mmc_response);
+        return E_OUTOFMEMORY;
     }
 
-    error = optcl_adapter_destroy(adapter);
+    nresponse->header.command_opcode = MMC_OPCODE_READ_CAPACITY;
+    nresponse->lba = uint32_from_be(*(uint32_t*)&mmc_response[0]);
+    nresponse->block_len = uint32_from_be(*(uint32_t*)&mmc_response[4]);
+    return error;
+}
+
+RESULT optcl_command_read_cd(const optcl_device *device,
+                             const optcl_mmc_read_cd *command,
+                             optcl_mmc_response_read_cd **response)
+{
+    RESULT error;
+
+    ptr_t data = 0;
+    uint32_t block_size;
+    uint32_t transfer_size;
+    optcl_transfer_limits limits;
+    optcl_mmc_response_read_cd *nresponse = 0;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(response != 0);
+    if (device == 0 || command == 0 || response == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_command_read_cd_block_size(command, &block_size);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)command->transfer_len * block_size > limits.max_transfer_len)
+        return E_INVALIDARG;
+
+    transfer_size = command->transfer_len * block_size;
+
+    nresponse = (optcl_mmc_response_read_cd*)
+        malloc(sizeof(optcl_mmc_response_read_cd));
+    if (nresponse == 0)
+        return E_OUTOFMEMORY;
+
+    data = (ptr_t)xmalloc_aligned((transfer_size > 0) ? transfer_size : 1, 
+        limits.alignment_mask);
+    if (data == 0) {
+        free(nresponse);
+        return E_OUTOFMEMORY;
+    }
+
+    error = optcl_command_read_cd_direct(device, command, data, transfer_size);
+    if (FAILED(error)) {
+        free(nresponse);
+        xfree_aligned(data);
+        return error;
+    }
+
+    nresponse->header.command_opcode = MMC_OPCODE_READ_CD;
+    nresponse->block_size = block_size;
+    nresponse->data = data;
+    *response = nresponse;
+    return error;
+}
+
+RESULT optcl_command_read_cd_block_size(const optcl_mmc_read_cd *command,
+                                        uint32_t *block_size)
+{
+    uint32_t size = 0;
+    uint32_t subheader = 0;
+    uint32_t user_data = 0;
+    uint32_t edc_ecc = 0;
+
+    assert(command != 0);
+    assert(block_size != 0);
+    if (command == 0 || block_size == 0)
+        return E_INVALIDARG;
+
+    /*
+     * Any sector type uses the mode 1 layout, every type has the same
+     * size when all main channel fields are selected
+     */
+    switch (command->est) {
+    case MMC_READ_CD_EST_ALL:
+    case MMC_READ_CD_EST_MODE1:
+        user_data = 2048;
+        edc_ecc = 288;
+        break;
+
+    case MMC_READ_CD_EST_CDDA:
+        user_data = 2352;
+        break;
+
+    case MMC_READ_CD_EST_MODE2_FORMLESS:
+        user_data = 2336;
+        break;
+
+    case MMC_READ_CD_EST_MODE2_FORM1:
+        subheader = 8;
+        user_data = 2048;
+        edc_ecc = 280;
+        break;
+
+    case MMC_READ_CD_EST_MODE2_FORM2:
+        subheader = 8;
+        user_data = 2324;
+        edc_ecc = 4;
+        break;
+
+    default:
+        return E_INVALIDARG;
+    }
+
+    /* CD-DA sectors have no headers, only the user data field counts */
+    if (command->est == MMC_READ_CD_EST_CDDA) {
+        if (command->user_data == True)
+            size += user_data;
+    } else {
+        if (command->sync == True)
+            size += 12;
+
+        if (command->header_codes & MMC_READ_CD_MCSB_4BYTE_HEADER)
+            size += 4;
+
+        if (command->header_codes & MMC_READ_CD_MCSB_8BYTE_SUBHEADER)
+            size += subheader;
+
+        if (command->user_data == True)
+            size += user_data;
+
+        if (command->edc_ecc == True)
+            size += edc_ecc;
+    }
+
+    switch (command->c2_error_info) {
+    case MMC_READ_CD_C2EI_NO_ERROR:
+        break;
+
+    case MMC_READ_CD_C2EI_C2EC294:
+        size += 294;
+        break;
+
+    case MMC_READ_CD_C2EI_C2EC296:
+        size += 296;
+        break;
+
+    default:
+        return E_INVALIDARG;
+    }
+
+    switch (command->subchannel_sel) {
+    case MMC_READ_CD_SCSB_NO_DATA:
+        break;
+
+    case MMC_READ_CD_SCSB_RAW_PW:
+    case MMC_READ_CD_SCSB_CORINTRW_SUBCH:
+        size += 96;
+        break;
+
+    case MMC_READ_CD_SCSB_FORMQ_SUBCH:
+        size += 16;
+        break;
+
+    default:
+        return E_INVALIDARG;
+    }
+
+    *block_size = size;
+    return SUCCESS;
+}
+
+RESULT optcl_command_read_cd_direct(const optcl_device *device,
+                                    const optcl_mmc_read_cd *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len)
+{
+    RESULT error;
+
+    cdb12 cdb;
+    uint32_t transfer_size;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(buffer != 0);
+    if (device == 0 || command == 0 || buffer == 0)
+        return E_INVALIDARG;
+
+    error = prepare_read_cd(device, command, buffer, buffer_len, cdb, 
+        &transfer_size);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * Execute command
+     */
+    return optcl_device_command_execute(device, cdb, sizeof(cdb), 
+        buffer, transfer_size);
+}
+
+RESULT optcl_command_read_cd_mapped(const optcl_device *device,
+                                    const optcl_mmc_read_cd *command,
+                                    const uint8_t **data)
+{
+    RESULT error;
+
+    cdb12 cdb;
+    uint32_t block_size;
+    uint32_t transfer_size;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(data != 0);
+    if (device == 0 || command == 0 || data == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    /*
-     * Execute command
-     */
-    memset(cdb, 0, sizeof(cdb));
-    cdb[0] = MMC_OPCODE_READ_CAPACITY;
-    mmc_response = (ptr_t)xmalloc_aligned(8, alignment);
-    if (mmc_response == 0)
-        return E_OUTOFMEMORY;
-
-    error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
-        mmc_response, 8);
-    if (FAILED(error)) {
-        xfree_aligned(mmc_response);
+    error = optcl_command_read_cd_block_size(command, &block_size);
+    if (FAILED(error))
         return error;
-    }
 
-    nresponse = (optcl_mmc_response_read_capacity*)
-        malloc(sizeof(optcl_mmc_response_read_capacity));
-    if (nresponse == 0) {
-        xfree_aligned(mmc_response);
-        return E_OUTOFMEMORY;
-    }
+    if (command->transfer_len > 0x00FFFFFF 
+        || (uint64_t)command->transfer_len * block_size > limits.max_transfer_len)
+        return E_INVALIDARG;
 
-    nresponse->header.command_opcode = MMC_OPCODE_READ_CAPACITY;
-    nresponse->lba = uint32_from_be(*(uint32_t*)&mmc_response[0]);
-    nresponse->block_len = uint32_from_be(*(uint32_t*)&mmc_response[4]);
-    return error;
-}
+    transfer_size = command->transfer_len * block_size;
+    encode_read_cd(command, cdb);
 
-RESULT optcl_command_read_cd(const optcl_device *device,
-                             const optcl_mmc_read_cd *command,
-                             optcl_mmc_response_read_cd **response)
-{
-    return SUCCESS;
+    /*
+     * Execute command, the data view stays valid until the next
+     * command on the device
+     */
+    return optcl_device_command_execute_mapped(device, cdb, sizeof(cdb), 
+        transfer_size, data);
 }
 
 RESULT optcl_command_read_msn(const optcl_device *device,
                               optcl_mmc_response_read_msn **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb12 cdb;
     ptr_t msn = 0;
     uint32_t msnlen;
     uint32_t alignment;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_read_msn *nresponse = 0;
 
     assert(device != 0);
@@ -3649,23 +4347,11 @@ RESULT optcl_command_read_msn(const optcl_device *device,
     if (device == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     /*
      * Execute command to get MSN length
@@ -3734,12 +4420,11 @@ RESULT optcl_command_read_track_information(const optcl_device *device,
                                             optcl_mmc_response_read_track_info **response)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     uint32_t alignment;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_read_track_info *nresponse = 0;
     assert(device != NULL);
     assert(command != NULL);
@@ -3747,23 +4432,11 @@ RESULT optcl_command_read_track_information(const optcl_device *device,
     if (device == 0 || command == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     /*
      * Execute command
@@ -3854,12 +4527,11 @@ RESULT optcl_command_request_sense(const optcl_device *device,
 {
     RESULT error;
     RESULT sense_code;
-    RESULT destroy_error;
 
     cdb6 cdb;
     uint32_t alignment;
     ptr_t mmc_response = 0;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
     optcl_mmc_response_request_sense *nresponse = 0;
 
     assert(device != 0);
@@ -3868,23 +4540,11 @@ RESULT optcl_command_request_sense(const optcl_device *device,
     if (device == 0 || command == 0 || response == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     /*
      * Execute command
@@ -3984,37 +4644,24 @@ RESULT optcl_command_send_disc_structure(const optcl_device *device,
                                          const optcl_mmc_send_disc_structure *command)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb12 cdb;
     ptr_t ndata = 0;
     ptr_t dataout = 0;
     uint32_t alignment;
     uint16_t dataout_len;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != 0);
     assert(command != 0);
     if (device == 0 || command == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     error = create_dataout_send_disc_structure(command, &ndata, &dataout_len);
     if (FAILED(error))
@@ -4058,13 +4705,12 @@ RESULT optcl_command_send_opc_information(const optcl_device *device,
                                           const optcl_mmc_send_opc_information *command)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     ptr_t data = 0;
     uint32_t alignment;
     uint16_t param_list_len;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != 0);
     assert(command != 0);
@@ -4075,23 +4721,11 @@ RESULT optcl_command_send_opc_information(const optcl_device *device,
     if (command->opc_entry_num < 1)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     param_list_len = command->opc_entry_num * sizeof(command->opc_table_entries[0]);
     data = (ptr_t)xmalloc_aligned(param_list_len, alignment);
@@ -4200,7 +4834,6 @@ RESULT optcl_command_set_streaming(const optcl_device *device,
                                    const optcl_mmc_set_streaming *command)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb12 cdb;
     uint32_t i;
@@ -4209,30 +4842,18 @@ RESULT optcl_command_set_streaming(const optcl_device *device,
     ptr_t data = 0;
     uint32_t alignment;
     uint32_t param_list_len;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != NULL);
     assert(command != NULL);
     if (device == 0 || command == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     if (command->type == MMC_SET_STREAMING_PERFORMANCE) {
         param_list_len = 28;
@@ -4391,12 +5012,10 @@ RESULT optcl_command_write(const optcl_device *device,
                            uint32_t data_len)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     ptr_t ndata = 0;
-    uint32_t alignment;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != 0);
     assert(command != 0);
@@ -4405,61 +5024,108 @@ RESULT optcl_command_write(const optcl_device *device,
     if (device == 0 || command == 0 || data == 0 || data_len < 1)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
+    error = prepare_dataout(device, &limits, data, data_len, &ndata);
     if (FAILED(error))
         return error;
 
-    ndata = (ptr_t)xmalloc_aligned(data_len, alignment);
-    if (ndata == 0)
-        return E_OUTOFMEMORY;
-
-    xmemcpy(ndata, data_len, data, data_len);
-
     /*
      * Execute command
      */
-    memset(cdb, 0, sizeof(cdb));
-    cdb[0] = MMC_OPCODE_WRITE;
-    cdb[1] = (uint8_t)((command->fua << 3) | (command->tsr << 2));
-    cdb[2] = (uint8_t)(command->lba >> 24);
-    cdb[3] = (uint8_t)((command->lba << 8) >> 24);
-    cdb[4] = (uint8_t)((command->lba << 16) >> 24);
-    cdb[5] = (uint8_t)((command->lba << 24) >> 24);
-    cdb[7] = (uint8_t)(command->transfer_len >> 8);
-    cdb[8] = (uint8_t)((command->transfer_len << 8) >> 8);
+    encode_write_10(command, cdb);
     error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
         ndata, data_len);
-    xfree_aligned(ndata);
+
+    if (ndata != data)
+        xfree_aligned(ndata);
 
     return error;
 }
 
+RESULT optcl_command_write_submit(const optcl_device *device,
+                                  const optcl_mmc_write *command,
+                                  ptr_t data,
+                                  uint32_t data_len,
+                                  uint32_t tag)
+{
+    RESULT error;
+
+    cdb10 cdb;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(data != 0);
+    assert(data_len > 0);
+    if (device == 0 || command == 0 || data == 0 || data_len < 1)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * Data can not be bounced while the command is in flight,
+     * it has to be registered or aligned for the device.
+     */
+    error = check_data_buffer(device, &limits, data, data_len, data_len);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * Submit command, data must stay valid until it completes
+     */
+    encode_write_10(command, cdb);
+    return optcl_device_command_submit(device, cdb, sizeof(cdb), 
+        data, data_len, tag);
+}
+
+RESULT optcl_command_write_vectored(const optcl_device *device,
+                                    const optcl_mmc_write *command,
+                                    const optcl_iovec iov[],
+                                    uint32_t iov_count)
+{
+    RESULT error;
+
+    cdb10 cdb;
+    uint32_t total_len;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(iov != 0);
+    assert(iov_count > 0);
+    if (device == 0 || command == 0 || iov == 0 || iov_count == 0)
+        return E_INVALIDARG;
+
+    error = check_data_vector(device, iov, iov_count, &total_len);
+    if (FAILED(error))
+        return error;
+
+    /* Blocks of every write type carry at least 2 KiB of data */
+    if ((uint64_t)command->transfer_len * MIN_WRITE_BLOCK_SIZE > total_len)
+        return E_DEVINVALIDSIZE;
+
+    /*
+     * Execute command
+     */
+    encode_write_10(command, cdb);
+    return optcl_device_command_execute_vectored(device, cdb, sizeof(cdb), 
+        iov, iov_count);
+}
+
 RESULT optcl_command_write_12(const optcl_device *device,
                               const optcl_mmc_write_12 *command,
                               ptr_t data,
                               uint32_t data_len)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb12 cdb;
     ptr_t ndata = 0;
-    uint32_t alignment;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != 0);
     assert(command != 0);
@@ -4468,64 +5134,108 @@ RESULT optcl_command_write_12(const optcl_device *device,
     if (device == 0 || command == 0 || data == 0 || data_len < 1)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
+    error = prepare_dataout(device, &limits, data, data_len, &ndata);
     if (FAILED(error))
         return error;
 
-    ndata = (ptr_t)xmalloc_aligned(data_len, alignment);
-    if (ndata == 0)
-        return E_OUTOFMEMORY;
-
-    xmemcpy(ndata, data_len, data, data_len);
-
     /*
      * Execute command
      */
-    memset(cdb, 0, sizeof(cdb));
-    cdb[0] = MMC_OPCODE_WRITE;
-    cdb[1] = (uint8_t)((command->fua << 3) | (command->tsr << 2));
-    cdb[2] = (uint8_t)(command->lba >> 24);
-    cdb[3] = (uint8_t)((command->lba << 8) >> 24);
-    cdb[4] = (uint8_t)((command->lba << 16) >> 24);
-    cdb[5] = (uint8_t)((command->lba << 24) >> 24);
-    cdb[6] = (uint8_t)(command->transfer_len >> 24);
-    cdb[7] = (uint8_t)((command->transfer_len << 8) >> 24);
-    cdb[8] = (uint8_t)((command->transfer_len << 16) >> 24);
-    cdb[9] = (uint8_t)((command->transfer_len << 24) >> 24);
-    cdb[10] = (uint8_t)((command->streaming << 7) | (command->vnr << 6));
+    encode_write_12(command, cdb);
     error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
         ndata, data_len);
-    xfree_aligned(ndata);
+
+    if (ndata != data)
+        xfree_aligned(ndata);
 
     return error;
 }
 
+RESULT optcl_command_write_12_submit(const optcl_device *device,
+                                     const optcl_mmc_write_12 *command,
+                                     ptr_t data,
+                                     uint32_t data_len,
+                                     uint32_t tag)
+{
+    RESULT error;
+
+    cdb12 cdb;
+    optcl_transfer_limits limits;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(data != 0);
+    assert(data_len > 0);
+    if (device == 0 || command == 0 || data == 0 || data_len < 1)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transfer_limits(device, &limits);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * Data can not be bounced while the command is in flight,
+     * it has to be registered or aligned for the device.
+     */
+    error = check_data_buffer(device, &limits, data, data_len, data_len);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * Submit command, data must stay valid until it completes
+     */
+    encode_write_12(command, cdb);
+    return optcl_device_command_submit(device, cdb, sizeof(cdb), 
+        data, data_len, tag);
+}
+
+RESULT optcl_command_write_12_vectored(const optcl_device *device,
+                                       const optcl_mmc_write_12 *command,
+                                       const optcl_iovec iov[],
+                                       uint32_t iov_count)
+{
+    RESULT error;
+
+    cdb12 cdb;
+    uint32_t total_len;
+
+    assert(device != 0);
+    assert(command != 0);
+    assert(iov != 0);
+    assert(iov_count > 0);
+    if (device == 0 || command == 0 || iov == 0 || iov_count == 0)
+        return E_INVALIDARG;
+
+    error = check_data_vector(device, iov, iov_count, &total_len);
+    if (FAILED(error))
+        return error;
+
+    /* Blocks of every write type carry at least 2 KiB of data */
+    if ((uint64_t)command->transfer_len * MIN_WRITE_BLOCK_SIZE > total_len)
+        return E_DEVINVALIDSIZE;
+
+    /*
+     * Execute command
+     */
+    encode_write_12(command, cdb);
+    return optcl_device_command_execute_vectored(device, cdb, sizeof(cdb), 
+        iov, iov_count);
+}
+
 RESULT optcl_command_write_and_verify_10(const optcl_device *device,
                                          const optcl_mmc_write_and_verify_10 *command,
                                          ptr_t data,
                                          uint32_t data_len)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     ptr_t ndata = 0;
-    uint32_t alignment;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != 0);
     assert(command != 0);
@@ -4534,35 +5244,19 @@ RESULT optcl_command_write_and_verify_10(const optcl_device *device,
     if (device == 0 || command == 0 || data == 0 || data_len < 1)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
+    error = prepare_dataout(device, &limits, data, data_len, &ndata);
     if (FAILED(error))
         return error;
 
-    ndata = (ptr_t)xmalloc_aligned(data_len, alignment);
-    if (ndata == 0)
-        return E_OUTOFMEMORY;
-
-    xmemcpy(ndata, data_len, data, data_len);
-
     /*
      * Execute command
      */
     memset(cdb, 0, sizeof(cdb));
-    cdb[0] = MMC_OPCODE_WRITE;
+    cdb[0] = MMC_OPCODE_WRITE_AND_VERIFY_10;
     cdb[2] = (uint8_t)(command->lba >> 24);
     cdb[3] = (uint8_t)((command->lba << 8) >> 24);
     cdb[4] = (uint8_t)((command->lba << 16) >> 24);
@@ -4571,7 +5265,9 @@ RESULT optcl_command_write_and_verify_10(const optcl_device *device,
     cdb[8] = (uint8_t)((command->transfer_len << 8) >> 8);
     error = optcl_device_command_execute(device, cdb, sizeof(cdb), 
         ndata, data_len);
-    xfree_aligned(ndata);
+
+    if (ndata != data)
+        xfree_aligned(ndata);
 
     return error;
 }
@@ -4580,37 +5276,24 @@ RESULT optcl_command_write_buffer(const optcl_device *device,
                                   const optcl_mmc_write_buffer *command)
 {
     RESULT error;
-    RESULT destroy_error;
 
     cdb10 cdb;
     ptr_t ndata = 0;
     ptr_t dataout = 0;
     uint32_t dataoutlen;
     uint32_t alignment;
-    optcl_adapter *adapter = 0;
+    optcl_transfer_limits limits;
 
     assert(device != 0);
     assert(command != 0);
     if (device == 0 || command == 0)
         return E_INVALIDARG;
 
-    error = optcl_device_get_adapter(device, &adapter);
+    error = optcl_device_get_transfer_limits(device, &limits);
     if (FAILED(error))
         return error;
 
-    assert(adapter != 0);
-    if (adapter == 0)
-        return E_POINTER;
-
-    error = optcl_adapter_get_alignment_mask(adapter, &alignment);
-    if (FAILED(error)) {
-        destroy_error = optcl_adapter_destroy(adapter);
-        return SUCCEEDED(destroy_error) ? error : destroy_error;
-    }
-
-    error = optcl_adapter_destroy(adapter);
-    if (FAILED(error))
-        return error;
+    alignment = limits.alignment_mask;
 
     error = create_dataout_write_buffer(command, &ndata, &dataoutlen);
     if (FAILED(error))
@@ -4774,12 +5457,14 @@ static RESULT deallocator_mmc_response_read_10(optcl_mmc_response *response)
     if (response == 0)
         return SUCCESS;
 
-    assert(response->command_opcode == MMC_OPCODE_READ_10);
-    if (response->command_opcode != MMC_OPCODE_READ_10)
+    assert(response->command_opcode == MMC_OPCODE_READ_10 
+        || response->command_opcode == MMC_OPCODE_READ_12);
+    if (response->command_opcode != MMC_OPCODE_READ_10 
+        && response->command_opcode != MMC_OPCODE_READ_12)
         return E_CMNDINVOPCODE;
 
     mmc_response = (optcl_mmc_response_read*)response;
-    free(mmc_response->data);
+    xfree_aligned(mmc_response->data);
     free(mmc_response);
     return SUCCESS;
 }
@@ -4874,6 +5559,17 @@ static RESULT deallocator_mmc_response_read_track_information(optcl_mmc_response
 
 static RESULT deallocator_mmc_response_read_cd(optcl_mmc_response *response)
 {
+    optcl_mmc_response_read_cd *mmc_response = 0;
+    if (response == 0)
+        return SUCCESS;
+
+    assert(response->command_opcode == MMC_OPCODE_READ_CD);
+    if (response->command_opcode != MMC_OPCODE_READ_CD)
+        return E_CMNDINVOPCODE;
+
+    mmc_response = (optcl_mmc_response_read_cd*)response;
+    xfree_aligned(mmc_response->data);
+    free(mmc_response);
     return SUCCESS;
 }
 
@@ -4897,9 +5593,9 @@ static RESULT deallocator_mmc_response_request_sense(optcl_mmc_response *respons
 
 static struct response_deallocator_entry __deallocator_table[] = {
     { MMC_OPCODE_CLOSE_TRACK_SESSION,   deallocator_mmc_response_close_track_session	},
-    { MMC_OPCODE_INQUIRY,               deallocator_mmc_response_get_configuration      },
-    { MMC_OPCODE_GET_CONFIG,            deallocator_mmc_response_get_event_status       },
-    { MMC_OPCODE_GET_EVENT_STATUS,      deallocator_mmc_response_inquiry                },
+    { MMC_OPCODE_INQUIRY,               deallocator_mmc_response_inquiry                },
+    { MMC_OPCODE_GET_CONFIG,            deallocator_mmc_response_get_configuration      },
+    { MMC_OPCODE_GET_EVENT_STATUS,      deallocator_mmc_response_get_event_status       },
     { MMC_OPCODE_GET_PERFORMANCE,       deallocator_mmc_response_get_performance        },
     { MMC_OPCODE_MECHANISM_STATUS,      deallocator_mmc_response_mechanism_status       },
     { MMC_OPCODE_MODE_SENSE,            deallocator_mmc_response_sense_10               },
@@ -27,6 +27,15 @@
 #include "types.h"
 
 
+/*
+ * Command data transfer direction
+ */
+
+#define MMC_DATA_DIRECTION_NONE                                     0x00
+#define MMC_DATA_DIRECTION_IN                                       0x01
+#define MMC_DATA_DIRECTION_OUT                                      0x02
+
+
 /*
  * BLANK command command field flags
  */
@@ -123,12 +132,13 @@
  * GET EVENT STATUS NOTIFICATION command field flags
  */
 
-#define MMC_GET_EVENT_STATUS_OPCHANGE                               0x01
-#define MMC_GET_EVENT_STATUS_POWERMGMT                              0x02
-#define MMC_GET_EVENT_STATUS_EXTREQUEST                             0x04
-#define MMC_GET_EVENT_STATUS_MEDIA                                  0x08
-#define MMC_GET_EVENT_STATUS_MULTIHOST                              0x10
-#define MMC_GET_EVENT_STATUS_DEVICEBUSY                             0x20
+/* Class N is bit N of the class request, bit 0 is reserved */
+#define MMC_GET_EVENT_STATUS_OPCHANGE                               0x02
+#define MMC_GET_EVENT_STATUS_POWERMGMT                              0x04
+#define MMC_GET_EVENT_STATUS_EXTREQUEST                             0x08
+#define MMC_GET_EVENT_STATUS_MEDIA                                  0x10
+#define MMC_GET_EVENT_STATUS_MULTIHOST                              0x20
+#define MMC_GET_EVENT_STATUS_DEVICEBUSY                             0x40
 
 #define EVENT_OC_EC_NOCHG                                           0x00
 #define EVENT_OC_EC_CHANGED                                         0x02
@@ -325,6 +335,7 @@
 
 /* Sub-channel Selection Bits */
 #define MMC_READ_CD_SCSB_NO_DATA                                    0x00
+#define MMC_READ_CD_SCSB_RAW_PW                                     0x01
 #define MMC_READ_CD_SCSB_FORMQ_SUBCH                                0x02
 #define MMC_READ_CD_SCSB_CORINTRW_SUBCH                             0x04
 
@@ -523,7 +534,7 @@ typedef struct tag_mmc_response_get_configuration {
 typedef struct tag_mmc_get_event_status {
     bool_t polled;
     uint8_t class_request;
-    uint16_t allocation_length;
+    uint16_t allocation_length;     /* Zero reads the header first */
 } optcl_mmc_get_event_status;
 
 typedef struct tag_mmc_ges_header {
@@ -1030,7 +1041,9 @@ typedef struct tag_mmc_read_cd {
 } optcl_mmc_read_cd;
 
 typedef struct tag_mmc_response_read_cd {
-
+    optcl_mmc_response header;
+    uint32_t block_size;
+    ptr_t data;
 } optcl_mmc_response_read_cd;
 
 
@@ -1403,16 +1416,38 @@ extern
 RESULT optcl_command_format_unit(const optcl_device *device,
                                  const optcl_mmc_format_unit *command);
 
+extern 
+RESULT optcl_command_get_data_direction(const uint8_t cdb[],
+                                        uint32_t cdb_size,
+                                        uint32_t param_size,
+                                        int *direction);
+
 extern 
 RESULT optcl_command_get_configuration(const optcl_device *device,
                                        const optcl_mmc_get_configuration *command,
                                        optcl_mmc_response_get_configuration **response);
 
+/* Parse raw GET CONFIGURATION data, header included */
+extern 
+RESULT optcl_command_parse_configuration(const uint8_t data[],
+                                         uint32_t size,
+                                         optcl_mmc_response_get_configuration **response);
+
+/*
+ * GET EVENT STATUS NOTIFICATION, a polled request gets the event of a
+ * single class, 8 bytes hold its header and descriptor
+ */
 extern 
 RESULT optcl_command_get_event_status(const optcl_device *device,
                                       const optcl_mmc_get_event_status *command,
                                       optcl_mmc_response_get_event_status **response);
 
+/* Parse raw GET EVENT STATUS NOTIFICATION data, header included */
+extern 
+RESULT optcl_command_parse_event_status(const uint8_t data[],
+                                        uint32_t size,
+                                        optcl_mmc_response_get_event_status **response);
+
 extern 
 RESULT optcl_command_get_performance(const optcl_device *device,
                                      const optcl_mmc_get_performance *command,
@@ -1449,11 +1484,53 @@ RESULT optcl_command_read_10(const optcl_device *device,
                              const optcl_mmc_read_10 *command,
                              optcl_mmc_response_read **response);
 
+extern 
+RESULT optcl_command_read_10_direct(const optcl_device *device,
+                                    const optcl_mmc_read_10 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len);
+
+extern 
+RESULT optcl_command_read_10_mapped(const optcl_device *device,
+                                    const optcl_mmc_read_10 *command,
+                                    const uint8_t **data);
+
+extern 
+RESULT optcl_command_read_10_submit(const optcl_device *device,
+                                    const optcl_mmc_read_10 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len,
+                                    uint32_t tag);
+
 extern 
 RESULT optcl_command_read_12(const optcl_device *device,
                              const optcl_mmc_read_12 *command,
                              optcl_mmc_response_read **response);
 
+extern 
+RESULT optcl_command_read_12_direct(const optcl_device *device,
+                                    const optcl_mmc_read_12 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len);
+
+extern 
+RESULT optcl_command_read_12_mapped(const optcl_device *device,
+                                    const optcl_mmc_read_12 *command,
+                                    const uint8_t **data);
+
+extern 
+RESULT optcl_command_read_12_submit(const optcl_device *device,
+                                    const optcl_mmc_read_12 *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len,
+                                    uint32_t tag);
+
+extern 
+RESULT optcl_command_read_12_vectored(const optcl_device *device,
+                                      const optcl_mmc_read_12 *command,
+                                      const optcl_iovec iov[],
+                                      uint32_t iov_count);
+
 extern 
 RESULT optcl_command_read_buffer(const optcl_device *device,
                                  const optcl_mmc_read_buffer *command,
@@ -1473,6 +1550,22 @@ RESULT optcl_command_read_cd(const optcl_device *device,
                              const optcl_mmc_read_cd *command,
                              optcl_mmc_response_read_cd **response);
 
+/* Get the size of a block transferred with the command field selection */
+extern 
+RESULT optcl_command_read_cd_block_size(const optcl_mmc_read_cd *command,
+                                        uint32_t *block_size);
+
+extern 
+RESULT optcl_command_read_cd_direct(const optcl_device *device,
+                                    const optcl_mmc_read_cd *command,
+                                    ptr_t buffer,
+                                    uint32_t buffer_len);
+
+extern 
+RESULT optcl_command_read_cd_mapped(const optcl_device *device,
+                                    const optcl_mmc_read_cd *command,
+                                    const uint8_t **data);
+
 extern 
 RESULT optcl_command_read_msn(const optcl_device *device,
                               optcl_mmc_response_read_msn **response);
@@ -1538,12 +1631,38 @@ RESULT optcl_command_write(const optcl_device *device,
                            const optcl_mmc_write *command, ptr_t data,
                            uint32_t data_len);
 
+extern 
+RESULT optcl_command_write_submit(const optcl_device *device,
+                                  const optcl_mmc_write *command,
+                                  ptr_t data,
+                                  uint32_t data_len,
+                                  uint32_t tag);
+
+extern 
+RESULT optcl_command_write_vectored(const optcl_device *device,
+                                    const optcl_mmc_write *command,
+                                    const optcl_iovec iov[],
+                                    uint32_t iov_count);
+
 extern 
 RESULT optcl_command_write_12(const optcl_device *device,
                               const optcl_mmc_write_12 *command,
                               ptr_t data,
                               uint32_t data_len);
 
+extern 
+RESULT optcl_command_write_12_submit(const optcl_device *device,
+                                     const optcl_mmc_write_12 *command,
+                                     ptr_t data,
+                                     uint32_t data_len,
+                                     uint32_t tag);
+
+extern 
+RESULT optcl_command_write_12_vectored(const optcl_device *device,
+                                       const optcl_mmc_write_12 *command,
+                                       const optcl_iovec iov[],
+                                       uint32_t iov_count);
+
 extern 
 RESULT optcl_command_write_and_verify_10(const optcl_device *device,
                                          const optcl_mmc_write_and_verify_10 *command,
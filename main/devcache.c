@@ -0,0 +1,643 @@
+/*
+    devcache.c - Persistent device enumeration cache
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "adapter.h"
+#include "devcache.h"
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Record layout
+ */
+
+#define RECORD_LOCATION			0
+#define RECORD_VENDOR			256
+#define RECORD_PRODUCT			268
+#define RECORD_REVISION			288
+#define RECORD_SERIAL			296
+#define RECORD_VENDOR_STRING		336
+#define RECORD_VENDOR_STRING_SIZE	24
+#define RECORD_DEVICE_TYPE		360
+#define RECORD_BUS_TYPE			362
+#define RECORD_ALIGNMENT_MASK		364
+#define RECORD_MAX_PAGES		368
+#define RECORD_MAX_TRANSFER_LEN		372
+#define RECORD_FEATURES_OFFSET		376
+#define RECORD_FEATURES_SIZE		380
+
+
+/*
+ * Internal structures
+ */
+
+/* Cached drive, records read from the file point into its mapping */
+typedef struct tag_devcache_entry {
+    const uint8_t *record;
+    const uint8_t *features;
+    uint32_t features_size;
+    uint8_t *data;              /* Record and features owned by the entry */
+} optcl_devcache_entry;
+
+struct tag_devcache {
+    char *filename;
+    xfile_map map;
+    bool_t mapped;
+    bool_t changed;
+    uint32_t count;
+    optcl_devcache_entry entries[DEVCACHE_MAX_ENTRIES];
+};
+
+
+/*
+ * Helper functions
+ */
+
+static uint16_t get_le16(const uint8_t data[])
+{
+    return (uint16_t)(((uint16_t)data[1] << 8) | data[0]);
+}
+
+static uint32_t get_le32(const uint8_t data[])
+{
+    return ((uint32_t)data[3] << 24) | ((uint32_t)data[2] << 16)
+        | ((uint32_t)data[1] << 8) | (uint32_t)data[0];
+}
+
+static void put_le16(uint8_t data[], uint16_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+}
+
+static void put_le32(uint8_t data[], uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+/* Copy a zero padded record field into a string */
+static void get_field(char dest[], size_t dest_size,
+                      const uint8_t record[], uint32_t offset, size_t size)
+{
+    size_t len = (size < dest_size) ? size : dest_size - 1;
+
+    memcpy(dest, &record[offset], len);
+    dest[len] = 0;
+}
+
+/* Store a string into a zero padded record field, cutting it to fit */
+static void put_field(uint8_t record[], uint32_t offset, size_t size,
+                      const char *src)
+{
+    size_t len = (src != 0) ? strlen(src) : 0;
+
+    if (len > size - 1)
+        len = size - 1;
+
+    memset(&record[offset], 0, size);
+    if (len > 0)
+        memcpy(&record[offset], src, len);
+}
+
+static bool_t field_equals(const uint8_t record[], uint32_t offset,
+                           size_t size, const char *value)
+{
+    char field[DEVCACHE_LOCATION_SIZE];
+
+    assert(size <= sizeof(field));
+    get_field(field, sizeof(field), record, offset, size);
+    return (strcmp(field, value) == 0) ? True : False;
+}
+
+static optcl_devcache_entry* find_entry(const optcl_devcache *cache,
+                                        const char *location)
+{
+    uint32_t i;
+
+    for (i = 0; i < cache->count; ++i) {
+        if (field_equals(cache->entries[i].record, RECORD_LOCATION,
+            DEVCACHE_LOCATION_SIZE, location) == True)
+            return (optcl_devcache_entry*)&cache->entries[i];
+    }
+
+    return 0;
+}
+
+static void free_entry(optcl_devcache_entry *entry)
+{
+    free(entry->data);
+    memset(entry, 0, sizeof(optcl_devcache_entry));
+}
+
+/* Copy an entry out of the file mapping */
+static RESULT own_entry(optcl_devcache_entry *entry)
+{
+    uint8_t *data;
+
+    if (entry->data != 0)
+        return SUCCESS;
+
+    data = (uint8_t*)malloc(DEVCACHE_RECORD_SIZE + entry->features_size);
+    if (data == 0)
+        return E_OUTOFMEMORY;
+
+    memcpy(data, entry->record, DEVCACHE_RECORD_SIZE);
+    if (entry->features_size > 0)
+        memcpy(&data[DEVCACHE_RECORD_SIZE], entry->features,
+            entry->features_size);
+
+    entry->data = data;
+    entry->record = data;
+    entry->features = &data[DEVCACHE_RECORD_SIZE];
+    return SUCCESS;
+}
+
+/* Index the records of a mapped cache file, unusable records are left out */
+static void read_entries(optcl_devcache *cache)
+{
+    uint32_t i;
+    uint32_t count;
+    uint32_t offset;
+    uint32_t size;
+    const uint8_t *record;
+    const uint8_t *view = (const uint8_t*)cache->map.view;
+
+    if (view == 0 || cache->map.size < DEVCACHE_HEADER_SIZE)
+        return;
+
+    if (memcmp(view, DEVCACHE_MAGIC, 8) != 0
+        || get_le32(&view[8]) != DEVCACHE_VERSION)
+        return;
+
+    count = get_le32(&view[12]);
+    if (count > DEVCACHE_MAX_ENTRIES
+        || DEVCACHE_HEADER_SIZE + (uint64_t)count * DEVCACHE_RECORD_SIZE
+        > cache->map.size)
+        return;
+
+    for (i = 0; i < count; ++i) {
+        record = &view[DEVCACHE_HEADER_SIZE + i * DEVCACHE_RECORD_SIZE];
+        offset = get_le32(&record[RECORD_FEATURES_OFFSET]);
+        size = get_le32(&record[RECORD_FEATURES_SIZE]);
+
+        if (record[RECORD_LOCATION] == 0
+            || record[RECORD_LOCATION + DEVCACHE_LOCATION_SIZE - 1] != 0
+            || size > DEVCACHE_MAX_FEATURES_SIZE
+            || (uint64_t)offset + size > cache->map.size)
+            continue;
+
+        cache->entries[cache->count].record = record;
+        cache->entries[cache->count].features = &view[offset];
+        cache->entries[cache->count].features_size = size;
+        cache->entries[cache->count].data = 0;
+        ++cache->count;
+    }
+}
+
+static RESULT write_entries(const optcl_devcache *cache, FILE *file)
+{
+    uint32_t i;
+    uint32_t offset;
+    uint8_t header[DEVCACHE_HEADER_SIZE];
+    uint8_t record[DEVCACHE_RECORD_SIZE];
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, DEVCACHE_MAGIC, 8);
+    put_le32(&header[8], DEVCACHE_VERSION);
+    put_le32(&header[12], cache->count);
+
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header))
+        return E_UNEXPECTED;
+
+    offset = DEVCACHE_HEADER_SIZE + cache->count * DEVCACHE_RECORD_SIZE;
+
+    for (i = 0; i < cache->count; ++i) {
+        memcpy(record, cache->entries[i].record, sizeof(record));
+        put_le32(&record[RECORD_FEATURES_OFFSET], offset);
+        put_le32(&record[RECORD_FEATURES_SIZE],
+            cache->entries[i].features_size);
+
+        if (fwrite(record, 1, sizeof(record), file) != sizeof(record))
+            return E_UNEXPECTED;
+
+        offset += cache->entries[i].features_size;
+    }
+
+    for (i = 0; i < cache->count; ++i) {
+        if (cache->entries[i].features_size > 0
+            && fwrite(cache->entries[i].features, 1,
+            cache->entries[i].features_size, file)
+            != cache->entries[i].features_size)
+            return E_UNEXPECTED;
+    }
+
+    return SUCCESS;
+}
+
+
+/*
+ * Enumeration cache functions
+ */
+
+RESULT optcl_devcache_open(const char *filename, optcl_devcache **cache)
+{
+    optcl_devcache *ncache;
+
+    assert(filename != 0);
+    assert(cache != 0);
+    if (filename == 0 || cache == 0)
+        return E_INVALIDARG;
+
+    ncache = (optcl_devcache*)malloc(sizeof(optcl_devcache));
+    if (ncache == 0)
+        return E_OUTOFMEMORY;
+
+    memset(ncache, 0, sizeof(optcl_devcache));
+    ncache->filename = xstrdup(filename);
+    if (ncache->filename == 0) {
+        free(ncache);
+        return E_OUTOFMEMORY;
+    }
+
+    /* The file stays mapped, records are read in place */
+    if (xmap_file(filename, False, &ncache->map) == 0) {
+        ncache->mapped = True;
+        read_entries(ncache);
+    }
+
+    *cache = ncache;
+    return SUCCESS;
+}
+
+RESULT optcl_devcache_close(optcl_devcache *cache)
+{
+    uint32_t i;
+
+    assert(cache != 0);
+    if (cache == 0)
+        return E_INVALIDARG;
+
+    for (i = 0; i < cache->count; ++i)
+        free_entry(&cache->entries[i]);
+
+    if (cache->mapped == True)
+        xunmap_file(&cache->map);
+
+    free(cache->filename);
+    free(cache);
+    return SUCCESS;
+}
+
+RESULT optcl_devcache_save(optcl_devcache *cache)
+{
+    FILE *file;
+    RESULT error;
+    uint32_t i;
+    size_t len;
+    char *temp_name;
+
+    assert(cache != 0);
+    if (cache == 0)
+        return E_INVALIDARG;
+
+    if (cache->changed == False)
+        return SUCCESS;
+
+    /* The mapping goes away before the file is replaced */
+    for (i = 0; i < cache->count; ++i) {
+        error = own_entry(&cache->entries[i]);
+        if (FAILED(error))
+            return error;
+    }
+
+    if (cache->mapped == True) {
+        xunmap_file(&cache->map);
+        cache->mapped = False;
+    }
+
+    len = strlen(cache->filename) + 5;
+    temp_name = (char*)malloc(len);
+    if (temp_name == 0)
+        return E_OUTOFMEMORY;
+
+    snprintf(temp_name, len, "%s.tmp", cache->filename);
+
+    /*
+     * The new file is written aside and renamed over the old one, so
+     * that readers never see a partly written cache.
+     */
+    file = fopen(temp_name, "wb");
+    if (file == 0) {
+        free(temp_name);
+        return E_DEVINVALIDPATH;
+    }
+
+    error = write_entries(cache, file);
+
+    if (fclose(file) != 0 && SUCCEEDED(error))
+        error = E_UNEXPECTED;
+
+    if (SUCCEEDED(error) && rename(temp_name, cache->filename) != 0) {
+        remove(cache->filename);
+        if (rename(temp_name, cache->filename) != 0)
+            error = E_DEVINVALIDPATH;
+    }
+
+    if (FAILED(error))
+        remove(temp_name);
+    else
+        cache->changed = False;
+
+    free(temp_name);
+    return error;
+}
+
+RESULT optcl_devcache_get_identity(const optcl_devcache *cache,
+                                   const char *location,
+                                   optcl_devcache_identity *identity)
+{
+    const optcl_devcache_entry *entry;
+
+    assert(cache != 0);
+    assert(location != 0);
+    assert(identity != 0);
+    if (cache == 0 || location == 0 || identity == 0)
+        return E_INVALIDARG;
+
+    entry = find_entry(cache, location);
+    if (entry == 0)
+        return E_DEVCACHEMISS;
+
+    get_field(identity->vendor, sizeof(identity->vendor), entry->record,
+        RECORD_VENDOR, sizeof(identity->vendor));
+    get_field(identity->product, sizeof(identity->product), entry->record,
+        RECORD_PRODUCT, sizeof(identity->product));
+    get_field(identity->revision, sizeof(identity->revision), entry->record,
+        RECORD_REVISION, sizeof(identity->revision));
+    get_field(identity->serial, sizeof(identity->serial), entry->record,
+        RECORD_SERIAL, sizeof(identity->serial));
+    return SUCCESS;
+}
+
+RESULT optcl_devcache_load(const optcl_devcache *cache,
+                           const char *location,
+                           optcl_device *device,
+                           const uint8_t **features,
+                           uint32_t *features_size)
+{
+    RESULT error;
+    RESULT destroy_error;
+    char *value;
+    char field[RECORD_VENDOR_STRING_SIZE];
+    optcl_adapter *adapter = 0;
+    const optcl_devcache_entry *entry;
+
+    assert(cache != 0);
+    assert(location != 0);
+    assert(device != 0);
+    assert(features != 0);
+    assert(features_size != 0);
+    if (cache == 0 || location == 0 || device == 0 || features == 0
+        || features_size == 0)
+        return E_INVALIDARG;
+
+    entry = find_entry(cache, location);
+    if (entry == 0)
+        return E_DEVCACHEMISS;
+
+    error = optcl_adapter_create(&adapter);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_adapter_set_bus_type(adapter,
+        get_le16(&entry->record[RECORD_BUS_TYPE]));
+    if (SUCCEEDED(error))
+        error = optcl_adapter_set_max_alignment_mask(adapter,
+            get_le32(&entry->record[RECORD_ALIGNMENT_MASK]));
+    if (SUCCEEDED(error))
+        error = optcl_adapter_set_max_physical_pages(adapter,
+            get_le32(&entry->record[RECORD_MAX_PAGES]));
+    if (SUCCEEDED(error))
+        error = optcl_adapter_set_max_transfer_length(adapter,
+            get_le32(&entry->record[RECORD_MAX_TRANSFER_LEN]));
+    if (SUCCEEDED(error))
+        error = optcl_device_set_adapter(device, adapter);
+
+    if (FAILED(error)) {
+        destroy_error = optcl_adapter_destroy(adapter);
+        return SUCCEEDED(destroy_error) ? error : destroy_error;
+    }
+
+    error = optcl_device_set_type(device,
+        get_le16(&entry->record[RECORD_DEVICE_TYPE]));
+    if (FAILED(error))
+        return error;
+
+    get_field(field, sizeof(field), entry->record, RECORD_VENDOR, 12);
+    value = xstrdup(field);
+    if (value == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_vendor(device, value);
+    if (FAILED(error)) {
+        free(value);
+        return error;
+    }
+
+    get_field(field, sizeof(field), entry->record, RECORD_PRODUCT, 20);
+    value = xstrdup(field);
+    if (value == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_product(device, value);
+    if (FAILED(error)) {
+        free(value);
+        return error;
+    }
+
+    get_field(field, sizeof(field), entry->record, RECORD_REVISION, 8);
+    value = xstrdup(field);
+    if (value == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_revision(device, value);
+    if (FAILED(error)) {
+        free(value);
+        return error;
+    }
+
+    get_field(field, sizeof(field), entry->record, RECORD_VENDOR_STRING,
+        RECORD_VENDOR_STRING_SIZE);
+    value = xstrdup(field);
+    if (value == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_vendor_string(device, value);
+    if (FAILED(error)) {
+        free(value);
+        return error;
+    }
+
+    *features = entry->features;
+    *features_size = entry->features_size;
+    return SUCCESS;
+}
+
+RESULT optcl_devcache_store(optcl_devcache *cache,
+                            const char *location,
+                            const optcl_devcache_identity *identity,
+                            const optcl_device *device,
+                            const uint8_t features[],
+                            uint32_t features_size)
+{
+    RESULT error;
+    uint8_t *data;
+    uint16_t type;
+    uint32_t value;
+    char *string = 0;
+    const optcl_adapter *adapter = 0;
+    optcl_devcache_entry *entry;
+
+    assert(cache != 0);
+    assert(location != 0);
+    assert(identity != 0);
+    assert(device != 0);
+    assert(features != 0 || features_size == 0);
+    if (cache == 0 || location == 0 || identity == 0 || device == 0
+        || (features == 0 && features_size > 0))
+        return E_INVALIDARG;
+
+    if (strlen(location) >= DEVCACHE_LOCATION_SIZE
+        || features_size > DEVCACHE_MAX_FEATURES_SIZE)
+        return E_OUTOFRANGE;
+
+    data = (uint8_t*)malloc(DEVCACHE_RECORD_SIZE + features_size);
+    if (data == 0)
+        return E_OUTOFMEMORY;
+
+    memset(data, 0, DEVCACHE_RECORD_SIZE);
+    put_field(data, RECORD_LOCATION, DEVCACHE_LOCATION_SIZE, location);
+    put_field(data, RECORD_VENDOR, sizeof(identity->vendor),
+        identity->vendor);
+    put_field(data, RECORD_PRODUCT, sizeof(identity->product),
+        identity->product);
+    put_field(data, RECORD_REVISION, sizeof(identity->revision),
+        identity->revision);
+    put_field(data, RECORD_SERIAL, sizeof(identity->serial),
+        identity->serial);
+
+    error = optcl_device_get_type(device, &type);
+    if (SUCCEEDED(error)) {
+        put_le16(&data[RECORD_DEVICE_TYPE], type);
+        error = optcl_device_get_vendor_string(device, &string);
+    }
+
+    if (SUCCEEDED(error)) {
+        put_field(data, RECORD_VENDOR_STRING, RECORD_VENDOR_STRING_SIZE,
+            string);
+        free(string);
+        error = optcl_device_get_adapter_ref(device, &adapter);
+    }
+
+    if (SUCCEEDED(error) && adapter == 0)
+        error = E_POINTER;
+
+    if (SUCCEEDED(error)) {
+        error = optcl_adapter_get_bus_type(adapter, &value);
+        put_le16(&data[RECORD_BUS_TYPE], (uint16_t)value);
+    }
+
+    if (SUCCEEDED(error)) {
+        error = optcl_adapter_get_alignment_mask(adapter, &value);
+        put_le32(&data[RECORD_ALIGNMENT_MASK], value);
+    }
+
+    if (SUCCEEDED(error)) {
+        error = optcl_adapter_get_max_physical_pages(adapter, &value);
+        put_le32(&data[RECORD_MAX_PAGES], value);
+    }
+
+    if (SUCCEEDED(error)) {
+        error = optcl_adapter_get_max_transfer_len(adapter, &value);
+        put_le32(&data[RECORD_MAX_TRANSFER_LEN], value);
+    }
+
+    if (FAILED(error)) {
+        free(data);
+        return error;
+    }
+
+    if (features_size > 0)
+        memcpy(&data[DEVCACHE_RECORD_SIZE], features, features_size);
+
+    entry = find_entry(cache, location);
+    if (entry != 0) {
+        free_entry(entry);
+    } else {
+        /* A full cache drops its oldest entry */
+        if (cache->count == DEVCACHE_MAX_ENTRIES) {
+            free_entry(&cache->entries[0]);
+            memmove(&cache->entries[0], &cache->entries[1],
+                (DEVCACHE_MAX_ENTRIES - 1) * sizeof(optcl_devcache_entry));
+            --cache->count;
+        }
+
+        entry = &cache->entries[cache->count++];
+    }
+
+    entry->data = data;
+    entry->record = data;
+    entry->features = &data[DEVCACHE_RECORD_SIZE];
+    entry->features_size = features_size;
+    cache->changed = True;
+    return SUCCESS;
+}
+
+RESULT optcl_devcache_invalidate(optcl_devcache *cache, const char *location)
+{
+    optcl_devcache_entry *entry;
+
+    assert(cache != 0);
+    assert(location != 0);
+    if (cache == 0 || location == 0)
+        return E_INVALIDARG;
+
+    entry = find_entry(cache, location);
+    if (entry == 0)
+        return SUCCESS;
+
+    free_entry(entry);
+    memmove(entry, entry + 1, (size_t)(&cache->entries[cache->count] - (entry + 1))
+        * sizeof(optcl_devcache_entry));
+    --cache->count;
+    cache->changed = True;
+    return SUCCESS;
+}
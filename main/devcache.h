@@ -0,0 +1,113 @@
+/*
+    devcache.h - Persistent device enumeration cache
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _DEVCACHE_H
+#define _DEVCACHE_H
+
+#include "device.h"
+#include "errors.h"
+#include "types.h"
+
+
+/*
+ * Cache file layout, all fields are little endian
+ *
+ *  0   magic "OPTCLDVC"
+ *  8   uint32_t version
+ *  12  uint32_t entry count
+ *  16  entry records, DEVCACHE_RECORD_SIZE bytes each
+ *
+ * Every record holds the location and identity of a drive, its INQUIRY
+ * strings and adapter limits, and the file offset and size of the raw
+ * GET CONFIGURATION data stored after the records. Files of another
+ * version are ignored and rewritten.
+ */
+
+#define DEVCACHE_MAGIC			"OPTCLDVC"
+#define DEVCACHE_VERSION		1
+#define DEVCACHE_HEADER_SIZE		16U
+#define DEVCACHE_RECORD_SIZE		384U
+
+/* Most drives kept in a cache file */
+#define DEVCACHE_MAX_ENTRIES		32
+
+/* Largest drive location, including the terminating zero */
+#define DEVCACHE_LOCATION_SIZE		256
+
+/* Largest raw GET CONFIGURATION data kept for a drive */
+#define DEVCACHE_MAX_FEATURES_SIZE	0x10000U
+
+
+/* Device enumeration cache */
+typedef struct tag_devcache optcl_devcache;
+
+/* Drive identity, cached capabilities are used only while it matches */
+typedef struct tag_devcache_identity {
+    char vendor[12];
+    char product[20];
+    char revision[8];
+    char serial[40];
+} optcl_devcache_identity;
+
+
+/* Open cache file, a missing or unusable file gives an empty cache */
+extern 
+RESULT optcl_devcache_open(const char *filename, optcl_devcache **cache);
+
+/* Close cache without saving it */
+extern 
+RESULT optcl_devcache_close(optcl_devcache *cache);
+
+/* Write cache file if the cache was changed */
+extern 
+RESULT optcl_devcache_save(optcl_devcache *cache);
+
+/* Get identity of the drive cached for a location */
+extern 
+RESULT optcl_devcache_get_identity(const optcl_devcache *cache,
+                                   const char *location,
+                                   optcl_devcache_identity *identity);
+
+/*
+ * Set device type, INQUIRY strings and adapter from the entry of a
+ * location, the raw GET CONFIGURATION data stays owned by the cache
+ */
+extern 
+RESULT optcl_devcache_load(const optcl_devcache *cache,
+                           const char *location,
+                           optcl_device *device,
+                           const uint8_t **features,
+                           uint32_t *features_size);
+
+/* Add or replace the entry of a location */
+extern 
+RESULT optcl_devcache_store(optcl_devcache *cache,
+                            const char *location,
+                            const optcl_devcache_identity *identity,
+                            const optcl_device *device,
+                            const uint8_t features[],
+                            uint32_t features_size);
+
+/* Remove the entry of a location */
+extern 
+RESULT optcl_devcache_invalidate(optcl_devcache *cache, const char *location);
+
+#endif /* _DEVCACHE_H */
@@ -18,15 +18,21 @@
 */
 
 #include "adapter.h"
+#include "cdimage.h"
 #include "errors.h"
 #include "device.h"
 #include "hashtable.h"
 #include "helpers.h"
+#include "image.h"
 #include "list.h"
 #include "media.h"
+#include "retry.h"
+#include "sysdevice.h"
+#include "transport.h"
 #include "types.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <malloc.h>
 #include <string.h>
 
@@ -44,6 +50,13 @@ typedef struct tag_device_info {
     optcl_hashtable *features;
 } optcl_device_info;
 
+/* Registered data buffer */
+typedef struct tag_device_buffer {
+    ptr_t base;
+    uint32_t size;
+    bool_t owned;
+} optcl_device_buffer;
+
 /* Device descriptor */
 struct tag_device {
     char *path;
@@ -51,6 +64,15 @@ struct tag_device {
     optcl_list *medias;
     optcl_adapter *adapter;
     optcl_device_info *info;
+    optcl_device_session *session;
+    optcl_transfer_limits limits;
+    optcl_list *buffers;
+    uint16_t backend;
+    uint16_t block_read_mode;
+    const optcl_transport *transport;
+    ptr_t transport_context;
+    optcl_retry_policy retry_policy;
+    uint64_t probe_time;
 };
 
 
@@ -213,14 +235,345 @@ static RESULT copy_features_hashtable(optcl_hashtable *dest,
     return optcl_list_destroy(pairs, 1);
 }
 
+static RESULT find_registered_buffer(const optcl_list *buffers,
+                                     const ptr_t buffer,
+                                     optcl_list_iterator *pos)
+{
+    RESULT error;
+    optcl_list_iterator it;
+    optcl_device_buffer *entry;
+
+    assert(buffers != 0);
+    assert(pos != 0);
+    if (buffers == 0 || pos == 0)
+        return E_INVALIDARG;
+
+    error = optcl_list_get_head_pos(buffers, &it);
+    if (FAILED(error))
+        return error;
+
+    while (it != 0) {
+        error = optcl_list_get_at_pos(buffers, it, (const pptr_t)&entry);
+        if (FAILED(error))
+            return error;
+
+        if (entry->base == buffer)
+            break;
+
+        error = optcl_list_get_next(buffers, it, &it);
+        if (FAILED(error))
+            return error;
+    }
+
+    *pos = it;
+    return SUCCESS;
+}
+
+static RESULT destroy_buffers_list(optcl_list *buffers)
+{
+    RESULT error;
+    optcl_list_iterator it;
+    optcl_device_buffer *entry;
+
+    assert(buffers != 0);
+    if (buffers == 0)
+        return E_INVALIDARG;
+
+    error = optcl_list_get_head_pos(buffers, &it);
+    if (FAILED(error))
+        return error;
+
+    while (it != 0) {
+        error = optcl_list_get_at_pos(buffers, it, (const pptr_t)&entry);
+        if (FAILED(error))
+            break;
+
+        if (entry->owned == True)
+            xfree_aligned(entry->base);
+
+        free(entry);
+        error = optcl_list_get_next(buffers, it, &it);
+        if (FAILED(error))
+            break;
+    }
+
+    optcl_list_destroy(buffers, False);
+    return error;
+}
+
+/* Check if the file name ends with the extension, ignoring case */
+static bool_t has_extension(const char *filename, const char *extension)
+{
+    size_t len = strlen(filename);
+    size_t ext_len = strlen(extension);
+
+    if (len < ext_len)
+        return False;
+
+    filename += len - ext_len;
+    while (*extension != '\0') {
+        if (tolower((unsigned char)*filename) != *extension)
+            return False;
+
+        ++filename;
+        ++extension;
+    }
+
+    return True;
+}
+
+static RESULT update_transfer_limits(optcl_device *device)
+{
+    RESULT error;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    memset(&device->limits, 0, sizeof(device->limits));
+
+    /* Bound transports know their own limits */
+    if (device->transport != 0 && device->transport->query_limits != 0) {
+        return device->transport->query_limits(device, 
+            device->transport_context, &device->limits);
+    }
+
+    if (device->adapter == 0)
+        return SUCCESS;
+
+    error = optcl_adapter_get_alignment_mask(device->adapter, 
+        &device->limits.alignment_mask);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_adapter_get_max_transfer_len(device->adapter, 
+        &device->limits.max_transfer_len);
+    if (FAILED(error))
+        return error;
+
+    return optcl_adapter_get_max_physical_pages(device->adapter, 
+        &device->limits.max_physical_pages);
+}
+
 /*
  * Device functions
  */
 
+RESULT optcl_device_alloc_buffer(optcl_device *device, 
+                                 uint32_t size, 
+                                 ptr_t *buffer)
+{
+    RESULT error;
+    ptr_t nbuffer;
+    optcl_device_buffer *entry;
+
+    assert(device != 0);
+    assert(buffer != 0);
+    assert(size > 0);
+    if (device == 0 || buffer == 0 || size == 0)
+        return E_INVALIDARG;
+
+    assert(device->buffers != 0);
+    if (device->buffers == 0)
+        return E_UNEXPECTED;
+
+    entry = (optcl_device_buffer*)malloc(sizeof(optcl_device_buffer));
+    if (entry == 0)
+        return E_OUTOFMEMORY;
+
+    nbuffer = (ptr_t)xmalloc_aligned(size, 
+        (device->limits.alignment_mask > 0) 
+        ? device->limits.alignment_mask : sizeof(void*));
+    if (nbuffer == 0) {
+        free(entry);
+        return E_OUTOFMEMORY;
+    }
+
+    entry->base = nbuffer;
+    entry->size = size;
+    entry->owned = True;
+    error = optcl_list_add_tail(device->buffers, (const ptr_t)entry);
+    if (FAILED(error)) {
+        xfree_aligned(nbuffer);
+        free(entry);
+        return error;
+    }
+
+    *buffer = nbuffer;
+    return SUCCESS;
+}
+
+RESULT optcl_device_free_buffer(optcl_device *device, ptr_t buffer)
+{
+    RESULT error;
+    optcl_list_iterator pos;
+    optcl_device_buffer *entry;
+
+    assert(device != 0);
+    assert(buffer != 0);
+    if (device == 0 || buffer == 0)
+        return E_INVALIDARG;
+
+    assert(device->buffers != 0);
+    if (device->buffers == 0)
+        return E_UNEXPECTED;
+
+    error = find_registered_buffer(device->buffers, buffer, &pos);
+    if (FAILED(error))
+        return error;
+
+    if (pos == 0)
+        return E_INVALIDARG;
+
+    error = optcl_list_get_at_pos(device->buffers, pos, (const pptr_t)&entry);
+    if (FAILED(error))
+        return error;
+
+    assert(entry->owned == True);
+    if (entry->owned == False)
+        return E_INVALIDARG;
+
+    error = optcl_list_remove(device->buffers, pos);
+    if (FAILED(error))
+        return error;
+
+    xfree_aligned(entry->base);
+    free(entry);
+    return SUCCESS;
+}
+
+RESULT optcl_device_register_buffer(optcl_device *device, 
+                                    ptr_t buffer, 
+                                    uint32_t size)
+{
+    RESULT error;
+    optcl_list_iterator pos;
+    optcl_device_buffer *entry;
+
+    assert(device != 0);
+    assert(buffer != 0);
+    assert(size > 0);
+    if (device == 0 || buffer == 0 || size == 0)
+        return E_INVALIDARG;
+
+    assert(device->buffers != 0);
+    if (device->buffers == 0)
+        return E_UNEXPECTED;
+
+    if (device->limits.alignment_mask > 1 
+        && (size_t)buffer % device->limits.alignment_mask != 0)
+        return E_DEVUNALIGNEDBUF;
+
+    error = find_registered_buffer(device->buffers, buffer, &pos);
+    if (FAILED(error))
+        return error;
+
+    if (pos != 0)
+        return E_INVALIDARG;
+
+    entry = (optcl_device_buffer*)malloc(sizeof(optcl_device_buffer));
+    if (entry == 0)
+        return E_OUTOFMEMORY;
+
+    entry->base = buffer;
+    entry->size = size;
+    entry->owned = False;
+    error = optcl_list_add_tail(device->buffers, (const ptr_t)entry);
+    if (FAILED(error))
+        free(entry);
+
+    return error;
+}
+
+RESULT optcl_device_unregister_buffer(optcl_device *device, ptr_t buffer)
+{
+    RESULT error;
+    optcl_list_iterator pos;
+    optcl_device_buffer *entry;
+
+    assert(device != 0);
+    assert(buffer != 0);
+    if (device == 0 || buffer == 0)
+        return E_INVALIDARG;
+
+    assert(device->buffers != 0);
+    if (device->buffers == 0)
+        return E_UNEXPECTED;
+
+    error = find_registered_buffer(device->buffers, buffer, &pos);
+    if (FAILED(error))
+        return error;
+
+    if (pos == 0)
+        return E_INVALIDARG;
+
+    error = optcl_list_get_at_pos(device->buffers, pos, (const pptr_t)&entry);
+    if (FAILED(error))
+        return error;
+
+    assert(entry->owned == False);
+    if (entry->owned == True)
+        return E_INVALIDARG;
+
+    error = optcl_list_remove(device->buffers, pos);
+    if (FAILED(error))
+        return error;
+
+    free(entry);
+    return SUCCESS;
+}
+
+RESULT optcl_device_is_buffer_registered(const optcl_device *device,
+                                         const ptr_t data,
+                                         uint32_t size,
+                                         bool_t *registered)
+{
+    RESULT error;
+    optcl_list_iterator it;
+    optcl_device_buffer *entry;
+
+    assert(device != 0);
+    assert(registered != 0);
+    if (device == 0 || registered == 0)
+        return E_INVALIDARG;
+
+    assert(device->buffers != 0);
+    if (device->buffers == 0)
+        return E_UNEXPECTED;
+
+    *registered = False;
+    if (data == 0)
+        return SUCCESS;
+
+    error = optcl_list_get_head_pos(device->buffers, &it);
+    if (FAILED(error))
+        return error;
+
+    while (it != 0) {
+        error = optcl_list_get_at_pos(device->buffers, it, 
+            (const pptr_t)&entry);
+        if (FAILED(error))
+            return error;
+
+        if (data >= entry->base 
+            && (size_t)(data - entry->base) + size <= entry->size) {
+            *registered = True;
+            break;
+        }
+
+        error = optcl_list_get_next(device->buffers, it, &it);
+        if (FAILED(error))
+            return error;
+    }
+
+    return SUCCESS;
+}
+
 RESULT optcl_device_bind2file(optcl_device *device, const char *filename)
 {
     RESULT error;
     char *devicepath;
+    const optcl_transport *transport = 0;
 
     assert(device != 0);
     assert(filename != 0);
@@ -239,6 +592,19 @@ RESULT optcl_device_bind2file(optcl_device *device, const char *filename)
     if (FAILED(error))
         return error;
 
+    /* CUE sheets describe raw CD images */
+    if (has_extension(filename, ".cue") == True)
+        error = optcl_cdimage_get_transport(&transport);
+    else
+        error = optcl_image_get_transport(&transport);
+
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_set_transport(device, transport, 0);
+    if (FAILED(error))
+        return error;
+
     return optcl_device_set_type(device, DEVICE_TYPE_IMAGE);
 }
 
@@ -250,7 +616,21 @@ RESULT optcl_device_clear(optcl_device *device)
     if (device == 0)
         return E_INVALIDARG;
 
+    if (device->session != 0) {
+        error = optcl_device_close(device);
+        if (FAILED(error))
+            return error;
+
+        memset(device->session, 0, sizeof(optcl_device_session));
+    }
+
     device->type = 0;
+    device->backend = DEVICE_BACKEND_SG;
+    device->block_read_mode = DEVICE_BLOCKREAD_DISABLED;
+    device->transport = 0;
+    optcl_retry_get_default_policy(&device->retry_policy);
+    device->transport_context = 0;
+    device->probe_time = 0;
     free(device->path);
     device->path = 0;
     if (device->adapter != 0) {
@@ -259,6 +639,8 @@ RESULT optcl_device_clear(optcl_device *device)
             return error;
     }
 
+    memset(&device->limits, 0, sizeof(device->limits));
+
     if (device->info != 0) {
         if (device->info->features != 0) {
             error = optcl_hashtable_clear(device->info->features, 1);
@@ -294,11 +676,19 @@ RESULT optcl_device_copy(optcl_device *dest, const optcl_device *src)
     if (dest == 0 || src == 0)
         return E_INVALIDARG;
 
+    if (src->transport_context != 0)
+        return E_DEVTRANSPORTBOUND;
+
     error = optcl_device_clear(dest);
     if (FAILED(error))
         return error;
 
     dest->type = src->type;
+    dest->backend = src->backend;
+    dest->block_read_mode = src->block_read_mode;
+    dest->retry_policy = src->retry_policy;
+    dest->transport = src->transport;
+    dest->probe_time = src->probe_time;
     dest->path = xstrdup(src->path);
     if (src->path != 0 && dest->path == 0)
         return E_OUTOFMEMORY;
@@ -312,6 +702,8 @@ RESULT optcl_device_copy(optcl_device *dest, const optcl_device *src)
     if (FAILED(error))
         return error;
 
+    dest->limits = src->limits;
+
     assert(src->info != 0);
     assert(dest->info != 0);
     if (src->info == 0 || dest->info == 0)
@@ -397,7 +789,16 @@ RESULT optcl_device_create(optcl_device **device)
     }
 
     memset(newdev->info, 0, sizeof(optcl_device_info));
-    error = optcl_hashtable_create(sizeof(int), 0, &newdev->info->features);
+    newdev->session = (optcl_device_session*)
+        malloc(sizeof(optcl_device_session));
+    if (newdev->session == 0) {
+        optcl_device_destroy(newdev);
+        return E_OUTOFMEMORY;
+    }
+
+    memset(newdev->session, 0, sizeof(optcl_device_session));
+    optcl_retry_get_default_policy(&newdev->retry_policy);
+    error = optcl_hashtable_create(sizeof(uint16_t), 0, &newdev->info->features);
     if (FAILED(error)) {
         optcl_device_destroy(newdev);
         return error;
@@ -409,6 +810,12 @@ RESULT optcl_device_create(optcl_device **device)
         return error;
     }
 
+    error = optcl_list_create(0, &newdev->buffers);
+    if (FAILED(error)) {
+        optcl_device_destroy(newdev);
+        return error;
+    }
+
     *device = newdev;
     return error;
 }
@@ -445,6 +852,13 @@ RESULT optcl_device_destroy(optcl_device *device)
             return error;
     }
 
+    if (device->buffers != 0) {
+        error = destroy_buffers_list(device->buffers);
+        if (FAILED(error))
+            return error;
+    }
+
+    free(device->session);
     free(device);
     return SUCCESS;
 }
@@ -474,6 +888,73 @@ RESULT optcl_device_get_adapter(const optcl_device *device,
     return error;
 }
 
+RESULT optcl_device_get_adapter_ref(const optcl_device *device,
+                                    const optcl_adapter **adapter)
+{
+    assert(device != 0);
+    assert(adapter != 0);
+    if (device == 0 || adapter == 0)
+        return E_INVALIDARG;
+
+    assert(device->adapter != 0);
+    if (device->adapter == 0)
+        return E_UNEXPECTED;
+
+    *adapter = device->adapter;
+    return SUCCESS;
+}
+
+RESULT optcl_device_get_transfer_limits(const optcl_device *device,
+                                        optcl_transfer_limits *limits)
+{
+    assert(device != 0);
+    assert(limits != 0);
+    if (device == 0 || limits == 0)
+        return E_INVALIDARG;
+
+    *limits = device->limits;
+    return SUCCESS;
+}
+
+RESULT optcl_device_get_backend(const optcl_device *device, uint16_t *backend)
+{
+    assert(device != 0);
+    assert(backend != 0);
+    if (device == 0 || backend == 0)
+        return E_INVALIDARG;
+
+    *backend = device->backend;
+    return SUCCESS;
+}
+
+RESULT optcl_device_get_transport(const optcl_device *device,
+                                  const optcl_transport **transport,
+                                  ptr_t *context)
+{
+    assert(device != 0);
+    assert(transport != 0);
+    if (device == 0 || transport == 0)
+        return E_INVALIDARG;
+
+    *transport = device->transport;
+    if (context != 0)
+        *context = device->transport_context;
+
+    return SUCCESS;
+}
+
+RESULT optcl_device_get_block_read_mode(const optcl_device *device, 
+                                        uint16_t *mode)
+{
+    assert(device != 0);
+    assert(mode != 0);
+    if (device == 0 || mode == 0)
+        return E_INVALIDARG;
+
+    *mode = device->block_read_mode;
+    return SUCCESS;
+}
+
 RESULT optcl_device_get_feature(const optcl_device *device,
                                 uint16_t feature_code,
                                 optcl_feature **feature)
@@ -563,6 +1044,22 @@ RESULT optcl_get_media_info(const optcl_device *device,
     return SUCCESS;
 }
 
+RESULT optcl_device_get_session(const optcl_device *device,
+                                optcl_device_session **session)
+{
+    assert(device != 0);
+    assert(session != 0);
+    if (device == 0 || session == 0)
+        return E_INVALIDARG;
+
+    assert(device->session != 0);
+    if (device->session == 0)
+        return E_UNEXPECTED;
+
+    *session = device->session;
+    return SUCCESS;
+}
+
 RESULT optcl_device_get_path(const optcl_device *device, char **path)
 {
     assert(device != 0);
@@ -577,6 +1074,30 @@ RESULT optcl_device_get_path(const optcl_device *device, char **path)
     return SUCCESS;
 }
 
+RESULT optcl_device_get_path_ref(const optcl_device *device, 
+                                 const char **path)
+{
+    assert(device != 0);
+    assert(path != 0);
+    if (device == 0 || path == 0)
+        return E_INVALIDARG;
+
+    *path = device->path;
+    return SUCCESS;
+}
+
+RESULT optcl_device_get_probe_time(const optcl_device *device, 
+                                   uint64_t *probe_time)
+{
+    assert(device != 0);
+    assert(probe_time != 0);
+    if (device == 0 || probe_time == 0)
+        return E_INVALIDARG;
+
+    *probe_time = device->probe_time;
+    return SUCCESS;
+}
+
 RESULT optcl_device_get_product(const optcl_device *device, char **product)
 {
     assert(device != 0);
@@ -613,6 +1134,18 @@ RESULT optcl_device_get_revision(const optcl_device *device, char **revision)
     return SUCCESS;
 }
 
+RESULT optcl_device_get_retry_policy(const optcl_device *device,
+                                     optcl_retry_policy *policy)
+{
+    assert(device != 0);
+    assert(policy != 0);
+    if (device == 0 || policy == 0)
+        return E_INVALIDARG;
+
+    *policy = device->retry_policy;
+    return SUCCESS;
+}
+
 RESULT optcl_device_get_type(const optcl_device *device, uint16_t *type)
 {
     assert(device != 0);
@@ -694,7 +1227,7 @@ RESULT optcl_device_set_adapter(optcl_device *device, optcl_adapter *adapter)
         return error;
 
     device->adapter = adapter;
-    return SUCCESS;
+    return update_transfer_limits(device);
 }
 
 RESULT optcl_device_set_feature(optcl_device *device,
@@ -725,6 +1258,80 @@ RESULT optcl_device_set_feature(optcl_device *device,
         (const ptr_t)key, (const ptr_t)feature);
 }
 
+RESULT optcl_device_clear_features(optcl_device *device)
+{
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    assert(device->info != 0);
+    if (device->info == 0)
+        return E_UNEXPECTED;
+
+    assert(device->info->features != 0);
+    if (device->info->features == 0)
+        return E_INVALIDARG;
+
+    return optcl_hashtable_clear(device->info->features, 1);
+}
+
+RESULT optcl_device_set_backend(optcl_device *device, uint16_t backend)
+{
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    if (backend != DEVICE_BACKEND_SG && backend != DEVICE_BACKEND_BSG)
+        return E_INVALIDARG;
+
+    assert(device->session != 0);
+    if (device->session == 0)
+        return E_UNEXPECTED;
+
+    /* The system handle belongs to the backend it was opened for */
+    if (device->session->is_open == True)
+        return E_ACCESSDENIED;
+
+    device->backend = backend;
+    return SUCCESS;
+}
+
+RESULT optcl_device_set_transport(optcl_device *device,
+                                  const optcl_transport *transport,
+                                  ptr_t context)
+{
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    assert(device->session != 0);
+    if (device->session == 0)
+        return E_UNEXPECTED;
+
+    /* The session handle belongs to the transport that opened it */
+    if (device->session->is_open == True)
+        return E_ACCESSDENIED;
+
+    device->transport = transport;
+    device->transport_context = (transport != 0) ? context : 0;
+    return update_transfer_limits(device);
+}
+
+RESULT optcl_device_set_block_read_mode(optcl_device *device, uint16_t mode)
+{
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    if (mode != DEVICE_BLOCKREAD_AUTO 
+        && mode != DEVICE_BLOCKREAD_DISABLED 
+        && mode != DEVICE_BLOCKREAD_ENABLED)
+        return E_INVALIDARG;
+
+    device->block_read_mode = mode;
+    return SUCCESS;
+}
+
 RESULT optcl_device_set_path(optcl_device *device, char *path)
 {
     assert(device != 0);
@@ -736,6 +1343,16 @@ RESULT optcl_device_set_path(optcl_device *device, char *path)
     return SUCCESS;
 }
 
+RESULT optcl_device_set_probe_time(optcl_device *device, uint64_t probe_time)
+{
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    device->probe_time = probe_time;
+    return SUCCESS;
+}
+
 RESULT optcl_device_set_product(optcl_device *device, char *product)
 {
     assert(device != 0);
@@ -766,6 +1383,18 @@ RESULT optcl_device_set_revision(optcl_device *device, char *revision)
     return SUCCESS;
 }
 
+RESULT optcl_device_set_retry_policy(optcl_device *device,
+                                     const optcl_retry_policy *policy)
+{
+    assert(device != 0);
+    assert(policy != 0);
+    if (device == 0 || policy == 0)
+        return E_INVALIDARG;
+
+    device->retry_policy = *policy;
+    return SUCCESS;
+}
+
 RESULT optcl_device_set_type(optcl_device *device, uint16_t type)
 {
     assert(device != 0);
@@ -24,7 +24,7 @@
 #include "feature.h"
 #include "list.h"
 #include "media.h"
-#include "transport.h"
+#include "retry.h"
 #include "types.h"
 
 
@@ -33,11 +33,104 @@
 #define DEVICE_TYPE_CD_DVD		5
 
 
+/* Device command backends */
+#define DEVICE_BACKEND_SG		0	/* sg v3 interface, /dev/sg* */
+#define DEVICE_BACKEND_BSG		1	/* sg v4 interface, /dev/bsg nodes */
+
+
+/* Block device read path modes */
+#define DEVICE_BLOCKREAD_AUTO		0	/* Probe throughput when opened */
+#define DEVICE_BLOCKREAD_DISABLED	1	/* Always read with SCSI commands, default */
+#define DEVICE_BLOCKREAD_ENABLED	2	/* Read data through the block device */
+
+
 /* Device descriptor */
 struct tag_device;
 typedef struct tag_device optcl_device;
 
-/* Bind device to an image file */
+/* Command transport, see transport.h */
+struct tag_transport;
+
+/*
+ * Device session
+ *
+ * While a session is open the system handle is kept for the device
+ * lifetime and every command reuses it, instead of opening and closing
+ * the device for each command. Commands submitted asynchronously
+ * complete on the system handle, which may be waited on with
+ * poll/epoll on platforms that support it.
+ */
+typedef struct tag_device_session {
+    bool_t is_open;
+    ptr_t handle;           /* System handle, valid while is_open is set */
+    uint32_t commands;      /* Commands executed on the device */
+    uint32_t opens;         /* System handle opens performed */
+    uint32_t opens_saved;   /* Opens avoided by reusing the session handle */
+    uint32_t direct_io;     /* Data transfers done with direct I/O */
+    uint32_t indirect_io;   /* Data transfers copied through kernel buffers */
+    uint32_t pending;       /* Submitted commands not yet completed */
+    ptr_t queue;            /* Platform asynchronous command queue */
+    ptr_t mmap_view;        /* Mapped reserved transfer buffer, read only */
+    uint32_t mmap_size;     /* Size of the mapped transfer buffer */
+    ptr_t block_handle;     /* Block device handle for plain data reads */
+    bool_t block_reads;     /* Plain data reads use the block device */
+    bool_t progress_valid;  /* Last sense data held a progress indication */
+    uint16_t progress;      /* Progress of the last sense data, 65536ths */
+    optcl_retry_stats retries;  /* Commands retried by the retry policy */
+} optcl_device_session;
+
+/*
+ * Device transfer limits
+ *
+ * Cached copy of the adapter limits, refreshed whenever the device
+ * adapter changes so that commands can read them without copying
+ * the adapter.
+ */
+typedef struct tag_transfer_limits {
+    uint32_t alignment_mask;
+    uint32_t max_transfer_len;
+    uint32_t max_physical_pages;
+} optcl_transfer_limits;
+
+/*
+ * Data transfer vector element
+ */
+typedef struct tag_iovec {
+    ptr_t base;
+    uint32_t len;
+} optcl_iovec;
+
+/* Allocate and register data buffer aligned for the device adapter */
+extern 
+RESULT optcl_device_alloc_buffer(optcl_device *device, 
+                                 uint32_t size, 
+                                 ptr_t *buffer);
+
+/* Unregister and deallocate buffer from optcl_device_alloc_buffer */
+extern 
+RESULT optcl_device_free_buffer(optcl_device *device, ptr_t buffer);
+
+/* Validate and register caller owned data buffer */
+extern 
+RESULT optcl_device_register_buffer(optcl_device *device, 
+                                    ptr_t buffer, 
+                                    uint32_t size);
+
+/* Unregister caller owned data buffer */
+extern 
+RESULT optcl_device_unregister_buffer(optcl_device *device, ptr_t buffer);
+
+/* Check if data lies entirely within a registered buffer */
+extern 
+RESULT optcl_device_is_buffer_registered(const optcl_device *device,
+                                         const ptr_t data,
+                                         uint32_t size,
+                                         bool_t *registered);
+
+/*
+ * Bind device to an image file served by the image transport, or
+ * to a CUE sheet served by the CD image transport
+ */
 extern 
 RESULT optcl_device_bind2file(optcl_device *device, const char *filename);
 
@@ -49,7 +142,12 @@ RESULT optcl_device_create(optcl_device **device);
 extern 
 RESULT optcl_device_clear(optcl_device *device);
 
-/* Copy device structure */
+/*
+ * Copy device structure
+ *
+ * A transport context holds state of the device it was bound to, so
+ * devices bound with a context can not be copied.
+ */
 extern 
 RESULT optcl_device_copy(optcl_device *dest, const optcl_device *src);
 
@@ -62,6 +160,31 @@ extern
 RESULT optcl_device_get_adapter(const optcl_device *device,
                                 optcl_adapter **adapter);
 
+/* Get device adapter (borrowed, owned by the device) */
+extern 
+RESULT optcl_device_get_adapter_ref(const optcl_device *device,
+                                    const optcl_adapter **adapter);
+
+/* Get cached device transfer limits */
+extern 
+RESULT optcl_device_get_transfer_limits(const optcl_device *device,
+                                        optcl_transfer_limits *limits);
+
+/* Get device command backend */
+extern 
+RESULT optcl_device_get_backend(const optcl_device *device, uint16_t *backend);
+
+/* Get transport bound to the device, zero for the system transport */
+extern 
+RESULT optcl_device_get_transport(const optcl_device *device,
+                                  const struct tag_transport **transport,
+                                  ptr_t *context);
+
+/* Get block device read path mode */
+extern 
+RESULT optcl_device_get_block_read_mode(const optcl_device *device, 
+                                        uint16_t *mode);
+
 /* Get device feature */
 extern 
 RESULT optcl_device_get_feature(const optcl_device *device,
@@ -78,10 +201,25 @@ RESULT optcl_device_get_media_info(const optcl_device *device,
                                    uint32_t media_index,
                                    optcl_media_info **info);
 
+/* Get device session (borrowed, owned by the device) */
+extern 
+RESULT optcl_device_get_session(const optcl_device *device,
+                                optcl_device_session **session);
+
 /* Get device name */
 extern 
 RESULT optcl_device_get_path(const optcl_device *device, char **path);
 
+/* Get device name (borrowed, owned by the device) */
+extern 
+RESULT optcl_device_get_path_ref(const optcl_device *device,
+                                 const char **path);
+
+/* Get time spent probing the device when it was enumerated, in microseconds */
+extern 
+RESULT optcl_device_get_probe_time(const optcl_device *device, 
+                                   uint64_t *probe_time);
+
 /* Get product string */
 extern 
 RESULT optcl_device_get_product(const optcl_device *device,
@@ -92,6 +230,11 @@ extern
 RESULT optcl_device_get_revision(const optcl_device *device,
                                  char **revision);
 
+/* Get command retry policy */
+extern 
+RESULT optcl_device_get_retry_policy(const optcl_device *device,
+                                     optcl_retry_policy *policy);
+
 /* Get device type */
 extern 
 RESULT optcl_device_get_type(const optcl_device *device,
@@ -118,14 +261,43 @@ RESULT optcl_device_set_feature(optcl_device *device,
                                 uint16_t feature_number,
                                 optcl_feature *feature);
 
+/* Remove all features */
+extern 
+RESULT optcl_device_clear_features(optcl_device *device);
+
 /* Set device adapter */
 extern 
 RESULT optcl_device_set_adapter(optcl_device *device, optcl_adapter *adapter);
 
+/* Set device command backend, device must not be open */
+extern 
+RESULT optcl_device_set_backend(optcl_device *device, uint16_t backend);
+
+/* Bind transport to the device, zero restores the system transport */
+extern 
+RESULT optcl_device_set_transport(optcl_device *device,
+                                  const struct tag_transport *transport,
+                                  ptr_t context);
+
+/*
+ * Set block device read path mode, applies when the device is opened
+ *
+ * Block reads are disabled by default. Probing reads from the medium
+ * and spins it up, so DEVICE_BLOCKREAD_AUTO is only worth it for long
+ * read sessions. With AUTO or ENABLED the open fails with the error
+ * of the block device or the probe when either can not be set up.
+ */
+extern 
+RESULT optcl_device_set_block_read_mode(optcl_device *device, uint16_t mode);
+
 /* Set device name */
 extern 
 RESULT optcl_device_set_path(optcl_device *device, char *path);
 
+/* Set device probe time in microseconds */
+extern 
+RESULT optcl_device_set_probe_time(optcl_device *device, uint64_t probe_time);
+
 /* Set product */
 extern 
 RESULT optcl_device_set_product(optcl_device *device, char *product);
@@ -134,6 +306,11 @@ RESULT optcl_device_set_product(optcl_device *device, char *product);
 extern 
 RESULT optcl_device_set_revision(optcl_device *device, char *revision);
 
+/* Set command retry policy, a zero policy turns retries off */
+extern 
+RESULT optcl_device_set_retry_policy(optcl_device *device,
+                                     const optcl_retry_policy *policy);
+
 /* Set device type */
 extern 
 RESULT optcl_device_set_type(optcl_device *device, uint16_t type);
@@ -0,0 +1,1400 @@
+/*
+    emulator.c - Emulated MMC drive
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "command.h"
+#include "device.h"
+#include "emulator.h"
+#include "errors.h"
+#include "feature.h"
+#include "helpers.h"
+#include "profile.h"
+#include "sensedata.h"
+#include "transport.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+#define EMULATOR_BLOCK_SIZE		2048U
+#define EMULATOR_INQUIRY_LEN		96U
+#define EMULATOR_CONFIG_LEN		64U
+#define EMULATOR_USEC			1000000U
+
+/* Smallest alignment xmalloc_aligned accepts, memory needs no more */
+#define EMULATOR_ALIGNMENT		sizeof(ptr_t)
+
+#define EMULATOR_VENDOR			"OPTCL   "
+#define EMULATOR_PRODUCT		"EMULATED DRIVE  "
+#define EMULATOR_REVISION		"1.00"
+
+/* DVD 1x transfer rate in bytes per second */
+#define DVD_1X_RATE			1385000U
+
+/* Event classes reported by GET EVENT STATUS NOTIFICATION */
+#define EMULATOR_EVENT_CLASSES		(MMC_GET_EVENT_STATUS_OPCHANGE \
+					| MMC_GET_EVENT_STATUS_MEDIA \
+					| MMC_GET_EVENT_STATUS_DEVICEBUSY)
+#define EMULATOR_EVENT_LEN		8U
+
+
+/*
+ * MMC opcodes served by the emulator
+ */
+
+#define MMC_OPCODE_GET_CONFIG			    0x0046
+#define MMC_OPCODE_GET_EVENT_STATUS		    0x004A
+#define MMC_OPCODE_INQUIRY			        0x0012
+#define MMC_OPCODE_PREVENT_ALLOW_REMOVAL	0x001E
+#define MMC_OPCODE_READ_10			        0x0028
+#define MMC_OPCODE_READ_12			        0x00A8
+#define MMC_OPCODE_READ_BUFFER_CAPACITY		0x005C
+#define MMC_OPCODE_READ_CAPACITY		    0x0025
+#define MMC_OPCODE_READ_TRACK_INFORMATION	0x0052
+#define MMC_OPCODE_REQUEST_SENSE		    0x0003
+#define MMC_OPCODE_SEEK				        0x002B
+#define MMC_OPCODE_SET_CD_SPEED			    0x00BB
+#define MMC_OPCODE_START_STOP_UNIT		    0x001B
+#define MMC_OPCODE_SYNCHRONIZE_CACHE		0x0035
+#define MMC_OPCODE_TEST_UNIT_READY		    0x0000
+#define MMC_OPCODE_VERIFY			        0x002F
+#define MMC_OPCODE_WRITE			        0x002A
+#define MMC_OPCODE_WRITE_12			        0x00AA
+#define MMC_OPCODE_WRITE_AND_VERIFY_10		0x002E
+
+
+/*
+ * Internal emulator structures
+ */
+
+/* Emulated medium */
+typedef struct tag_emulator_medium {
+    bool_t present;
+    uint16_t profile;
+    uint32_t blocks;        /* Medium capacity */
+    uint32_t recorded;      /* Blocks recorded from the start of the medium */
+    ptr_t memory;           /* Memory backed medium data */
+    FILE *file;             /* File backed medium data */
+} optcl_emulator_medium;
+
+/* Emulated drive descriptor */
+struct tag_emulator {
+    optcl_emulator_timing timing;
+    optcl_emulator_stats stats;
+    optcl_emulator_medium medium;
+    uint64_t clock;         /* Emulated time in microseconds */
+    uint64_t epoch;         /* Clock value at the last statistics reset */
+    uint64_t ready_at;      /* Time the disc is up to speed */
+    uint64_t last_access;   /* Time of the last medium access */
+    bool_t spinning;
+    uint32_t head_lba;
+    uint32_t buffer_fill;   /* Write buffer bytes not yet on the medium */
+    uint32_t read_limit;    /* SET CD SPEED read rate cap, 0 none */
+    uint32_t write_limit;   /* SET CD SPEED write rate cap, 0 none */
+    bool_t tray_open;
+    uint8_t media_event;    /* Media event not yet reported, EVENT_MEDIA_EC_* */
+};
+
+
+/*
+ * Helper functions
+ */
+
+static uint32_t get_be32(const uint8_t data[])
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+        | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static uint16_t get_be16(const uint8_t data[])
+{
+    return (uint16_t)(((uint16_t)data[0] << 8) | (uint16_t)data[1]);
+}
+
+static void put_be32(uint8_t data[], uint32_t value)
+{
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+static void put_be16(uint8_t data[], uint16_t value)
+{
+    data[0] = (uint8_t)(value >> 8);
+    data[1] = (uint8_t)value;
+}
+
+static uint64_t transfer_time(uint64_t bytes, uint32_t rate)
+{
+    return (rate == 0) ? 0 : (bytes * EMULATOR_USEC + rate - 1) / rate;
+}
+
+static bool_t is_rom_profile(uint16_t profile)
+{
+    switch (profile) {
+    case PROFILE_CD_ROM:
+    case PROFILE_DVD_ROM:
+    case PROFILE_BD_ROM:
+    case PROFILE_HD_DVD_ROM:
+        return True;
+    default:
+        return False;
+    }
+}
+
+static bool_t is_sequential_profile(uint16_t profile)
+{
+    switch (profile) {
+    case PROFILE_CD_R:
+    case PROFILE_DVD_R_SEQREC:
+    case PROFILE_DVD_RW_SEQREC:
+    case PROFILE_DVD_R_DUAL_LAYER_SEQREC:
+    case PROFILE_DVD_PLUS_R:
+    case PROFILE_DVD_PLUS_R_DUAL_LAYER:
+    case PROFILE_BD_R_SRM:
+    case PROFILE_HD_DVD_R:
+        return True;
+    default:
+        return False;
+    }
+}
+
+/* Data transfer rate at lba, limited by SET CD SPEED and the bus */
+static uint32_t get_media_rate(const optcl_emulator *emulator,
+                               uint32_t lba,
+                               bool_t write)
+{
+    uint32_t i;
+    uint32_t rate;
+    uint32_t limit;
+    uint32_t zone_end;
+    uint64_t span;
+    const optcl_emulator_zone *zone = 0;
+
+    assert(emulator != 0);
+
+    for (i = 0; i < emulator->timing.zone_count; ++i) {
+        if (emulator->timing.zones[i].start_lba <= lba)
+            zone = &emulator->timing.zones[i];
+    }
+
+    if (zone == 0)
+        return emulator->timing.bus_rate;
+
+    rate = zone->inner_rate;
+    if (zone->mode == EMULATOR_ZONE_CAV && zone->outer_rate > zone->inner_rate) {
+        zone_end = emulator->medium.blocks;
+        for (i = 0; i < emulator->timing.zone_count; ++i) {
+            if (emulator->timing.zones[i].start_lba > zone->start_lba
+                && emulator->timing.zones[i].start_lba < zone_end)
+                zone_end = emulator->timing.zones[i].start_lba;
+        }
+
+        span = (zone_end > zone->start_lba) ? zone_end - zone->start_lba : 1;
+        rate += (uint32_t)((uint64_t)(zone->outer_rate - zone->inner_rate)
+            * (lba - zone->start_lba) / span);
+    }
+
+    limit = (write == True) ? emulator->write_limit : emulator->read_limit;
+    if (limit != 0 && limit < rate)
+        rate = limit;
+
+    if (emulator->timing.bus_rate != 0 && emulator->timing.bus_rate < rate)
+        rate = emulator->timing.bus_rate;
+
+    return rate;
+}
+
+static uint32_t get_drain_rate(const optcl_emulator *emulator)
+{
+    assert(emulator != 0);
+
+    return (emulator->timing.drain_rate != 0)
+        ? emulator->timing.drain_rate
+        : get_media_rate(emulator, emulator->head_lba, True);
+}
+
+/* Advance clock, draining the write buffer meanwhile */
+static void advance_clock(optcl_emulator *emulator, uint64_t usec)
+{
+    uint64_t drained;
+
+    assert(emulator != 0);
+
+    if (emulator->buffer_fill > 0) {
+        drained = usec * get_drain_rate(emulator) / EMULATOR_USEC;
+        emulator->buffer_fill = (drained >= emulator->buffer_fill)
+            ? 0 : emulator->buffer_fill - (uint32_t)drained;
+    }
+
+    emulator->clock += usec;
+}
+
+static void flush_buffer(optcl_emulator *emulator)
+{
+    assert(emulator != 0);
+
+    if (emulator->buffer_fill > 0)
+        advance_clock(emulator, transfer_time(emulator->buffer_fill,
+            get_drain_rate(emulator)));
+
+    emulator->buffer_fill = 0;
+}
+
+/* Bring the disc up to speed and move the head to lba */
+static void access_medium(optcl_emulator *emulator, uint32_t lba)
+{
+    uint32_t distance;
+    uint64_t idle;
+
+    assert(emulator != 0);
+
+    idle = emulator->clock - emulator->last_access;
+    if (emulator->spinning == True && emulator->timing.spindown_delay != 0
+        && idle >= emulator->timing.spindown_delay
+        && emulator->buffer_fill == 0) {
+        emulator->spinning = False;
+    }
+
+    if (emulator->spinning == False) {
+        emulator->spinning = True;
+        emulator->ready_at = emulator->clock + emulator->timing.spinup_time;
+        ++emulator->stats.spinups;
+    }
+
+    if (emulator->clock < emulator->ready_at)
+        advance_clock(emulator, emulator->ready_at - emulator->clock);
+
+    if (lba != emulator->head_lba) {
+        distance = (lba > emulator->head_lba)
+            ? lba - emulator->head_lba : emulator->head_lba - lba;
+
+        advance_clock(emulator, emulator->timing.seek_settle
+            + (uint64_t)emulator->timing.seek_stroke * distance
+            / (emulator->medium.blocks > 0 ? emulator->medium.blocks : 1));
+
+        emulator->head_lba = lba;
+        ++emulator->stats.seeks;
+    }
+}
+
+static uint32_t get_iov_size(const optcl_iovec iov[], uint32_t iov_count)
+{
+    uint32_t i;
+    uint32_t size = 0;
+
+    for (i = 0; i < iov_count; ++i)
+        size += iov[i].len;
+
+    return size;
+}
+
+/* Copy emulator generated data into the host buffers */
+static void copy_to_iov(const optcl_iovec iov[],
+                        uint32_t iov_count,
+                        const uint8_t data[],
+                        uint32_t size)
+{
+    uint32_t i;
+    uint32_t chunk;
+
+    for (i = 0; i < iov_count && size > 0; ++i) {
+        chunk = (iov[i].len < size) ? iov[i].len : size;
+        memcpy(iov[i].base, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static RESULT transfer_medium(optcl_emulator *emulator,
+                              uint32_t lba,
+                              const optcl_iovec iov[],
+                              uint32_t iov_count,
+                              uint32_t size,
+                              bool_t write)
+{
+    uint32_t i;
+    uint32_t chunk;
+    uint64_t offset;
+    optcl_emulator_medium *medium;
+
+    assert(emulator != 0);
+
+    medium = &emulator->medium;
+    offset = (uint64_t)lba * EMULATOR_BLOCK_SIZE;
+
+    if (medium->file != 0 && fseek(medium->file, (long)offset, SEEK_SET) != 0)
+        return E_SENSE_URE;
+
+    for (i = 0; i < iov_count && size > 0; ++i) {
+        chunk = (iov[i].len < size) ? iov[i].len : size;
+
+        if (medium->memory != 0) {
+            if (write == True)
+                memcpy(medium->memory + offset, iov[i].base, chunk);
+            else
+                memcpy(iov[i].base, medium->memory + offset, chunk);
+        } else if (write == True) {
+            if (fwrite(iov[i].base, 1, chunk, medium->file) != chunk)
+                return E_SENSE_URE;
+        } else {
+            if (fread(iov[i].base, 1, chunk, medium->file) != chunk)
+                memset(iov[i].base, 0, chunk); /* Past the end of file */
+        }
+
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return SUCCESS;
+}
+
+static RESULT check_medium_ready(optcl_emulator *emulator)
+{
+    assert(emulator != 0);
+
+    return (emulator->medium.present == True) ? SUCCESS : E_SENSE_MNP;
+}
+
+static RESULT check_medium_range(const optcl_emulator *emulator,
+                                 uint32_t lba,
+                                 uint32_t count,
+                                 bool_t write)
+{
+    uint32_t limit;
+    const optcl_emulator_medium *medium;
+
+    assert(emulator != 0);
+
+    medium = &emulator->medium;
+    limit = (write == True || !is_sequential_profile(medium->profile))
+        ? medium->blocks : medium->recorded;
+
+    if (lba > limit || count > limit - lba)
+        return E_SENSE_LBAOOR;
+
+    if (write == True && is_rom_profile(medium->profile))
+        return E_SENSE_CWM_IF_5;
+
+    if (write == True && is_sequential_profile(medium->profile)
+        && lba != medium->recorded)
+        return E_SENSE_IAFW;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Command handlers
+ */
+
+static RESULT emulate_inquiry(optcl_emulator *emulator,
+                              const uint8_t cdb[],
+                              const optcl_iovec iov[],
+                              uint32_t iov_count)
+{
+    uint16_t alloc_len;
+    uint8_t response[EMULATOR_INQUIRY_LEN];
+
+    memset(response, 0, sizeof(response));
+    response[0] = 0x05;             /* CD/DVD device */
+    response[1] = 0x80;             /* Removable medium */
+    response[2] = 0x05;
+    response[3] = 0x02;
+    response[4] = EMULATOR_INQUIRY_LEN - 5;
+    memcpy(&response[8], EMULATOR_VENDOR, 8);
+    memcpy(&response[16], EMULATOR_PRODUCT, 16);
+    memcpy(&response[32], EMULATOR_REVISION, 4);
+
+    alloc_len = get_be16(&cdb[3]);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < sizeof(response)) ? alloc_len : sizeof(response));
+
+    return SUCCESS;
+}
+
+static uint32_t append_feature(uint8_t response[],
+                               uint32_t offset,
+                               uint16_t feature_code,
+                               bool_t current,
+                               const uint8_t data[],
+                               uint8_t data_len)
+{
+    put_be16(&response[offset], feature_code);
+    response[offset + 2] = (uint8_t)(0x02 | (current == True ? 0x01 : 0x00));
+    response[offset + 3] = data_len;
+    memcpy(&response[offset + 4], data, data_len);
+    return offset + 4 + data_len;
+}
+
+static RESULT emulate_get_configuration(optcl_emulator *emulator,
+                                        const uint8_t cdb[],
+                                        const optcl_iovec iov[],
+                                        uint32_t iov_count)
+{
+    int i;
+    uint8_t rt;
+    bool_t current;
+    uint8_t data[12];
+    uint32_t offset;
+    uint16_t alloc_len;
+    uint16_t start_feature;
+    uint16_t profile;
+    uint8_t response[EMULATOR_CONFIG_LEN];
+    const uint16_t features[] = {
+        FEATURE_PROFILE_LIST,
+        FEATURE_CORE,
+        FEATURE_REMOVABLE_MEDIUM,
+        FEATURE_RANDOM_READABLE,
+        FEATURE_RANDOM_WRITABLE
+    };
+
+    rt = cdb[1] & 0x03;
+    start_feature = get_be16(&cdb[2]);
+    alloc_len = get_be16(&cdb[7]);
+    profile = (emulator->medium.present == True) ? emulator->medium.profile : 0;
+
+    memset(response, 0, sizeof(response));
+    put_be16(&response[6], profile);
+    offset = 8;
+
+    for (i = 0; i < (int)(sizeof(features) / sizeof(features[0])); ++i) {
+        if (features[i] < start_feature)
+            continue;
+
+        if (rt == MMC_GET_CONFIG_RT_FROM && features[i] != start_feature)
+            break;
+
+        memset(data, 0, sizeof(data));
+
+        switch (features[i]) {
+        case FEATURE_PROFILE_LIST:
+            put_be16(&data[0], emulator->medium.profile);
+            data[2] = (uint8_t)(profile != 0 ? 0x01 : 0x00);
+            current = True;
+            offset = append_feature(response, offset, features[i], current,
+                data, 4);
+            break;
+
+        case FEATURE_CORE:
+            put_be32(&data[0], 0x00000001); /* SCSI */
+            current = True;
+            offset = append_feature(response, offset, features[i], current,
+                data, 8);
+            break;
+
+        case FEATURE_REMOVABLE_MEDIUM:
+            data[0] = 0x29;                 /* Tray, eject, lock */
+            current = True;
+            offset = append_feature(response, offset, features[i], current,
+                data, 4);
+            break;
+
+        case FEATURE_RANDOM_READABLE:
+            put_be32(&data[0], EMULATOR_BLOCK_SIZE);
+            put_be16(&data[4], 16);
+            current = bool_from_uint8(profile != 0);
+            if (rt != MMC_GET_CONFIG_RT_CURRENT || current == True) {
+                offset = append_feature(response, offset, features[i],
+                    current, data, 8);
+            }
+            break;
+
+        case FEATURE_RANDOM_WRITABLE:
+            if (is_rom_profile(emulator->medium.profile)
+                || is_sequential_profile(emulator->medium.profile))
+                break;
+
+            put_be32(&data[0], emulator->medium.blocks - 1);
+            put_be32(&data[4], EMULATOR_BLOCK_SIZE);
+            put_be16(&data[8], 16);
+            current = bool_from_uint8(profile != 0);
+            if (rt != MMC_GET_CONFIG_RT_CURRENT || current == True) {
+                offset = append_feature(response, offset, features[i],
+                    current, data, 12);
+            }
+            break;
+        }
+    }
+
+    put_be32(&response[0], offset - 4);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < offset) ? alloc_len : offset);
+
+    return SUCCESS;
+}
+
+static RESULT emulate_read_capacity(optcl_emulator *emulator,
+                                    const optcl_iovec iov[],
+                                    uint32_t iov_count)
+{
+    RESULT error;
+    uint32_t blocks;
+    uint8_t response[8];
+
+    error = check_medium_ready(emulator);
+    if (FAILED(error))
+        return error;
+
+    blocks = is_sequential_profile(emulator->medium.profile)
+        ? emulator->medium.recorded : emulator->medium.blocks;
+
+    put_be32(&response[0], (blocks > 0) ? blocks - 1 : 0);
+    put_be32(&response[4], EMULATOR_BLOCK_SIZE);
+    copy_to_iov(iov, iov_count, response, sizeof(response));
+    return SUCCESS;
+}
+
+static RESULT emulate_read_track_information(optcl_emulator *emulator,
+                                             const uint8_t cdb[],
+                                             const optcl_iovec iov[],
+                                             uint32_t iov_count)
+{
+    RESULT error;
+    bool_t sequential;
+    uint16_t alloc_len;
+    uint8_t response[48];
+    const optcl_emulator_medium *medium;
+
+    error = check_medium_ready(emulator);
+    if (FAILED(error))
+        return error;
+
+    medium = &emulator->medium;
+    sequential = is_sequential_profile(medium->profile);
+
+    /* The emulated medium holds a single track in a single session */
+    memset(response, 0, sizeof(response));
+    put_be16(&response[0], sizeof(response) - 2);
+    response[2] = 1;
+    response[3] = 1;
+    response[5] = 0x04;                             /* Data track */
+    response[6] = 0x01;                             /* Mode 1 */
+    if (sequential == True) {
+        if (medium->recorded == 0)
+            response[6] |= 0x40;                    /* Blank */
+
+        if (medium->recorded < medium->blocks) {
+            response[6] |= 0x80;                    /* Reserved track */
+            response[7] = 0x01;                     /* NWA valid */
+            put_be32(&response[12], medium->recorded);
+        }
+
+        put_be32(&response[16], medium->blocks - medium->recorded);
+        put_be32(&response[24], medium->recorded);
+    } else {
+        put_be32(&response[24], medium->blocks);
+    }
+
+    alloc_len = get_be16(&cdb[7]);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < sizeof(response)) ? alloc_len : sizeof(response));
+
+    return SUCCESS;
+}
+
+static RESULT emulate_read_buffer_capacity(optcl_emulator *emulator,
+                                           const uint8_t cdb[],
+                                           const optcl_iovec iov[],
+                                           uint32_t iov_count)
+{
+    uint8_t response[12];
+    uint32_t blank_len;
+
+    blank_len = emulator->timing.buffer_size - emulator->buffer_fill;
+
+    memset(response, 0, sizeof(response));
+    put_be16(&response[0], sizeof(response) - 2);
+    if (cdb[1] & 0x01) {
+        response[3] = 0x01;
+        put_be32(&response[8], blank_len / EMULATOR_BLOCK_SIZE);
+    } else {
+        put_be32(&response[4], emulator->timing.buffer_size);
+        put_be32(&response[8], blank_len);
+    }
+
+    copy_to_iov(iov, iov_count, response, sizeof(response));
+    return SUCCESS;
+}
+
+static RESULT emulate_read(optcl_emulator *emulator,
+                           uint32_t lba,
+                           uint32_t count,
+                           const optcl_iovec iov[],
+                           uint32_t iov_count)
+{
+    RESULT error;
+    uint32_t size;
+
+    error = check_medium_ready(emulator);
+    if (FAILED(error))
+        return error;
+
+    error = check_medium_range(emulator, lba, count, False);
+    if (FAILED(error))
+        return error;
+
+    size = count * EMULATOR_BLOCK_SIZE;
+    if (get_iov_size(iov, iov_count) < size)
+        return E_INVALIDARG;
+
+    flush_buffer(emulator);
+    access_medium(emulator, lba);
+
+    error = transfer_medium(emulator, lba, iov, iov_count, size, False);
+    if (FAILED(error))
+        return error;
+
+    advance_clock(emulator,
+        transfer_time(size, get_media_rate(emulator, lba, False)));
+
+    emulator->head_lba = lba + count;
+    emulator->stats.bytes_read += size;
+    return SUCCESS;
+}
+
+static RESULT emulate_write(optcl_emulator *emulator,
+                            uint32_t lba,
+                            uint32_t count,
+                            const optcl_iovec iov[],
+                            uint32_t iov_count,
+                            bool_t verify)
+{
+    RESULT error;
+    uint32_t size;
+    optcl_emulator_medium *medium;
+
+    error = check_medium_ready(emulator);
+    if (FAILED(error))
+        return error;
+
+    error = check_medium_range(emulator, lba, count, True);
+    if (FAILED(error))
+        return error;
+
+    size = count * EMULATOR_BLOCK_SIZE;
+    if (get_iov_size(iov, iov_count) < size)
+        return E_INVALIDARG;
+
+    /* Data in the buffer is written before the head moves */
+    if (lba != emulator->head_lba)
+        flush_buffer(emulator);
+
+    access_medium(emulator, lba);
+
+    error = transfer_medium(emulator, lba, iov, iov_count, size, True);
+    if (FAILED(error))
+        return error;
+
+    /*
+     * The host fills the drive buffer at bus rate while the buffer
+     * drains to the medium, a full buffer stalls the host.
+     */
+    advance_clock(emulator, transfer_time(size, emulator->timing.bus_rate));
+    emulator->buffer_fill += size;
+    emulator->head_lba = lba + count;
+    if (emulator->buffer_fill > emulator->timing.buffer_size) {
+        advance_clock(emulator, transfer_time(
+            emulator->buffer_fill - emulator->timing.buffer_size,
+            get_drain_rate(emulator)));
+
+        emulator->buffer_fill = emulator->timing.buffer_size;
+        ++emulator->stats.buffer_stalls;
+    }
+
+    if (verify == True) {
+        flush_buffer(emulator);
+        advance_clock(emulator,
+            transfer_time(size, get_media_rate(emulator, lba, False)));
+    }
+
+    medium = &emulator->medium;
+    if (lba + count > medium->recorded)
+        medium->recorded = lba + count;
+
+    emulator->stats.bytes_written += size;
+    return SUCCESS;
+}
+
+static RESULT emulate_verify(optcl_emulator *emulator,
+                             uint32_t lba,
+                             uint32_t count)
+{
+    RESULT error;
+
+    error = check_medium_ready(emulator);
+    if (FAILED(error))
+        return error;
+
+    error = check_medium_range(emulator, lba, count, False);
+    if (FAILED(error))
+        return error;
+
+    flush_buffer(emulator);
+    access_medium(emulator, lba);
+    advance_clock(emulator, transfer_time(
+        (uint64_t)count * EMULATOR_BLOCK_SIZE,
+        get_media_rate(emulator, lba, False)));
+
+    emulator->head_lba = lba + count;
+    return SUCCESS;
+}
+
+static RESULT emulate_test_unit_ready(optcl_emulator *emulator)
+{
+    RESULT error;
+
+    error = check_medium_ready(emulator);
+    if (FAILED(error))
+        return error;
+
+    if (emulator->spinning == False) {
+        emulator->spinning = True;
+        emulator->ready_at = emulator->clock + emulator->timing.spinup_time;
+        ++emulator->stats.spinups;
+    }
+
+    return (emulator->clock < emulator->ready_at) ? E_SENSE_LUIIPOBR : SUCCESS;
+}
+
+static RESULT emulate_start_stop_unit(optcl_emulator *emulator,
+                                      const uint8_t cdb[])
+{
+    bool_t start;
+    bool_t loej;
+
+    start = bool_from_uint8(cdb[4] & 0x01);
+    loej = bool_from_uint8(cdb[4] & 0x02);
+
+    flush_buffer(emulator);
+
+    if (start == False) {
+        emulator->spinning = False;
+        if (loej == True) {
+            if (emulator->medium.present == True)
+                emulator->media_event = EVENT_MEDIA_EC_MEDIAREMOVAL;
+
+            emulator->medium.present = False;
+            emulator->tray_open = True;
+        }
+
+        return SUCCESS;
+    }
+
+    if (loej == True) {
+        emulator->medium.present = bool_from_uint8(emulator->medium.blocks > 0);
+        if (emulator->tray_open == True && emulator->medium.present == True)
+            emulator->media_event = EVENT_MEDIA_EC_NEWMEDIA;
+
+        emulator->tray_open = False;
+    }
+
+    if (emulator->medium.present == False)
+        return E_SENSE_MNP;
+
+    access_medium(emulator, emulator->head_lba);
+    return SUCCESS;
+}
+
+/*
+ * Polled requests get the pending media event or, without one, the
+ * status of the lowest requested class. Device busy status follows
+ * disc spin up.
+ */
+static RESULT emulate_get_event_status(optcl_emulator *emulator,
+                                       const uint8_t cdb[],
+                                       const optcl_iovec iov[],
+                                       uint32_t iov_count)
+{
+    uint8_t classes;
+    uint16_t length;
+    uint64_t busy_time;
+    uint8_t response[EMULATOR_EVENT_LEN];
+
+    /* Asynchronous notification is not supported */
+    if ((cdb[1] & 0x01) == 0)
+        return E_SENSE_IFICDB;
+
+    classes = cdb[4] & EMULATOR_EVENT_CLASSES;
+    length = get_be16(&cdb[7]);
+
+    memset(response, 0, sizeof(response));
+    response[3] = EMULATOR_EVENT_CLASSES;
+
+    if (classes == 0) {
+        put_be16(&response[0], 2);
+        response[2] = 0x80;
+        copy_to_iov(iov, iov_count, response, (length < 4) ? length : 4);
+        return SUCCESS;
+    }
+
+    put_be16(&response[0], EMULATOR_EVENT_LEN - 2);
+
+    if ((classes & MMC_GET_EVENT_STATUS_MEDIA) != 0 
+        && (emulator->media_event != EVENT_MEDIA_EC_NOCHG 
+        || (classes & MMC_GET_EVENT_STATUS_OPCHANGE) == 0))
+    {
+        response[2] = 4;
+        response[4] = emulator->media_event;
+        response[5] = (emulator->medium.present == True ? 0x02 : 0x00)
+            | (emulator->tray_open == True ? 0x01 : 0x00);
+
+        /* The event is reported once, even if only the header was read */
+        emulator->media_event = EVENT_MEDIA_EC_NOCHG;
+    } else if ((classes & MMC_GET_EVENT_STATUS_OPCHANGE) != 0) {
+        response[2] = 1;
+    } else {
+        response[2] = 6;
+        if (emulator->spinning == True && emulator->clock < emulator->ready_at) {
+            busy_time = (emulator->ready_at - emulator->clock) / 100000U;
+            response[5] = EVENT_DB_DBS_BUSY;
+            put_be16(&response[6], (uint16_t)((busy_time < 0xFFFF) ? busy_time : 0xFFFF));
+        }
+    }
+
+    copy_to_iov(iov, iov_count, response, 
+        (length < sizeof(response)) ? length : sizeof(response));
+    return SUCCESS;
+}
+
+static uint32_t get_speed_limit(const uint8_t data[])
+{
+    uint16_t speed;
+
+    /* Speed in kilobytes per second, all bits set selects maximum speed */
+    speed = get_be16(data);
+    return (speed == 0xFFFF || speed == 0) ? 0 : (uint32_t)speed * 1000U;
+}
+
+static RESULT emulate_command(optcl_emulator *emulator,
+                              const uint8_t cdb[],
+                              uint32_t cdb_size,
+                              const optcl_iovec iov[],
+                              uint32_t iov_count)
+{
+    uint8_t sense[18];
+
+    advance_clock(emulator, emulator->timing.command_overhead);
+    ++emulator->stats.commands;
+
+    switch (cdb[0]) {
+    case MMC_OPCODE_TEST_UNIT_READY:
+        return emulate_test_unit_ready(emulator);
+
+    case MMC_OPCODE_INQUIRY:
+        return emulate_inquiry(emulator, cdb, iov, iov_count);
+
+    case MMC_OPCODE_REQUEST_SENSE:
+        memset(sense, 0, sizeof(sense));
+        sense[0] = 0x70;
+        sense[7] = sizeof(sense) - 8;
+        copy_to_iov(iov, iov_count, sense,
+            (cdb[4] < sizeof(sense)) ? cdb[4] : sizeof(sense));
+        return SUCCESS;
+
+    case MMC_OPCODE_GET_CONFIG:
+        return emulate_get_configuration(emulator, cdb, iov, iov_count);
+
+    case MMC_OPCODE_GET_EVENT_STATUS:
+        return emulate_get_event_status(emulator, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_CAPACITY:
+        return emulate_read_capacity(emulator, iov, iov_count);
+
+    case MMC_OPCODE_READ_TRACK_INFORMATION:
+        return emulate_read_track_information(emulator, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_BUFFER_CAPACITY:
+        return emulate_read_buffer_capacity(emulator, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_10:
+        return emulate_read(emulator, get_be32(&cdb[2]), get_be16(&cdb[7]),
+            iov, iov_count);
+
+    case MMC_OPCODE_READ_12:
+        return emulate_read(emulator, get_be32(&cdb[2]), get_be32(&cdb[6]),
+            iov, iov_count);
+
+    case MMC_OPCODE_WRITE:
+        return emulate_write(emulator, get_be32(&cdb[2]), get_be16(&cdb[7]),
+            iov, iov_count, False);
+
+    case MMC_OPCODE_WRITE_12:
+        return emulate_write(emulator, get_be32(&cdb[2]), get_be32(&cdb[6]),
+            iov, iov_count, False);
+
+    case MMC_OPCODE_WRITE_AND_VERIFY_10:
+        return emulate_write(emulator, get_be32(&cdb[2]), get_be16(&cdb[7]),
+            iov, iov_count, True);
+
+    case MMC_OPCODE_VERIFY:
+        return emulate_verify(emulator, get_be32(&cdb[2]), get_be16(&cdb[7]));
+
+    case MMC_OPCODE_SEEK:
+        if (emulator->medium.present == False)
+            return E_SENSE_MNP;
+
+        if (get_be32(&cdb[2]) >= emulator->medium.blocks)
+            return E_SENSE_LBAOOR;
+
+        flush_buffer(emulator);
+        access_medium(emulator, get_be32(&cdb[2]));
+        return SUCCESS;
+
+    case MMC_OPCODE_SYNCHRONIZE_CACHE:
+        flush_buffer(emulator);
+        return SUCCESS;
+
+    case MMC_OPCODE_START_STOP_UNIT:
+        return emulate_start_stop_unit(emulator, cdb);
+
+    case MMC_OPCODE_SET_CD_SPEED:
+        emulator->read_limit = get_speed_limit(&cdb[2]);
+        emulator->write_limit = get_speed_limit(&cdb[4]);
+        return SUCCESS;
+
+    case MMC_OPCODE_PREVENT_ALLOW_REMOVAL:
+        return SUCCESS;
+
+    default:
+        return E_SENSE_ICOC;
+    }
+}
+
+
+/*
+ * Emulator transport
+ */
+
+static RESULT emulator_open(optcl_device *device, ptr_t context)
+{
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    return SUCCESS;
+}
+
+static RESULT emulator_execute_vectored(const optcl_device *device,
+                                        ptr_t context,
+                                        const uint8_t cdb[],
+                                        uint32_t cdb_size,
+                                        const optcl_iovec iov[],
+                                        uint32_t iov_count)
+{
+    RESULT error;
+    optcl_emulator *emulator;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    assert(cdb_size > 0);
+    if (device == 0 || context == 0 || cdb == 0 || cdb_size == 0)
+        return E_INVALIDARG;
+
+    assert(iov != 0 || iov_count == 0);
+    if (iov == 0 && iov_count > 0)
+        return E_INVALIDARG;
+
+    emulator = (optcl_emulator*)context;
+    error = emulate_command(emulator, cdb, cdb_size, iov, iov_count);
+
+    if (emulator->medium.present == True)
+        emulator->last_access = emulator->clock;
+
+    return error;
+}
+
+static RESULT emulator_execute(const optcl_device *device,
+                               ptr_t context,
+                               const uint8_t cdb[],
+                               uint32_t cdb_size,
+                               uint8_t param[],
+                               uint32_t param_size)
+{
+    optcl_iovec iov;
+
+    iov.base = param;
+    iov.len = (param != 0) ? param_size : 0;
+
+    return emulator_execute_vectored(device, context, cdb, cdb_size,
+        &iov, (param != 0) ? 1 : 0);
+}
+
+static RESULT emulator_query_limits(const optcl_device *device,
+                                    ptr_t context,
+                                    optcl_transfer_limits *limits)
+{
+    optcl_emulator *emulator;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(limits != 0);
+    if (device == 0 || context == 0 || limits == 0)
+        return E_INVALIDARG;
+
+    emulator = (optcl_emulator*)context;
+    limits->alignment_mask = EMULATOR_ALIGNMENT;
+    limits->max_transfer_len = emulator->timing.max_transfer_len;
+    limits->max_physical_pages = 0;
+    return SUCCESS;
+}
+
+static const optcl_transport __emulator_transport = {
+    "emulator",
+    emulator_open,
+    0,
+    emulator_execute,
+    emulator_execute_vectored,
+    0,
+    0,
+    0,
+    emulator_query_limits,
+    0
+};
+
+
+/*
+ * Emulator functions
+ */
+
+RESULT optcl_emulator_get_default_timing(optcl_emulator_timing *timing)
+{
+    assert(timing != 0);
+    if (timing == 0)
+        return E_INVALIDARG;
+
+    memset(timing, 0, sizeof(optcl_emulator_timing));
+    timing->command_overhead = 50;
+    timing->spinup_time = 1500000;
+    timing->spindown_delay = 0;
+    timing->seek_settle = 1000;
+    timing->seek_stroke = 120000;
+    timing->bus_rate = 100000000;
+    timing->buffer_size = 2 * 1024 * 1024;
+    timing->drain_rate = 0;
+    timing->max_transfer_len = 65536;
+    timing->zone_count = 1;
+    timing->zones[0].start_lba = 0;
+    timing->zones[0].mode = EMULATOR_ZONE_CAV;
+    timing->zones[0].inner_rate = DVD_1X_RATE * 6;
+    timing->zones[0].outer_rate = DVD_1X_RATE * 16;
+    return SUCCESS;
+}
+
+RESULT optcl_emulator_create(const optcl_emulator_timing *timing,
+                             optcl_emulator **emulator)
+{
+    optcl_emulator *nemulator;
+
+    assert(emulator != 0);
+    if (emulator == 0)
+        return E_INVALIDARG;
+
+    assert(timing == 0 || timing->zone_count <= EMULATOR_MAX_ZONES);
+    if (timing != 0 && timing->zone_count > EMULATOR_MAX_ZONES)
+        return E_INVALIDARG;
+
+    nemulator = (optcl_emulator*)malloc(sizeof(optcl_emulator));
+    if (nemulator == 0)
+        return E_OUTOFMEMORY;
+
+    memset(nemulator, 0, sizeof(optcl_emulator));
+
+    if (timing != 0)
+        memcpy(&nemulator->timing, timing, sizeof(optcl_emulator_timing));
+    else
+        optcl_emulator_get_default_timing(&nemulator->timing);
+
+    *emulator = nemulator;
+    return SUCCESS;
+}
+
+RESULT optcl_emulator_destroy(optcl_emulator *emulator)
+{
+    RESULT error;
+
+    assert(emulator != 0);
+    if (emulator == 0)
+        return E_INVALIDARG;
+
+    error = optcl_emulator_eject(emulator);
+    free(emulator);
+    return error;
+}
+
+RESULT optcl_emulator_load_memory(optcl_emulator *emulator,
+                                  uint32_t blocks,
+                                  uint16_t profile)
+{
+    RESULT error;
+    ptr_t memory;
+
+    assert(emulator != 0);
+    assert(blocks > 0);
+    if (emulator == 0 || blocks == 0)
+        return E_INVALIDARG;
+
+    error = optcl_emulator_eject(emulator);
+    if (FAILED(error))
+        return error;
+
+    memory = (ptr_t)calloc(blocks, EMULATOR_BLOCK_SIZE);
+    if (memory == 0)
+        return E_OUTOFMEMORY;
+
+    emulator->medium.memory = memory;
+    emulator->medium.blocks = blocks;
+    emulator->medium.recorded = is_sequential_profile(profile) ? 0 : blocks;
+    emulator->medium.profile = profile;
+    emulator->medium.present = True;
+    emulator->tray_open = False;
+    emulator->media_event = EVENT_MEDIA_EC_NEWMEDIA;
+    return SUCCESS;
+}
+
+RESULT optcl_emulator_load_file(optcl_emulator *emulator,
+                                const char *filename,
+                                uint32_t blocks,
+                                uint16_t profile)
+{
+    long size;
+    FILE *file;
+    RESULT error;
+    uint32_t recorded;
+
+    assert(emulator != 0);
+    assert(filename != 0);
+    if (emulator == 0 || filename == 0)
+        return E_INVALIDARG;
+
+    error = optcl_emulator_eject(emulator);
+    if (FAILED(error))
+        return error;
+
+    file = fopen(filename, is_rom_profile(profile) ? "rb" : "r+b");
+    if (file == 0 && !is_rom_profile(profile))
+        file = fopen(filename, "w+b");
+
+    if (file == 0)
+        return E_DEVNOTOPEN;
+
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0) {
+        fclose(file);
+        return E_UNEXPECTED;
+    }
+
+    recorded = (uint32_t)(size / EMULATOR_BLOCK_SIZE);
+    if (blocks == 0)
+        blocks = recorded;
+
+    if (blocks == 0) {
+        fclose(file);
+        return E_INVALIDARG;
+    }
+
+    emulator->medium.file = file;
+    emulator->medium.blocks = blocks;
+    emulator->medium.recorded = is_sequential_profile(profile)
+        ? (recorded < blocks ? recorded : blocks) : blocks;
+    emulator->medium.profile = profile;
+    emulator->medium.present = True;
+    emulator->tray_open = False;
+    emulator->media_event = EVENT_MEDIA_EC_NEWMEDIA;
+    return SUCCESS;
+}
+
+RESULT optcl_emulator_eject(optcl_emulator *emulator)
+{
+    RESULT error = SUCCESS;
+
+    assert(emulator != 0);
+    if (emulator == 0)
+        return E_INVALIDARG;
+
+    flush_buffer(emulator);
+
+    if (emulator->medium.file != 0 && fclose(emulator->medium.file) != 0)
+        error = E_UNEXPECTED;
+
+    /* Ejecting opens the tray */
+    if (emulator->medium.present == True) {
+        emulator->media_event = EVENT_MEDIA_EC_MEDIAREMOVAL;
+        emulator->tray_open = True;
+    }
+
+    free(emulator->medium.memory);
+    memset(&emulator->medium, 0, sizeof(emulator->medium));
+    emulator->spinning = False;
+    emulator->head_lba = 0;
+    return error;
+}
+
+RESULT optcl_emulator_advance_clock(optcl_emulator *emulator, uint32_t usec)
+{
+    assert(emulator != 0);
+    if (emulator == 0)
+        return E_INVALIDARG;
+
+    advance_clock(emulator, usec);
+    return SUCCESS;
+}
+
+RESULT optcl_emulator_get_stats(const optcl_emulator *emulator,
+                                optcl_emulator_stats *stats)
+{
+    assert(emulator != 0);
+    assert(stats != 0);
+    if (emulator == 0 || stats == 0)
+        return E_INVALIDARG;
+
+    memcpy(stats, &emulator->stats, sizeof(optcl_emulator_stats));
+    stats->clock = emulator->clock - emulator->epoch;
+    return SUCCESS;
+}
+
+RESULT optcl_emulator_reset_stats(optcl_emulator *emulator)
+{
+    assert(emulator != 0);
+    if (emulator == 0)
+        return E_INVALIDARG;
+
+    memset(&emulator->stats, 0, sizeof(optcl_emulator_stats));
+    emulator->epoch = emulator->clock;
+    return SUCCESS;
+}
+
+RESULT optcl_emulator_bind(optcl_device *device, optcl_emulator *emulator)
+{
+    RESULT error;
+    RESULT destroy_error;
+    char *string;
+    optcl_list_iterator it = 0;
+    optcl_feature *feature = 0;
+    optcl_retry_policy policy;
+    optcl_mmc_get_configuration command;
+    optcl_mmc_response_get_configuration *response = 0;
+
+    assert(device != 0);
+    assert(emulator != 0);
+    if (device == 0 || emulator == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_clear(device);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_transport_register(&__emulator_transport);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_set_transport(device, &__emulator_transport,
+        (ptr_t)emulator);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_set_type(device, DEVICE_TYPE_CD_DVD);
+    if (FAILED(error))
+        return error;
+
+    /* Retry delays would not advance the emulated clock */
+    memset(&policy, 0, sizeof(policy));
+    error = optcl_device_set_retry_policy(device, &policy);
+    if (FAILED(error))
+        return error;
+
+    string = xstrdup(__emulator_transport.name);
+    if (string == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_path(device, string);
+    if (FAILED(error)) {
+        free(string);
+        return error;
+    }
+
+    string = xstrdup(EMULATOR_VENDOR);
+    if (string == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_vendor(device, string);
+    if (FAILED(error)) {
+        free(string);
+        return error;
+    }
+
+    string = xstrdup(EMULATOR_PRODUCT);
+    if (string == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_product(device, string);
+    if (FAILED(error)) {
+        free(string);
+        return error;
+    }
+
+    string = xstrdup(EMULATOR_REVISION);
+    if (string == 0)
+        return E_OUTOFMEMORY;
+
+    error = optcl_device_set_revision(device, string);
+    if (FAILED(error)) {
+        free(string);
+        return error;
+    }
+
+    /*
+     * Fill device features the same way enumeration does, the
+     * emulator answers GET CONFIGURATION itself.
+     */
+    command.rt = MMC_GET_CONFIG_RT_ALL;
+    command.start_feature = 0;
+    error = optcl_command_get_configuration(device, &command, &response);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_list_get_head_pos(response->descriptors, &it);
+    while (SUCCEEDED(error) && it != 0) {
+        error = optcl_list_get_at_pos(response->descriptors, it,
+            (const pptr_t)&feature);
+        if (FAILED(error))
+            break;
+
+        error = optcl_device_set_feature(device, feature->feature_code,
+            feature);
+        if (FAILED(error))
+            break;
+
+        error = optcl_list_get_next(response->descriptors, it, &it);
+    }
+
+    destroy_error = optcl_list_destroy(response->descriptors, False);
+    free(response);
+    return SUCCEEDED(destroy_error) ? error : destroy_error;
+}
@@ -0,0 +1,142 @@
+/*
+    emulator.h - Emulated MMC drive
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _EMULATOR_H
+#define _EMULATOR_H
+
+#include "device.h"
+#include "errors.h"
+#include "types.h"
+
+
+/* Maximum number of speed zones in a timing model */
+#define EMULATOR_MAX_ZONES		8
+
+/* Speed zone modes */
+#define EMULATOR_ZONE_CLV		0	/* Constant linear velocity */
+#define EMULATOR_ZONE_CAV		1	/* Constant angular velocity */
+
+
+/* Emulated drive descriptor */
+struct tag_emulator;
+typedef struct tag_emulator optcl_emulator;
+
+/*
+ * Speed zone
+ *
+ * A zone starts at start_lba and ends where the next zone starts or
+ * at the end of the medium. CLV zones transfer at inner_rate, in CAV
+ * zones the rate grows linearly from inner_rate to outer_rate.
+ */
+typedef struct tag_emulator_zone {
+    uint32_t start_lba;
+    uint16_t mode;
+    uint32_t inner_rate;        /* Bytes per second at zone start */
+    uint32_t outer_rate;        /* Bytes per second at zone end */
+} optcl_emulator_zone;
+
+/*
+ * Emulated drive timing model
+ *
+ * Times are in microseconds and rates in bytes per second. The
+ * emulator does not sleep, every command advances an emulated clock
+ * instead, so the same command sequence always takes the same
+ * emulated time.
+ */
+typedef struct tag_emulator_timing {
+    uint32_t command_overhead;  /* Time spent on every command */
+    uint32_t spinup_time;       /* Time from stopped disc to ready */
+    uint32_t spindown_delay;    /* Idle time before the disc stops, 0 never */
+    uint32_t seek_settle;       /* Fixed part of every seek */
+    uint32_t seek_stroke;       /* Additional time for a full stroke seek */
+    uint32_t bus_rate;          /* Host transfer rate */
+    uint32_t buffer_size;       /* Drive write buffer size in bytes */
+    uint32_t drain_rate;        /* Buffer drain rate, 0 follows the zones */
+    uint32_t max_transfer_len;  /* Largest transfer reported to the host */
+    uint32_t zone_count;
+    optcl_emulator_zone zones[EMULATOR_MAX_ZONES];
+} optcl_emulator_timing;
+
+/*
+ * Emulated drive statistics
+ */
+typedef struct tag_emulator_stats {
+    uint64_t clock;             /* Emulated time in microseconds */
+    uint32_t commands;          /* Commands executed */
+    uint32_t seeks;             /* Head movements */
+    uint32_t spinups;           /* Disc spin ups */
+    uint32_t buffer_stalls;     /* Writes that waited for buffer space */
+    uint64_t bytes_read;        /* Data read from the medium */
+    uint64_t bytes_written;     /* Data written to the medium */
+} optcl_emulator_stats;
+
+
+/* Fill timing model with 16x DVD drive defaults */
+extern 
+RESULT optcl_emulator_get_default_timing(optcl_emulator_timing *timing);
+
+/* Create emulated drive with the given timing model */
+extern 
+RESULT optcl_emulator_create(const optcl_emulator_timing *timing,
+                             optcl_emulator **emulator);
+
+/* Destroy emulated drive, it must not be bound to any device */
+extern 
+RESULT optcl_emulator_destroy(optcl_emulator *emulator);
+
+/* Insert zero filled memory medium */
+extern 
+RESULT optcl_emulator_load_memory(optcl_emulator *emulator,
+                                  uint32_t blocks,
+                                  uint16_t profile);
+
+/* Insert file backed medium, zero blocks uses the file size */
+extern 
+RESULT optcl_emulator_load_file(optcl_emulator *emulator,
+                                const char *filename,
+                                uint32_t blocks,
+                                uint16_t profile);
+
+/* Remove medium, the tray is left open until a medium is inserted */
+extern 
+RESULT optcl_emulator_eject(optcl_emulator *emulator);
+
+/* Advance emulated clock, e.g. by host processing time */
+extern 
+RESULT optcl_emulator_advance_clock(optcl_emulator *emulator, uint32_t usec);
+
+/* Get emulated drive statistics */
+extern 
+RESULT optcl_emulator_get_stats(const optcl_emulator *emulator,
+                                optcl_emulator_stats *stats);
+
+/* Reset emulated clock and statistics */
+extern 
+RESULT optcl_emulator_reset_stats(optcl_emulator *emulator);
+
+/* 
+ * Bind device to the emulated drive, command retries are turned off
+ * since retry delays would not advance the emulated clock
+ */
+extern 
+RESULT optcl_emulator_bind(optcl_device *device, optcl_emulator *emulator);
+
+#endif /* _EMULATOR_H */
@@ -65,6 +65,7 @@ typedef int32_t RESULT;
 #define FACILITY_FEATURES	3
 #define FACILITY_SENSE		4
 #define FACILITY_COMMANDS	5
+#define FACILITY_TRACE		6
 
 
 /* Error status testing macros */
@@ -124,6 +125,9 @@ typedef int32_t RESULT;
 #define E_POINTER		\
 	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_GENERAL, 7)
 
+#define E_NOTIMPL		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_GENERAL, 8)
+
 
 /* FACILITY_DEVICE error codes */
 
@@ -139,6 +143,33 @@ typedef int32_t RESULT;
 #define E_DEVINVALIDSIZE	\
 	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 4)
 
+#define E_DEVUNALIGNEDBUF	\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 5)
+
+#define E_DEVNOTOPEN		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 6)
+
+#define E_DEVQUEUEFULL		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 7)
+
+#define E_DEVNOTMAPPED		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 8)
+
+#define E_DEVTIMEOUT		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 9)
+
+#define E_DEVINVALIDIMAGE	\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 10)
+
+#define E_DEVCACHEMISS		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 11)
+
+#define E_DEVTRANSPORTBOUND	\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 12)
+
+#define E_DEVDRIVERERROR	\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 13)
+
 #define E_DEVNOMOREDATA		\
 	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_DEVICE, 259)
 
@@ -173,4 +204,16 @@ typedef int32_t RESULT;
 	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_COMMANDS, 0)
 
 
+/* FACILITY_TRACE error codes */
+
+#define E_TRACEINVFORMAT	\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_TRACE, 0)
+
+#define E_TRACEMISMATCH		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_TRACE, 1)
+
+#define E_TRACEEND		\
+	MAKE_ERRORCODE(SEVERITY_ERROR, FACILITY_TRACE, 2)
+
+
 #endif /* _ERRORS_H */
@@ -0,0 +1,814 @@
+/*
+    fault.c - Fault injection transport
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "device.h"
+#include "errors.h"
+#include "fault.h"
+#include "helpers.h"
+#include "sensedata.h"
+#include "sysdevice.h"
+#include "transport.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+#define FAULT_MAX_CDB_SIZE		16U
+#define FAULT_MAX_PENDING		16U
+#define FAULT_DEFAULT_SEED		0x2545F491U
+
+
+/*
+ * MMC opcodes addressing logical blocks
+ */
+
+#define MMC_OPCODE_READ_10			        0x0028
+#define MMC_OPCODE_READ_12			        0x00A8
+#define MMC_OPCODE_READ_CD			        0x00BE
+#define MMC_OPCODE_SEEK				        0x002B
+#define MMC_OPCODE_VERIFY			        0x002F
+#define MMC_OPCODE_WRITE			        0x002A
+#define MMC_OPCODE_WRITE_12			        0x00AA
+#define MMC_OPCODE_WRITE_AND_VERIFY_10		0x002E
+
+
+/*
+ * Internal fault injector structures
+ */
+
+/* Fault rule and the number of times it fired */
+typedef struct tag_fault_entry {
+    optcl_fault_rule rule;
+    uint32_t fired;
+} optcl_fault_entry;
+
+/* Fault drawn for a submitted command, applied when it completes */
+typedef struct tag_fault_pending {
+    bool_t busy;
+    uint32_t tag;
+    uint8_t opcode;
+    const optcl_fault_entry *entry;
+} optcl_fault_pending;
+
+/* Fault injector descriptor */
+struct tag_fault_injector {
+    uint32_t state;             /* Random generator state */
+    bool_t sleep;
+    uint32_t rule_count;
+    optcl_fault_entry rules[FAULT_MAX_RULES];
+    optcl_fault_pending pending[FAULT_MAX_PENDING];
+    optcl_fault_stats stats;
+    optcl_transfer_limits limits;
+    const optcl_transport *transport;   /* Wrapped transport */
+    ptr_t context;
+    const optcl_transport *saved;       /* Transport bound before attaching */
+    ptr_t saved_context;
+};
+
+
+/*
+ * Helper functions
+ */
+
+static uint32_t get_be32(const uint8_t data[])
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+        | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static void put_be32(uint8_t data[], uint32_t value)
+{
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+/* Xorshift generator, the sequence depends on the seed only */
+static uint32_t next_random(optcl_fault_injector *injector)
+{
+    uint32_t x = injector->state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    injector->state = x;
+    return x;
+}
+
+static bool_t is_write_opcode(uint8_t opcode)
+{
+    return bool_from_uint8(opcode == MMC_OPCODE_WRITE
+        || opcode == MMC_OPCODE_WRITE_12
+        || opcode == MMC_OPCODE_WRITE_AND_VERIFY_10);
+}
+
+/* Get block range addressed by the command, false if it has none */
+static bool_t get_block_range(const uint8_t cdb[],
+                              uint32_t cdb_size,
+                              uint32_t *lba,
+                              uint32_t *count,
+                              uint32_t *count_offset,
+                              uint32_t *count_size)
+{
+    if (cdb_size < 10)
+        return False;
+
+    switch (cdb[0]) {
+    case MMC_OPCODE_READ_10:
+    case MMC_OPCODE_WRITE:
+    case MMC_OPCODE_WRITE_AND_VERIFY_10:
+    case MMC_OPCODE_VERIFY:
+        *count_offset = 7;
+        *count_size = 2;
+        *count = ((uint32_t)cdb[7] << 8) | cdb[8];
+        break;
+
+    case MMC_OPCODE_READ_12:
+    case MMC_OPCODE_WRITE_12:
+        if (cdb_size < 12)
+            return False;
+
+        *count_offset = 6;
+        *count_size = 4;
+        *count = get_be32(&cdb[6]);
+        break;
+
+    case MMC_OPCODE_READ_CD:
+        if (cdb_size < 12)
+            return False;
+
+        *count_offset = 6;
+        *count_size = 3;
+        *count = ((uint32_t)cdb[6] << 16) | ((uint32_t)cdb[7] << 8) | cdb[8];
+        break;
+
+    case MMC_OPCODE_SEEK:
+        *count_offset = 0;
+        *count_size = 0;
+        *count = 1;
+        break;
+
+    default:
+        return False;
+    }
+
+    *lba = get_be32(&cdb[2]);
+    return True;
+}
+
+static optcl_fault_entry* select_fault(optcl_fault_injector *injector,
+                                       const uint8_t cdb[],
+                                       uint32_t cdb_size)
+{
+    uint32_t i;
+    uint32_t lba;
+    uint32_t count;
+    uint32_t last;
+    uint32_t count_offset;
+    uint32_t count_size;
+    bool_t addressed;
+    optcl_fault_entry *entry;
+
+    assert(injector != 0);
+
+    addressed = get_block_range(cdb, cdb_size, &lba, &count,
+        &count_offset, &count_size);
+
+    for (i = 0; i < injector->rule_count; ++i) {
+        entry = &injector->rules[i];
+
+        if (entry->rule.opcode != FAULT_ANY_OPCODE
+            && entry->rule.opcode != cdb[0])
+            continue;
+
+        if (entry->rule.count != 0 && entry->fired >= entry->rule.count)
+            continue;
+
+        if (addressed == True) {
+            last = (count > 0) ? lba + count - 1 : lba;
+            if (last < entry->rule.first_lba || lba > entry->rule.last_lba)
+                continue;
+        } else if (entry->rule.first_lba != 0
+            || entry->rule.last_lba != FAULT_ANY_LBA) {
+            continue;
+        }
+
+        if (entry->rule.rate < FAULT_RATE_ALWAYS
+            && next_random(injector) % FAULT_RATE_ALWAYS >= entry->rule.rate)
+            continue;
+
+        ++entry->fired;
+        ++injector->stats.injected[entry->rule.kind];
+        return entry;
+    }
+
+    return 0;
+}
+
+static void inject_delay(optcl_fault_injector *injector, uint32_t usec)
+{
+    assert(injector != 0);
+
+    injector->stats.delay += usec;
+    if (injector->sleep == True && usec > 0)
+        xsleep_usec(usec);
+}
+
+static RESULT get_fault_sense(const optcl_fault_rule *rule, uint8_t opcode)
+{
+    assert(rule != 0);
+
+    if (rule->sense != 0)
+        return rule->sense;
+
+    switch (rule->kind) {
+    case FAULT_NOT_READY:
+        return E_SENSE_LUNR_LWIP;
+
+    case FAULT_UNIT_ATTENTION:
+        return E_SENSE_NRTRC_MMHC;
+
+    case FAULT_TIMEOUT:
+        return E_DEVTIMEOUT;
+
+    default:
+        return (is_write_opcode(opcode) == True) ? E_SENSE_WE_3 : E_SENSE_URE;
+    }
+}
+
+/*
+ * Shorten a block command to half of its blocks, returns false
+ * if nothing would be transferred.
+ */
+static bool_t shorten_command(const uint8_t cdb[],
+                              uint32_t cdb_size,
+                              uint8_t short_cdb[],
+                              uint32_t data_size,
+                              uint32_t *short_size)
+{
+    uint32_t lba;
+    uint32_t count;
+    uint32_t half;
+    uint32_t count_offset;
+    uint32_t count_size;
+
+    if (cdb_size > FAULT_MAX_CDB_SIZE)
+        return False;
+
+    if (get_block_range(cdb, cdb_size, &lba, &count,
+        &count_offset, &count_size) == False || count < 2 || count_size == 0)
+        return False;
+
+    half = count / 2;
+    memcpy(short_cdb, cdb, cdb_size);
+
+    if (count_size == 2) {
+        short_cdb[count_offset] = (uint8_t)(half >> 8);
+        short_cdb[count_offset + 1] = (uint8_t)half;
+    } else if (count_size == 3) {
+        short_cdb[count_offset] = (uint8_t)(half >> 16);
+        short_cdb[count_offset + 1] = (uint8_t)(half >> 8);
+        short_cdb[count_offset + 2] = (uint8_t)half;
+    } else {
+        put_be32(&short_cdb[count_offset], half);
+    }
+
+    *short_size = (uint32_t)((uint64_t)data_size * half / count);
+    return True;
+}
+
+/* Injects faults that do not reach the device, true if one was */
+static bool_t inject_fault(optcl_fault_injector *injector,
+                           const optcl_fault_entry *entry,
+                           uint8_t opcode,
+                           RESULT *result)
+{
+    assert(injector != 0);
+
+    if (entry == 0)
+        return False;
+
+    switch (entry->rule.kind) {
+    case FAULT_LATENCY:
+        inject_delay(injector, entry->rule.latency);
+        return False;
+
+    case FAULT_PARTIAL_TRANSFER:
+        return False;
+
+    case FAULT_TIMEOUT:
+        inject_delay(injector, entry->rule.latency);
+        break;
+
+    default:
+        break;
+    }
+
+    *result = get_fault_sense(&entry->rule, opcode);
+    return True;
+}
+
+
+/*
+ * Fault injection transport
+ */
+
+static RESULT fault_open(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+    optcl_fault_injector *injector;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    injector = (optcl_fault_injector*)context;
+    if (injector->transport->open == 0)
+        return E_NOTIMPL;
+
+    error = injector->transport->open(device, injector->context);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    /* Block device reads bypass the transport and would never fail */
+    session->block_reads = False;
+    return SUCCESS;
+}
+
+static RESULT fault_close(optcl_device *device, ptr_t context)
+{
+    optcl_fault_injector *injector;
+
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    /* Commands still in flight are dropped with the session */
+    injector = (optcl_fault_injector*)context;
+    memset(injector->pending, 0, sizeof(injector->pending));
+
+    return (injector->transport->close != 0)
+        ? injector->transport->close(device, injector->context) : SUCCESS;
+}
+
+static RESULT fault_execute(const optcl_device *device,
+                            ptr_t context,
+                            const uint8_t cdb[],
+                            uint32_t cdb_size,
+                            uint8_t param[],
+                            uint32_t param_size)
+{
+    RESULT error;
+    RESULT result;
+    uint32_t short_size;
+    optcl_fault_entry *entry;
+    optcl_fault_injector *injector;
+    uint8_t short_cdb[FAULT_MAX_CDB_SIZE];
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    if (device == 0 || context == 0 || cdb == 0 || cdb_size == 0)
+        return E_INVALIDARG;
+
+    injector = (optcl_fault_injector*)context;
+    if (injector->transport->execute == 0)
+        return E_NOTIMPL;
+
+    ++injector->stats.commands;
+    entry = select_fault(injector, cdb, cdb_size);
+    if (inject_fault(injector, entry, cdb[0], &result) == True)
+        return result;
+
+    if (entry != 0 && entry->rule.kind == FAULT_PARTIAL_TRANSFER) {
+        if (shorten_command(cdb, cdb_size, short_cdb, param_size,
+            &short_size) == True) {
+            error = injector->transport->execute(device, injector->context,
+                short_cdb, cdb_size, param, short_size);
+            if (FAILED(error))
+                return error;
+        }
+
+        return get_fault_sense(&entry->rule, cdb[0]);
+    }
+
+    return injector->transport->execute(device, injector->context,
+        cdb, cdb_size, param, param_size);
+}
+
+static RESULT fault_execute_vectored(const optcl_device *device,
+                                     ptr_t context,
+                                     const uint8_t cdb[],
+                                     uint32_t cdb_size,
+                                     const optcl_iovec iov[],
+                                     uint32_t iov_count)
+{
+    RESULT error;
+    RESULT result;
+    uint32_t i;
+    uint32_t size;
+    uint32_t short_size;
+    uint32_t short_count;
+    optcl_iovec *short_iov;
+    optcl_fault_entry *entry;
+    optcl_fault_injector *injector;
+    uint8_t short_cdb[FAULT_MAX_CDB_SIZE];
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    if (device == 0 || context == 0 || cdb == 0 || cdb_size == 0)
+        return E_INVALIDARG;
+
+    injector = (optcl_fault_injector*)context;
+    if (injector->transport->execute_vectored == 0)
+        return E_NOTIMPL;
+
+    ++injector->stats.commands;
+    entry = select_fault(injector, cdb, cdb_size);
+    if (inject_fault(injector, entry, cdb[0], &result) == True)
+        return result;
+
+    if (entry == 0 || entry->rule.kind != FAULT_PARTIAL_TRANSFER) {
+        return injector->transport->execute_vectored(device,
+            injector->context, cdb, cdb_size, iov, iov_count);
+    }
+
+    for (i = 0, size = 0; i < iov_count; ++i)
+        size += iov[i].len;
+
+    if (shorten_command(cdb, cdb_size, short_cdb, size, &short_size) == True) {
+        short_iov = (optcl_iovec*)malloc(iov_count * sizeof(optcl_iovec));
+        if (short_iov == 0)
+            return E_OUTOFMEMORY;
+
+        for (i = 0, short_count = 0; i < iov_count && short_size > 0; ++i) {
+            short_iov[i].base = iov[i].base;
+            short_iov[i].len = (iov[i].len < short_size)
+                ? iov[i].len : short_size;
+            short_size -= short_iov[i].len;
+            ++short_count;
+        }
+
+        error = injector->transport->execute_vectored(device,
+            injector->context, short_cdb, cdb_size, short_iov, short_count);
+
+        free(short_iov);
+        if (FAILED(error))
+            return error;
+    }
+
+    return get_fault_sense(&entry->rule, cdb[0]);
+}
+
+/*
+ * Submitted commands are always passed on, so their completion comes
+ * back through the wrapped transport. A fault drawn at submit time
+ * replaces the status when the command completes.
+ */
+static RESULT fault_submit(const optcl_device *device,
+                           ptr_t context,
+                           const uint8_t cdb[],
+                           uint32_t cdb_size,
+                           uint8_t param[],
+                           uint32_t param_size,
+                           uint32_t tag)
+{
+    RESULT error;
+    uint32_t i;
+    uint32_t short_size;
+    optcl_fault_entry *entry;
+    optcl_fault_pending *pending;
+    optcl_fault_injector *injector;
+    uint8_t short_cdb[FAULT_MAX_CDB_SIZE];
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    if (device == 0 || context == 0 || cdb == 0 || cdb_size == 0)
+        return E_INVALIDARG;
+
+    injector = (optcl_fault_injector*)context;
+    if (injector->transport->submit == 0)
+        return E_NOTIMPL;
+
+    for (i = 0, pending = 0; i < FAULT_MAX_PENDING; ++i) {
+        if (injector->pending[i].busy == False) {
+            pending = &injector->pending[i];
+            break;
+        }
+    }
+
+    if (pending == 0)
+        return E_DEVQUEUEFULL;
+
+    ++injector->stats.commands;
+    entry = select_fault(injector, cdb, cdb_size);
+    if (entry != 0 && entry->rule.kind == FAULT_PARTIAL_TRANSFER
+        && shorten_command(cdb, cdb_size, short_cdb, param_size,
+        &short_size) == True) {
+        error = injector->transport->submit(device, injector->context,
+            short_cdb, cdb_size, param, short_size, tag);
+    } else {
+        error = injector->transport->submit(device, injector->context,
+            cdb, cdb_size, param, param_size, tag);
+    }
+
+    if (FAILED(error) || entry == 0)
+        return error;
+
+    pending->busy = True;
+    pending->tag = tag;
+    pending->opcode = cdb[0];
+    pending->entry = entry;
+    return SUCCESS;
+}
+
+static RESULT fault_complete(const optcl_device *device,
+                             ptr_t context,
+                             uint32_t *tag,
+                             RESULT *status)
+{
+    RESULT error;
+    RESULT result;
+    uint32_t i;
+    optcl_fault_pending *pending;
+    optcl_fault_injector *injector;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(tag != 0);
+    assert(status != 0);
+    if (device == 0 || context == 0 || tag == 0 || status == 0)
+        return E_INVALIDARG;
+
+    injector = (optcl_fault_injector*)context;
+    if (injector->transport->complete == 0)
+        return E_NOTIMPL;
+
+    error = injector->transport->complete(device, injector->context,
+        tag, status);
+    if (FAILED(error))
+        return error;
+
+    for (i = 0; i < FAULT_MAX_PENDING; ++i) {
+        pending = &injector->pending[i];
+        if (pending->busy == True && pending->tag == *tag)
+            break;
+    }
+
+    if (i == FAULT_MAX_PENDING)
+        return SUCCESS;
+
+    pending->busy = False;
+    if (inject_fault(injector, pending->entry, pending->opcode,
+        &result) == True) {
+        *status = result;
+    } else if (pending->entry->rule.kind == FAULT_PARTIAL_TRANSFER
+        && SUCCEEDED(*status)) {
+        *status = get_fault_sense(&pending->entry->rule, pending->opcode);
+    }
+
+    return SUCCESS;
+}
+
+static RESULT fault_poll(const optcl_device *device,
+                         ptr_t context,
+                         int32_t timeout,
+                         bool_t *ready)
+{
+    optcl_fault_injector *injector;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(ready != 0);
+    if (device == 0 || context == 0 || ready == 0)
+        return E_INVALIDARG;
+
+    injector = (optcl_fault_injector*)context;
+    return (injector->transport->poll != 0)
+        ? injector->transport->poll(device, injector->context, timeout, ready)
+        : E_NOTIMPL;
+}
+
+static RESULT fault_execute_mapped(const optcl_device *device,
+                                   ptr_t context,
+                                   const uint8_t cdb[],
+                                   uint32_t cdb_size,
+                                   uint32_t transfer_size,
+                                   const uint8_t **view)
+{
+    RESULT error;
+    RESULT result;
+    uint32_t short_size;
+    optcl_fault_entry *entry;
+    optcl_fault_injector *injector;
+    uint8_t short_cdb[FAULT_MAX_CDB_SIZE];
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    assert(view != 0);
+    if (device == 0 || context == 0 || cdb == 0 || cdb_size == 0 || view == 0)
+        return E_INVALIDARG;
+
+    injector = (optcl_fault_injector*)context;
+    if (injector->transport->execute_mapped == 0)
+        return E_NOTIMPL;
+
+    ++injector->stats.commands;
+    entry = select_fault(injector, cdb, cdb_size);
+    if (inject_fault(injector, entry, cdb[0], &result) == True)
+        return result;
+
+    if (entry != 0 && entry->rule.kind == FAULT_PARTIAL_TRANSFER) {
+        if (shorten_command(cdb, cdb_size, short_cdb, transfer_size,
+            &short_size) == True) {
+            error = injector->transport->execute_mapped(device,
+                injector->context, short_cdb, cdb_size, short_size, view);
+            if (FAILED(error))
+                return error;
+        }
+
+        return get_fault_sense(&entry->rule, cdb[0]);
+    }
+
+    return injector->transport->execute_mapped(device, injector->context,
+        cdb, cdb_size, transfer_size, view);
+}
+
+static RESULT fault_query_limits(const optcl_device *device,
+                                 ptr_t context,
+                                 optcl_transfer_limits *limits)
+{
+    assert(device != 0);
+    assert(context != 0);
+    assert(limits != 0);
+    if (device == 0 || context == 0 || limits == 0)
+        return E_INVALIDARG;
+
+    memcpy(limits, &((optcl_fault_injector*)context)->limits,
+        sizeof(optcl_transfer_limits));
+
+    return SUCCESS;
+}
+
+static const optcl_transport __fault_transport = {
+    "fault",
+    fault_open,
+    fault_close,
+    fault_execute,
+    fault_execute_vectored,
+    fault_submit,
+    fault_complete,
+    fault_poll,
+    fault_query_limits,
+    fault_execute_mapped
+};
+
+
+/*
+ * Fault injector functions
+ */
+
+RESULT optcl_fault_attach(optcl_device *device,
+                          uint32_t seed,
+                          bool_t sleep,
+                          optcl_fault_injector **injector)
+{
+    RESULT error;
+    optcl_fault_injector *ninjector;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(injector != 0);
+    if (device == 0 || injector == 0)
+        return E_INVALIDARG;
+
+    ninjector = (optcl_fault_injector*)malloc(sizeof(optcl_fault_injector));
+    if (ninjector == 0)
+        return E_OUTOFMEMORY;
+
+    memset(ninjector, 0, sizeof(optcl_fault_injector));
+    ninjector->state = (seed != 0) ? seed : FAULT_DEFAULT_SEED;
+    ninjector->sleep = sleep;
+
+    error = optcl_device_get_transport(device, &ninjector->saved,
+        &ninjector->saved_context);
+
+    ninjector->transport = ninjector->saved;
+    ninjector->context = ninjector->saved_context;
+    if (SUCCEEDED(error) && ninjector->transport == 0)
+        error = optcl_device_get_system_transport(&ninjector->transport);
+
+    if (SUCCEEDED(error))
+        error = optcl_device_get_transfer_limits(device, &ninjector->limits);
+
+    if (SUCCEEDED(error))
+        error = optcl_device_get_session(device, &session);
+
+    if (SUCCEEDED(error)) {
+        error = optcl_device_set_transport(device, &__fault_transport,
+            (ptr_t)ninjector);
+    }
+
+    if (FAILED(error)) {
+        free(ninjector);
+        return error;
+    }
+
+    /* Block device reads bypass the transport and would never fail */
+    session->block_reads = False;
+
+    *injector = ninjector;
+    return SUCCESS;
+}
+
+RESULT optcl_fault_add_rule(optcl_fault_injector *injector,
+                            const optcl_fault_rule *rule)
+{
+    assert(injector != 0);
+    assert(rule != 0);
+    if (injector == 0 || rule == 0)
+        return E_INVALIDARG;
+
+    assert(rule->kind < FAULT_KIND_COUNT);
+    assert(rule->first_lba <= rule->last_lba);
+    if (rule->kind >= FAULT_KIND_COUNT || rule->first_lba > rule->last_lba)
+        return E_INVALIDARG;
+
+    if (injector->rule_count >= FAULT_MAX_RULES)
+        return E_OVERFLOW;
+
+    memcpy(&injector->rules[injector->rule_count].rule, rule,
+        sizeof(optcl_fault_rule));
+
+    injector->rules[injector->rule_count].fired = 0;
+    ++injector->rule_count;
+    return SUCCESS;
+}
+
+RESULT optcl_fault_get_stats(const optcl_fault_injector *injector,
+                             optcl_fault_stats *stats)
+{
+    assert(injector != 0);
+    assert(stats != 0);
+    if (injector == 0 || stats == 0)
+        return E_INVALIDARG;
+
+    memcpy(stats, &injector->stats, sizeof(optcl_fault_stats));
+    return SUCCESS;
+}
+
+RESULT optcl_fault_detach(optcl_device *device,
+                          optcl_fault_injector *injector)
+{
+    RESULT error;
+
+    assert(device != 0);
+    assert(injector != 0);
+    if (device == 0 || injector == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_close(device);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_set_transport(device, injector->saved,
+        injector->saved_context);
+
+    free(injector);
+    return error;
+}
@@ -0,0 +1,113 @@
+/*
+    fault.h - Fault injection transport
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _FAULT_H
+#define _FAULT_H
+
+#include "device.h"
+#include "errors.h"
+#include "types.h"
+
+
+/* Maximum number of fault rules */
+#define FAULT_MAX_RULES			16
+
+/* Fault kinds */
+#define FAULT_MEDIUM_ERROR		0	/* Unrecovered read or write error */
+#define FAULT_NOT_READY			1	/* Not ready, long write in progress */
+#define FAULT_UNIT_ATTENTION		2	/* Medium may have changed */
+#define FAULT_TIMEOUT			3	/* Command times out after the rule latency */
+#define FAULT_PARTIAL_TRANSFER		4	/* Half of the blocks transfer, then medium error */
+#define FAULT_LATENCY			5	/* Command succeeds after the rule latency */
+#define FAULT_KIND_COUNT		6
+
+/* Rule matching any opcode */
+#define FAULT_ANY_OPCODE		0xFFFF
+
+/* Last LBA of a rule that also matches commands without an LBA */
+#define FAULT_ANY_LBA			0xFFFFFFFFU
+
+/* Rule rate that fires on every matching command, rates are per million */
+#define FAULT_RATE_ALWAYS		1000000U
+
+
+/* Fault injector descriptor */
+struct tag_fault_injector;
+typedef struct tag_fault_injector optcl_fault_injector;
+
+/*
+ * Fault rule
+ *
+ * A rule matches commands with the given opcode that touch blocks in
+ * the first_lba to last_lba range. Matching commands fail with the
+ * rule rate, at most count times if count is not zero. Zero sense
+ * selects the default sense for the fault kind.
+ */
+typedef struct tag_fault_rule {
+    uint16_t kind;
+    uint16_t opcode;
+    uint32_t first_lba;
+    uint32_t last_lba;
+    uint32_t rate;
+    uint32_t count;
+    uint32_t latency;       /* Microseconds for timeouts and latency spikes */
+    RESULT sense;
+} optcl_fault_rule;
+
+/*
+ * Fault injection statistics
+ */
+typedef struct tag_fault_stats {
+    uint32_t commands;                      /* Commands seen */
+    uint32_t injected[FAULT_KIND_COUNT];    /* Faults injected by kind */
+    uint64_t delay;                         /* Injected delay in microseconds */
+} optcl_fault_stats;
+
+
+/*
+ * Wrap transport bound to the device with a fault injector
+ *
+ * The device must not be open. Faults are drawn from a generator
+ * seeded with seed, so the same command sequence always gets the
+ * same faults. Without sleep injected delays are only counted.
+ */
+extern 
+RESULT optcl_fault_attach(optcl_device *device,
+                          uint32_t seed,
+                          bool_t sleep,
+                          optcl_fault_injector **injector);
+
+/* Add fault rule, rules are tried in the order they were added */
+extern 
+RESULT optcl_fault_add_rule(optcl_fault_injector *injector,
+                            const optcl_fault_rule *rule);
+
+/* Get fault injection statistics */
+extern 
+RESULT optcl_fault_get_stats(const optcl_fault_injector *injector,
+                             optcl_fault_stats *stats);
+
+/* Restore device transport and destroy fault injector */
+extern 
+RESULT optcl_fault_detach(optcl_device *device,
+                          optcl_fault_injector *injector);
+
+#endif /* _FAULT_H */
@@ -141,7 +141,14 @@ RESULT optcl_hashtable_clear(optcl_hashtable *hashtable, bool_t deallocate)
         return error;
 
     error = optcl_array_destroy(hashtable->entries, deallocate);
-    return error;
+    if (FAILED(error))
+        return error;
+
+    /* Cleared tables stay usable */
+    hashtable->entries = 0;
+    hashtable->keycount = 0;
+    hashtable->primeindex = 0;
+    return optcl_array_create(sizeof(struct entry*), 0, &hashtable->entries);
 }
 
 RESULT optcl_hashtable_copy(optcl_hashtable *dest, const optcl_hashtable *src)
@@ -239,10 +246,14 @@ RESULT optcl_hashtable_destroy(optcl_hashtable *hashtable, bool_t deallocate)
         return E_INVALIDARG;
 
     error = optcl_hashtable_clear(hashtable, deallocate);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_array_destroy(hashtable->entries, False);
     if (SUCCEEDED(error))
         free(hashtable);
 
-    return SUCCESS;
+    return error;
 }
 
 RESULT optcl_hashtable_get_pairs(const optcl_hashtable *hashtable,
@@ -20,6 +20,8 @@
 #ifndef _HELPERS_H
 #define _HELPERS_H
 
+#include "types.h"
+
 #include <stdlib.h>
 
 #ifndef WIN_32
@@ -56,4 +58,76 @@ errno_t xstrcat(char *dest, size_t dest_size, const char *src);
 extern 
 errno_t xmemcpy(void *dest, size_t dest_size, const void *src, size_t count);
 
+/*
+ * Time routines
+ */
+
+/* Monotonic time in microseconds */
+extern 
+uint64_t xtime_usec(void);
+
+/* Suspend the calling thread */
+extern 
+void xsleep_usec(uint32_t usec);
+
+/*
+ * File mapping routines
+ */
+
+/* File mapped read only into memory */
+typedef struct tag_xfile_map {
+    ptr_t view;         /* Zero for empty files */
+    uint64_t size;
+    ptr_t handle;       /* System file handle */
+    ptr_t mapping;      /* System mapping handle, where there is one */
+} xfile_map;
+
+/* Open and map file, writable maps may be written with xpwrite_file */
+extern 
+errno_t xmap_file(const char *filename, bool_t writable, xfile_map *map);
+
+/* Unmap and close file */
+extern 
+void xunmap_file(xfile_map *map);
+
+/* Write mapped file at offset, the view sees the written data */
+extern 
+errno_t xpwrite_file(const xfile_map *map, 
+                     const void *data, 
+                     size_t size, 
+                     uint64_t offset);
+
+/* Deallocate a range of a writable mapped file, it reads back as zeros */
+extern 
+errno_t xpunch_file(const xfile_map *map, uint64_t offset, uint64_t size);
+
+/*
+ * Find the first allocated range of a mapped file at or after offset,
+ * data_start and data_end are the file size when the rest is a hole
+ */
+extern 
+errno_t xfind_data(const xfile_map *map, 
+                   uint64_t offset, 
+                   uint64_t *data_start, 
+                   uint64_t *data_end);
+
+/*
+ * Thread routines
+ */
+
+/* Thread entry point */
+typedef void (*xthread_proc)(void *arg);
+
+/* Start a thread running proc */
+extern 
+errno_t xthread_create(xthread_proc proc, void *arg, ptr_t *thread);
+
+/* Wait for a thread to finish and release it */
+extern 
+errno_t xthread_join(ptr_t thread);
+
+/* Number of processors available to the process */
+extern 
+uint32_t xcpu_count(void);
+
 #endif /* _HELPERS_H */
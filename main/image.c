@@ -0,0 +1,947 @@
+/*
+    image.c - Image file device backend
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "device.h"
+#include "errors.h"
+#include "feature.h"
+#include "helpers.h"
+#include "image.h"
+#include "profile.h"
+#include "sensedata.h"
+#include "transport.h"
+#include "types.h"
+#include "zimage.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+#define IMAGE_INQUIRY_LEN		96U
+#define IMAGE_CONFIG_LEN		64U
+
+/* Images up to the size of a 90 minute CD are reported as CDs */
+#define IMAGE_CD_MAX_BLOCKS		405000U
+
+/* Smallest alignment xmalloc_aligned accepts, memory needs no more */
+#define IMAGE_ALIGNMENT			sizeof(ptr_t)
+
+#define IMAGE_VENDOR			"OPTCL   "
+#define IMAGE_PRODUCT			"IMAGE FILE      "
+#define IMAGE_REVISION			"1.00"
+
+
+/*
+ * MMC opcodes served by image devices
+ */
+
+#define MMC_OPCODE_GET_CONFIG			    0x0046
+#define MMC_OPCODE_INQUIRY			        0x0012
+#define MMC_OPCODE_PREVENT_ALLOW_REMOVAL	0x001E
+#define MMC_OPCODE_READ_10			        0x0028
+#define MMC_OPCODE_READ_12			        0x00A8
+#define MMC_OPCODE_READ_CAPACITY		    0x0025
+#define MMC_OPCODE_READ_TRACK_INFORMATION	0x0052
+#define MMC_OPCODE_REQUEST_SENSE		    0x0003
+#define MMC_OPCODE_SEEK				        0x002B
+#define MMC_OPCODE_SET_CD_SPEED			    0x00BB
+#define MMC_OPCODE_START_STOP_UNIT		    0x001B
+#define MMC_OPCODE_SYNCHRONIZE_CACHE		0x0035
+#define MMC_OPCODE_TEST_UNIT_READY		    0x0000
+#define MMC_OPCODE_VERIFY			        0x002F
+#define MMC_OPCODE_WRITE			        0x002A
+#define MMC_OPCODE_WRITE_12			        0x00AA
+#define MMC_OPCODE_WRITE_AND_VERIFY_10		0x002E
+
+
+/*
+ * Internal image structures
+ */
+
+/* Image opened on a device */
+typedef struct tag_image {
+    xfile_map map;
+    optcl_zimage *zimage;       /* Compressed image reader, if compressed */
+    bool_t writable;
+    uint16_t profile;
+    uint32_t blocks;
+} optcl_image;
+
+
+/*
+ * Helper functions
+ */
+
+static uint32_t get_be32(const uint8_t data[])
+{
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+        | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+}
+
+static uint16_t get_be16(const uint8_t data[])
+{
+    return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static void put_be32(uint8_t data[], uint32_t value)
+{
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+static void put_be16(uint8_t data[], uint16_t value)
+{
+    data[0] = (uint8_t)(value >> 8);
+    data[1] = (uint8_t)value;
+}
+
+static uint64_t get_iov_size(const optcl_iovec iov[], uint32_t iov_count)
+{
+    uint32_t i;
+    uint64_t size = 0;
+
+    for (i = 0; i < iov_count; ++i)
+        size += iov[i].len;
+
+    return size;
+}
+
+/* Copy synthesized or image data into the host buffers */
+static void copy_to_iov(const optcl_iovec iov[],
+                        uint32_t iov_count,
+                        const uint8_t data[],
+                        uint32_t size)
+{
+    uint32_t i;
+    uint32_t chunk;
+
+    for (i = 0; i < iov_count && size > 0; ++i) {
+        chunk = (iov[i].len < size) ? iov[i].len : size;
+        memcpy(iov[i].base, data, chunk);
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+static void close_image(optcl_image *image)
+{
+    assert(image != 0);
+
+    if (image->zimage != 0)
+        optcl_zimage_close(image->zimage);
+
+    xunmap_file(&image->map);
+    free(image);
+}
+
+static RESULT open_image(const optcl_device *device, optcl_image **image)
+{
+    errno_t err;
+    RESULT error;
+    uint64_t size;
+    const char *path = 0;
+    optcl_image *nimage;
+
+    assert(device != 0);
+    assert(image != 0);
+
+    error = optcl_device_get_path_ref(device, &path);
+    if (FAILED(error))
+        return error;
+
+    if (path == 0)
+        return E_DEVINVALIDPATH;
+
+    nimage = (optcl_image*)malloc(sizeof(optcl_image));
+    if (nimage == 0)
+        return E_OUTOFMEMORY;
+
+    memset(nimage, 0, sizeof(optcl_image));
+
+    /* Images without write access are read only media */
+    nimage->writable = True;
+    err = xmap_file(path, True, &nimage->map);
+    if (err != 0) {
+        nimage->writable = False;
+        err = xmap_file(path, False, &nimage->map);
+    }
+
+    if (err != 0) {
+        free(nimage);
+        return E_DEVINVALIDPATH;
+    }
+
+    size = nimage->map.size;
+
+    /* Compressed images are read only media */
+    if (optcl_zimage_is_zimage(&nimage->map) == True) {
+        error = optcl_zimage_open(&nimage->map, &nimage->zimage);
+        if (SUCCEEDED(error))
+            error = optcl_zimage_get_size(nimage->zimage, &size);
+
+        if (FAILED(error)) {
+            close_image(nimage);
+            return error;
+        }
+
+        nimage->writable = False;
+    }
+
+    nimage->blocks = (uint32_t)(size / IMAGE_BLOCK_SIZE);
+
+    /* Writes never grow the file, an empty target could not be written */
+    if (nimage->writable == True && nimage->blocks == 0) {
+        close_image(nimage);
+        return E_DEVINVALIDSIZE;
+    }
+
+    if (nimage->writable == True)
+        nimage->profile = PROFILE_DVD_PLUS_RW;
+    else if (nimage->blocks <= IMAGE_CD_MAX_BLOCKS)
+        nimage->profile = PROFILE_CD_ROM;
+    else
+        nimage->profile = PROFILE_DVD_ROM;
+
+    *image = nimage;
+    return SUCCESS;
+}
+
+/* Get image of an open device or open it for a single command */
+static RESULT acquire_image(const optcl_device *device,
+                            optcl_image **image,
+                            bool_t *temporary)
+{
+    RESULT error;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(image != 0);
+    assert(temporary != 0);
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    ++session->commands;
+
+    if (session->is_open == True && session->handle != 0) {
+        *image = (optcl_image*)session->handle;
+        *temporary = False;
+        ++session->opens_saved;
+        return SUCCESS;
+    }
+
+    ++session->opens;
+    *temporary = True;
+    return open_image(device, image);
+}
+
+/*
+ * Check if a block holds only zeros. Words are or-ed together a cache
+ * line at a time without branches, which compilers turn into vector
+ * instructions, so blank blocks cost little more than a memory scan.
+ */
+static bool_t is_zero_block(const uint8_t data[], uint32_t size)
+{
+    uint32_t i;
+    uint32_t j;
+    uint64_t acc;
+    uint64_t words[8];
+
+    for (i = 0; i + sizeof(words) <= size; i += sizeof(words)) {
+        memcpy(words, &data[i], sizeof(words));
+
+        acc = 0;
+        for (j = 0; j < 8; ++j)
+            acc |= words[j];
+
+        if (acc != 0)
+            return False;
+    }
+
+    for (; i < size; ++i) {
+        if (data[i] != 0)
+            return False;
+    }
+
+    return True;
+}
+
+/*
+ * Get the recorded extent at or after the block, start and end are
+ * the image size when no block after it is recorded
+ */
+static RESULT find_recorded_extent(const optcl_image *image,
+                                   uint32_t lba,
+                                   uint32_t *start,
+                                   uint32_t *end)
+{
+    uint64_t data_start;
+    uint64_t data_end;
+
+    /* Compressed images are recorded to the end */
+    if (image->zimage != 0) {
+        *start = (lba < image->blocks) ? lba : image->blocks;
+        *end = image->blocks;
+        return SUCCESS;
+    }
+
+    if (xfind_data(&image->map, (uint64_t)lba * IMAGE_BLOCK_SIZE,
+        &data_start, &data_end) != 0)
+        return E_SENSE_URE;
+
+    /* Holes are file system blocks, partly recorded blocks are recorded */
+    *start = (uint32_t)(data_start / IMAGE_BLOCK_SIZE);
+    *end = (uint32_t)((data_end + IMAGE_BLOCK_SIZE - 1) / IMAGE_BLOCK_SIZE);
+
+    if (*start > image->blocks)
+        *start = image->blocks;
+
+    if (*end > image->blocks)
+        *end = image->blocks;
+
+    return SUCCESS;
+}
+
+static RESULT check_range(const optcl_image *image,
+                          uint32_t lba,
+                          uint32_t count)
+{
+    assert(image != 0);
+
+    if (lba > image->blocks || count > image->blocks - lba)
+        return E_SENSE_LBAOOR;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Command handlers
+ */
+
+static RESULT image_inquiry(const uint8_t cdb[],
+                            const optcl_iovec iov[],
+                            uint32_t iov_count)
+{
+    uint16_t alloc_len;
+    uint8_t response[IMAGE_INQUIRY_LEN];
+
+    memset(response, 0, sizeof(response));
+    response[0] = 0x05;             /* CD/DVD device */
+    response[1] = 0x80;             /* Removable medium */
+    response[2] = 0x05;
+    response[3] = 0x02;
+    response[4] = IMAGE_INQUIRY_LEN - 5;
+    memcpy(&response[8], IMAGE_VENDOR, 8);
+    memcpy(&response[16], IMAGE_PRODUCT, 16);
+    memcpy(&response[32], IMAGE_REVISION, 4);
+
+    alloc_len = get_be16(&cdb[3]);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < sizeof(response)) ? alloc_len : sizeof(response));
+
+    return SUCCESS;
+}
+
+static uint32_t append_feature(uint8_t response[],
+                               uint32_t offset,
+                               uint16_t feature_code,
+                               const uint8_t data[],
+                               uint8_t data_len)
+{
+    put_be16(&response[offset], feature_code);
+    response[offset + 2] = 0x03;    /* Persistent, current */
+    response[offset + 3] = data_len;
+    memcpy(&response[offset + 4], data, data_len);
+    return offset + 4 + data_len;
+}
+
+static RESULT image_get_configuration(const optcl_image *image,
+                                      const uint8_t cdb[],
+                                      const optcl_iovec iov[],
+                                      uint32_t iov_count)
+{
+    int i;
+    uint8_t rt;
+    uint8_t data[12];
+    uint32_t offset;
+    uint16_t alloc_len;
+    uint16_t start_feature;
+    uint8_t response[IMAGE_CONFIG_LEN];
+    const uint16_t features[] = {
+        FEATURE_PROFILE_LIST,
+        FEATURE_CORE,
+        FEATURE_REMOVABLE_MEDIUM,
+        FEATURE_RANDOM_READABLE,
+        FEATURE_RANDOM_WRITABLE
+    };
+
+    rt = cdb[1] & 0x03;
+    start_feature = get_be16(&cdb[2]);
+    alloc_len = get_be16(&cdb[7]);
+
+    memset(response, 0, sizeof(response));
+    put_be16(&response[6], image->profile);
+    offset = 8;
+
+    /* Every feature of an image is current, so RT 01b is RT 00b */
+    for (i = 0; i < (int)(sizeof(features) / sizeof(features[0])); ++i) {
+        if (features[i] < start_feature)
+            continue;
+
+        if (rt == 0x02 && features[i] != start_feature)
+            break;
+
+        memset(data, 0, sizeof(data));
+
+        switch (features[i]) {
+        case FEATURE_PROFILE_LIST:
+            put_be16(&data[0], image->profile);
+            data[2] = 0x01;
+            offset = append_feature(response, offset, features[i], data, 4);
+            break;
+
+        case FEATURE_CORE:
+            put_be32(&data[0], 0x00000001); /* SCSI */
+            offset = append_feature(response, offset, features[i], data, 8);
+            break;
+
+        case FEATURE_REMOVABLE_MEDIUM:
+            data[0] = 0x29;                 /* Tray, eject, lock */
+            offset = append_feature(response, offset, features[i], data, 4);
+            break;
+
+        case FEATURE_RANDOM_READABLE:
+            put_be32(&data[0], IMAGE_BLOCK_SIZE);
+            put_be16(&data[4], 1);
+            offset = append_feature(response, offset, features[i], data, 8);
+            break;
+
+        case FEATURE_RANDOM_WRITABLE:
+            if (image->writable == False)
+                break;
+
+            put_be32(&data[0], (image->blocks > 0) ? image->blocks - 1 : 0);
+            put_be32(&data[4], IMAGE_BLOCK_SIZE);
+            put_be16(&data[8], 1);
+            offset = append_feature(response, offset, features[i], data, 12);
+            break;
+        }
+    }
+
+    put_be32(&response[0], offset - 4);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < offset) ? alloc_len : offset);
+
+    return SUCCESS;
+}
+
+static RESULT image_read_capacity(const optcl_image *image,
+                                  const optcl_iovec iov[],
+                                  uint32_t iov_count)
+{
+    uint8_t response[8];
+
+    put_be32(&response[0], (image->blocks > 0) ? image->blocks - 1 : 0);
+    put_be32(&response[4], IMAGE_BLOCK_SIZE);
+    copy_to_iov(iov, iov_count, response, sizeof(response));
+    return SUCCESS;
+}
+
+static RESULT image_read_track_information(const optcl_image *image,
+                                           const uint8_t cdb[],
+                                           const optcl_iovec iov[],
+                                           uint32_t iov_count)
+{
+    RESULT error;
+    uint32_t lba;
+    uint32_t start;
+    uint32_t end;
+    uint32_t hole = 0;
+    uint32_t recorded_end = 0;
+    uint16_t alloc_len;
+    uint8_t response[48];
+
+    /* An image holds a single track in a single session */
+    memset(response, 0, sizeof(response));
+    put_be16(&response[0], sizeof(response) - 2);
+    response[2] = 1;
+    response[3] = 1;
+    response[5] = 0x04;                             /* Data track */
+    response[6] = 0x01;                             /* Mode 1 */
+
+    lba = get_be32(&cdb[2]);
+    if ((cdb[1] & 0x03) == 0x00 && lba >= image->blocks)
+        return E_SENSE_LBAOOR;
+
+    /* Walk recorded extents up to the block or up to the last one */
+    for (;;) {
+        error = find_recorded_extent(image, hole, &start, &end);
+        if (FAILED(error))
+            return error;
+
+        if (start >= image->blocks)
+            break;
+
+        if ((cdb[1] & 0x03) == 0x00 && lba < end)
+            break;
+
+        recorded_end = end;
+        hole = end;
+    }
+
+    if ((cdb[1] & 0x03) != 0x00) {
+        /* The whole track, recorded up to its last recorded extent */
+        if (recorded_end == 0)
+            response[6] |= 0x40;                    /* Blank */
+
+        response[7] = 0x02;                         /* LRA valid */
+        put_be32(&response[16], image->blocks - recorded_end);
+        put_be32(&response[24], image->blocks);
+        put_be32(&response[28], (recorded_end > 0) ? recorded_end - 1 : 0);
+    } else if (lba < start) {
+        /* Unrecorded extent holding the block */
+        response[6] |= 0x40;
+        response[7] = 0x01;                         /* NWA valid */
+        put_be32(&response[8], hole);
+        put_be32(&response[12], hole);
+        put_be32(&response[16], start - hole);
+        put_be32(&response[24], start - hole);
+    } else {
+        /* Recorded extent holding the block */
+        response[7] = 0x02;
+        put_be32(&response[8], start);
+        put_be32(&response[24], end - start);
+        put_be32(&response[28], end - 1);
+    }
+
+    alloc_len = get_be16(&cdb[7]);
+    copy_to_iov(iov, iov_count, response,
+        (alloc_len < sizeof(response)) ? alloc_len : sizeof(response));
+
+    return SUCCESS;
+}
+
+static RESULT image_read(const optcl_image *image,
+                         uint32_t lba,
+                         uint32_t count,
+                         const optcl_iovec iov[],
+                         uint32_t iov_count)
+{
+    RESULT error;
+    uint32_t i;
+    uint32_t size;
+    uint32_t chunk;
+    uint64_t offset;
+
+    error = check_range(image, lba, count);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)count * IMAGE_BLOCK_SIZE > get_iov_size(iov, iov_count))
+        return E_INVALIDARG;
+
+    size = count * IMAGE_BLOCK_SIZE;
+
+    if (image->zimage == 0) {
+        copy_to_iov(iov, iov_count,
+            (const uint8_t*)image->map.view + (uint64_t)lba * IMAGE_BLOCK_SIZE,
+            size);
+
+        return SUCCESS;
+    }
+
+    offset = (uint64_t)lba * IMAGE_BLOCK_SIZE;
+
+    for (i = 0; i < iov_count && size > 0; ++i) {
+        chunk = (iov[i].len < size) ? iov[i].len : size;
+
+        error = optcl_zimage_read(image->zimage, offset, 
+            (uint8_t*)iov[i].base, chunk);
+        if (FAILED(error))
+            return (error == E_OUTOFMEMORY) ? error : E_SENSE_URE;
+
+        offset += chunk;
+        size -= chunk;
+    }
+
+    return SUCCESS;
+}
+
+/*
+ * Write blocks, blank blocks are punched out of the file instead so
+ * that images of mostly unrecorded media stay sparse
+ */
+static RESULT image_write(const optcl_image *image,
+                          uint32_t lba,
+                          uint32_t count,
+                          const optcl_iovec iov[],
+                          uint32_t iov_count)
+{
+    RESULT error;
+    bool_t zero;
+    uint32_t i;
+    uint32_t pos;
+    uint32_t len;
+    uint32_t size;
+    uint32_t chunk;
+    uint32_t data_len = 0;
+    uint64_t offset;
+    uint64_t hole_len = 0;
+    const uint8_t *data = 0;
+
+    if (image->writable == False)
+        return E_SENSE_WP;
+
+    error = check_range(image, lba, count);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)count * IMAGE_BLOCK_SIZE > get_iov_size(iov, iov_count))
+        return E_INVALIDARG;
+
+    size = count * IMAGE_BLOCK_SIZE;
+
+    offset = (uint64_t)lba * IMAGE_BLOCK_SIZE;
+
+    /* Runs of data and of blank blocks go to the file in one call */
+    for (i = 0; i < iov_count && size > 0; ++i) {
+        chunk = (iov[i].len < size) ? iov[i].len : size;
+
+        for (pos = 0; pos < chunk; pos += len) {
+            len = (chunk - pos < IMAGE_BLOCK_SIZE) 
+                ? chunk - pos : IMAGE_BLOCK_SIZE;
+
+            zero = (len == IMAGE_BLOCK_SIZE) 
+                ? is_zero_block((const uint8_t*)iov[i].base + pos, len) 
+                : False;
+
+            if (zero == True) {
+                if (data_len > 0) {
+                    if (xpwrite_file(&image->map, data, data_len, offset) != 0)
+                        return E_SENSE_WE_3;
+
+                    offset += data_len;
+                    data_len = 0;
+                }
+
+                hole_len += len;
+                continue;
+            }
+
+            if (hole_len > 0) {
+                if (xpunch_file(&image->map, offset, hole_len) != 0)
+                    return E_SENSE_WE_3;
+
+                offset += hole_len;
+                hole_len = 0;
+            }
+
+            if (data_len == 0)
+                data = (const uint8_t*)iov[i].base + pos;
+
+            data_len += len;
+        }
+
+        /* Data runs do not span host buffers */
+        if (data_len > 0) {
+            if (xpwrite_file(&image->map, data, data_len, offset) != 0)
+                return E_SENSE_WE_3;
+
+            offset += data_len;
+            data_len = 0;
+        }
+
+        size -= chunk;
+    }
+
+    if (hole_len > 0 && xpunch_file(&image->map, offset, hole_len) != 0)
+        return E_SENSE_WE_3;
+
+    return SUCCESS;
+}
+
+static RESULT image_command(const optcl_image *image,
+                            const uint8_t cdb[],
+                            uint32_t cdb_size,
+                            const optcl_iovec iov[],
+                            uint32_t iov_count)
+{
+    uint8_t sense[18];
+
+    switch (cdb[0]) {
+    case MMC_OPCODE_TEST_UNIT_READY:
+    case MMC_OPCODE_PREVENT_ALLOW_REMOVAL:
+    case MMC_OPCODE_START_STOP_UNIT:
+    case MMC_OPCODE_SET_CD_SPEED:
+    case MMC_OPCODE_SYNCHRONIZE_CACHE:
+        return SUCCESS;
+
+    case MMC_OPCODE_INQUIRY:
+        return image_inquiry(cdb, iov, iov_count);
+
+    case MMC_OPCODE_REQUEST_SENSE:
+        memset(sense, 0, sizeof(sense));
+        sense[0] = 0x70;
+        sense[7] = sizeof(sense) - 8;
+        copy_to_iov(iov, iov_count, sense,
+            (cdb[4] < sizeof(sense)) ? cdb[4] : sizeof(sense));
+        return SUCCESS;
+
+    case MMC_OPCODE_GET_CONFIG:
+        return image_get_configuration(image, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_CAPACITY:
+        return image_read_capacity(image, iov, iov_count);
+
+    case MMC_OPCODE_READ_TRACK_INFORMATION:
+        return image_read_track_information(image, cdb, iov, iov_count);
+
+    case MMC_OPCODE_READ_10:
+        return image_read(image, get_be32(&cdb[2]), get_be16(&cdb[7]),
+            iov, iov_count);
+
+    case MMC_OPCODE_READ_12:
+        return image_read(image, get_be32(&cdb[2]), get_be32(&cdb[6]),
+            iov, iov_count);
+
+    case MMC_OPCODE_WRITE:
+    case MMC_OPCODE_WRITE_AND_VERIFY_10:
+        return image_write(image, get_be32(&cdb[2]), get_be16(&cdb[7]),
+            iov, iov_count);
+
+    case MMC_OPCODE_WRITE_12:
+        return image_write(image, get_be32(&cdb[2]), get_be32(&cdb[6]),
+            iov, iov_count);
+
+    case MMC_OPCODE_VERIFY:
+        return check_range(image, get_be32(&cdb[2]), get_be16(&cdb[7]));
+
+    case MMC_OPCODE_SEEK:
+        return (get_be32(&cdb[2]) < image->blocks) ? SUCCESS : E_SENSE_LBAOOR;
+
+    default:
+        return E_SENSE_ICOC;
+    }
+}
+
+
+/*
+ * Image transport
+ */
+
+static RESULT image_open(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+    optcl_image *image = 0;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    error = open_image(device, &image);
+    if (FAILED(error))
+        return error;
+
+    session->handle = (ptr_t)image;
+    session->is_open = True;
+    session->block_reads = False;
+    ++session->opens;
+    return SUCCESS;
+}
+
+static RESULT image_close(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->handle != 0)
+        close_image((optcl_image*)session->handle);
+
+    session->handle = 0;
+    return SUCCESS;
+}
+
+static RESULT image_execute_vectored(const optcl_device *device,
+                                     ptr_t context,
+                                     const uint8_t cdb[],
+                                     uint32_t cdb_size,
+                                     const optcl_iovec iov[],
+                                     uint32_t iov_count)
+{
+    RESULT error;
+    bool_t temporary;
+    optcl_image *image = 0;
+
+    assert(device != 0);
+    assert(cdb != 0);
+    assert(cdb_size > 0);
+    if (device == 0 || cdb == 0 || cdb_size == 0)
+        return E_INVALIDARG;
+
+    assert(iov != 0 || iov_count == 0);
+    if (iov == 0 && iov_count > 0)
+        return E_INVALIDARG;
+
+    error = acquire_image(device, &image, &temporary);
+    if (FAILED(error))
+        return error;
+
+    error = image_command(image, cdb, cdb_size, iov, iov_count);
+
+    if (temporary == True)
+        close_image(image);
+
+    return error;
+}
+
+static RESULT image_execute(const optcl_device *device,
+                            ptr_t context,
+                            const uint8_t cdb[],
+                            uint32_t cdb_size,
+                            uint8_t param[],
+                            uint32_t param_size)
+{
+    optcl_iovec iov;
+
+    iov.base = param;
+    iov.len = (param != 0) ? param_size : 0;
+
+    return image_execute_vectored(device, context, cdb, cdb_size,
+        &iov, (param != 0) ? 1 : 0);
+}
+
+static RESULT image_query_limits(const optcl_device *device,
+                                 ptr_t context,
+                                 optcl_transfer_limits *limits)
+{
+    assert(device != 0);
+    assert(limits != 0);
+    if (device == 0 || limits == 0)
+        return E_INVALIDARG;
+
+    limits->alignment_mask = IMAGE_ALIGNMENT;
+    limits->max_transfer_len = IMAGE_MAX_TRANSFER_LEN;
+    limits->max_physical_pages = 0;
+    return SUCCESS;
+}
+
+/* Reads return a view of the image mapping, valid until the device closes */
+static RESULT image_execute_mapped(const optcl_device *device,
+                                   ptr_t context,
+                                   const uint8_t cdb[],
+                                   uint32_t cdb_size,
+                                   uint32_t transfer_size,
+                                   const uint8_t **view)
+{
+    RESULT error;
+    uint32_t lba;
+    uint32_t count;
+    optcl_image *image;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(cdb != 0);
+    assert(view != 0);
+    if (device == 0 || cdb == 0 || cdb_size == 0 || view == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->is_open == False || session->handle == 0)
+        return E_DEVNOTOPEN;
+
+    if (cdb[0] == MMC_OPCODE_READ_10 && cdb_size >= 10)
+        count = get_be16(&cdb[7]);
+    else if (cdb[0] == MMC_OPCODE_READ_12 && cdb_size >= 12)
+        count = get_be32(&cdb[6]);
+    else
+        return E_NOTIMPL;
+
+    image = (optcl_image*)session->handle;
+    lba = get_be32(&cdb[2]);
+
+    /* Compressed data only exists in the chunk cache */
+    if (image->zimage != 0)
+        return E_NOTIMPL;
+
+    error = check_range(image, lba, count);
+    if (FAILED(error))
+        return error;
+
+    if ((uint64_t)count * IMAGE_BLOCK_SIZE < transfer_size)
+        return E_DEVINVALIDSIZE;
+
+    ++session->commands;
+    ++session->opens_saved;
+    *view = (const uint8_t*)image->map.view + (uint64_t)lba * IMAGE_BLOCK_SIZE;
+    return SUCCESS;
+}
+
+static const optcl_transport __image_transport = {
+    "image",
+    image_open,
+    image_close,
+    image_execute,
+    image_execute_vectored,
+    0,
+    0,
+    0,
+    image_query_limits,
+    image_execute_mapped
+};
+
+
+/*
+ * Image functions
+ */
+
+RESULT optcl_image_get_transport(const optcl_transport **transport)
+{
+    assert(transport != 0);
+    if (transport == 0)
+        return E_INVALIDARG;
+
+    *transport = &__image_transport;
+    return SUCCESS;
+}
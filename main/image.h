@@ -0,0 +1,64 @@
+/*
+    image.h - Image file device backend
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _IMAGE_H
+#define _IMAGE_H
+
+#include "device.h"
+#include "errors.h"
+#include "transport.h"
+#include "types.h"
+
+
+/* Image file block size */
+#define IMAGE_BLOCK_SIZE		2048U
+
+/* Largest data transfer accepted by image devices */
+#define IMAGE_MAX_TRANSFER_LEN		0x800000U
+
+
+/*
+ * Get image file transport
+ *
+ * Devices bound with optcl_device_bind2file use this transport. The
+ * image at the device path is mapped into memory while the device is
+ * open, reads are served from the mapping and writes go to the file.
+ * Images that can not be opened for writing are read only media.
+ *
+ * Writable images are media of a fixed capacity, writes never extend
+ * the file. Targets must be sized before they are bound, for example
+ * as sparse files of the media capacity. Opening a writable image of
+ * less than one block fails with E_DEVINVALIDSIZE.
+ *
+ * Blank blocks are not written, their range of the file is punched
+ * out so that images of unrecorded media stay sparse. READ TRACK
+ * INFORMATION addressed by track reports the track recorded up to
+ * its last recorded block, addressed by block it reports the recorded
+ * or unrecorded extent holding the block.
+ *
+ * Compressed images made with optcl_zimage_convert are recognized by
+ * their header. They are read only media, reads decompress the chunks
+ * they touch through a small cache of decompressed chunks.
+ */
+extern 
+RESULT optcl_image_get_transport(const optcl_transport **transport);
+
+#endif /* _IMAGE_H */
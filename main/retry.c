@@ -0,0 +1,148 @@
+/*
+    retry.c - Sense driven command retry policy
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "errors.h"
+#include "retry.h"
+#include "sensedata.h"
+#include "types.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+/*
+ * Default retry policy
+ */
+
+static const optcl_retry_policy __default_policy = {
+    {
+        20,     /* Becoming ready, spin up takes a few seconds */
+        60,     /* Long write in progress, cache flush or close */
+        60,     /* Format or operation in progress */
+        2,      /* Unit attention, reported once per condition */
+        2       /* Medium error */
+    },
+    10000,      /* 10 ms initial delay */
+    1000000,    /* 1 s maximum delay */
+    120000000   /* 2 min maximum wait */
+};
+
+
+/*
+ * Retry policy functions
+ */
+
+RESULT optcl_retry_get_default_policy(optcl_retry_policy *policy)
+{
+    assert(policy != 0);
+    if (policy == 0)
+        return E_INVALIDARG;
+
+    memcpy(policy, &__default_policy, sizeof(optcl_retry_policy));
+    return SUCCESS;
+}
+
+RESULT optcl_retry_classify(RESULT error, uint16_t *retry_class)
+{
+    assert(retry_class != 0);
+    if (retry_class == 0)
+        return E_INVALIDARG;
+
+    *retry_class = RETRY_CLASS_NONE;
+
+    if (SUCCEEDED(error) || ERROR_FACILITY(error) != FACILITY_SENSE)
+        return SUCCESS;
+
+    switch (ERROR_SENSE_SK(error)) {
+    case SENSEDATA_SK_NOT_READY:
+        if (ERROR_SENSE_ASC(error) != 0x04)
+            break;
+
+        switch (ERROR_SENSE_ASCQ(error)) {
+        case 0x01:
+            *retry_class = RETRY_CLASS_BECOMING_READY;
+            break;
+
+        case 0x08:
+            *retry_class = RETRY_CLASS_LONG_WRITE;
+            break;
+
+        case 0x04:
+        case 0x07:
+            *retry_class = RETRY_CLASS_OPERATION;
+            break;
+
+        default:
+            break;
+        }
+        break;
+
+    case SENSEDATA_SK_UNIT_ATTENTION:
+        /*
+         * Medium changes and resets may have lost the medium or the
+         * write state, a retried read or write would go to whatever
+         * is in the drive now. The caller has to see those.
+         */
+        if (ERROR_SENSE_ASC(error) == 0x28 || ERROR_SENSE_ASC(error) == 0x29)
+            break;
+
+        *retry_class = RETRY_CLASS_UNIT_ATTENTION;
+        break;
+
+    case SENSEDATA_SK_MEDIUM_ERROR:
+        /* Read and positioning errors, writes may have moved the NWA */
+        if (ERROR_SENSE_ASC(error) == 0x11
+            || ERROR_SENSE_ASC(error) == 0x15
+            || ERROR_SENSE_ASC(error) == 0x02)
+            *retry_class = RETRY_CLASS_MEDIUM_ERROR;
+        break;
+
+    default:
+        break;
+    }
+
+    return SUCCESS;
+}
+
+RESULT optcl_retry_get_delay(const optcl_retry_policy *policy,
+                             uint16_t retry_class,
+                             uint32_t attempt,
+                             uint32_t *delay)
+{
+    uint64_t next;
+
+    assert(policy != 0);
+    assert(delay != 0);
+    assert(retry_class < RETRY_CLASS_COUNT);
+    if (policy == 0 || delay == 0 || retry_class >= RETRY_CLASS_COUNT)
+        return E_INVALIDARG;
+
+    if (retry_class == RETRY_CLASS_UNIT_ATTENTION) {
+        *delay = 0;
+        return SUCCESS;
+    }
+
+    next = (attempt < 32)
+        ? (uint64_t)policy->initial_delay << attempt : policy->max_delay;
+
+    *delay = (next < policy->max_delay) ? (uint32_t)next : policy->max_delay;
+    return SUCCESS;
+}
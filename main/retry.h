@@ -0,0 +1,90 @@
+/*
+    retry.h - Sense driven command retry policy
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _RETRY_H
+#define _RETRY_H
+
+#include "errors.h"
+#include "types.h"
+
+
+/* Retry classes of command errors */
+#define RETRY_CLASS_BECOMING_READY	0	/* Not ready, becoming ready */
+#define RETRY_CLASS_LONG_WRITE		1	/* Not ready, long write in progress */
+#define RETRY_CLASS_OPERATION		2	/* Not ready, format or operation in progress */
+#define RETRY_CLASS_UNIT_ATTENTION	3	/* Unit attention, not medium change or reset */
+#define RETRY_CLASS_MEDIUM_ERROR	4	/* Unrecovered read or positioning error */
+#define RETRY_CLASS_COUNT		5
+
+/* Errors that are never retried */
+#define RETRY_CLASS_NONE		0xFFFF
+
+
+/*
+ * Command retry policy
+ *
+ * Commands failing with a retryable sense are retried up to the
+ * retry count of their class. The delay between retries starts at
+ * initial_delay and doubles up to max_delay, unit attentions are
+ * retried at once. While the drive reports progress on a long
+ * running operation retries are not counted, but no command waits
+ * longer than max_wait in total. All times are in microseconds.
+ */
+typedef struct tag_retry_policy {
+    uint32_t max_retries[RETRY_CLASS_COUNT];
+    uint32_t initial_delay;
+    uint32_t max_delay;
+    uint32_t max_wait;
+} optcl_retry_policy;
+
+/*
+ * Command retry statistics
+ */
+typedef struct tag_retry_stats {
+    uint32_t retried;                       /* Commands retried at least once */
+    uint32_t recovered;                     /* Retried commands that succeeded */
+    uint32_t exhausted;                     /* Retried commands that still failed */
+    uint32_t retries[RETRY_CLASS_COUNT];    /* Retries by class */
+    uint64_t wait;                          /* Time waited between retries */
+} optcl_retry_stats;
+
+
+/* Get default retry policy */
+extern 
+RESULT optcl_retry_get_default_policy(optcl_retry_policy *policy);
+
+/*
+ * Get retry class of a command error, RETRY_CLASS_NONE if not retryable
+ *
+ * Unit attentions for a medium change (ASC 28h) or a reset (ASC 29h)
+ * are not retryable, they are returned to the caller.
+ */
+extern 
+RESULT optcl_retry_classify(RESULT error, uint16_t *retry_class);
+
+/* Get delay before the given retry of a command, attempts start at zero */
+extern 
+RESULT optcl_retry_get_delay(const optcl_retry_policy *policy,
+                             uint16_t retry_class,
+                             uint32_t attempt,
+                             uint32_t *delay);
+
+#endif /* _RETRY_H */
@@ -69,7 +69,7 @@ RESULT optcl_sensedata_get_code(const uint8_t raw_data[],
         case SENSEDATA_RESPONSE_DESCFORMAT:
         case SENSEDATA_RESPONSE_DESCFORMAT_DEFFERED: {
             if (size > 1)
-                sk = raw_data[2] & 0x0F;	/* 00001111 */
+                sk = raw_data[1] & 0x0F;	/* 00001111 */
 
             if (size > 2)
                 asc = raw_data[2];
@@ -87,16 +87,11 @@ RESULT optcl_sensedata_get_code(const uint8_t raw_data[],
             if (size > 7)
                 addlen = raw_data[7];
 
-            assert(addlen + 7 == size);
-            if (addlen + 7 != size) {
-                error = E_SIZEMISMATCH;
-                break;
-            }
-
-            if (addlen > 5)
+            /* Sense data may be truncated to the sense buffer size */
+            if (addlen > 4 && size > 12)
                 asc = raw_data[12];
 
-            if (addlen > 6)
+            if (addlen > 5 && size > 13)
                 ascq = raw_data[13];
 
             break;
@@ -118,6 +113,67 @@ RESULT optcl_sensedata_get_code(const uint8_t raw_data[],
     return SUCCESS;
 }
 
+RESULT optcl_sensedata_get_progress(const uint8_t raw_data[],
+                                    uint8_t size,
+                                    uint16_t *progress,
+                                    bool_t *valid)
+{
+    uint8_t sk = 0;
+    uint32_t offset;
+    uint32_t length;
+    const uint8_t *field = 0;
+
+    assert(raw_data != 0);
+    assert(progress != 0);
+    assert(valid != 0);
+    if (raw_data == 0 || progress == 0 || valid == 0)
+        return E_INVALIDARG;
+
+    *valid = False;
+
+    switch (raw_data[0] & 0x7F) {
+        case SENSEDATA_RESPONSE_FIXEDFORMAT:
+        case SENSEDATA_RESPONSE_FIXEDFORMAT_DEFERRED: {
+            if (size > 17) {
+                sk = raw_data[2] & 0x0F;
+                field = &raw_data[15];
+            }
+
+            break;
+        }
+        case SENSEDATA_RESPONSE_DESCFORMAT:
+        case SENSEDATA_RESPONSE_DESCFORMAT_DEFFERED: {
+            if (size < 8)
+                break;
+
+            sk = raw_data[1] & 0x0F;
+
+            /* Look for the sense key specific descriptor */
+            for (offset = 8; offset + 1 < size; offset += length + 2) {
+                length = raw_data[offset + 1];
+                if (raw_data[offset] == 0x02 && length >= 6 
+                    && offset + 6 < size) {
+                    field = &raw_data[offset + 4];
+                    break;
+                }
+            }
+
+            break;
+        }
+        default:
+            break;
+    }
+
+    /* Progress is only reported with no sense and not ready keys */
+    if (field == 0 || (field[0] & 0x80) == 0 
+        || (sk != SENSEDATA_SK_NO_SENSE && sk != SENSEDATA_SK_NOT_READY))
+        return SUCCESS;
+
+    *progress = (uint16_t)((field[1] << 8) | field[2]);
+    *valid = True;
+    return SUCCESS;
+}
+
 RESULT optcl_sensedata_get_formatted_msg(RESULT error_code, char **message)
 {
     char *nmsg = 0;
@@ -29,10 +29,10 @@
  * Sense response codes
  */
 
-#define SENSEDATA_RESPONSE_DESCFORMAT               0x70	/* Descriptor format sense data			*/
-#define SENSEDATA_RESPONSE_DESCFORMAT_DEFFERED      0x71	/* Descriptor format deferred sense data	*/
-#define SENSEDATA_RESPONSE_FIXEDFORMAT              0x72	/* Fixed format sense data			*/
-#define SENSEDATA_RESPONSE_FIXEDFORMAT_DEFERRED     0x73	/* Fixed format deferred sense data		*/
+#define SENSEDATA_RESPONSE_FIXEDFORMAT              0x70	/* Fixed format sense data			*/
+#define SENSEDATA_RESPONSE_FIXEDFORMAT_DEFERRED     0x71	/* Fixed format deferred sense data		*/
+#define SENSEDATA_RESPONSE_DESCFORMAT               0x72	/* Descriptor format sense data			*/
+#define SENSEDATA_RESPONSE_DESCFORMAT_DEFFERED      0x73	/* Descriptor format deferred sense data	*/
 #define SENSEDATA_RESPONSE_VENDOR_SPECIFIC          0x7F	/* Vendor specific sense data			*/
 
 /*
@@ -232,7 +232,7 @@
 #define E_SENSE_LUNR_MIR    MAKE_SENSE_ERRORCODE(SENSEDATA_SK_NOT_READY, 0x04, 0x03)
 
 /* Logical unit not ready, format in progress */
-#define E_SENSE_LUNR_FIP    MAKE_SENSE_ERRORCODE(SENSEDATA_SK_NOT_READY, 0x04, 0x03)
+#define E_SENSE_LUNR_FIP    MAKE_SENSE_ERRORCODE(SENSEDATA_SK_NOT_READY, 0x04, 0x04)
 
 /* Logical unit not ready, operation in progress */
 #define E_SENSE_LUNR_OIP    MAKE_SENSE_ERRORCODE(SENSEDATA_SK_NOT_READY, 0x04, 0x07)
@@ -848,6 +848,16 @@ RESULT optcl_sensedata_get_code(const uint8_t raw_data[],
                                 uint8_t size,
                                 RESULT *error_code);
 
+/* 
+ * Parse progress indication from raw sense data, valid is set
+ * only if the sense key specific field holds a progress indication
+ */
+extern 
+RESULT optcl_sensedata_get_progress(const uint8_t raw_data[],
+                                    uint8_t size,
+                                    uint16_t *progress,
+                                    bool_t *valid);
+
 /* Format error code message */
 extern 
 RESULT optcl_sensedata_get_formatted_msg(RESULT error_code,
@@ -23,19 +23,105 @@
 #include "device.h"
 #include "errors.h"
 #include "list.h"
+#include "transport.h"
 #include "types.h"
 
 
-/* Enumerates all supported optical devices */
+/* Device monitor events */
+#define DEVICE_MONITOR_ADDED		1	/* Drive probed and added to the list */
+#define DEVICE_MONITOR_REMOVED		2	/* Drive detached, removed from the list */
+
+/* Dispatch timeout when no drive waits for a probe retry */
+#define DEVICE_MONITOR_INFINITE		0xFFFFFFFFU
+
+
+/* Hotplug monitor keeping a device list up to date */
+typedef struct tag_device_monitor optcl_device_monitor;
+
+/*
+ * Monitor callback, removed devices are destroyed after the callback
+ * returns
+ */
+typedef void (*optcl_device_monitorfn)(uint16_t event,
+                                       optcl_device *device,
+                                       ptr_t context);
+
+
+/*
+ * Enumerates all supported optical devices
+ *
+ * Drive capabilities are kept in a per user enumeration cache, see
+ * optcl_device_enumerate_cached.
+ */
 extern 
 RESULT optcl_device_enumerate(optcl_list **devices);
 
-/* Execute SCSI command */
+/*
+ * Enumerates all supported optical devices through a cache file
+ *
+ * A drive found in the cache is checked with an INQUIRY and gets its
+ * features from the cached GET CONFIGURATION data. Drives that are not
+ * cached, or whose identity or firmware revision changed, are probed
+ * in full and the cache file is updated. A zero cache file probes
+ * every drive in full.
+ */
+extern 
+RESULT optcl_device_enumerate_cached(const char *cache_file, 
+                                     optcl_list **devices);
+
+/*
+ * Create a hotplug monitor over an enumerated device list
+ *
+ * Kernel uevents for SCSI generic and CD-ROM block nodes are read from
+ * a netlink socket. An attached drive is probed on its own, through the
+ * enumeration cache, and added to the tail of the list, a detached
+ * drive is removed from the list and destroyed. Other devices in the
+ * list are left alone. Drives attached before the monitor was created
+ * but missing from the list are picked up by the first dispatch.
+ *
+ * The list is changed only by optcl_device_monitor_dispatch, from the
+ * thread calling it, and must outlive the monitor.
+ */
+extern 
+RESULT optcl_device_monitor_create(optcl_list *devices,
+                                   optcl_device_monitorfn callback,
+                                   ptr_t context,
+                                   optcl_device_monitor **monitor);
+
+/* Destroy monitor, the device list is left as it is */
+extern 
+RESULT optcl_device_monitor_destroy(optcl_device_monitor *monitor);
+
+/* Get the descriptor that becomes readable when uevents are pending */
+extern 
+RESULT optcl_device_monitor_get_fd(const optcl_device_monitor *monitor, 
+                                   int *fd);
+
+/*
+ * Handle pending uevents without waiting
+ *
+ * Drives that can not be opened yet, while udev sets up their node,
+ * are probed again for a few seconds. The timeout in milliseconds
+ * after which dispatch should be called even without new uevents is
+ * returned, DEVICE_MONITOR_INFINITE when nothing waits.
+ */
+extern 
+RESULT optcl_device_monitor_dispatch(optcl_device_monitor *monitor, 
+                                     uint32_t *timeout);
+
+/* Get the platform transport used by devices without a bound transport */
+extern 
+RESULT optcl_device_get_system_transport(const optcl_transport **transport);
+
+/* Read 2048 byte data sectors through the block device */
+extern 
+RESULT optcl_device_block_read(const optcl_device *device,
+                               uint32_t lba,
+                               const optcl_iovec iov[],
+                               uint32_t iov_count);
+
+/* Enable or disable memory mapped transfers on an open device */
 extern 
-RESULT optcl_device_command_execute(const optcl_device *device,
-                                    const uint8_t cdb[],
-                                    uint32_t cdb_size,
-                                    uint8_t param[],
-                                    uint32_t param_size);
+RESULT optcl_device_set_mmap_io(optcl_device *device, bool_t enable);
 
 #endif /* _SYSDEVICE_H */
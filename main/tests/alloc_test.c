@@ -0,0 +1,155 @@
+/*
+    alloc_test.c - Heap allocations of steady state commands
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+/*
+ * Allocations are counted by replacing the allocator entry points,
+ * which forward to glibc.
+ */
+
+#include "adapter.h"
+#include "command.h"
+#include "device.h"
+#include "emulator.h"
+#include "errors.h"
+#include "profile.h"
+#include "transport.h"
+#include "types.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define TEST_BLOCKS		1000
+#define TEST_ROUNDS		100
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void *ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+
+static volatile uint32_t allocations = 0;
+
+
+void* malloc(size_t size)
+{
+    ++allocations;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size)
+{
+    ++allocations;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void *ptr, size_t size)
+{
+    ++allocations;
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    ++allocations;
+    *ptr = __libc_memalign(alignment, size);
+    return (*ptr != 0) ? 0 : ENOMEM;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    uint32_t count;
+    const char *path;
+    uint8_t *buffer;
+    optcl_device *device;
+    optcl_emulator *emulator;
+    optcl_emulator_timing timing;
+    const optcl_adapter *adapter;
+    optcl_transfer_limits limits;
+    optcl_mmc_write write;
+
+    CHECK(SUCCEEDED(optcl_device_create(&device)));
+    /* Drive that is always ready */
+    CHECK(SUCCEEDED(optcl_emulator_get_default_timing(&timing)));
+    timing.spinup_time = 0;
+    timing.spindown_delay = 0;
+
+    CHECK(SUCCEEDED(optcl_emulator_create(&timing, &emulator)));
+    CHECK(SUCCEEDED(optcl_emulator_load_memory(emulator, TEST_BLOCKS, PROFILE_DVD_PLUS_R)));
+    CHECK(SUCCEEDED(optcl_emulator_bind(device, emulator)));
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+
+    /* Warm up, first commands may fill caches */
+    CHECK(SUCCEEDED(optcl_command_test_unit_ready(device)));
+
+    /* Borrowed accessors do not copy */
+    count = allocations;
+    for (i = 0; i < TEST_ROUNDS; ++i) {
+        CHECK(SUCCEEDED(optcl_device_get_transfer_limits(device, &limits)));
+        CHECK(SUCCEEDED(optcl_device_get_adapter_ref(device, &adapter)));
+        CHECK(SUCCEEDED(optcl_device_get_path_ref(device, &path)));
+    }
+    CHECK(allocations == count);
+
+    /* Command without data allocates nothing */
+    count = allocations;
+    for (i = 0; i < TEST_ROUNDS; ++i)
+        CHECK(SUCCEEDED(optcl_command_test_unit_ready(device)));
+    CHECK(allocations == count);
+
+    /* Aligned data goes to the transport as it is */
+    buffer = (uint8_t*)malloc(2 * 2048);
+    CHECK(buffer != 0);
+    memset(buffer, 0xA5, 2 * 2048);
+
+    memset(&write, 0, sizeof(write));
+    write.transfer_len = 1;
+
+    count = allocations;
+    for (i = 0; i < TEST_ROUNDS; ++i) {
+        write.lba = i;
+        CHECK(SUCCEEDED(optcl_command_write(device, &write, buffer, 2048)));
+    }
+    CHECK(allocations == count);
+
+    /* Misaligned data allocates only its bounce buffer */
+    count = allocations;
+    for (i = 0; i < TEST_ROUNDS; ++i) {
+        write.lba = TEST_ROUNDS + i;
+        CHECK(SUCCEEDED(optcl_command_write(device, &write, buffer + 1, 2048)));
+    }
+    CHECK(allocations - count == TEST_ROUNDS);
+
+    free(buffer);
+
+    CHECK(SUCCEEDED(optcl_device_close(device)));
+    CHECK(SUCCEEDED(optcl_device_destroy(device)));
+    CHECK(SUCCEEDED(optcl_emulator_destroy(emulator)));
+
+    return(0);
+}
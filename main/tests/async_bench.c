@@ -0,0 +1,235 @@
+/*
+    async_bench.c - Synchronous and pipelined read benchmark
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+/*
+ * Usage: async_bench <device path> [size in MB] [queue depth]
+ *
+ * Reads the start of the medium in the drive sequentially, once with
+ * READ(10) commands that wait for each other and once with READ(10)
+ * commands kept in flight with submit and complete. The drive needs
+ * a readable medium, the pipelined pass runs second so both passes
+ * start with the disc spinning.
+ */
+
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "list.h"
+#include "sysdevice.h"
+#include "transport.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define BENCH_BLOCK_SIZE	2048
+#define BENCH_READ_BLOCKS	32
+#define BENCH_DEFAULT_SIZE	256		/* MB */
+#define BENCH_DEFAULT_DEPTH	8
+#define BENCH_MAX_DEPTH		16
+
+#define MMC_OPCODE_READ_CAPACITY	0x0025
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+static double rate(uint64_t bytes, uint64_t usec)
+{
+    return (usec != 0) ? (double)bytes / (double)usec : 0.0;
+}
+
+/* Find enumerated device with the given path */
+static optcl_device* find_device(const optcl_list *devices, const char *path)
+{
+    RESULT error;
+    const char *device_path;
+    optcl_device *device = 0;
+    optcl_list_iterator it = 0;
+
+    error = optcl_list_get_head_pos(devices, &it);
+    while (SUCCEEDED(error) && it != 0) {
+        error = optcl_list_get_at_pos(devices, it, (const pptr_t)&device);
+        if (FAILED(error))
+            break;
+
+        error = optcl_device_get_path_ref(device, &device_path);
+        if (SUCCEEDED(error) && device_path != 0 && strcmp(device_path, path) == 0)
+            return device;
+
+        error = optcl_list_get_next(devices, it, &it);
+    }
+
+    return 0;
+}
+
+static void destroy_devices(optcl_list *devices)
+{
+    RESULT error;
+    optcl_device *device = 0;
+    optcl_list_iterator it = 0;
+
+    error = optcl_list_get_head_pos(devices, &it);
+    while (SUCCEEDED(error) && it != 0) {
+        error = optcl_list_get_at_pos(devices, it, (const pptr_t)&device);
+        if (SUCCEEDED(error))
+            optcl_device_destroy(device);
+
+        error = optcl_list_get_next(devices, it, &it);
+    }
+
+    optcl_list_destroy(devices, False);
+}
+
+/* Number of blocks on the medium from READ CAPACITY */
+static RESULT get_block_count(const optcl_device *device, uint32_t *blocks)
+{
+    RESULT error;
+    uint8_t cdb[10];
+    uint8_t data[8];
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = MMC_OPCODE_READ_CAPACITY;
+
+    error = optcl_device_command_execute(device, cdb, sizeof(cdb), data, sizeof(data));
+    if (FAILED(error))
+        return error;
+
+    *blocks = (((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+        | ((uint32_t)data[2] << 8) | (uint32_t)data[3]) + 1;
+    return SUCCESS;
+}
+
+static void init_read(optcl_mmc_read_10 *command, uint32_t lba, uint32_t blocks)
+{
+    memset(command, 0, sizeof(*command));
+    command->start_lba = lba;
+    command->transfer_length = (uint16_t)blocks;
+}
+
+int main(int argc, char **argv)
+{
+    RESULT status;
+    uint32_t i;
+    uint32_t lba;
+    uint32_t tag;
+    uint32_t depth;
+    uint32_t count;
+    uint32_t blocks;
+    uint32_t chunk;
+    uint32_t in_flight;
+    uint64_t start;
+    uint64_t elapsed;
+    uint8_t *buffers[BENCH_MAX_DEPTH];
+    optcl_list *devices;
+    optcl_device *device;
+    optcl_transfer_limits limits;
+    optcl_mmc_read_10 command;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <device path> [size in MB] [queue depth]\n", argv[0]);
+        return(2);
+    }
+
+    blocks = (uint32_t)(((argc > 2) ? atoi(argv[2]) : BENCH_DEFAULT_SIZE)
+        * (1024 * 1024 / BENCH_BLOCK_SIZE));
+    depth = (argc > 3) ? (uint32_t)atoi(argv[3]) : BENCH_DEFAULT_DEPTH;
+    CHECK(depth >= 1 && depth <= BENCH_MAX_DEPTH);
+
+    CHECK(SUCCEEDED(optcl_device_enumerate(&devices)));
+    device = find_device(devices, argv[1]);
+    CHECK(device != 0);
+
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+    CHECK(SUCCEEDED(optcl_device_get_transfer_limits(device, &limits)));
+
+    chunk = BENCH_READ_BLOCKS;
+    if (limits.max_transfer_len != 0 && chunk * BENCH_BLOCK_SIZE > limits.max_transfer_len)
+        chunk = limits.max_transfer_len / BENCH_BLOCK_SIZE;
+    CHECK(chunk != 0);
+
+    CHECK(SUCCEEDED(get_block_count(device, &count)));
+    if (count < blocks)
+        blocks = count;
+    blocks -= blocks % chunk;
+    CHECK(blocks != 0);
+
+    /* Registered buffers go to the transport without bounce copies */
+    for (i = 0; i < depth; ++i)
+        CHECK(SUCCEEDED(optcl_device_alloc_buffer(device, chunk * BENCH_BLOCK_SIZE, (ptr_t*)&buffers[i])));
+
+    /* Each read waits for the previous one */
+    start = xtime_usec();
+    for (lba = 0; lba < blocks; lba += chunk) {
+        init_read(&command, lba, chunk);
+        CHECK(SUCCEEDED(optcl_command_read_10_direct(device, &command,
+            buffers[0], chunk * BENCH_BLOCK_SIZE)));
+    }
+    elapsed = xtime_usec() - start;
+
+    printf("synchronous %8.2f MB/s  %u block reads\n",
+        rate((uint64_t)blocks * BENCH_BLOCK_SIZE, elapsed), chunk);
+
+    /* Reads kept in flight, a completed tag is the free buffer index */
+    start = xtime_usec();
+    lba = 0;
+    in_flight = 0;
+    for (i = 0; i < depth && lba < blocks; ++i, lba += chunk) {
+        init_read(&command, lba, chunk);
+        CHECK(SUCCEEDED(optcl_command_read_10_submit(device, &command,
+            buffers[i], chunk * BENCH_BLOCK_SIZE, i)));
+        ++in_flight;
+    }
+
+    count = 0;
+    while (in_flight > 0) {
+        CHECK(SUCCEEDED(optcl_device_command_complete(device, &tag, &status)));
+        CHECK(SUCCEEDED(status));
+        CHECK(tag < depth);
+        --in_flight;
+        ++count;
+
+        if (lba < blocks) {
+            init_read(&command, lba, chunk);
+            CHECK(SUCCEEDED(optcl_command_read_10_submit(device, &command,
+                buffers[tag], chunk * BENCH_BLOCK_SIZE, tag)));
+            ++in_flight;
+            lba += chunk;
+        }
+    }
+    elapsed = xtime_usec() - start;
+
+    CHECK(count == blocks / chunk);
+    printf("pipelined   %8.2f MB/s  %u block reads, %u in flight\n",
+        rate((uint64_t)blocks * BENCH_BLOCK_SIZE, elapsed), chunk, depth);
+
+    for (i = 0; i < depth; ++i)
+        CHECK(SUCCEEDED(optcl_device_free_buffer(device, buffers[i])));
+
+    CHECK(SUCCEEDED(optcl_device_close(device)));
+    destroy_devices(devices);
+
+    return(0);
+}
@@ -0,0 +1,238 @@
+/*
+    backend_bench.c - sg v3 and bsg command backend benchmark
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+/*
+ * Usage: backend_bench <device path> [size in MB] [TEST UNIT READY count]
+ *
+ * Opens the drive once with each command backend and measures TEST
+ * UNIT READY latency and sequential READ(10) throughput with the
+ * largest transfer the adapter takes. Block device reads are turned
+ * off so every read is a SCSI command. The drive needs a readable
+ * medium, each backend is warmed up before it is measured.
+ */
+
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "list.h"
+#include "sysdevice.h"
+#include "transport.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define BENCH_BLOCK_SIZE	2048
+#define BENCH_MAX_BLOCKS	0xFFFF
+#define BENCH_DEFAULT_SIZE	256		/* MB */
+#define BENCH_DEFAULT_TURS	1000
+
+#define MMC_OPCODE_READ_CAPACITY	0x0025
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+static double rate(uint64_t bytes, uint64_t usec)
+{
+    return (usec != 0) ? (double)bytes / (double)usec : 0.0;
+}
+
+/* Find enumerated device with the given path */
+static optcl_device* find_device(const optcl_list *devices, const char *path)
+{
+    RESULT error;
+    const char *device_path;
+    optcl_device *device = 0;
+    optcl_list_iterator it = 0;
+
+    error = optcl_list_get_head_pos(devices, &it);
+    while (SUCCEEDED(error) && it != 0) {
+        error = optcl_list_get_at_pos(devices, it, (const pptr_t)&device);
+        if (FAILED(error))
+            break;
+
+        error = optcl_device_get_path_ref(device, &device_path);
+        if (SUCCEEDED(error) && device_path != 0 && strcmp(device_path, path) == 0)
+            return device;
+
+        error = optcl_list_get_next(devices, it, &it);
+    }
+
+    return 0;
+}
+
+static void destroy_devices(optcl_list *devices)
+{
+    RESULT error;
+    optcl_device *device = 0;
+    optcl_list_iterator it = 0;
+
+    error = optcl_list_get_head_pos(devices, &it);
+    while (SUCCEEDED(error) && it != 0) {
+        error = optcl_list_get_at_pos(devices, it, (const pptr_t)&device);
+        if (SUCCEEDED(error))
+            optcl_device_destroy(device);
+
+        error = optcl_list_get_next(devices, it, &it);
+    }
+
+    optcl_list_destroy(devices, False);
+}
+
+/* Number of blocks on the medium from READ CAPACITY */
+static RESULT get_block_count(const optcl_device *device, uint32_t *blocks)
+{
+    RESULT error;
+    uint8_t cdb[10];
+    uint8_t data[8];
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = MMC_OPCODE_READ_CAPACITY;
+
+    error = optcl_device_command_execute(device, cdb, sizeof(cdb), data, sizeof(data));
+    if (FAILED(error))
+        return error;
+
+    *blocks = (((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16)
+        | ((uint32_t)data[2] << 8) | (uint32_t)data[3]) + 1;
+    return SUCCESS;
+}
+
+static RESULT read_blocks(const optcl_device *device,
+                          uint32_t lba,
+                          uint32_t blocks,
+                          uint8_t *data)
+{
+    optcl_mmc_read_10 command;
+
+    memset(&command, 0, sizeof(command));
+    command.start_lba = lba;
+    command.transfer_length = (uint16_t)blocks;
+
+    return optcl_command_read_10_direct(device, &command, data,
+        blocks * BENCH_BLOCK_SIZE);
+}
+
+static int run_backend(optcl_device *device,
+                       uint16_t backend,
+                       const char *name,
+                       uint32_t size,
+                       uint32_t turs)
+{
+    uint32_t i;
+    uint32_t lba;
+    uint32_t chunk;
+    uint32_t blocks;
+    uint64_t start;
+    uint64_t latency;
+    uint64_t elapsed;
+    uint64_t fastest;
+    uint8_t *buffer;
+    optcl_transfer_limits limits;
+
+    CHECK(SUCCEEDED(optcl_device_set_backend(device, backend)));
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+    CHECK(SUCCEEDED(optcl_device_get_transfer_limits(device, &limits)));
+
+    chunk = (limits.max_transfer_len != 0) 
+        ? limits.max_transfer_len / BENCH_BLOCK_SIZE : 32;
+    if (chunk > BENCH_MAX_BLOCKS)
+        chunk = BENCH_MAX_BLOCKS;
+    CHECK(chunk != 0);
+
+    CHECK(SUCCEEDED(get_block_count(device, &blocks)));
+    if (blocks > size)
+        blocks = size;
+    blocks -= blocks % chunk;
+    CHECK(blocks != 0);
+
+    CHECK(SUCCEEDED(optcl_device_alloc_buffer(device, chunk * BENCH_BLOCK_SIZE, (ptr_t*)&buffer)));
+
+    /* Spin the disc up and fill the caches before measuring */
+    CHECK(SUCCEEDED(optcl_command_test_unit_ready(device)));
+    CHECK(SUCCEEDED(read_blocks(device, 0, chunk, buffer)));
+
+    elapsed = 0;
+    fastest = (uint64_t)-1;
+    for (i = 0; i < turs; ++i) {
+        start = xtime_usec();
+        CHECK(SUCCEEDED(optcl_command_test_unit_ready(device)));
+        latency = xtime_usec() - start;
+
+        elapsed += latency;
+        if (latency < fastest)
+            fastest = latency;
+    }
+
+    printf("%-4s TEST UNIT READY  %8.1f us mean  %8.1f us min\n", name,
+        (double)elapsed / turs, (double)fastest);
+
+    start = xtime_usec();
+    for (lba = 0; lba < blocks; lba += chunk)
+        CHECK(SUCCEEDED(read_blocks(device, lba, chunk, buffer)));
+    elapsed = xtime_usec() - start;
+
+    printf("%-4s READ(10)         %8.2f MB/s  %u block reads\n", name,
+        rate((uint64_t)blocks * BENCH_BLOCK_SIZE, elapsed), chunk);
+
+    CHECK(SUCCEEDED(optcl_device_free_buffer(device, buffer)));
+    CHECK(SUCCEEDED(optcl_device_close(device)));
+
+    return(0);
+}
+
+int main(int argc, char **argv)
+{
+    int result;
+    uint32_t size;
+    uint32_t turs;
+    optcl_list *devices;
+    optcl_device *device;
+
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <device path> [size in MB] [TEST UNIT READY count]\n", argv[0]);
+        return(2);
+    }
+
+    size = (uint32_t)(((argc > 2) ? atoi(argv[2]) : BENCH_DEFAULT_SIZE)
+        * (1024 * 1024 / BENCH_BLOCK_SIZE));
+    turs = (argc > 3) ? (uint32_t)atoi(argv[3]) : BENCH_DEFAULT_TURS;
+    CHECK(turs != 0);
+
+    CHECK(SUCCEEDED(optcl_device_enumerate(&devices)));
+    device = find_device(devices, argv[1]);
+    CHECK(device != 0);
+
+    CHECK(SUCCEEDED(optcl_device_set_block_read_mode(device, DEVICE_BLOCKREAD_DISABLED)));
+
+    result = run_backend(device, DEVICE_BACKEND_SG, "sg", size, turs);
+    if (result == 0)
+        result = run_backend(device, DEVICE_BACKEND_BSG, "bsg", size, turs);
+
+    destroy_devices(devices);
+
+    return(result);
+}
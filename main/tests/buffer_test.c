@@ -0,0 +1,186 @@
+/*
+    buffer_test.c - Registered data buffer tests
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "command.h"
+#include "device.h"
+#include "emulator.h"
+#include "errors.h"
+#include "fault.h"
+#include "profile.h"
+#include "transport.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define TEST_BLOCKS		1000
+#define TEST_BLOCK_SIZE		2048
+#define TEST_BUFFER_BLOCKS	4
+
+#define MMC_OPCODE_WRITE_12	0x00AA
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+static void fill(uint8_t *data, uint32_t size, uint8_t seed)
+{
+    uint32_t i;
+
+    for (i = 0; i < size; ++i)
+        data[i] = (uint8_t)(seed + i * 7);
+}
+
+static RESULT read_back(const optcl_device *device,
+                        uint32_t lba,
+                        uint16_t blocks,
+                        uint8_t *data)
+{
+    optcl_mmc_read_10 command;
+
+    memset(&command, 0, sizeof(command));
+    command.start_lba = lba;
+    command.transfer_length = blocks;
+
+    return optcl_command_read_10_direct(device, &command, data,
+        blocks * TEST_BLOCK_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    bool_t registered;
+    uint8_t *buffer;
+    uint8_t *owned;
+    uint8_t *check;
+    uint32_t size;
+    optcl_device *device;
+    optcl_emulator *emulator;
+    optcl_emulator_timing timing;
+    optcl_fault_rule rule;
+    optcl_fault_stats stats;
+    optcl_fault_injector *injector;
+    optcl_mmc_write write;
+    optcl_mmc_write_12 write_12;
+
+    size = TEST_BUFFER_BLOCKS * TEST_BLOCK_SIZE;
+
+    /* Drive that is always ready */
+    CHECK(SUCCEEDED(optcl_emulator_get_default_timing(&timing)));
+    timing.spinup_time = 0;
+    timing.spindown_delay = 0;
+
+    CHECK(SUCCEEDED(optcl_device_create(&device)));
+    CHECK(SUCCEEDED(optcl_emulator_create(&timing, &emulator)));
+    CHECK(SUCCEEDED(optcl_emulator_load_memory(emulator, TEST_BLOCKS, PROFILE_DVD_PLUS_R)));
+    CHECK(SUCCEEDED(optcl_emulator_bind(device, emulator)));
+
+    /* Commands are counted by opcode, latency rules only count */
+    CHECK(SUCCEEDED(optcl_fault_attach(device, 1, False, &injector)));
+
+    memset(&rule, 0, sizeof(rule));
+    rule.kind = FAULT_LATENCY;
+    rule.opcode = MMC_OPCODE_WRITE_12;
+    rule.last_lba = FAULT_ANY_LBA;
+    rule.rate = FAULT_RATE_ALWAYS;
+    CHECK(SUCCEEDED(optcl_fault_add_rule(injector, &rule)));
+
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+
+    check = (uint8_t*)malloc(size);
+    CHECK(check != 0);
+
+    /* Allocated buffers are registered whole, ranges inside them too */
+    CHECK(SUCCEEDED(optcl_device_alloc_buffer(device, size, (ptr_t*)&buffer)));
+
+    CHECK(SUCCEEDED(optcl_device_is_buffer_registered(device, buffer, size, &registered)));
+    CHECK(registered == True);
+    CHECK(SUCCEEDED(optcl_device_is_buffer_registered(device,
+        buffer + TEST_BLOCK_SIZE, TEST_BLOCK_SIZE, &registered)));
+    CHECK(registered == True);
+    CHECK(SUCCEEDED(optcl_device_is_buffer_registered(device,
+        buffer + TEST_BLOCK_SIZE, size, &registered)));
+    CHECK(registered == False);
+
+    /* WRITE(10) from a registered buffer reaches the medium */
+    fill(buffer, size, 0x11);
+
+    memset(&write, 0, sizeof(write));
+    write.lba = 0;
+    write.transfer_len = TEST_BUFFER_BLOCKS;
+    CHECK(SUCCEEDED(optcl_command_write(device, &write, buffer, size)));
+
+    CHECK(SUCCEEDED(read_back(device, 0, TEST_BUFFER_BLOCKS, check)));
+    CHECK(memcmp(check, buffer, size) == 0);
+
+    /* WRITE(12) is sent with its own opcode */
+    fill(buffer, size, 0x22);
+
+    memset(&write_12, 0, sizeof(write_12));
+    write_12.lba = TEST_BUFFER_BLOCKS;
+    write_12.transfer_len = TEST_BUFFER_BLOCKS;
+    CHECK(SUCCEEDED(optcl_command_write_12(device, &write_12, buffer, size)));
+
+    CHECK(SUCCEEDED(optcl_fault_get_stats(injector, &stats)));
+    CHECK(stats.injected[FAULT_LATENCY] == 1);
+
+    CHECK(SUCCEEDED(read_back(device, TEST_BUFFER_BLOCKS, TEST_BUFFER_BLOCKS, check)));
+    CHECK(memcmp(check, buffer, size) == 0);
+
+    CHECK(SUCCEEDED(optcl_device_free_buffer(device, buffer)));
+    CHECK(SUCCEEDED(optcl_device_is_buffer_registered(device, check, size, &registered)));
+    CHECK(registered == False);
+
+    /* Caller owned buffers must be aligned for the adapter */
+    owned = (uint8_t*)malloc(size + 1);
+    CHECK(owned != 0);
+
+    CHECK(optcl_device_register_buffer(device, owned + 1, size) == E_DEVUNALIGNEDBUF);
+    CHECK(SUCCEEDED(optcl_device_register_buffer(device, owned, size)));
+    CHECK(SUCCEEDED(optcl_device_is_buffer_registered(device, owned, size, &registered)));
+    CHECK(registered == True);
+
+    CHECK(SUCCEEDED(optcl_device_unregister_buffer(device, owned)));
+    CHECK(SUCCEEDED(optcl_device_is_buffer_registered(device, owned, size, &registered)));
+    CHECK(registered == False);
+
+    /* Unaligned data outside any registered buffer is bounced */
+    fill(check, size, 0x33);
+    memcpy(owned + 1, check, size);
+
+    write.lba = 2 * TEST_BUFFER_BLOCKS;
+    CHECK(SUCCEEDED(optcl_command_write(device, &write, owned + 1, size)));
+
+    CHECK(SUCCEEDED(read_back(device, 2 * TEST_BUFFER_BLOCKS, TEST_BUFFER_BLOCKS, owned)));
+    CHECK(memcmp(check, owned, size) == 0);
+
+    free(owned);
+    free(check);
+
+    CHECK(SUCCEEDED(optcl_device_close(device)));
+    CHECK(SUCCEEDED(optcl_fault_detach(device, injector)));
+    CHECK(SUCCEEDED(optcl_device_destroy(device)));
+    CHECK(SUCCEEDED(optcl_emulator_destroy(emulator)));
+
+    return(0);
+}
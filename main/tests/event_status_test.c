@@ -0,0 +1,234 @@
+/*
+    event_status_test.c - GET EVENT STATUS NOTIFICATION encoding tests
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+/*
+ * Commands go to a transport that records the CDB and answers with
+ * fixed event data, so the bytes are checked against MMC and not
+ * against the emulator.
+ */
+
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "list.h"
+#include "transport.h"
+#include "types.h"
+#include "watcher.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+#define MMC_OPCODE_GET_EVENT_STATUS	0x004A
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+/* Media class, new media, medium present */
+static const uint8_t media_event[8] = {
+    0x00, 0x06, 0x04, 0x52, 0x02, 0x02, 0x00, 0x00
+};
+
+/* Device busy class, busy for one second */
+static const uint8_t busy_event[8] = {
+    0x00, 0x06, 0x06, 0x52, 0x01, 0x01, 0x00, 0x0A
+};
+
+static uint8_t last_cdb[16];
+static uint32_t requests = 0;
+static uint32_t arrivals = 0;
+
+/* Media class state the transport reports */
+static uint8_t media_code = 0x00;
+static uint8_t media_status = 0x00;
+
+
+static RESULT mock_open(optcl_device *device, ptr_t context)
+{
+    return SUCCESS;
+}
+
+static RESULT mock_close(optcl_device *device, ptr_t context)
+{
+    return SUCCESS;
+}
+
+static RESULT mock_execute(const optcl_device *device,
+                           ptr_t context,
+                           const uint8_t cdb[],
+                           uint32_t cdb_size,
+                           uint8_t param[],
+                           uint32_t param_size)
+{
+    memset(last_cdb, 0, sizeof(last_cdb));
+    memcpy(last_cdb, cdb, (cdb_size < sizeof(last_cdb)) ? cdb_size : sizeof(last_cdb));
+
+    if (cdb[0] != MMC_OPCODE_GET_EVENT_STATUS)
+        return SUCCESS;
+
+    ++requests;
+    memset(param, 0, param_size);
+    memcpy(param, media_event, (param_size < 8) ? param_size : 8);
+    if (param_size >= 6) {
+        param[4] = media_code;
+        param[5] = media_status;
+    }
+
+    /* The event is reported once */
+    media_code = 0x00;
+    return SUCCESS;
+}
+
+static RESULT mock_query_limits(const optcl_device *device,
+                                ptr_t context,
+                                optcl_transfer_limits *limits)
+{
+    limits->alignment_mask = sizeof(ptr_t);
+    limits->max_transfer_len = 0x10000;
+    limits->max_physical_pages = 0;
+    return SUCCESS;
+}
+
+static const optcl_transport mock_transport = {
+    "event_status_test",
+    mock_open,
+    mock_close,
+    mock_execute,
+    0, 0, 0, 0,
+    mock_query_limits,
+    0
+};
+
+static void count_arrivals(const optcl_device *device,
+                           const optcl_watcher_event *event,
+                           ptr_t context)
+{
+    if (event->type == WATCHER_EVENT_MEDIA_ARRIVED)
+        ++arrivals;
+}
+
+static RESULT get_first_descriptor(const optcl_mmc_response_get_event_status *response,
+                                   optcl_mmc_ges_descriptor **descriptor)
+{
+    RESULT error;
+    optcl_list_iterator it = 0;
+
+    *descriptor = 0;
+
+    error = optcl_list_get_head_pos(response->descriptors, &it);
+    if (FAILED(error) || it == 0)
+        return FAILED(error) ? error : E_UNEXPECTED;
+
+    return optcl_list_get_at_pos(response->descriptors, it, (const pptr_t)descriptor);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t now = 0;
+    optcl_device *device;
+    optcl_watcher *watcher;
+    optcl_mmc_ges_media *media;
+    optcl_mmc_ges_device_busy *busy;
+    optcl_mmc_ges_descriptor *descriptor;
+    optcl_mmc_get_event_status command;
+    optcl_mmc_response_get_event_status *response;
+
+    /* Class N is bit N of the request, bit 0 is reserved */
+    CHECK(MMC_GET_EVENT_STATUS_OPCHANGE == 0x02);
+    CHECK(MMC_GET_EVENT_STATUS_POWERMGMT == 0x04);
+    CHECK(MMC_GET_EVENT_STATUS_EXTREQUEST == 0x08);
+    CHECK(MMC_GET_EVENT_STATUS_MEDIA == 0x10);
+    CHECK(MMC_GET_EVENT_STATUS_MULTIHOST == 0x20);
+    CHECK(MMC_GET_EVENT_STATUS_DEVICEBUSY == 0x40);
+
+    /* Raw responses, descriptors follow the notification class */
+    CHECK(SUCCEEDED(optcl_command_parse_event_status(media_event,
+        sizeof(media_event), &response)));
+    CHECK(response->ges_header.nea == False);
+    CHECK(response->ges_header.notification_class == 4);
+    CHECK(response->event_class == 0x52);
+    CHECK(SUCCEEDED(get_first_descriptor(response, &descriptor)));
+    media = (optcl_mmc_ges_media*)descriptor;
+    CHECK(media->event_code == 0x02);
+    CHECK(media->media_present == True);
+    CHECK(media->tray_open == False);
+    CHECK(SUCCEEDED(optcl_command_destroy_response((optcl_mmc_response*)response)));
+
+    CHECK(SUCCEEDED(optcl_command_parse_event_status(busy_event,
+        sizeof(busy_event), &response)));
+    CHECK(response->ges_header.notification_class == 6);
+    CHECK(SUCCEEDED(get_first_descriptor(response, &descriptor)));
+    busy = (optcl_mmc_ges_device_busy*)descriptor;
+    CHECK(busy->event_code == 0x01);
+    CHECK(busy->busy_status == 0x01);
+    CHECK(busy->time == 10);
+    CHECK(SUCCEEDED(optcl_command_destroy_response((optcl_mmc_response*)response)));
+
+    CHECK(SUCCEEDED(optcl_device_create(&device)));
+    CHECK(SUCCEEDED(optcl_device_set_transport(device, &mock_transport, 0)));
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+
+    /* Class request goes to CDB byte 4 as it is */
+    memset(&command, 0, sizeof(command));
+    command.polled = True;
+    command.class_request = MMC_GET_EVENT_STATUS_MEDIA;
+    command.allocation_length = sizeof(media_event);
+    CHECK(SUCCEEDED(optcl_command_get_event_status(device, &command, &response)));
+    CHECK(last_cdb[0] == MMC_OPCODE_GET_EVENT_STATUS);
+    CHECK(last_cdb[1] == 0x01);
+    CHECK(last_cdb[4] == 0x10);
+    CHECK(response->ges_header.notification_class == 4);
+    CHECK(SUCCEEDED(optcl_command_destroy_response((optcl_mmc_response*)response)));
+
+    /* Watcher asks for its default classes and sees the media event */
+    CHECK(SUCCEEDED(optcl_watcher_create(device, 0, &watcher)));
+    CHECK(SUCCEEDED(optcl_watcher_subscribe(watcher, WATCHER_CLASSES_DEFAULT,
+        count_arrivals, 0)));
+
+    requests = 0;
+    while (requests < 2) {
+        CHECK(SUCCEEDED(optcl_watcher_poll(watcher, now, &now)));
+        CHECK(last_cdb[0] == MMC_OPCODE_GET_EVENT_STATUS);
+        CHECK((last_cdb[4] & 0x01) == 0);
+        CHECK((last_cdb[4] & MMC_GET_EVENT_STATUS_MEDIA) != 0);
+    }
+
+    CHECK(last_cdb[4] == 0x52);
+    CHECK(arrivals == 0);
+
+    media_code = 0x02;
+    media_status = 0x02;
+
+    requests = 0;
+    while (requests < 1)
+        CHECK(SUCCEEDED(optcl_watcher_poll(watcher, now, &now)));
+
+    CHECK(last_cdb[4] == 0x52);
+    CHECK(arrivals == 1);
+
+    CHECK(SUCCEEDED(optcl_watcher_destroy(watcher)));
+    CHECK(SUCCEEDED(optcl_device_close(device)));
+    CHECK(SUCCEEDED(optcl_device_destroy(device)));
+
+    return(0);
+}
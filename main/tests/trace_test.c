@@ -0,0 +1,251 @@
+/*
+    trace_test.c - Command trace record and replay tests
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+/*
+ * Usage: trace_test [directory]
+ *
+ * Records a drive that reports progress and answers submitted and
+ * mapped reads, then replays the trace on a device without a drive
+ * and checks that results, data and session progress come back.
+ */
+
+#include "device.h"
+#include "errors.h"
+#include "sensedata.h"
+#include "trace.h"
+#include "transport.h"
+#include "types.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+#define TEST_BLOCK_SIZE		2048
+#define TEST_PROGRESS		0x4000
+
+#define MMC_OPCODE_TEST_UNIT_READY	0x0000
+#define MMC_OPCODE_READ_10		0x0028
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+static uint32_t queue[4];
+static uint32_t queued = 0;
+static uint8_t view[TEST_BLOCK_SIZE];
+
+
+/* Data of a block is its LBA in every byte */
+static void fill_block(const uint8_t cdb[], uint8_t data[])
+{
+    memset(data, cdb[5], TEST_BLOCK_SIZE);
+}
+
+static RESULT mock_open(optcl_device *device, ptr_t context)
+{
+    return SUCCESS;
+}
+
+/* Drive is becoming ready, a quarter of the way there */
+static RESULT mock_execute(const optcl_device *device,
+                           ptr_t context,
+                           const uint8_t cdb[],
+                           uint32_t cdb_size,
+                           uint8_t param[],
+                           uint32_t param_size)
+{
+    optcl_device_session *session = 0;
+
+    if (cdb[0] != MMC_OPCODE_TEST_UNIT_READY)
+        return E_SENSE_ICOC;
+
+    optcl_device_get_session(device, &session);
+    session->progress = TEST_PROGRESS;
+    session->progress_valid = True;
+    return E_SENSE_LUIIPOBR;
+}
+
+static RESULT mock_submit(const optcl_device *device,
+                          ptr_t context,
+                          const uint8_t cdb[],
+                          uint32_t cdb_size,
+                          uint8_t param[],
+                          uint32_t param_size,
+                          uint32_t tag)
+{
+    if (queued == sizeof(queue) / sizeof(queue[0]))
+        return E_DEVQUEUEFULL;
+
+    fill_block(cdb, param);
+    queue[queued++] = tag;
+    return SUCCESS;
+}
+
+/* Commands complete last in, first out */
+static RESULT mock_complete(const optcl_device *device,
+                            ptr_t context,
+                            uint32_t *tag,
+                            RESULT *status)
+{
+    if (queued == 0)
+        return E_DEVNOMOREITEMS;
+
+    *tag = queue[--queued];
+    *status = SUCCESS;
+    return SUCCESS;
+}
+
+static RESULT mock_poll(const optcl_device *device,
+                        ptr_t context,
+                        int32_t timeout,
+                        bool_t *ready)
+{
+    *ready = bool_from_uint8(queued > 0);
+    return SUCCESS;
+}
+
+static RESULT mock_query_limits(const optcl_device *device,
+                                ptr_t context,
+                                optcl_transfer_limits *limits)
+{
+    limits->alignment_mask = sizeof(ptr_t);
+    limits->max_transfer_len = 0x10000;
+    limits->max_physical_pages = 0;
+    return SUCCESS;
+}
+
+static RESULT mock_execute_mapped(const optcl_device *device,
+                                  ptr_t context,
+                                  const uint8_t cdb[],
+                                  uint32_t cdb_size,
+                                  uint32_t transfer_size,
+                                  const uint8_t **data)
+{
+    fill_block(cdb, view);
+    *data = view;
+    return SUCCESS;
+}
+
+static const optcl_transport mock_transport = {
+    "trace_test",
+    mock_open,
+    0,
+    mock_execute,
+    0,
+    mock_submit,
+    mock_complete,
+    mock_poll,
+    mock_query_limits,
+    mock_execute_mapped
+};
+
+static void init_read(uint8_t cdb[], uint8_t lba)
+{
+    memset(cdb, 0, 10);
+    cdb[0] = MMC_OPCODE_READ_10;
+    cdb[5] = lba;
+    cdb[8] = 1;
+}
+
+/* Same command sequence on the drive and on the replay */
+static int run_commands(optcl_device *device)
+{
+    uint32_t tag;
+    RESULT status;
+    bool_t ready;
+    uint8_t cdb[10];
+    uint8_t tur[6];
+    const uint8_t *data;
+    uint8_t blocks[2][TEST_BLOCK_SIZE];
+    optcl_device_session *session = 0;
+
+    CHECK(SUCCEEDED(optcl_device_get_session(device, &session)));
+
+    /* Failed command restores the sense progress for retries */
+    memset(tur, 0, sizeof(tur));
+    CHECK(optcl_device_command_execute_once(device, tur, sizeof(tur), 0, 0) == E_SENSE_LUIIPOBR);
+    CHECK(session->progress_valid == True);
+    CHECK(session->progress == TEST_PROGRESS);
+
+    /* Submitted reads complete in the recorded order */
+    memset(blocks, 0, sizeof(blocks));
+    init_read(cdb, 1);
+    CHECK(SUCCEEDED(optcl_device_command_submit(device, cdb, sizeof(cdb), blocks[0], TEST_BLOCK_SIZE, 10)));
+    init_read(cdb, 2);
+    CHECK(SUCCEEDED(optcl_device_command_submit(device, cdb, sizeof(cdb), blocks[1], TEST_BLOCK_SIZE, 20)));
+
+    CHECK(SUCCEEDED(optcl_device_command_poll(device, 0, &ready)));
+    CHECK(ready == True);
+
+    CHECK(SUCCEEDED(optcl_device_command_complete(device, &tag, &status)));
+    CHECK(tag == 20 && SUCCEEDED(status));
+    CHECK(SUCCEEDED(optcl_device_command_complete(device, &tag, &status)));
+    CHECK(tag == 10 && SUCCEEDED(status));
+    CHECK(optcl_device_command_complete(device, &tag, &status) == E_DEVNOMOREITEMS);
+
+    CHECK(blocks[0][0] == 1 && blocks[0][TEST_BLOCK_SIZE - 1] == 1);
+    CHECK(blocks[1][0] == 2 && blocks[1][TEST_BLOCK_SIZE - 1] == 2);
+
+    /* Mapped reads return a view of the data */
+    init_read(cdb, 3);
+    CHECK(SUCCEEDED(optcl_device_command_execute_mapped(device, cdb, sizeof(cdb), TEST_BLOCK_SIZE, &data)));
+    CHECK(data[0] == 3 && data[TEST_BLOCK_SIZE - 1] == 3);
+
+    return(0);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t count;
+    char path[1024];
+    optcl_trace *trace;
+    optcl_device *device;
+    optcl_device_session *session = 0;
+
+    snprintf(path, sizeof(path), "%s/trace_test.trc", (argc > 1) ? argv[1] : ".");
+
+    CHECK(SUCCEEDED(optcl_device_create(&device)));
+    CHECK(SUCCEEDED(optcl_device_set_transport(device, &mock_transport, 0)));
+    CHECK(SUCCEEDED(optcl_trace_record(device, path, 0, &trace)));
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+    CHECK(run_commands(device) == 0);
+    CHECK(SUCCEEDED(optcl_trace_get_count(trace, &count)));
+    CHECK(count == 4);
+    CHECK(SUCCEEDED(optcl_trace_stop(device, trace)));
+    CHECK(SUCCEEDED(optcl_device_destroy(device)));
+
+    CHECK(SUCCEEDED(optcl_device_create(&device)));
+    CHECK(SUCCEEDED(optcl_trace_replay(device, path, 0, &trace)));
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+    CHECK(SUCCEEDED(optcl_device_get_session(device, &session)));
+    session->progress_valid = False;
+    session->progress = 0;
+    CHECK(run_commands(device) == 0);
+    CHECK(SUCCEEDED(optcl_trace_get_count(trace, &count)));
+    CHECK(count == 4);
+    CHECK(SUCCEEDED(optcl_trace_stop(device, trace)));
+    CHECK(SUCCEEDED(optcl_device_destroy(device)));
+
+    remove(path);
+
+    return(0);
+}
@@ -0,0 +1,162 @@
+/*
+    watcher_test.c - Media change watcher tests
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "command.h"
+#include "device.h"
+#include "emulator.h"
+#include "errors.h"
+#include "fault.h"
+#include "profile.h"
+#include "retry.h"
+#include "sensedata.h"
+#include "transport.h"
+#include "types.h"
+#include "watcher.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+#define TEST_BLOCKS		1000
+
+#define MMC_OPCODE_GET_EVENT_STATUS		0x004A
+#define MMC_OPCODE_TEST_UNIT_READY		0x0000
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+static uint32_t changes = 0;
+
+
+static void count_changes(const optcl_device *device,
+                          const optcl_watcher_event *event,
+                          ptr_t context)
+{
+    if (event->type == WATCHER_EVENT_MEDIA_CHANGED)
+        ++changes;
+}
+
+static RESULT add_rule(optcl_fault_injector *injector,
+                       uint16_t kind,
+                       uint16_t opcode,
+                       uint32_t count,
+                       RESULT sense)
+{
+    optcl_fault_rule rule;
+
+    memset(&rule, 0, sizeof(rule));
+    rule.kind = kind;
+    rule.opcode = opcode;
+    rule.last_lba = FAULT_ANY_LBA;
+    rule.rate = FAULT_RATE_ALWAYS;
+    rule.count = count;
+    rule.sense = sense;
+
+    return optcl_fault_add_rule(injector, &rule);
+}
+
+static uint32_t poll_commands(optcl_watcher *watcher,
+                              optcl_fault_injector *injector,
+                              uint64_t *now,
+                              RESULT *error)
+{
+    uint32_t commands;
+    optcl_fault_stats stats;
+
+    optcl_fault_get_stats(injector, &stats);
+    commands = stats.commands;
+
+    *error = optcl_watcher_poll(watcher, *now, now);
+
+    optcl_fault_get_stats(injector, &stats);
+    return stats.commands - commands;
+}
+
+int main(int argc, char **argv)
+{
+    RESULT error;
+    uint64_t now = 0;
+    bool_t present;
+    bool_t tray_open;
+    optcl_device *device;
+    optcl_emulator *emulator;
+    optcl_watcher *watcher;
+    optcl_retry_policy policy;
+    optcl_fault_injector *injector;
+
+    CHECK(SUCCEEDED(optcl_device_create(&device)));
+    CHECK(SUCCEEDED(optcl_emulator_create(0, &emulator)));
+    CHECK(SUCCEEDED(optcl_emulator_load_memory(emulator, TEST_BLOCKS, PROFILE_DVD_PLUS_R)));
+    CHECK(SUCCEEDED(optcl_emulator_bind(device, emulator)));
+
+    /* Watcher must see the sense the device retry policy would hide */
+    CHECK(SUCCEEDED(optcl_retry_get_default_policy(&policy)));
+    CHECK(SUCCEEDED(optcl_device_set_retry_policy(device, &policy)));
+
+    CHECK(SUCCEEDED(optcl_fault_attach(device, 1, False, &injector)));
+
+    /* Drive without event status support, watched with TEST UNIT READY */
+    CHECK(SUCCEEDED(add_rule(injector, FAULT_MEDIUM_ERROR,
+        MMC_OPCODE_GET_EVENT_STATUS, 0, E_SENSE_ICOC)));
+
+    CHECK(SUCCEEDED(optcl_device_open(device)));
+    CHECK(SUCCEEDED(optcl_watcher_create(device, 0, &watcher)));
+    CHECK(SUCCEEDED(optcl_watcher_subscribe(watcher,
+        MMC_GET_EVENT_STATUS_MEDIA, count_changes, 0)));
+
+    poll_commands(watcher, injector, &now, &error);
+    CHECK(SUCCEEDED(error));
+    CHECK(changes == 0);
+
+    /* Medium swapped between two polls */
+    CHECK(SUCCEEDED(add_rule(injector, FAULT_UNIT_ATTENTION,
+        MMC_OPCODE_TEST_UNIT_READY, 1, E_SENSE_NRTRC_MMHC)));
+
+    poll_commands(watcher, injector, &now, &error);
+    CHECK(SUCCEEDED(error));
+    CHECK(changes == 1);
+
+    CHECK(SUCCEEDED(optcl_watcher_get_state(watcher, &present, &tray_open)));
+    CHECK(present == True);
+
+    /* Drive becoming ready is present and costs one command a poll */
+    CHECK(SUCCEEDED(add_rule(injector, FAULT_NOT_READY,
+        MMC_OPCODE_TEST_UNIT_READY, 2, E_SENSE_LUIIPOBR)));
+
+    CHECK(poll_commands(watcher, injector, &now, &error) == 1);
+    CHECK(SUCCEEDED(error));
+    CHECK(poll_commands(watcher, injector, &now, &error) == 1);
+    CHECK(SUCCEEDED(error));
+
+    CHECK(SUCCEEDED(optcl_watcher_get_state(watcher, &present, &tray_open)));
+    CHECK(present == True);
+    CHECK(changes == 1);
+
+    CHECK(SUCCEEDED(optcl_watcher_destroy(watcher)));
+    CHECK(SUCCEEDED(optcl_device_close(device)));
+    CHECK(SUCCEEDED(optcl_fault_detach(device, injector)));
+    CHECK(SUCCEEDED(optcl_device_destroy(device)));
+    CHECK(SUCCEEDED(optcl_emulator_destroy(emulator)));
+
+    return(0);
+}
@@ -0,0 +1,250 @@
+/*
+    zimage_bench.c - Compressed image throughput benchmark
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+/*
+ * Usage: zimage_bench [directory] [image size in MB]
+ *
+ * Writes an image of text, zero and random chunks, converts it into a
+ * compressed image and reads both back through the image backend with
+ * sequential and random READ(12) commands. Every read is compared with
+ * the raw image, the run fails on the first mismatch.
+ */
+
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "transport.h"
+#include "types.h"
+#include "zimage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define BENCH_BLOCK_SIZE	2048
+#define BENCH_DEFAULT_SIZE	200		/* MB */
+#define BENCH_SEQ_BLOCKS	32
+#define BENCH_RANDOM_READS	3000
+
+#define CHECK(expr)	do { if (!(expr)) { \
+    fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #expr); \
+    return(1); } } while (0)
+
+
+static uint32_t seed = 0x2545F491U;
+
+
+static uint32_t next_random(void)
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+static double rate(uint64_t bytes, uint64_t usec)
+{
+    return (usec != 0) ? (double)bytes / (double)usec : 0.0;
+}
+
+/* Thirds of the image are text, zero runs and random data, by chunk */
+static int write_image(const char *path, uint32_t blocks)
+{
+    FILE *file;
+    uint32_t i;
+    uint32_t j;
+    uint8_t block[BENCH_BLOCK_SIZE];
+    static const char text[] = "The quick brown fox jumps over the lazy dog. ";
+
+    file = fopen(path, "wb");
+    if (file == 0)
+        return(-1);
+
+    for (i = 0; i < blocks; ++i) {
+        switch ((i * BENCH_BLOCK_SIZE / ZIMAGE_DEFAULT_CHUNK_SIZE) % 3) {
+        case 0:
+            for (j = 0; j < BENCH_BLOCK_SIZE; ++j)
+                block[j] = (uint8_t)text[(i + j) % (sizeof(text) - 1)];
+            break;
+
+        case 1:
+            memset(block, 0, sizeof(block));
+            break;
+
+        default:
+            for (j = 0; j < BENCH_BLOCK_SIZE; ++j)
+                block[j] = (uint8_t)next_random();
+            break;
+        }
+
+        if (fwrite(block, 1, sizeof(block), file) != sizeof(block)) {
+            fclose(file);
+            return(-1);
+        }
+    }
+
+    return(fclose(file));
+}
+
+static uint64_t file_size(const char *path)
+{
+    long size;
+    FILE *file;
+
+    file = fopen(path, "rb");
+    if (file == 0)
+        return 0;
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fclose(file);
+
+    return (size > 0) ? (uint64_t)size : 0;
+}
+
+static RESULT open_image(const char *path, optcl_device **device)
+{
+    RESULT error;
+
+    error = optcl_device_create(device);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_bind2file(*device, path);
+    if (SUCCEEDED(error))
+        error = optcl_device_open(*device);
+
+    if (FAILED(error))
+        optcl_device_destroy(*device);
+
+    return error;
+}
+
+static RESULT read_blocks(const optcl_device *device,
+                          uint32_t lba,
+                          uint32_t blocks,
+                          uint8_t *data)
+{
+    optcl_mmc_read_12 command;
+
+    memset(&command, 0, sizeof(command));
+    command.start_lba = lba;
+    command.transfer_length = blocks;
+
+    return optcl_command_read_12_direct(device, &command, data,
+        blocks * BENCH_BLOCK_SIZE);
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    uint32_t lba;
+    uint32_t count;
+    uint32_t blocks;
+    uint64_t start;
+    uint64_t elapsed;
+    uint64_t raw_size;
+    uint64_t zimage_size;
+    uint8_t *data;
+    uint8_t *expected;
+    const char *directory;
+    char raw_path[1024];
+    char zimage_path[1024];
+    optcl_device *raw;
+    optcl_device *zimage;
+
+    directory = (argc > 1) ? argv[1] : ".";
+    blocks = (uint32_t)(((argc > 2) ? atoi(argv[2]) : BENCH_DEFAULT_SIZE)
+        * (1024 * 1024 / BENCH_BLOCK_SIZE));
+    CHECK(blocks >= BENCH_SEQ_BLOCKS);
+
+    snprintf(raw_path, sizeof(raw_path), "%s/zimage_bench.iso", directory);
+    snprintf(zimage_path, sizeof(zimage_path), "%s/zimage_bench.zim", directory);
+
+    CHECK(write_image(raw_path, blocks) == 0);
+
+    start = xtime_usec();
+    CHECK(SUCCEEDED(optcl_zimage_convert(raw_path, zimage_path, 0)));
+    elapsed = xtime_usec() - start;
+
+    raw_size = (uint64_t)blocks * BENCH_BLOCK_SIZE;
+    zimage_size = file_size(zimage_path);
+    CHECK(zimage_size != 0);
+
+    printf("convert     %8.1f MB/s  %llu -> %llu bytes (%.1f%%)\n",
+        rate(raw_size, elapsed), (unsigned long long)raw_size,
+        (unsigned long long)zimage_size, 100.0 * zimage_size / raw_size);
+
+    CHECK(SUCCEEDED(open_image(raw_path, &raw)));
+    CHECK(SUCCEEDED(open_image(zimage_path, &zimage)));
+
+    data = (uint8_t*)malloc(BENCH_SEQ_BLOCKS * BENCH_BLOCK_SIZE);
+    expected = (uint8_t*)malloc(BENCH_SEQ_BLOCKS * BENCH_BLOCK_SIZE);
+    CHECK(data != 0 && expected != 0);
+
+    /* Sequential reads decompress every chunk once */
+    elapsed = 0;
+    for (lba = 0; lba < blocks; lba += count) {
+        count = (blocks - lba < BENCH_SEQ_BLOCKS) ? blocks - lba : BENCH_SEQ_BLOCKS;
+
+        start = xtime_usec();
+        CHECK(SUCCEEDED(read_blocks(zimage, lba, count, data)));
+        elapsed += xtime_usec() - start;
+
+        CHECK(SUCCEEDED(read_blocks(raw, lba, count, expected)));
+        CHECK(memcmp(data, expected, count * BENCH_BLOCK_SIZE) == 0);
+    }
+
+    printf("sequential  %8.1f MB/s  %u block reads\n",
+        rate(raw_size, elapsed), BENCH_SEQ_BLOCKS);
+
+    /* Random single block reads mostly miss the chunk cache */
+    elapsed = 0;
+    for (i = 0; i < BENCH_RANDOM_READS; ++i) {
+        lba = next_random() % blocks;
+
+        start = xtime_usec();
+        CHECK(SUCCEEDED(read_blocks(zimage, lba, 1, data)));
+        elapsed += xtime_usec() - start;
+
+        CHECK(SUCCEEDED(read_blocks(raw, lba, 1, expected)));
+        CHECK(memcmp(data, expected, BENCH_BLOCK_SIZE) == 0);
+    }
+
+    printf("random      %8.1f MB/s  %u single block reads\n",
+        rate((uint64_t)BENCH_RANDOM_READS * BENCH_BLOCK_SIZE, elapsed),
+        BENCH_RANDOM_READS);
+
+    free(expected);
+    free(data);
+
+    CHECK(SUCCEEDED(optcl_device_close(zimage)));
+    CHECK(SUCCEEDED(optcl_device_destroy(zimage)));
+    CHECK(SUCCEEDED(optcl_device_close(raw)));
+    CHECK(SUCCEEDED(optcl_device_destroy(raw)));
+
+    remove(zimage_path);
+    remove(raw_path);
+
+    return(0);
+}
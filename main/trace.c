@@ -0,0 +1,1100 @@
+/*
+    trace.c - Command trace recording and replay
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "sensedata.h"
+#include "sysdevice.h"
+#include "trace.h"
+#include "transport.h"
+#include "types.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+#define TRACE_MAGIC			"OPTCLTRC"
+#define TRACE_VERSION			2U
+#define TRACE_HEADER_SIZE		28U
+#define TRACE_RECORD_SIZE		16U
+#define TRACE_MAX_CDB_SIZE		16U
+#define TRACE_SENSE_SIZE		18U
+#define TRACE_MAX_PENDING		16U
+
+/* Record payload kinds */
+#define TRACE_PAYLOAD_NONE		0
+#define TRACE_PAYLOAD_DATA		1
+#define TRACE_PAYLOAD_HASH		2
+
+/* FNV-1a hash parameters */
+#define FNV_OFFSET_BASIS		2166136261U
+#define FNV_PRIME			16777619U
+
+
+/*
+ * Trace file layout, all values little endian
+ *
+ * Header:
+ *	magic[8], version, flags, alignment, max transfer length,
+ *	max physical pages
+ *
+ * Record:
+ *	cdb size, data direction, payload kind, sense size,
+ *	result, latency in microseconds, transfer size,
+ *	cdb[cdb size], sense[sense size], payload
+ *
+ * The payload is the transfer data, or for data-out commands
+ * recorded without TRACE_FLAG_DATA_OUT a 32 bit hash of it.
+ * Submitted commands are recorded in the order they complete.
+ */
+
+
+/*
+ * Internal trace structures
+ */
+
+/* Submitted command, recorded or replayed when it completes */
+typedef struct tag_trace_pending {
+    bool_t busy;
+    uint32_t tag;
+    uint8_t cdb[TRACE_MAX_CDB_SIZE];
+    uint32_t cdb_size;
+    uint8_t *param;
+    uint32_t param_size;
+    uint64_t start;
+} optcl_trace_pending;
+
+/* Command trace descriptor */
+struct tag_trace {
+    FILE *file;
+    uint32_t flags;
+    uint32_t count;
+    uint32_t time_scale;
+    optcl_trace_pending pending[TRACE_MAX_PENDING];
+    uint8_t *view;                      /* Replayed mapped transfer data */
+    uint32_t view_size;
+    optcl_transfer_limits limits;
+    const optcl_transport *transport;   /* Wrapped transport while recording */
+    ptr_t context;
+    const optcl_transport *saved;       /* Transport bound before the trace */
+    ptr_t saved_context;
+};
+
+
+/*
+ * Helper functions
+ */
+
+static void put_le32(uint8_t data[], uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+static uint32_t get_le32(const uint8_t data[])
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8)
+        | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint32_t hash_data(uint32_t hash, const uint8_t data[], uint32_t size)
+{
+    uint32_t i;
+
+    for (i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+static uint32_t hash_iov(const optcl_iovec iov[], uint32_t iov_count)
+{
+    uint32_t i;
+    uint32_t hash = FNV_OFFSET_BASIS;
+
+    for (i = 0; i < iov_count; ++i)
+        hash = hash_data(hash, iov[i].base, iov[i].len);
+
+    return hash;
+}
+
+static uint32_t get_iov_size(const optcl_iovec iov[], uint32_t iov_count)
+{
+    uint32_t i;
+    uint32_t size = 0;
+
+    for (i = 0; i < iov_count; ++i)
+        size += iov[i].len;
+
+    return size;
+}
+
+/*
+ * Sense data of a completed command
+ *
+ * Transports return the sense code and keep the progress indication
+ * in the session instead of handing back the raw bytes, the two are
+ * stored as fixed format sense data that replays parse like the
+ * sense data of a drive.
+ */
+static uint8_t get_sense(const optcl_device *device,
+                         RESULT result,
+                         uint8_t sense[])
+{
+    bool_t progress_valid;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(sense != 0);
+
+    progress_valid = False;
+    if (SUCCEEDED(optcl_device_get_session(device, &session)))
+        progress_valid = session->progress_valid;
+
+    if (ERROR_FACILITY(result) != FACILITY_SENSE && progress_valid == False)
+        return 0;
+
+    memset(sense, 0, TRACE_SENSE_SIZE);
+    sense[0] = SENSEDATA_RESPONSE_FIXEDFORMAT;
+    sense[7] = TRACE_SENSE_SIZE - 8;
+
+    if (ERROR_FACILITY(result) == FACILITY_SENSE) {
+        sense[2] = ERROR_SENSE_SK(result);
+        sense[12] = ERROR_SENSE_ASC(result);
+        sense[13] = ERROR_SENSE_ASCQ(result);
+    }
+
+    if (progress_valid == True) {
+        sense[15] = 0x80;
+        sense[16] = (uint8_t)(session->progress >> 8);
+        sense[17] = (uint8_t)session->progress;
+    }
+
+    return TRACE_SENSE_SIZE;
+}
+
+/* Only the progress of the command being recorded goes into its sense */
+static void clear_progress(const optcl_device *device)
+{
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+
+    if (SUCCEEDED(optcl_device_get_session(device, &session)))
+        session->progress_valid = False;
+}
+
+/* Take a free pending slot for a submitted command */
+static RESULT add_pending(optcl_trace *trace,
+                          const uint8_t cdb[],
+                          uint32_t cdb_size,
+                          uint8_t param[],
+                          uint32_t param_size,
+                          uint32_t tag,
+                          optcl_trace_pending **added)
+{
+    uint32_t i;
+    optcl_trace_pending *pending = 0;
+
+    assert(trace != 0);
+    assert(cdb != 0);
+    assert(added != 0);
+    if (cdb_size > TRACE_MAX_CDB_SIZE)
+        return E_INVALIDARG;
+
+    for (i = 0; i < TRACE_MAX_PENDING && pending == 0; ++i) {
+        if (trace->pending[i].busy == False)
+            pending = &trace->pending[i];
+    }
+
+    if (pending == 0)
+        return E_DEVQUEUEFULL;
+
+    pending->busy = True;
+    pending->tag = tag;
+    memcpy(pending->cdb, cdb, cdb_size);
+    pending->cdb_size = cdb_size;
+    pending->param = param;
+    pending->param_size = (param != 0) ? param_size : 0;
+    pending->start = xtime_usec();
+
+    *added = pending;
+    return SUCCESS;
+}
+
+static uint32_t get_pending_count(const optcl_trace *trace)
+{
+    uint32_t i;
+    uint32_t count = 0;
+
+    assert(trace != 0);
+
+    for (i = 0; i < TRACE_MAX_PENDING; ++i) {
+        if (trace->pending[i].busy == True)
+            ++count;
+    }
+
+    return count;
+}
+
+static RESULT write_record(optcl_trace *trace,
+                           const optcl_device *device,
+                           const uint8_t cdb[],
+                           uint32_t cdb_size,
+                           const optcl_iovec iov[],
+                           uint32_t iov_count,
+                           RESULT result,
+                           uint32_t latency)
+{
+    int direction;
+    uint32_t i;
+    uint8_t kind;
+    RESULT error;
+    uint32_t size;
+    uint8_t sense_size;
+    uint8_t header[TRACE_RECORD_SIZE];
+    uint8_t sense[TRACE_SENSE_SIZE];
+    uint8_t hash[4];
+
+    assert(trace != 0);
+    assert(device != 0);
+    assert(cdb_size <= TRACE_MAX_CDB_SIZE);
+    if (cdb_size > TRACE_MAX_CDB_SIZE)
+        return E_INVALIDARG;
+
+    size = get_iov_size(iov, iov_count);
+    error = optcl_command_get_data_direction(cdb, cdb_size, size, &direction);
+    if (FAILED(error))
+        return error;
+
+    if (direction == MMC_DATA_DIRECTION_IN)
+        kind = SUCCEEDED(result) ? TRACE_PAYLOAD_DATA : TRACE_PAYLOAD_NONE;
+    else if (direction == MMC_DATA_DIRECTION_OUT)
+        kind = (trace->flags & TRACE_FLAG_DATA_OUT)
+            ? TRACE_PAYLOAD_DATA : TRACE_PAYLOAD_HASH;
+    else
+        kind = TRACE_PAYLOAD_NONE;
+
+    sense_size = get_sense(device, result, sense);
+
+    header[0] = (uint8_t)cdb_size;
+    header[1] = (uint8_t)direction;
+    header[2] = kind;
+    header[3] = sense_size;
+    put_le32(&header[4], (uint32_t)result);
+    put_le32(&header[8], latency);
+    put_le32(&header[12], size);
+
+    if (fwrite(header, 1, sizeof(header), trace->file) != sizeof(header)
+        || fwrite(cdb, 1, cdb_size, trace->file) != cdb_size
+        || fwrite(sense, 1, sense_size, trace->file) != sense_size)
+        return E_UNEXPECTED;
+
+    if (kind == TRACE_PAYLOAD_HASH) {
+        put_le32(hash, hash_iov(iov, iov_count));
+        if (fwrite(hash, 1, sizeof(hash), trace->file) != sizeof(hash))
+            return E_UNEXPECTED;
+    } else if (kind == TRACE_PAYLOAD_DATA) {
+        for (i = 0; i < iov_count; ++i) {
+            if (fwrite(iov[i].base, 1, iov[i].len, trace->file) != iov[i].len)
+                return E_UNEXPECTED;
+        }
+    }
+
+    ++trace->count;
+    return SUCCESS;
+}
+
+static RESULT replay_record(optcl_trace *trace,
+                            const optcl_device *device,
+                            const uint8_t cdb[],
+                            uint32_t cdb_size,
+                            const optcl_iovec iov[],
+                            uint32_t iov_count)
+{
+    uint32_t i;
+    uint32_t size;
+    uint32_t latency;
+    RESULT error;
+    RESULT result;
+    uint8_t header[TRACE_RECORD_SIZE];
+    uint8_t recorded_cdb[TRACE_MAX_CDB_SIZE];
+    uint8_t sense[TRACE_SENSE_SIZE];
+    uint8_t hash[4];
+    optcl_device_session *session = 0;
+
+    assert(trace != 0);
+    assert(device != 0);
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (fread(header, 1, sizeof(header), trace->file) != sizeof(header))
+        return E_TRACEEND;
+
+    size = get_le32(&header[12]);
+    if (header[0] > TRACE_MAX_CDB_SIZE
+        || fread(recorded_cdb, 1, header[0], trace->file) != header[0])
+        return E_TRACEINVFORMAT;
+
+    if (header[3] > TRACE_SENSE_SIZE
+        || fread(sense, 1, header[3], trace->file) != header[3])
+        return E_TRACEINVFORMAT;
+
+    /* Commands must be issued exactly as they were recorded */
+    if (header[0] != cdb_size || memcmp(recorded_cdb, cdb, cdb_size) != 0
+        || size != get_iov_size(iov, iov_count))
+        return E_TRACEMISMATCH;
+
+    switch (header[2]) {
+    case TRACE_PAYLOAD_NONE:
+        break;
+
+    case TRACE_PAYLOAD_HASH:
+        if (fread(hash, 1, sizeof(hash), trace->file) != sizeof(hash))
+            return E_TRACEINVFORMAT;
+
+        if (get_le32(hash) != hash_iov(iov, iov_count))
+            return E_TRACEMISMATCH;
+        break;
+
+    case TRACE_PAYLOAD_DATA:
+        for (i = 0; i < iov_count; ++i) {
+            if (header[1] != MMC_DATA_DIRECTION_IN) {
+                if (fseek(trace->file, (long)iov[i].len, SEEK_CUR) != 0)
+                    return E_TRACEINVFORMAT;
+            } else if (fread(iov[i].base, 1, iov[i].len, trace->file)
+                != iov[i].len) {
+                return E_TRACEINVFORMAT;
+            }
+        }
+        break;
+
+    default:
+        return E_TRACEINVFORMAT;
+    }
+
+    result = (RESULT)get_le32(&header[4]);
+    latency = get_le32(&header[8]);
+
+    /* Retries read the progress of the drive from the session */
+    session->progress_valid = False;
+    if (header[3] > 0) {
+        error = optcl_sensedata_get_progress(sense, header[3],
+            &session->progress, &session->progress_valid);
+        if (FAILED(error))
+            return error;
+    }
+
+    if (trace->time_scale > 0 && latency > 0)
+        xsleep_usec((uint32_t)((uint64_t)latency * trace->time_scale / 100));
+
+    ++trace->count;
+    return result;
+}
+
+static RESULT create_trace(optcl_device *device,
+                           const char *filename,
+                           bool_t replay,
+                           optcl_trace **trace)
+{
+    RESULT error;
+    optcl_trace *ntrace;
+
+    assert(device != 0);
+    assert(filename != 0);
+    assert(trace != 0);
+
+    ntrace = (optcl_trace*)malloc(sizeof(optcl_trace));
+    if (ntrace == 0)
+        return E_OUTOFMEMORY;
+
+    memset(ntrace, 0, sizeof(optcl_trace));
+
+    error = optcl_device_get_transport(device, &ntrace->saved,
+        &ntrace->saved_context);
+    if (FAILED(error)) {
+        free(ntrace);
+        return error;
+    }
+
+    ntrace->file = fopen(filename, (replay == True) ? "rb" : "wb");
+    if (ntrace->file == 0) {
+        free(ntrace);
+        return E_DEVINVALIDPATH;
+    }
+
+    *trace = ntrace;
+    return SUCCESS;
+}
+
+static void destroy_trace(optcl_trace *trace)
+{
+    assert(trace != 0);
+
+    if (trace->file != 0)
+        fclose(trace->file);
+
+    free(trace->view);
+    free(trace);
+}
+
+
+/*
+ * Recording transport
+ */
+
+static RESULT record_open(optcl_device *device, ptr_t context)
+{
+    RESULT error;
+    optcl_trace *trace;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    if (trace->transport->open == 0)
+        return E_NOTIMPL;
+
+    error = trace->transport->open(device, trace->context);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    /* Block device reads bypass the transport and would be lost */
+    session->block_reads = False;
+    return SUCCESS;
+}
+
+static RESULT record_close(optcl_device *device, ptr_t context)
+{
+    optcl_trace *trace;
+
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    memset(trace->pending, 0, sizeof(trace->pending));
+
+    return (trace->transport->close != 0)
+        ? trace->transport->close(device, trace->context) : SUCCESS;
+}
+
+static RESULT record_execute_vectored(const optcl_device *device,
+                                      ptr_t context,
+                                      const uint8_t cdb[],
+                                      uint32_t cdb_size,
+                                      const optcl_iovec iov[],
+                                      uint32_t iov_count)
+{
+    RESULT error;
+    RESULT result;
+    uint64_t start;
+    optcl_trace *trace;
+
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    if (trace->transport->execute_vectored == 0)
+        return E_NOTIMPL;
+
+    start = xtime_usec();
+    result = trace->transport->execute_vectored(device, trace->context,
+        cdb, cdb_size, iov, iov_count);
+
+    error = write_record(trace, device, cdb, cdb_size, iov, iov_count,
+        result, (uint32_t)(xtime_usec() - start));
+
+    return SUCCEEDED(error) ? result : error;
+}
+
+static RESULT record_execute(const optcl_device *device,
+                             ptr_t context,
+                             const uint8_t cdb[],
+                             uint32_t cdb_size,
+                             uint8_t param[],
+                             uint32_t param_size)
+{
+    RESULT error;
+    RESULT result;
+    uint64_t start;
+    optcl_iovec iov;
+    optcl_trace *trace;
+
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    if (trace->transport->execute == 0)
+        return E_NOTIMPL;
+
+    start = xtime_usec();
+    result = trace->transport->execute(device, trace->context,
+        cdb, cdb_size, param, param_size);
+
+    iov.base = param;
+    iov.len = (param != 0) ? param_size : 0;
+    error = write_record(trace, device, cdb, cdb_size, &iov, 1, result,
+        (uint32_t)(xtime_usec() - start));
+
+    return SUCCEEDED(error) ? result : error;
+}
+
+static RESULT record_submit(const optcl_device *device,
+                            ptr_t context,
+                            const uint8_t cdb[],
+                            uint32_t cdb_size,
+                            uint8_t param[],
+                            uint32_t param_size,
+                            uint32_t tag)
+{
+    RESULT error;
+    optcl_trace *trace;
+    optcl_trace_pending *pending;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    if (device == 0 || context == 0 || cdb == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    if (trace->transport->submit == 0)
+        return E_NOTIMPL;
+
+    /* Data is only known once the command completes */
+    error = add_pending(trace, cdb, cdb_size, param, param_size, tag,
+        &pending);
+    if (FAILED(error))
+        return error;
+
+    error = trace->transport->submit(device, trace->context, cdb,
+        cdb_size, param, param_size, tag);
+    if (FAILED(error))
+        pending->busy = False;
+
+    return error;
+}
+
+static RESULT record_complete(const optcl_device *device,
+                              ptr_t context,
+                              uint32_t *tag,
+                              RESULT *status)
+{
+    RESULT error;
+    uint32_t i;
+    optcl_iovec iov;
+    optcl_trace *trace;
+    optcl_trace_pending *pending;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(tag != 0);
+    assert(status != 0);
+    if (device == 0 || context == 0 || tag == 0 || status == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    if (trace->transport->complete == 0)
+        return E_NOTIMPL;
+
+    clear_progress(device);
+    error = trace->transport->complete(device, trace->context, tag, status);
+    if (FAILED(error))
+        return error;
+
+    for (i = 0; i < TRACE_MAX_PENDING; ++i) {
+        pending = &trace->pending[i];
+        if (pending->busy == True && pending->tag == *tag)
+            break;
+    }
+
+    if (i == TRACE_MAX_PENDING)
+        return SUCCESS;
+
+    pending->busy = False;
+
+    iov.base = pending->param;
+    iov.len = pending->param_size;
+    return write_record(trace, device, pending->cdb, pending->cdb_size,
+        &iov, 1, *status, (uint32_t)(xtime_usec() - pending->start));
+}
+
+static RESULT record_poll(const optcl_device *device,
+                          ptr_t context,
+                          int32_t timeout,
+                          bool_t *ready)
+{
+    optcl_trace *trace;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(ready != 0);
+    if (device == 0 || context == 0 || ready == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    return (trace->transport->poll != 0)
+        ? trace->transport->poll(device, trace->context, timeout, ready)
+        : E_NOTIMPL;
+}
+
+static RESULT record_execute_mapped(const optcl_device *device,
+                                    ptr_t context,
+                                    const uint8_t cdb[],
+                                    uint32_t cdb_size,
+                                    uint32_t transfer_size,
+                                    const uint8_t **view)
+{
+    RESULT error;
+    RESULT result;
+    uint64_t start;
+    optcl_iovec iov;
+    optcl_trace *trace;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(view != 0);
+    if (device == 0 || context == 0 || view == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    if (trace->transport->execute_mapped == 0)
+        return E_NOTIMPL;
+
+    clear_progress(device);
+    start = xtime_usec();
+    result = trace->transport->execute_mapped(device, trace->context,
+        cdb, cdb_size, transfer_size, view);
+
+    /* Failed data-in commands record no payload, the view is not read */
+    iov.base = SUCCEEDED(result) ? (ptr_t)*view : 0;
+    iov.len = transfer_size;
+    error = write_record(trace, device, cdb, cdb_size, &iov, 1, result,
+        (uint32_t)(xtime_usec() - start));
+
+    return SUCCEEDED(error) ? result : error;
+}
+
+static RESULT record_query_limits(const optcl_device *device,
+                                  ptr_t context,
+                                  optcl_transfer_limits *limits)
+{
+    assert(device != 0);
+    assert(context != 0);
+    assert(limits != 0);
+    if (device == 0 || context == 0 || limits == 0)
+        return E_INVALIDARG;
+
+    memcpy(limits, &((optcl_trace*)context)->limits,
+        sizeof(optcl_transfer_limits));
+
+    return SUCCESS;
+}
+
+static const optcl_transport __record_transport = {
+    "trace-record",
+    record_open,
+    record_close,
+    record_execute,
+    record_execute_vectored,
+    record_submit,
+    record_complete,
+    record_poll,
+    record_query_limits,
+    record_execute_mapped
+};
+
+
+/*
+ * Replay transport
+ */
+
+static RESULT replay_open(optcl_device *device, ptr_t context)
+{
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    return SUCCESS;
+}
+
+static RESULT replay_execute_vectored(const optcl_device *device,
+                                      ptr_t context,
+                                      const uint8_t cdb[],
+                                      uint32_t cdb_size,
+                                      const optcl_iovec iov[],
+                                      uint32_t iov_count)
+{
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    if (device == 0 || context == 0 || cdb == 0)
+        return E_INVALIDARG;
+
+    return replay_record((optcl_trace*)context, device, cdb, cdb_size,
+        iov, iov_count);
+}
+
+static RESULT replay_execute(const optcl_device *device,
+                             ptr_t context,
+                             const uint8_t cdb[],
+                             uint32_t cdb_size,
+                             uint8_t param[],
+                             uint32_t param_size)
+{
+    optcl_iovec iov;
+
+    iov.base = param;
+    iov.len = (param != 0) ? param_size : 0;
+
+    return replay_execute_vectored(device, context, cdb, cdb_size, &iov, 1);
+}
+
+static RESULT replay_close(optcl_device *device, ptr_t context)
+{
+    assert(device != 0);
+    assert(context != 0);
+    if (device == 0 || context == 0)
+        return E_INVALIDARG;
+
+    memset(((optcl_trace*)context)->pending, 0, 
+        sizeof(((optcl_trace*)context)->pending));
+
+    return SUCCESS;
+}
+
+static RESULT replay_submit(const optcl_device *device,
+                            ptr_t context,
+                            const uint8_t cdb[],
+                            uint32_t cdb_size,
+                            uint8_t param[],
+                            uint32_t param_size,
+                            uint32_t tag)
+{
+    optcl_trace_pending *pending;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    if (device == 0 || context == 0 || cdb == 0)
+        return E_INVALIDARG;
+
+    return add_pending((optcl_trace*)context, cdb, cdb_size, param,
+        param_size, tag, &pending);
+}
+
+static RESULT replay_complete(const optcl_device *device,
+                              ptr_t context,
+                              uint32_t *tag,
+                              RESULT *status)
+{
+    long position;
+    uint32_t i;
+    optcl_iovec iov;
+    optcl_trace *trace;
+    optcl_trace_pending *pending;
+    uint8_t header[TRACE_RECORD_SIZE];
+    uint8_t recorded_cdb[TRACE_MAX_CDB_SIZE];
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(tag != 0);
+    assert(status != 0);
+    if (device == 0 || context == 0 || tag == 0 || status == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+    if (get_pending_count(trace) == 0)
+        return E_DEVNOMOREITEMS;
+
+    /* Commands complete in the recorded order, find the next one */
+    position = ftell(trace->file);
+    if (position < 0)
+        return E_TRACEINVFORMAT;
+
+    if (fread(header, 1, sizeof(header), trace->file) != sizeof(header))
+        return E_TRACEEND;
+
+    if (header[0] > TRACE_MAX_CDB_SIZE
+        || fread(recorded_cdb, 1, header[0], trace->file) != header[0]
+        || fseek(trace->file, position, SEEK_SET) != 0)
+        return E_TRACEINVFORMAT;
+
+    for (i = 0; i < TRACE_MAX_PENDING; ++i) {
+        pending = &trace->pending[i];
+        if (pending->busy == True && pending->cdb_size == header[0]
+            && memcmp(pending->cdb, recorded_cdb, header[0]) == 0)
+            break;
+    }
+
+    if (i == TRACE_MAX_PENDING)
+        return E_TRACEMISMATCH;
+
+    pending->busy = False;
+    *tag = pending->tag;
+
+    iov.base = pending->param;
+    iov.len = pending->param_size;
+    *status = replay_record(trace, device, pending->cdb, pending->cdb_size,
+        &iov, 1);
+
+    return (ERROR_FACILITY(*status) == FACILITY_TRACE) ? *status : SUCCESS;
+}
+
+static RESULT replay_poll(const optcl_device *device,
+                          ptr_t context,
+                          int32_t timeout,
+                          bool_t *ready)
+{
+    assert(device != 0);
+    assert(context != 0);
+    assert(ready != 0);
+    if (device == 0 || context == 0 || ready == 0)
+        return E_INVALIDARG;
+
+    /* Replayed commands complete as soon as they are asked for */
+    *ready = bool_from_uint8(get_pending_count((optcl_trace*)context) > 0);
+    return SUCCESS;
+}
+
+static RESULT replay_execute_mapped(const optcl_device *device,
+                                    ptr_t context,
+                                    const uint8_t cdb[],
+                                    uint32_t cdb_size,
+                                    uint32_t transfer_size,
+                                    const uint8_t **view)
+{
+    RESULT result;
+    optcl_iovec iov;
+    optcl_trace *trace;
+
+    assert(device != 0);
+    assert(context != 0);
+    assert(cdb != 0);
+    assert(view != 0);
+    if (device == 0 || context == 0 || cdb == 0 || view == 0)
+        return E_INVALIDARG;
+
+    trace = (optcl_trace*)context;
+
+    /* The view stays valid until the next command, as on the drive */
+    if (trace->view_size < transfer_size) {
+        free(trace->view);
+        trace->view_size = 0;
+        trace->view = (uint8_t*)malloc(transfer_size);
+        if (trace->view == 0)
+            return E_OUTOFMEMORY;
+
+        trace->view_size = transfer_size;
+    }
+
+    iov.base = trace->view;
+    iov.len = transfer_size;
+    result = replay_record(trace, device, cdb, cdb_size, &iov, 1);
+    if (SUCCEEDED(result))
+        *view = trace->view;
+
+    return result;
+}
+
+static const optcl_transport __replay_transport = {
+    "trace-replay",
+    replay_open,
+    replay_close,
+    replay_execute,
+    replay_execute_vectored,
+    replay_submit,
+    replay_complete,
+    replay_poll,
+    record_query_limits,
+    replay_execute_mapped
+};
+
+
+/*
+ * Trace functions
+ */
+
+RESULT optcl_trace_record(optcl_device *device,
+                          const char *filename,
+                          uint32_t flags,
+                          optcl_trace **trace)
+{
+    RESULT error;
+    optcl_trace *ntrace = 0;
+    optcl_device_session *session = 0;
+    uint8_t header[TRACE_HEADER_SIZE];
+
+    assert(device != 0);
+    assert(filename != 0);
+    assert(trace != 0);
+    if (device == 0 || filename == 0 || trace == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    error = create_trace(device, filename, False, &ntrace);
+    if (FAILED(error))
+        return error;
+
+    ntrace->flags = flags;
+    ntrace->transport = ntrace->saved;
+    ntrace->context = ntrace->saved_context;
+    if (ntrace->transport == 0)
+        error = optcl_device_get_system_transport(&ntrace->transport);
+
+    if (SUCCEEDED(error))
+        error = optcl_device_get_transfer_limits(device, &ntrace->limits);
+
+    if (FAILED(error)) {
+        destroy_trace(ntrace);
+        return error;
+    }
+
+    /* Replays split transfers the same way when limits match */
+    memcpy(header, TRACE_MAGIC, 8);
+    put_le32(&header[8], TRACE_VERSION);
+    put_le32(&header[12], flags);
+    put_le32(&header[16], ntrace->limits.alignment_mask);
+    put_le32(&header[20], ntrace->limits.max_transfer_len);
+    put_le32(&header[24], ntrace->limits.max_physical_pages);
+    if (fwrite(header, 1, sizeof(header), ntrace->file) != sizeof(header)) {
+        destroy_trace(ntrace);
+        return E_UNEXPECTED;
+    }
+
+    error = optcl_device_set_transport(device, &__record_transport,
+        (ptr_t)ntrace);
+    if (FAILED(error)) {
+        destroy_trace(ntrace);
+        return error;
+    }
+
+    /* Block device reads bypass the transport and would be lost */
+    session->block_reads = False;
+
+    *trace = ntrace;
+    return SUCCESS;
+}
+
+RESULT optcl_trace_replay(optcl_device *device,
+                          const char *filename,
+                          uint32_t time_scale,
+                          optcl_trace **trace)
+{
+    RESULT error;
+    optcl_trace *ntrace = 0;
+    uint8_t header[TRACE_HEADER_SIZE];
+
+    assert(device != 0);
+    assert(filename != 0);
+    assert(trace != 0);
+    if (device == 0 || filename == 0 || trace == 0)
+        return E_INVALIDARG;
+
+    error = create_trace(device, filename, True, &ntrace);
+    if (FAILED(error))
+        return error;
+
+    if (fread(header, 1, sizeof(header), ntrace->file) != sizeof(header)
+        || memcmp(header, TRACE_MAGIC, 8) != 0
+        || get_le32(&header[8]) != TRACE_VERSION) {
+        destroy_trace(ntrace);
+        return E_TRACEINVFORMAT;
+    }
+
+    ntrace->flags = get_le32(&header[12]);
+    ntrace->time_scale = time_scale;
+    ntrace->limits.alignment_mask = get_le32(&header[16]);
+    ntrace->limits.max_transfer_len = get_le32(&header[20]);
+    ntrace->limits.max_physical_pages = get_le32(&header[24]);
+
+    error = optcl_device_set_transport(device, &__replay_transport,
+        (ptr_t)ntrace);
+    if (FAILED(error)) {
+        destroy_trace(ntrace);
+        return error;
+    }
+
+    *trace = ntrace;
+    return SUCCESS;
+}
+
+RESULT optcl_trace_stop(optcl_device *device, optcl_trace *trace)
+{
+    RESULT error;
+
+    assert(device != 0);
+    assert(trace != 0);
+    if (device == 0 || trace == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_close(device);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_set_transport(device, trace->saved,
+        trace->saved_context);
+
+    destroy_trace(trace);
+    return error;
+}
+
+RESULT optcl_trace_get_count(const optcl_trace *trace, uint32_t *count)
+{
+    assert(trace != 0);
+    assert(count != 0);
+    if (trace == 0 || count == 0)
+        return E_INVALIDARG;
+
+    *count = trace->count;
+    return SUCCESS;
+}
@@ -0,0 +1,101 @@
+/*
+    trace.h - Command trace recording and replay
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include "device.h"
+#include "errors.h"
+#include "types.h"
+
+
+/* Trace recording flags */
+#define TRACE_FLAG_DATA_OUT		0x01	/* Store data-out payloads, not only a hash */
+
+/*
+ * Replay time scale in percent of the recorded latencies, 100 keeps
+ * them, 200 doubles them and zero replays without any delay
+ */
+#define TRACE_TIME_ORIGINAL		100
+
+
+/* Command trace descriptor */
+struct tag_trace;
+typedef struct tag_trace optcl_trace;
+
+/*
+ * Trace errors
+ *
+ * E_TRACEINVFORMAT - file is not a trace, has an unsupported version
+ *                    or a truncated or corrupt record
+ * E_TRACEMISMATCH  - replayed command differs from the recorded one
+ *                    in its CDB, transfer size or data-out payload
+ * E_TRACEEND       - replayed command comes after the last record
+ */
+
+/*
+ * Start recording commands executed on the device
+ *
+ * The trace wraps the transport bound to the device, which must be
+ * closed and is opened by the caller afterwards. Every command is
+ * written with its CDB, result, sense data, latency, data-in payload
+ * and data-out payload or hash. Submitted commands are written when
+ * they complete and mapped reads with the data of the view. Block
+ * device reads are turned off while recording so that all reads are
+ * captured. Flags are TRACE_FLAG_* values.
+ */
+extern 
+RESULT optcl_trace_record(optcl_device *device,
+                          const char *filename,
+                          uint32_t flags,
+                          optcl_trace **trace);
+
+/*
+ * Bind device to a replay of a recorded trace
+ *
+ * The device must be closed and needs no drive, it is opened by the
+ * caller afterwards. Commands must come in the recorded order and get
+ * the recorded results, data and sense progress in the session.
+ * Submitted commands complete in the recorded completion order. Time
+ * scale is in percent of the recorded latency, see TRACE_TIME_ORIGINAL.
+ * Fails with E_TRACEINVFORMAT when the file is not a trace, commands
+ * fail with the E_TRACE* codes above.
+ */
+extern 
+RESULT optcl_trace_replay(optcl_device *device,
+                          const char *filename,
+                          uint32_t time_scale,
+                          optcl_trace **trace);
+
+/*
+ * Stop recording or replay, restore device transport and destroy trace
+ *
+ * Closes the device first. Commands still submitted when the device
+ * is closed are not recorded.
+ */
+extern 
+RESULT optcl_trace_stop(optcl_device *device, optcl_trace *trace);
+
+/* Get number of commands recorded or replayed so far */
+extern 
+RESULT optcl_trace_get_count(const optcl_trace *trace, uint32_t *count);
+
+#endif /* _TRACE_H */
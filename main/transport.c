@@ -0,0 +1,488 @@
+/*
+    transport.c - Device command transport layer
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+    
+    $Id$
+*/
+
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "retry.h"
+#include "sysdevice.h"
+#include "transport.h"
+#include "types.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+#define MAX_REGISTERED_TRANSPORTS	16
+
+
+/*
+ * Registered transports
+ */
+
+static const optcl_transport* __transports[MAX_REGISTERED_TRANSPORTS];
+
+
+/*
+ * Helper functions
+ */
+
+static RESULT get_device_transport(const optcl_device *device,
+                                   const optcl_transport **transport,
+                                   ptr_t *context)
+{
+    RESULT error;
+
+    assert(device != 0);
+    assert(transport != 0);
+    assert(context != 0);
+    if (device == 0 || transport == 0 || context == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_transport(device, transport, context);
+    if (FAILED(error))
+        return error;
+
+    if (*transport == 0) {
+        *context = 0;
+        return optcl_device_get_system_transport(transport);
+    }
+
+    return SUCCESS;
+}
+
+/* Execute command and retry it while it fails with a retryable sense */
+static RESULT execute_with_retries(const optcl_device *device,
+                                   const optcl_transport *transport,
+                                   ptr_t context,
+                                   const uint8_t cdb[],
+                                   uint32_t cdb_size,
+                                   uint8_t param[],
+                                   uint32_t param_size,
+                                   bool_t vectored,
+                                   const optcl_iovec iov[],
+                                   uint32_t iov_count)
+{
+    RESULT error;
+    RESULT result;
+    uint32_t delay;
+    uint64_t waited = 0;
+    uint16_t progress = 0;
+    uint16_t retry_class;
+    bool_t retried = False;
+    bool_t has_progress = False;
+    optcl_retry_policy policy;
+    optcl_device_session *session = 0;
+    uint32_t attempts[RETRY_CLASS_COUNT];
+
+    assert(device != 0);
+    assert(transport != 0);
+
+    error = optcl_device_get_retry_policy(device, &policy);
+    if (FAILED(error))
+        return error;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    memset(attempts, 0, sizeof(attempts));
+
+    for (;;) {
+        session->progress_valid = False;
+        result = (vectored == True)
+            ? transport->execute_vectored(device, context, cdb, cdb_size, 
+                iov, iov_count)
+            : transport->execute(device, context, cdb, cdb_size, 
+                param, param_size);
+
+        error = optcl_retry_classify(result, &retry_class);
+        if (FAILED(error) || retry_class == RETRY_CLASS_NONE)
+            break;
+
+        if (attempts[retry_class] >= policy.max_retries[retry_class])
+            break;
+
+        error = optcl_retry_get_delay(&policy, retry_class, 
+            attempts[retry_class], &delay);
+        if (FAILED(error) || waited + delay > policy.max_wait)
+            break;
+
+        /* A drive reporting progress is still busy, not stuck */
+        if (session->progress_valid == True
+            && (has_progress == False || session->progress > progress)) {
+            progress = session->progress;
+            has_progress = True;
+        } else {
+            ++attempts[retry_class];
+        }
+
+        if (delay > 0)
+            xsleep_usec(delay);
+
+        waited += delay;
+        retried = True;
+        ++session->retries.retries[retry_class];
+    }
+
+    if (retried == True) {
+        ++session->retries.retried;
+        if (SUCCEEDED(result))
+            ++session->retries.recovered;
+        else
+            ++session->retries.exhausted;
+
+        session->retries.wait += waited;
+    }
+
+    return result;
+}
+
+
+/*
+ * Transport registration functions
+ */
+
+RESULT optcl_transport_register(const optcl_transport *transport)
+{
+    int i;
+    int slot = -1;
+
+    assert(transport != 0);
+    assert(transport->name != 0);
+    if (transport == 0 || transport->name == 0)
+        return E_INVALIDARG;
+
+    for (i = 0; i < MAX_REGISTERED_TRANSPORTS; ++i) {
+        if (__transports[i] == transport)
+            return SUCCESS;
+
+        if (__transports[i] == 0 && slot < 0)
+            slot = i;
+    }
+
+    if (slot < 0)
+        return E_OVERFLOW;
+
+    __transports[slot] = transport;
+    return SUCCESS;
+}
+
+RESULT optcl_transport_unregister(const optcl_transport *transport)
+{
+    int i;
+
+    assert(transport != 0);
+    if (transport == 0)
+        return E_INVALIDARG;
+
+    for (i = 0; i < MAX_REGISTERED_TRANSPORTS; ++i) {
+        if (__transports[i] == transport) {
+            __transports[i] = 0;
+            return SUCCESS;
+        }
+    }
+
+    return E_INVALIDARG;
+}
+
+RESULT optcl_transport_find(const char *name, 
+                            const optcl_transport **transport)
+{
+    int i;
+    RESULT error;
+    const optcl_transport *system_transport = 0;
+
+    assert(name != 0);
+    assert(transport != 0);
+    if (name == 0 || transport == 0)
+        return E_INVALIDARG;
+
+    for (i = 0; i < MAX_REGISTERED_TRANSPORTS; ++i) {
+        if (__transports[i] != 0 && strcmp(__transports[i]->name, name) == 0) {
+            *transport = __transports[i];
+            return SUCCESS;
+        }
+    }
+
+    error = optcl_device_get_system_transport(&system_transport);
+    if (FAILED(error))
+        return error;
+
+    if (system_transport != 0 && strcmp(system_transport->name, name) == 0) {
+        *transport = system_transport;
+        return SUCCESS;
+    }
+
+    return E_DEVNOMOREITEMS;
+}
+
+
+/*
+ * Dispatch functions
+ */
+
+RESULT optcl_device_open(optcl_device *device)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->is_open == True)
+        return SUCCESS;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->open == 0)
+        return E_NOTIMPL;
+
+    error = transport->open(device, context);
+    if (FAILED(error))
+        return error;
+
+    /* Transports without a system handle still have a session */
+    if (session->is_open == False) {
+        session->is_open = True;
+        ++session->opens;
+    }
+
+    return SUCCESS;
+}
+
+RESULT optcl_device_close(optcl_device *device)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    if (session->is_open == False)
+        return SUCCESS;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    error = (transport->close != 0) 
+        ? transport->close(device, context) : SUCCESS;
+
+    session->is_open = False;
+    return error;
+}
+
+RESULT optcl_device_command_execute(const optcl_device *device,
+                                    const uint8_t cdb[],
+                                    uint32_t cdb_size,
+                                    uint8_t param[],
+                                    uint32_t param_size)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->execute == 0)
+        return E_NOTIMPL;
+
+    return execute_with_retries(device, transport, context, cdb, cdb_size, 
+        param, param_size, False, 0, 0);
+}
+
+RESULT optcl_device_command_execute_once(const optcl_device *device,
+                                         const uint8_t cdb[],
+                                         uint32_t cdb_size,
+                                         uint8_t param[],
+                                         uint32_t param_size)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+    optcl_device_session *session = 0;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->execute == 0)
+        return E_NOTIMPL;
+
+    error = optcl_device_get_session(device, &session);
+    if (FAILED(error))
+        return error;
+
+    session->progress_valid = False;
+    return transport->execute(device, context, cdb, cdb_size, 
+        param, param_size);
+}
+
+RESULT optcl_device_command_execute_vectored(const optcl_device *device,
+                                             const uint8_t cdb[],
+                                             uint32_t cdb_size,
+                                             const optcl_iovec iov[],
+                                             uint32_t iov_count)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->execute_vectored == 0)
+        return E_NOTIMPL;
+
+    return execute_with_retries(device, transport, context, cdb, cdb_size, 
+        0, 0, True, iov, iov_count);
+}
+
+RESULT optcl_device_command_execute_mapped(const optcl_device *device,
+                                           const uint8_t cdb[],
+                                           uint32_t cdb_size,
+                                           uint32_t transfer_size,
+                                           const uint8_t **view)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->execute_mapped == 0)
+        return E_NOTIMPL;
+
+    return transport->execute_mapped(device, context, cdb, cdb_size, 
+        transfer_size, view);
+}
+
+RESULT optcl_device_command_submit(const optcl_device *device,
+                                   const uint8_t cdb[],
+                                   uint32_t cdb_size,
+                                   uint8_t param[],
+                                   uint32_t param_size,
+                                   uint32_t tag)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->submit == 0)
+        return E_NOTIMPL;
+
+    return transport->submit(device, context, cdb, cdb_size, 
+        param, param_size, tag);
+}
+
+RESULT optcl_device_command_complete(const optcl_device *device,
+                                     uint32_t *tag,
+                                     RESULT *status)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->complete == 0)
+        return E_NOTIMPL;
+
+    return transport->complete(device, context, tag, status);
+}
+
+RESULT optcl_device_command_poll(const optcl_device *device,
+                                 int32_t timeout,
+                                 bool_t *ready)
+{
+    RESULT error;
+    ptr_t context;
+    const optcl_transport *transport;
+
+    assert(device != 0);
+    if (device == 0)
+        return E_INVALIDARG;
+
+    error = get_device_transport(device, &transport, &context);
+    if (FAILED(error))
+        return error;
+
+    if (transport->poll == 0)
+        return E_NOTIMPL;
+
+    return transport->poll(device, context, timeout, ready);
+}
@@ -1,5 +1,5 @@
 /*
-    transport.h - Transport layer for Windows
+    transport.h - Device command transport layer
     Copyright (C) 2006  Aleksandar Dezelin <dezelin@gmail.com>
 
     This library is free software; you can redistribute it and/or
@@ -22,6 +22,153 @@
 #ifndef _TRANSPORT_H
 #define _TRANSPORT_H
 
+#include "device.h"
+#include "errors.h"
 #include "types.h"
 
+
+/*
+ * Transport interface
+ *
+ * A transport carries commands to a device. Every device dispatches
+ * through the transport bound to it, devices without one use the
+ * system transport of the platform. Operations a transport does not
+ * support are left zero and fail with E_NOTIMPL.
+ */
+typedef struct tag_transport {
+    const char *name;
+
+    RESULT (*open)(optcl_device *device, ptr_t context);
+
+    RESULT (*close)(optcl_device *device, ptr_t context);
+
+    RESULT (*execute)(const optcl_device *device,
+                      ptr_t context,
+                      const uint8_t cdb[],
+                      uint32_t cdb_size,
+                      uint8_t param[],
+                      uint32_t param_size);
+
+    RESULT (*execute_vectored)(const optcl_device *device,
+                               ptr_t context,
+                               const uint8_t cdb[],
+                               uint32_t cdb_size,
+                               const optcl_iovec iov[],
+                               uint32_t iov_count);
+
+    RESULT (*submit)(const optcl_device *device,
+                     ptr_t context,
+                     const uint8_t cdb[],
+                     uint32_t cdb_size,
+                     uint8_t param[],
+                     uint32_t param_size,
+                     uint32_t tag);
+
+    RESULT (*complete)(const optcl_device *device,
+                       ptr_t context,
+                       uint32_t *tag,
+                       RESULT *status);
+
+    RESULT (*poll)(const optcl_device *device,
+                   ptr_t context,
+                   int32_t timeout,
+                   bool_t *ready);
+
+    RESULT (*query_limits)(const optcl_device *device,
+                           ptr_t context,
+                           optcl_transfer_limits *limits);
+
+    RESULT (*execute_mapped)(const optcl_device *device,
+                             ptr_t context,
+                             const uint8_t cdb[],
+                             uint32_t cdb_size,
+                             uint32_t transfer_size,
+                             const uint8_t **view);
+} optcl_transport;
+
+
+/* Register transport so it can be found by name */
+extern 
+RESULT optcl_transport_register(const optcl_transport *transport);
+
+/* Unregister transport */
+extern 
+RESULT optcl_transport_unregister(const optcl_transport *transport);
+
+/* Find registered or system transport by name */
+extern 
+RESULT optcl_transport_find(const char *name, 
+                            const optcl_transport **transport);
+
+/* Open device session and keep the system handle until closed */
+extern 
+RESULT optcl_device_open(optcl_device *device);
+
+/* Close device session */
+extern 
+RESULT optcl_device_close(optcl_device *device);
+
+/* Execute SCSI command */
+extern 
+RESULT optcl_device_command_execute(const optcl_device *device,
+                                    const uint8_t cdb[],
+                                    uint32_t cdb_size,
+                                    uint8_t param[],
+                                    uint32_t param_size);
+
+/*
+ * Execute SCSI command once, failures are returned as the drive
+ * reported them without the retries of the device retry policy
+ */
+extern 
+RESULT optcl_device_command_execute_once(const optcl_device *device,
+                                         const uint8_t cdb[],
+                                         uint32_t cdb_size,
+                                         uint8_t param[],
+                                         uint32_t param_size);
+
+/* Execute SCSI command with data scattered over several buffers */
+extern 
+RESULT optcl_device_command_execute_vectored(const optcl_device *device,
+                                             const uint8_t cdb[],
+                                             uint32_t cdb_size,
+                                             const optcl_iovec iov[],
+                                             uint32_t iov_count);
+
+/* 
+ * Execute data in SCSI command and return a view of the data owned
+ * by the transport instead of copying it into a caller buffer
+ *
+ * The view is only valid until the next command on the device, sg
+ * moves the data of any command that fits its reserved buffer
+ * through the same mapping.
+ */
+extern 
+RESULT optcl_device_command_execute_mapped(const optcl_device *device,
+                                           const uint8_t cdb[],
+                                           uint32_t cdb_size,
+                                           uint32_t transfer_size,
+                                           const uint8_t **view);
+
+/* Submit SCSI command on an open device without waiting for it */
+extern 
+RESULT optcl_device_command_submit(const optcl_device *device,
+                                   const uint8_t cdb[],
+                                   uint32_t cdb_size,
+                                   uint8_t param[],
+                                   uint32_t param_size,
+                                   uint32_t tag);
+
+/* Wait for the next submitted command to complete */
+extern 
+RESULT optcl_device_command_complete(const optcl_device *device,
+                                     uint32_t *tag,
+                                     RESULT *status);
+
+/* Check if a submitted command has completed, waiting up to timeout ms */
+extern 
+RESULT optcl_device_command_poll(const optcl_device *device,
+                                 int32_t timeout,
+                                 bool_t *ready);
+
 #endif /* _TRANSPORT_H */
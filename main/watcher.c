@@ -0,0 +1,700 @@
+/*
+    watcher.c - Media change watcher
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "helpers.h"
+#include "list.h"
+#include "sensedata.h"
+#include "transport.h"
+#include "types.h"
+#include "watcher.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+/* Event header and the descriptor of one class */
+#define WATCHER_EVENT_LENGTH		8U
+
+/* Most queued events read in one poll */
+#define WATCHER_MAX_EVENTS		8
+
+/* Notification classes of event descriptors */
+#define WATCHER_CLASS_OPCHANGE		1
+#define WATCHER_CLASS_MEDIA		4
+#define WATCHER_CLASS_DEVICEBUSY	6
+
+
+/*
+ * MMC opcodes issued by the watcher
+ */
+
+#define MMC_OPCODE_GET_EVENT_STATUS		0x004A
+#define MMC_OPCODE_TEST_UNIT_READY		0x0000
+
+
+/*
+ * Internal structures
+ */
+
+struct watcher_subscriber {
+    uint8_t classes;
+    optcl_watcher_fn callback;
+    ptr_t context;
+};
+
+struct tag_watcher {
+    const optcl_device *device;
+    optcl_watcher_policy policy;
+    struct watcher_subscriber *subscribers;
+    uint32_t subscriber_count;
+    uint8_t classes;            /* Classes some subscriber wants */
+    bool_t use_tur;             /* Event status requests are not supported */
+    bool_t known;               /* Media and tray state were read */
+    bool_t media_present;
+    bool_t tray_open;
+    bool_t busy;
+    uint32_t interval;          /* Idle poll interval */
+    uint64_t next_poll;
+};
+
+
+/*
+ * Default polling policy
+ */
+
+static const optcl_watcher_policy __default_policy = {
+    200000,     /* 200 ms after the last event */
+    2000000,    /* 2 s when idle */
+    50000       /* 50 ms while the drive is busy */
+};
+
+
+/*
+ * Helper functions
+ */
+
+static uint32_t deliver_event(const optcl_watcher *watcher,
+                              uint16_t type,
+                              uint8_t event_class,
+                              uint8_t event_code,
+                              optcl_watcher_event *event)
+{
+    uint32_t i;
+    const struct watcher_subscriber *subscriber;
+
+    assert(watcher != 0);
+    assert(event != 0);
+
+    event->type = type;
+    event->event_class = event_class;
+    event->event_code = event_code;
+    event->media_present = watcher->media_present;
+    event->tray_open = watcher->tray_open;
+
+    for (i = 0; i < watcher->subscriber_count; ++i) {
+        subscriber = &watcher->subscribers[i];
+        if ((subscriber->classes & event_class) != 0)
+            subscriber->callback(watcher->device, event, subscriber->context);
+    }
+
+    return 1;
+}
+
+/* Deliver tray and media transitions, tray first */
+static uint32_t update_media_state(optcl_watcher *watcher,
+                                   bool_t media_present,
+                                   bool_t tray_open,
+                                   uint8_t event_code,
+                                   optcl_watcher_event *event)
+{
+    bool_t known;
+    uint32_t events = 0;
+    bool_t was_present;
+    bool_t was_open;
+
+    assert(watcher != 0);
+    assert(event != 0);
+
+    known = watcher->known;
+    was_present = watcher->media_present;
+    was_open = watcher->tray_open;
+
+    watcher->known = True;
+    watcher->media_present = media_present;
+    watcher->tray_open = tray_open;
+
+    /* The first state read is not a change */
+    if (known == False)
+        return 0;
+
+    if (tray_open != was_open) {
+        events += deliver_event(watcher,
+            (tray_open == True) ? WATCHER_EVENT_TRAY_OPENED : WATCHER_EVENT_TRAY_CLOSED,
+            MMC_GET_EVENT_STATUS_MEDIA, event_code, event);
+    }
+
+    if (media_present != was_present) {
+        events += deliver_event(watcher,
+            (media_present == True) ? WATCHER_EVENT_MEDIA_ARRIVED : WATCHER_EVENT_MEDIA_REMOVED,
+            MMC_GET_EVENT_STATUS_MEDIA, event_code, event);
+    } else if (media_present == True
+        && (event_code == EVENT_MEDIA_EC_NEWMEDIA || event_code == EVENT_MEDIA_EC_MEDIACHANGED))
+    {
+        events += deliver_event(watcher, WATCHER_EVENT_MEDIA_CHANGED,
+            MMC_GET_EVENT_STATUS_MEDIA, event_code, event);
+    }
+
+    return events;
+}
+
+static uint32_t handle_media_event(optcl_watcher *watcher,
+                                   const optcl_mmc_ges_media *media)
+{
+    uint32_t events = 0;
+    optcl_watcher_event event;
+
+    assert(watcher != 0);
+    assert(media != 0);
+
+    memset(&event, 0, sizeof(event));
+
+    switch (media->event_code) {
+    case EVENT_MEDIA_EC_EJECTREQUEST:
+        events += deliver_event(watcher, WATCHER_EVENT_EJECT_REQUEST,
+            MMC_GET_EVENT_STATUS_MEDIA, media->event_code, &event);
+        break;
+
+    case EVENT_MEDIA_EC_BGFORMATCOMPLETE:
+        events += deliver_event(watcher, WATCHER_EVENT_FORMAT_COMPLETED,
+            MMC_GET_EVENT_STATUS_MEDIA, media->event_code, &event);
+        break;
+
+    case EVENT_MEDIA_EC_BGFORMATRESTART:
+        events += deliver_event(watcher, WATCHER_EVENT_FORMAT_RESTARTED,
+            MMC_GET_EVENT_STATUS_MEDIA, media->event_code, &event);
+        break;
+
+    default:
+        break;
+    }
+
+    return events + update_media_state(watcher, media->media_present,
+        media->tray_open, media->event_code, &event);
+}
+
+static uint32_t handle_descriptor(optcl_watcher *watcher,
+                                  const optcl_mmc_ges_descriptor *descriptor)
+{
+    uint32_t events = 0;
+    optcl_watcher_event event;
+    const optcl_mmc_ges_device_busy *busy;
+    const optcl_mmc_ges_operational_change *opchange;
+
+    assert(watcher != 0);
+    assert(descriptor != 0);
+
+    memset(&event, 0, sizeof(event));
+
+    switch (descriptor->notification_class) {
+    case WATCHER_CLASS_OPCHANGE:
+        opchange = (const optcl_mmc_ges_operational_change*)descriptor;
+        if (opchange->event_code == EVENT_OC_EC_CHANGED) {
+            event.change = opchange->change;
+            events += deliver_event(watcher, WATCHER_EVENT_OPERATIONAL_CHANGE,
+                MMC_GET_EVENT_STATUS_OPCHANGE, opchange->event_code, &event);
+        }
+        break;
+
+    case WATCHER_CLASS_MEDIA:
+        events += handle_media_event(watcher, (const optcl_mmc_ges_media*)descriptor);
+        break;
+
+    case WATCHER_CLASS_DEVICEBUSY:
+        busy = (const optcl_mmc_ges_device_busy*)descriptor;
+        if (bool_from_uint8(busy->busy_status != EVENT_DB_DBS_NOTBUSY) != watcher->busy) {
+            watcher->busy = bool_from_uint8(busy->busy_status != EVENT_DB_DBS_NOTBUSY);
+            event.busy_time = busy->time;
+            events += deliver_event(watcher,
+                (watcher->busy == True) ? WATCHER_EVENT_DEVICE_BUSY : WATCHER_EVENT_DEVICE_READY,
+                MMC_GET_EVENT_STATUS_DEVICEBUSY, busy->event_code, &event);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return events;
+}
+
+/* Every class has its no change event code at zero */
+static uint8_t get_event_code(const optcl_mmc_ges_descriptor *descriptor)
+{
+    assert(descriptor != 0);
+
+    switch (descriptor->notification_class) {
+    case WATCHER_CLASS_OPCHANGE:
+        return ((const optcl_mmc_ges_operational_change*)descriptor)->event_code;
+
+    case WATCHER_CLASS_MEDIA:
+        return ((const optcl_mmc_ges_media*)descriptor)->event_code;
+
+    case WATCHER_CLASS_DEVICEBUSY:
+        return ((const optcl_mmc_ges_device_busy*)descriptor)->event_code;
+
+    default:
+        return 0;
+    }
+}
+
+/* Drives without event status support fail the request as illegal */
+static bool_t is_unsupported(RESULT error)
+{
+    return bool_from_uint8(ERROR_FACILITY(error) == FACILITY_SENSE
+        && ERROR_SENSE_SK(error) == SENSEDATA_SK_ILLEGAL_REQUEST);
+}
+
+static bool_t is_unit_attention(RESULT error)
+{
+    return bool_from_uint8(ERROR_FACILITY(error) == FACILITY_SENSE
+        && ERROR_SENSE_SK(error) == SENSEDATA_SK_UNIT_ATTENTION);
+}
+
+/*
+ * Watcher commands run once. The retry policy would swallow the unit
+ * attention of a changed medium and wait out a drive that is becoming
+ * ready, the watcher reads the sense as the drive reported it.
+ */
+static RESULT test_unit_ready(const optcl_watcher *watcher)
+{
+    uint8_t cdb[6];
+
+    assert(watcher != 0);
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = MMC_OPCODE_TEST_UNIT_READY;
+
+    return optcl_device_command_execute_once(watcher->device, cdb,
+        sizeof(cdb), 0, 0);
+}
+
+static RESULT get_event_status(const optcl_watcher *watcher,
+                               uint8_t classes,
+                               optcl_mmc_response_get_event_status **response)
+{
+    RESULT error;
+    uint8_t cdb[10];
+    uint8_t *data;
+    optcl_transfer_limits limits;
+
+    assert(watcher != 0);
+    assert(response != 0);
+
+    error = optcl_device_get_transfer_limits(watcher->device, &limits);
+    if (FAILED(error))
+        return error;
+
+    data = (uint8_t*)xmalloc_aligned(WATCHER_EVENT_LENGTH, limits.alignment_mask);
+    if (data == 0)
+        return E_OUTOFMEMORY;
+
+    memset(cdb, 0, sizeof(cdb));
+    cdb[0] = MMC_OPCODE_GET_EVENT_STATUS;
+    cdb[1] = 0x01;                      /* Polled */
+    cdb[4] = classes;
+    cdb[8] = WATCHER_EVENT_LENGTH;
+
+    /* A unit attention is reported once, the events are read after it */
+    error = optcl_device_command_execute_once(watcher->device, cdb,
+        sizeof(cdb), data, WATCHER_EVENT_LENGTH);
+    if (FAILED(error) && is_unit_attention(error) == True) {
+        error = optcl_device_command_execute_once(watcher->device, cdb,
+            sizeof(cdb), data, WATCHER_EVENT_LENGTH);
+    }
+
+    if (SUCCEEDED(error))
+        error = optcl_command_parse_event_status(data, WATCHER_EVENT_LENGTH, response);
+
+    xfree_aligned(data);
+    return error;
+}
+
+/* Request one event, the response tells if the drive had one queued */
+static RESULT request_event(optcl_watcher *watcher,
+                            uint8_t classes,
+                            uint32_t *events,
+                            bool_t *queued)
+{
+    RESULT error;
+    RESULT destroy_error;
+    optcl_list_iterator it = 0;
+    optcl_mmc_ges_descriptor *descriptor = 0;
+    optcl_mmc_response_get_event_status *response = 0;
+
+    assert(watcher != 0);
+    assert(events != 0);
+    assert(queued != 0);
+
+    *queued = False;
+
+    error = get_event_status(watcher, classes, &response);
+    if (FAILED(error))
+        return error;
+
+    assert(response != 0);
+    if (response == 0)
+        return E_POINTER;
+
+    if (response->ges_header.nea == True
+        || (response->event_class & MMC_GET_EVENT_STATUS_MEDIA) == 0)
+    {
+        /* Media events are what TEST UNIT READY can stand in for */
+        if ((classes & MMC_GET_EVENT_STATUS_MEDIA) != 0)
+            watcher->use_tur = True;
+    } else {
+        error = optcl_list_get_head_pos(response->descriptors, &it);
+        if (SUCCEEDED(error) && it != 0) {
+            error = optcl_list_get_at_pos(response->descriptors, it,
+                (const pptr_t)&descriptor);
+        }
+
+        if (SUCCEEDED(error) && descriptor != 0) {
+            *events += handle_descriptor(watcher, descriptor);
+            *queued = bool_from_uint8(get_event_code(descriptor));
+        }
+    }
+
+    destroy_error = optcl_command_destroy_response((optcl_mmc_response*)response);
+    return SUCCEEDED(destroy_error) ? error : destroy_error;
+}
+
+static RESULT poll_event_status(optcl_watcher *watcher, uint32_t *events)
+{
+    int i;
+    RESULT error;
+    bool_t queued = True;
+
+    assert(watcher != 0);
+    assert(events != 0);
+
+    /* Events are reported one at a time, highest priority class first */
+    for (i = 0; i < WATCHER_MAX_EVENTS && queued == True; ++i) {
+        error = request_event(watcher, watcher->classes, events, &queued);
+        if (FAILED(error))
+            return error;
+
+        if (watcher->use_tur == True)
+            return SUCCESS;
+    }
+
+    /*
+     * A request for several classes gets the no change event of the
+     * lowest class, the media state is read once on its own
+     */
+    if (watcher->known == False && (watcher->classes & MMC_GET_EVENT_STATUS_MEDIA) != 0
+        && watcher->classes != MMC_GET_EVENT_STATUS_MEDIA)
+    {
+        error = request_event(watcher, MMC_GET_EVENT_STATUS_MEDIA, events, &queued);
+        if (FAILED(error))
+            return error;
+    }
+
+    return SUCCESS;
+}
+
+static RESULT poll_test_unit_ready(optcl_watcher *watcher, uint32_t *events)
+{
+    RESULT error;
+    bool_t known;
+    bool_t changed;
+    bool_t present;
+    bool_t tray_open;
+    uint32_t changes;
+    optcl_watcher_event event;
+
+    assert(watcher != 0);
+    assert(events != 0);
+
+    /*
+     * A medium swapped between two polls shows up as a unit attention,
+     * which is reported once, the state is read with a second command
+     */
+    changed = False;
+    error = test_unit_ready(watcher);
+    if (FAILED(error) && is_unit_attention(error) == True) {
+        changed = bool_from_uint8(ERROR_SENSE_ASC(error) == 0x28);
+        error = test_unit_ready(watcher);
+    }
+
+    present = True;
+    tray_open = False;
+
+    if (FAILED(error)) {
+        if (ERROR_FACILITY(error) != FACILITY_SENSE)
+            return error;
+
+        switch (ERROR_SENSE_SK(error)) {
+        case SENSEDATA_SK_NOT_READY:
+            /* Medium not present, the qualifier tells if the tray is open */
+            if (ERROR_SENSE_ASC(error) == 0x3A) {
+                present = False;
+                tray_open = bool_from_uint8(ERROR_SENSE_ASCQ(error) == 0x02);
+            } else if (ERROR_SENSE_ASC(error) != 0x04) {
+                return error;
+            }
+
+            /* Becoming ready, the medium is there */
+            break;
+
+        case SENSEDATA_SK_UNIT_ATTENTION:
+            break;
+
+        default:
+            return error;
+        }
+    }
+
+    memset(&event, 0, sizeof(event));
+    known = watcher->known;
+    changes = update_media_state(watcher, present, tray_open,
+        EVENT_MEDIA_EC_NOCHG, &event);
+
+    if (changed == True && present == True && changes == 0 && known == True) {
+        changes += deliver_event(watcher, WATCHER_EVENT_MEDIA_CHANGED,
+            MMC_GET_EVENT_STATUS_MEDIA, EVENT_MEDIA_EC_NOCHG, &event);
+    }
+
+    *events += changes;
+
+    return SUCCESS;
+}
+
+static void update_classes(optcl_watcher *watcher)
+{
+    uint32_t i;
+
+    assert(watcher != 0);
+
+    watcher->classes = 0;
+    for (i = 0; i < watcher->subscriber_count; ++i)
+        watcher->classes |= watcher->subscribers[i].classes;
+}
+
+
+/*
+ * Watcher functions
+ */
+
+RESULT optcl_watcher_get_default_policy(optcl_watcher_policy *policy)
+{
+    assert(policy != 0);
+    if (policy == 0)
+        return E_INVALIDARG;
+
+    memcpy(policy, &__default_policy, sizeof(optcl_watcher_policy));
+    return SUCCESS;
+}
+
+RESULT optcl_watcher_create(const optcl_device *device,
+                            const optcl_watcher_policy *policy,
+                            optcl_watcher **watcher)
+{
+    optcl_watcher *nwatcher;
+
+    assert(device != 0);
+    assert(watcher != 0);
+    if (device == 0 || watcher == 0)
+        return E_INVALIDARG;
+
+    assert(policy == 0 || policy->min_interval <= policy->max_interval);
+    if (policy != 0 && policy->min_interval > policy->max_interval)
+        return E_INVALIDARG;
+
+    nwatcher = (optcl_watcher*)malloc(sizeof(optcl_watcher));
+    if (nwatcher == 0)
+        return E_OUTOFMEMORY;
+
+    memset(nwatcher, 0, sizeof(optcl_watcher));
+    nwatcher->device = device;
+
+    if (policy != 0)
+        memcpy(&nwatcher->policy, policy, sizeof(optcl_watcher_policy));
+    else
+        memcpy(&nwatcher->policy, &__default_policy, sizeof(optcl_watcher_policy));
+
+    nwatcher->interval = nwatcher->policy.min_interval;
+
+    *watcher = nwatcher;
+    return SUCCESS;
+}
+
+RESULT optcl_watcher_destroy(optcl_watcher *watcher)
+{
+    assert(watcher != 0);
+    if (watcher == 0)
+        return E_INVALIDARG;
+
+    free(watcher->subscribers);
+    free(watcher);
+    return SUCCESS;
+}
+
+RESULT optcl_watcher_subscribe(optcl_watcher *watcher,
+                               uint8_t classes,
+                               optcl_watcher_fn callback,
+                               ptr_t context)
+{
+    struct watcher_subscriber *nsubscribers;
+
+    assert(watcher != 0);
+    assert(callback != 0);
+    assert(classes != 0);
+    if (watcher == 0 || callback == 0 || classes == 0)
+        return E_INVALIDARG;
+
+    nsubscribers = (struct watcher_subscriber*)realloc(watcher->subscribers,
+        (watcher->subscriber_count + 1) * sizeof(struct watcher_subscriber));
+    if (nsubscribers == 0)
+        return E_OUTOFMEMORY;
+
+    nsubscribers[watcher->subscriber_count].classes = classes;
+    nsubscribers[watcher->subscriber_count].callback = callback;
+    nsubscribers[watcher->subscriber_count].context = context;
+    watcher->subscribers = nsubscribers;
+    ++watcher->subscriber_count;
+
+    /* Newly wanted classes are requested at the next poll */
+    if ((watcher->classes | classes) != watcher->classes)
+        watcher->next_poll = 0;
+
+    update_classes(watcher);
+    return SUCCESS;
+}
+
+RESULT optcl_watcher_unsubscribe(optcl_watcher *watcher,
+                                 optcl_watcher_fn callback,
+                                 ptr_t context)
+{
+    uint32_t i;
+
+    assert(watcher != 0);
+    assert(callback != 0);
+    if (watcher == 0 || callback == 0)
+        return E_INVALIDARG;
+
+    for (i = 0; i < watcher->subscriber_count; ++i) {
+        if (watcher->subscribers[i].callback == callback
+            && watcher->subscribers[i].context == context)
+            break;
+    }
+
+    if (i == watcher->subscriber_count)
+        return E_INVALIDARG;
+
+    memmove(&watcher->subscribers[i], &watcher->subscribers[i + 1],
+        (watcher->subscriber_count - i - 1) * sizeof(struct watcher_subscriber));
+    --watcher->subscriber_count;
+
+    update_classes(watcher);
+    return SUCCESS;
+}
+
+RESULT optcl_watcher_poll(optcl_watcher *watcher, uint64_t now, uint64_t *next)
+{
+    RESULT error;
+    uint32_t interval;
+    uint32_t events = 0;
+
+    assert(watcher != 0);
+    assert(next != 0);
+    if (watcher == 0 || next == 0)
+        return E_INVALIDARG;
+
+    if (now < watcher->next_poll) {
+        *next = watcher->next_poll;
+        return SUCCESS;
+    }
+
+    /* Nobody listens, the drive is left alone */
+    if (watcher->classes == 0) {
+        watcher->next_poll = now + watcher->policy.max_interval;
+        *next = watcher->next_poll;
+        return SUCCESS;
+    }
+
+    error = SUCCESS;
+
+    if (watcher->use_tur == False) {
+        error = poll_event_status(watcher, &events);
+        if (FAILED(error) && is_unsupported(error) == True) {
+            watcher->use_tur = True;
+            error = SUCCESS;
+        }
+    }
+
+    if (SUCCEEDED(error) && watcher->use_tur == True
+        && (watcher->classes & MMC_GET_EVENT_STATUS_MEDIA) != 0)
+        error = poll_test_unit_ready(watcher, &events);
+
+    /* Back off when idle, follow closely while things happen */
+    if (events > 0 || watcher->busy == True) {
+        interval = watcher->policy.active_interval;
+        watcher->interval = watcher->policy.min_interval;
+    } else if (watcher->tray_open == True) {
+        interval = watcher->policy.min_interval;
+        watcher->interval = watcher->policy.min_interval;
+    } else {
+        interval = watcher->interval;
+        watcher->interval = (watcher->interval < watcher->policy.max_interval / 2)
+            ? watcher->interval * 2 : watcher->policy.max_interval;
+    }
+
+    /* A drive that failed the poll is tried again at the idle rate */
+    if (FAILED(error))
+        interval = watcher->policy.max_interval;
+
+    watcher->next_poll = now + interval;
+    *next = watcher->next_poll;
+    return error;
+}
+
+RESULT optcl_watcher_get_state(const optcl_watcher *watcher,
+                               bool_t *media_present,
+                               bool_t *tray_open)
+{
+    assert(watcher != 0);
+    assert(media_present != 0);
+    assert(tray_open != 0);
+    if (watcher == 0 || media_present == 0 || tray_open == 0)
+        return E_INVALIDARG;
+
+    *media_present = watcher->media_present;
+    *tray_open = watcher->tray_open;
+    return SUCCESS;
+}
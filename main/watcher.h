@@ -0,0 +1,148 @@
+/*
+    watcher.h - Media change watcher
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _WATCHER_H
+#define _WATCHER_H
+
+#include "command.h"
+#include "device.h"
+#include "errors.h"
+#include "types.h"
+
+
+/* Watcher event types */
+#define WATCHER_EVENT_MEDIA_ARRIVED	1	/* Medium became present */
+#define WATCHER_EVENT_MEDIA_REMOVED	2	/* Medium went away */
+#define WATCHER_EVENT_MEDIA_CHANGED	3	/* Medium swapped between two polls */
+#define WATCHER_EVENT_EJECT_REQUEST	4	/* Eject button pressed */
+#define WATCHER_EVENT_TRAY_OPENED	5
+#define WATCHER_EVENT_TRAY_CLOSED	6
+#define WATCHER_EVENT_FORMAT_COMPLETED	7	/* Background format completed */
+#define WATCHER_EVENT_FORMAT_RESTARTED	8	/* Background format restarted */
+#define WATCHER_EVENT_OPERATIONAL_CHANGE	9	/* Drive feature set or state changed */
+#define WATCHER_EVENT_DEVICE_BUSY	10	/* Drive started a long operation */
+#define WATCHER_EVENT_DEVICE_READY	11	/* Drive finished a long operation */
+
+/* Event classes watched, MMC_GET_EVENT_STATUS_* bits */
+#define WATCHER_CLASSES_DEFAULT		(MMC_GET_EVENT_STATUS_OPCHANGE \
+					| MMC_GET_EVENT_STATUS_MEDIA \
+					| MMC_GET_EVENT_STATUS_DEVICEBUSY)
+
+
+/* Media change watcher */
+struct tag_watcher;
+typedef struct tag_watcher optcl_watcher;
+
+/*
+ * Watcher polling policy
+ *
+ * The drive is polled every active_interval after an event and while
+ * it is busy, so a moving tray, which reports a series of events, is
+ * followed closely. While the tray is open the drive is polled every
+ * min_interval, otherwise the interval starts at min_interval after
+ * the last event and doubles up to max_interval. All times are in
+ * microseconds.
+ */
+typedef struct tag_watcher_policy {
+    uint32_t min_interval;
+    uint32_t max_interval;
+    uint32_t active_interval;
+} optcl_watcher_policy;
+
+/*
+ * Watcher event
+ *
+ * Event code is the raw GET EVENT STATUS NOTIFICATION code of the
+ * class, zero for events derived from status changes and for drives
+ * watched with TEST UNIT READY.
+ */
+typedef struct tag_watcher_event {
+    uint16_t type;
+    uint8_t event_class;        /* MMC_GET_EVENT_STATUS_* */
+    uint8_t event_code;
+    bool_t media_present;
+    bool_t tray_open;
+    uint16_t change;            /* Operational change, EVENT_OC_OC_* */
+    uint16_t busy_time;         /* Expected busy time in 100 ms units */
+} optcl_watcher_event;
+
+/* Subscriber callback */
+typedef void (*optcl_watcher_fn)(const optcl_device *device,
+                                 const optcl_watcher_event *event,
+                                 ptr_t context);
+
+
+/* Get default polling policy */
+extern 
+RESULT optcl_watcher_get_default_policy(optcl_watcher_policy *policy);
+
+/*
+ * Create a watcher for an open device, zero policy uses the default
+ *
+ * Drives that do not take polled GET EVENT STATUS NOTIFICATION
+ * requests for the media class are watched with TEST UNIT READY,
+ * which only reports media arrival and removal.
+ */
+extern 
+RESULT optcl_watcher_create(const optcl_device *device,
+                            const optcl_watcher_policy *policy,
+                            optcl_watcher **watcher);
+
+/* Destroy watcher */
+extern 
+RESULT optcl_watcher_destroy(optcl_watcher *watcher);
+
+/*
+ * Subscribe to events of the given classes
+ *
+ * Only the classes some subscriber wants are requested from the
+ * drive.
+ */
+extern 
+RESULT optcl_watcher_subscribe(optcl_watcher *watcher,
+                               uint8_t classes,
+                               optcl_watcher_fn callback,
+                               ptr_t context);
+
+/* Remove subscription with the given callback and context */
+extern 
+RESULT optcl_watcher_unsubscribe(optcl_watcher *watcher,
+                                 optcl_watcher_fn callback,
+                                 ptr_t context);
+
+/*
+ * Poll the drive if it is due and deliver events to subscribers
+ *
+ * Time is in microseconds, e.g. from xtime_usec. The time of the next
+ * poll is returned, a watcher that is not due returns at once without
+ * a command, so many drives can be polled from one loop that sleeps
+ * until the earliest next poll.
+ */
+extern 
+RESULT optcl_watcher_poll(optcl_watcher *watcher, uint64_t now, uint64_t *next);
+
+/* Get last known media and tray state */
+extern 
+RESULT optcl_watcher_get_state(const optcl_watcher *watcher,
+                               bool_t *media_present,
+                               bool_t *tray_open);
+
+#endif /* _WATCHER_H */
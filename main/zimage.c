@@ -0,0 +1,532 @@
+/*
+    zimage.c - Chunked compressed image container
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#include "errors.h"
+#include "helpers.h"
+#include "types.h"
+#include "zimage.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+
+/*
+ * Constants used throughout the code
+ */
+
+/* Chunks hold whole blocks */
+#define ZIMAGE_BLOCK_SIZE		2048U
+
+/* Most conversion threads */
+#define ZIMAGE_MAX_THREADS		64
+
+/* Chunks compressed by each thread between writes */
+#define ZIMAGE_BATCH_PER_THREAD		8
+
+
+/*
+ * Internal structures
+ */
+
+/* Decompressed chunk */
+typedef struct tag_zimage_entry {
+    bool_t valid;
+    uint32_t chunk;
+    uint64_t last_use;
+    uint8_t *data;
+} optcl_zimage_entry;
+
+struct tag_zimage {
+    const uint8_t *view;
+    const uint8_t *index;
+    uint64_t size;
+    uint64_t index_offset;
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    uint64_t tick;
+    optcl_zimage_entry cache[ZIMAGE_CACHE_CHUNKS];
+};
+
+/* Chunks compressed between writes */
+typedef struct tag_zimage_batch {
+    const uint8_t *source;
+    uint64_t size;
+    uint32_t chunk_size;
+    int level;
+    uint32_t first;
+    uint32_t count;
+    uint32_t threads;
+    uint32_t capacity;
+    uint8_t *buffers;
+    const uint8_t **results;
+    uint32_t *result_sizes;
+} optcl_zimage_batch;
+
+/* Conversion thread */
+typedef struct tag_zimage_worker {
+    optcl_zimage_batch *batch;
+    uint32_t index;
+    ptr_t thread;
+} optcl_zimage_worker;
+
+
+/*
+ * Helper functions
+ */
+
+static uint32_t get_le32(const uint8_t data[])
+{
+    return ((uint32_t)data[3] << 24) | ((uint32_t)data[2] << 16)
+        | ((uint32_t)data[1] << 8) | (uint32_t)data[0];
+}
+
+static uint64_t get_le64(const uint8_t data[])
+{
+    return ((uint64_t)get_le32(&data[4]) << 32) | get_le32(data);
+}
+
+static void put_le32(uint8_t data[], uint32_t value)
+{
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+}
+
+static void put_le64(uint8_t data[], uint64_t value)
+{
+    put_le32(data, (uint32_t)value);
+    put_le32(&data[4], (uint32_t)(value >> 32));
+}
+
+static uint32_t get_chunk_len(uint64_t size, uint32_t chunk_size, uint32_t chunk)
+{
+    uint64_t offset = (uint64_t)chunk * chunk_size;
+
+    return (size - offset < chunk_size) ? (uint32_t)(size - offset) : chunk_size;
+}
+
+static RESULT load_chunk(const optcl_zimage *zimage,
+                         uint32_t chunk,
+                         uint8_t *data)
+{
+    uLongf len;
+    uint32_t chunk_len;
+    uint64_t start;
+    uint64_t end;
+
+    start = get_le64(&zimage->index[chunk * 8]);
+    end = get_le64(&zimage->index[(chunk + 1) * 8]);
+    chunk_len = get_chunk_len(zimage->size, zimage->chunk_size, chunk);
+
+    if (start < ZIMAGE_HEADER_SIZE || end < start || end > zimage->index_offset)
+        return E_DEVINVALIDIMAGE;
+
+    /* Chunks that did not compress are stored as they are */
+    if (end - start == chunk_len) {
+        memcpy(data, &zimage->view[start], chunk_len);
+        return SUCCESS;
+    }
+
+    len = chunk_len;
+    if (uncompress(data, &len, &zimage->view[start], (uLong)(end - start))
+        != Z_OK || len != chunk_len)
+        return E_DEVINVALIDIMAGE;
+
+    return SUCCESS;
+}
+
+/* Get decompressed chunk, replacing the least recently used one */
+static RESULT get_chunk(optcl_zimage *zimage,
+                        uint32_t chunk,
+                        const uint8_t **data)
+{
+    int i;
+    RESULT error;
+    optcl_zimage_entry *entry = 0;
+
+    ++zimage->tick;
+
+    for (i = 0; i < ZIMAGE_CACHE_CHUNKS; ++i) {
+        if (zimage->cache[i].valid == True && zimage->cache[i].chunk == chunk) {
+            zimage->cache[i].last_use = zimage->tick;
+            *data = zimage->cache[i].data;
+            return SUCCESS;
+        }
+
+        if (entry == 0 || zimage->cache[i].valid == False
+            || (entry->valid == True
+                && zimage->cache[i].last_use < entry->last_use))
+            entry = &zimage->cache[i];
+    }
+
+    if (entry->data == 0) {
+        entry->data = (uint8_t*)malloc(zimage->chunk_size);
+        if (entry->data == 0)
+            return E_OUTOFMEMORY;
+    }
+
+    entry->valid = False;
+
+    error = load_chunk(zimage, chunk, entry->data);
+    if (FAILED(error))
+        return error;
+
+    entry->valid = True;
+    entry->chunk = chunk;
+    entry->last_use = zimage->tick;
+    *data = entry->data;
+    return SUCCESS;
+}
+
+static void compress_chunks(void *arg)
+{
+    uLongf len;
+    uint32_t slot;
+    uint32_t chunk_len;
+    const uint8_t *source;
+    uint8_t *buffer;
+    optcl_zimage_worker *worker = (optcl_zimage_worker*)arg;
+    optcl_zimage_batch *batch = worker->batch;
+
+    for (slot = worker->index; slot < batch->count; slot += batch->threads) {
+        source = batch->source
+            + (uint64_t)(batch->first + slot) * batch->chunk_size;
+        chunk_len = get_chunk_len(batch->size, batch->chunk_size,
+            batch->first + slot);
+        buffer = batch->buffers + (size_t)slot * batch->capacity;
+
+        len = batch->capacity;
+        if (compress2(buffer, &len, source, chunk_len, batch->level) == Z_OK
+            && len < chunk_len) {
+            batch->results[slot] = buffer;
+            batch->result_sizes[slot] = (uint32_t)len;
+        } else {
+            batch->results[slot] = source;
+            batch->result_sizes[slot] = chunk_len;
+        }
+    }
+}
+
+/* Compress a batch, the calling thread works when no thread starts */
+static void compress_batch(optcl_zimage_batch *batch,
+                           optcl_zimage_worker workers[])
+{
+    uint32_t i;
+
+    for (i = 0; i < batch->threads; ++i) {
+        workers[i].batch = batch;
+        workers[i].index = i;
+        workers[i].thread = 0;
+
+        if (xthread_create(compress_chunks, &workers[i], &workers[i].thread) != 0) {
+            workers[i].thread = 0;
+            compress_chunks(&workers[i]);
+        }
+    }
+
+    for (i = 0; i < batch->threads; ++i) {
+        if (workers[i].thread != 0)
+            xthread_join(workers[i].thread);
+    }
+}
+
+static RESULT write_container(FILE *file,
+                              optcl_zimage_batch *batch,
+                              optcl_zimage_worker workers[],
+                              uint32_t chunk_count,
+                              uint32_t batch_chunks)
+{
+    uint32_t i;
+    uint64_t offset;
+    uint8_t entry[8];
+    uint8_t header[ZIMAGE_HEADER_SIZE];
+    uint64_t *offsets;
+
+    offsets = (uint64_t*)malloc(((size_t)chunk_count + 1) * sizeof(uint64_t));
+    if (offsets == 0)
+        return E_OUTOFMEMORY;
+
+    /* The header is written last, once the index offset is known */
+    memset(header, 0, sizeof(header));
+    if (fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        free(offsets);
+        return E_UNEXPECTED;
+    }
+
+    offset = ZIMAGE_HEADER_SIZE;
+
+    for (batch->first = 0; batch->first < chunk_count;
+        batch->first += batch_chunks) {
+        batch->count = chunk_count - batch->first;
+        if (batch->count > batch_chunks)
+            batch->count = batch_chunks;
+
+        compress_batch(batch, workers);
+
+        for (i = 0; i < batch->count; ++i) {
+            offsets[batch->first + i] = offset;
+            if (fwrite(batch->results[i], 1, batch->result_sizes[i], file)
+                != batch->result_sizes[i]) {
+                free(offsets);
+                return E_UNEXPECTED;
+            }
+
+            offset += batch->result_sizes[i];
+        }
+    }
+
+    offsets[chunk_count] = offset;
+
+    for (i = 0; i <= chunk_count; ++i) {
+        put_le64(entry, offsets[i]);
+        if (fwrite(entry, 1, sizeof(entry), file) != sizeof(entry)) {
+            free(offsets);
+            return E_UNEXPECTED;
+        }
+    }
+
+    free(offsets);
+
+    memcpy(header, ZIMAGE_MAGIC, 8);
+    put_le32(&header[8], ZIMAGE_VERSION);
+    put_le32(&header[12], batch->chunk_size);
+    put_le64(&header[16], batch->size);
+    put_le64(&header[24], offset);
+
+    if (fseek(file, 0, SEEK_SET) != 0
+        || fwrite(header, 1, sizeof(header), file) != sizeof(header))
+        return E_UNEXPECTED;
+
+    return SUCCESS;
+}
+
+
+/*
+ * Compressed image functions
+ */
+
+bool_t optcl_zimage_is_zimage(const xfile_map *map)
+{
+    assert(map != 0);
+    if (map == 0 || map->view == 0 || map->size < ZIMAGE_HEADER_SIZE)
+        return False;
+
+    return (memcmp(map->view, ZIMAGE_MAGIC, 8) == 0) ? True : False;
+}
+
+RESULT optcl_zimage_open(const xfile_map *map, optcl_zimage **zimage)
+{
+    uint64_t chunk_count;
+    const uint8_t *view;
+    optcl_zimage *nzimage;
+
+    assert(map != 0);
+    assert(zimage != 0);
+    if (map == 0 || zimage == 0)
+        return E_INVALIDARG;
+
+    if (optcl_zimage_is_zimage(map) == False)
+        return E_DEVINVALIDIMAGE;
+
+    nzimage = (optcl_zimage*)malloc(sizeof(optcl_zimage));
+    if (nzimage == 0)
+        return E_OUTOFMEMORY;
+
+    memset(nzimage, 0, sizeof(optcl_zimage));
+
+    view = (const uint8_t*)map->view;
+    nzimage->view = view;
+    nzimage->chunk_size = get_le32(&view[12]);
+    nzimage->size = get_le64(&view[16]);
+    nzimage->index_offset = get_le64(&view[24]);
+
+    if (get_le32(&view[8]) != ZIMAGE_VERSION
+        || nzimage->chunk_size == 0
+        || nzimage->chunk_size > ZIMAGE_MAX_CHUNK_SIZE
+        || nzimage->chunk_size % ZIMAGE_BLOCK_SIZE != 0) {
+        free(nzimage);
+        return E_DEVINVALIDIMAGE;
+    }
+
+    chunk_count = (nzimage->size + nzimage->chunk_size - 1) / nzimage->chunk_size;
+    if (chunk_count >= 0xFFFFFFFF
+        || nzimage->index_offset < ZIMAGE_HEADER_SIZE
+        || nzimage->index_offset > map->size
+        || (chunk_count + 1) * 8 > map->size - nzimage->index_offset) {
+        free(nzimage);
+        return E_DEVINVALIDIMAGE;
+    }
+
+    nzimage->chunk_count = (uint32_t)chunk_count;
+    nzimage->index = &view[nzimage->index_offset];
+
+    *zimage = nzimage;
+    return SUCCESS;
+}
+
+RESULT optcl_zimage_close(optcl_zimage *zimage)
+{
+    int i;
+
+    assert(zimage != 0);
+    if (zimage == 0)
+        return E_INVALIDARG;
+
+    for (i = 0; i < ZIMAGE_CACHE_CHUNKS; ++i)
+        free(zimage->cache[i].data);
+
+    free(zimage);
+    return SUCCESS;
+}
+
+RESULT optcl_zimage_get_size(const optcl_zimage *zimage, uint64_t *size)
+{
+    assert(zimage != 0);
+    assert(size != 0);
+    if (zimage == 0 || size == 0)
+        return E_INVALIDARG;
+
+    *size = zimage->size;
+    return SUCCESS;
+}
+
+RESULT optcl_zimage_read(optcl_zimage *zimage,
+                         uint64_t offset,
+                         uint8_t *data,
+                         uint32_t size)
+{
+    RESULT error;
+    uint32_t pos;
+    uint32_t len;
+    uint32_t chunk;
+    uint32_t chunk_len;
+    const uint8_t *chunk_data = 0;
+
+    assert(zimage != 0);
+    assert(data != 0 || size == 0);
+    if (zimage == 0 || (data == 0 && size > 0))
+        return E_INVALIDARG;
+
+    if (offset > zimage->size || size > zimage->size - offset)
+        return E_INVALIDARG;
+
+    while (size > 0) {
+        chunk = (uint32_t)(offset / zimage->chunk_size);
+        pos = (uint32_t)(offset % zimage->chunk_size);
+
+        error = get_chunk(zimage, chunk, &chunk_data);
+        if (FAILED(error))
+            return error;
+
+        chunk_len = get_chunk_len(zimage->size, zimage->chunk_size, chunk);
+        len = (size < chunk_len - pos) ? size : chunk_len - pos;
+
+        memcpy(data, &chunk_data[pos], len);
+        data += len;
+        offset += len;
+        size -= len;
+    }
+
+    return SUCCESS;
+}
+
+RESULT optcl_zimage_convert(const char *source,
+                            const char *destination,
+                            const optcl_zimage_params *params)
+{
+    RESULT error;
+    FILE *file;
+    xfile_map map;
+    uint32_t threads;
+    uint32_t batch_chunks;
+    uint64_t chunk_count;
+    optcl_zimage_batch batch;
+    optcl_zimage_worker *workers;
+
+    assert(source != 0);
+    assert(destination != 0);
+    if (source == 0 || destination == 0)
+        return E_INVALIDARG;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.chunk_size = (params != 0 && params->chunk_size != 0)
+        ? params->chunk_size : ZIMAGE_DEFAULT_CHUNK_SIZE;
+    batch.level = (params != 0 && params->level != 0)
+        ? params->level : Z_DEFAULT_COMPRESSION;
+
+    if (batch.chunk_size > ZIMAGE_MAX_CHUNK_SIZE
+        || batch.chunk_size % ZIMAGE_BLOCK_SIZE != 0)
+        return E_INVALIDARG;
+
+    threads = (params != 0 && params->threads != 0)
+        ? params->threads : xcpu_count();
+    if (threads > ZIMAGE_MAX_THREADS)
+        threads = ZIMAGE_MAX_THREADS;
+
+    if (xmap_file(source, False, &map) != 0)
+        return E_DEVINVALIDPATH;
+
+    chunk_count = (map.size + batch.chunk_size - 1) / batch.chunk_size;
+    if (chunk_count >= 0xFFFFFFFF) {
+        xunmap_file(&map);
+        return E_DEVINVALIDSIZE;
+    }
+
+    batch.source = (const uint8_t*)map.view;
+    batch.size = map.size;
+    batch.threads = threads;
+    batch.capacity = (uint32_t)compressBound(batch.chunk_size);
+    batch_chunks = threads * ZIMAGE_BATCH_PER_THREAD;
+
+    batch.buffers = (uint8_t*)malloc((size_t)batch_chunks * batch.capacity);
+    batch.results = (const uint8_t**)malloc(batch_chunks * sizeof(uint8_t*));
+    batch.result_sizes = (uint32_t*)malloc(batch_chunks * sizeof(uint32_t));
+    workers = (optcl_zimage_worker*)
+        malloc(threads * sizeof(optcl_zimage_worker));
+
+    file = fopen(destination, "wb");
+
+    if (batch.buffers == 0 || batch.results == 0
+        || batch.result_sizes == 0 || workers == 0)
+        error = E_OUTOFMEMORY;
+    else if (file == 0)
+        error = E_DEVINVALIDPATH;
+    else
+        error = write_container(file, &batch, workers,
+            (uint32_t)chunk_count, batch_chunks);
+
+    if (file != 0 && fclose(file) != 0 && SUCCEEDED(error))
+        error = E_UNEXPECTED;
+
+    if (file != 0 && FAILED(error))
+        remove(destination);
+
+    free(workers);
+    free(batch.result_sizes);
+    free((void*)batch.results);
+    free(batch.buffers);
+    xunmap_file(&map);
+    return error;
+}
@@ -0,0 +1,101 @@
+/*
+    zimage.h - Chunked compressed image container
+    Copyright (C) 2007  Aleksandar Dezelin <dezelin@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+
+    $Id$
+*/
+
+#ifndef _ZIMAGE_H
+#define _ZIMAGE_H
+
+#include "errors.h"
+#include "helpers.h"
+#include "types.h"
+
+
+/*
+ * Container layout, all fields are little endian
+ *
+ *  0   magic "OPTCLZIM"
+ *  8   uint32_t version
+ *  12  uint32_t chunk size in bytes
+ *  16  uint64_t image size in bytes
+ *  24  uint64_t index offset
+ *
+ * The index holds chunk count + 1 uint64_t file offsets, chunk i is
+ * stored between offsets i and i + 1. Chunks are zlib streams, except
+ * chunks that did not compress, which are stored as they are.
+ */
+
+#define ZIMAGE_MAGIC			"OPTCLZIM"
+#define ZIMAGE_VERSION			1
+#define ZIMAGE_HEADER_SIZE		32U
+
+/* Default and largest chunk sizes, chunks hold whole 2048 byte blocks */
+#define ZIMAGE_DEFAULT_CHUNK_SIZE	0x10000U
+#define ZIMAGE_MAX_CHUNK_SIZE		0x100000U
+
+/* Decompressed chunks kept by a reader */
+#define ZIMAGE_CACHE_CHUNKS		16
+
+
+/* Compressed image reader */
+typedef struct tag_zimage optcl_zimage;
+
+/* Conversion parameters, zero fields select defaults */
+typedef struct tag_zimage_params {
+    uint32_t chunk_size;
+    uint32_t threads;           /* Processor count by default */
+    int32_t level;              /* zlib level, zero is the zlib default */
+} optcl_zimage_params;
+
+
+/* Check if a mapped file is a compressed image */
+extern 
+bool_t optcl_zimage_is_zimage(const xfile_map *map);
+
+/* Open a compressed image reader over a mapped container */
+extern 
+RESULT optcl_zimage_open(const xfile_map *map, optcl_zimage **zimage);
+
+/* Close reader */
+extern 
+RESULT optcl_zimage_close(optcl_zimage *zimage);
+
+/* Get uncompressed image size */
+extern 
+RESULT optcl_zimage_get_size(const optcl_zimage *zimage, uint64_t *size);
+
+/* Read uncompressed data, decompressing only the chunks read */
+extern 
+RESULT optcl_zimage_read(optcl_zimage *zimage,
+                         uint64_t offset,
+                         uint8_t *data,
+                         uint32_t size);
+
+/*
+ * Convert an image file into a compressed image
+ *
+ * Chunks are compressed on a thread per processor, in batches that
+ * are written in order as each batch completes.
+ */
+extern 
+RESULT optcl_zimage_convert(const char *source,
+                            const char *destination,
+                            const optcl_zimage_params *params);
+
+#endif /* _ZIMAGE_H */